@@ -0,0 +1,496 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+#endif
+#include "alarm.h"
+#include "events.h"
+#include "output.h"
+
+#define ALARM_HOOK_THREADS 4
+#define ALARM_HOOK_QUEUE 64
+
+static const struct
+{
+    const char *name;
+    const char *label;
+} metrics[ALARM_METRICS] = {
+    [ALARM_BITRATE] = {"bitrate", "RATE"},
+    [ALARM_DATA_BITRATE] = {"data_bitrate", "RATE"},
+    [ALARM_CC_RATE] = {"cc_rate", "CC"},
+    [ALARM_TEI_RATE] = {"tei_rate", "TEI"},
+    [ALARM_SYNC_RATE] = {"sync_rate", "SYNC"},
+    [ALARM_PCR_JITTER] = {"pcr_jitter", "PCR"},
+    [ALARM_PAT_INTERVAL] = {"pat_interval", "PAT"},
+    [ALARM_IAT] = {"iat", "IAT"},
+};
+
+static const char *const severities[] = {
+    [ALARM_WARNING] = "warning",
+    [ALARM_CRITICAL] = "critical",
+};
+
+/* A transition waiting for the hook */
+typedef struct hook_job
+{
+    char stream[64];
+    bool raised;
+    alarm_metric_t metric;
+    alarm_severity_t severity;
+    double value;
+    double threshold;
+} hook_job_t;
+
+/* One queue per hook thread, the transitions of a rule always go to the
+   same one so its hooks run one at a time and in order */
+typedef struct hook_shard
+{
+    pthread_t thread;
+    pthread_cond_t cond;
+    hook_job_t queue[ALARM_HOOK_QUEUE];
+    size_t head;
+    size_t count;
+} hook_shard_t;
+
+static const char *hook_command = NULL;
+static hook_shard_t hook_shards[ALARM_HOOK_THREADS];
+static unsigned hook_thread_count = 0;
+static bool hook_stop = false;
+static pthread_mutex_t hook_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t hook_dropped = 0;
+
+/* Next whitespace separated word of `*s`, false at the end */
+static bool next_word(const char **s, char *word, size_t size)
+{
+    const char *p = *s;
+    while (isspace((unsigned char)*p))
+        p++;
+    if (*p == '\0')
+        return false;
+    size_t n = 0;
+    for (; *p && !isspace((unsigned char)*p); p++)
+        if (n + 1 < size)
+            word[n++] = *p;
+    word[n] = '\0';
+    *s = p;
+    return true;
+}
+
+/* "<n>[.<n>][K|M|G]", decimal multiples as for bitrates elsewhere */
+static int parse_value(const char *s, double *out)
+{
+    char *end;
+    if (!isdigit((unsigned char)*s))
+        return -1;
+    double v = strtod(s, &end);
+    switch (*end)
+    {
+    case 'G':
+    case 'g':
+        v *= 1000;
+        /* fall through */
+    case 'M':
+    case 'm':
+        v *= 1000;
+        /* fall through */
+    case 'K':
+    case 'k':
+        v *= 1000;
+        end++;
+        break;
+    }
+    if (*end != '\0')
+        return -1;
+    *out = v;
+    return 0;
+}
+
+const char *alarm_parse(const char *spec, alarm_rule_t *rule)
+{
+    char word[32];
+    const char *s = spec;
+
+    *rule = (alarm_rule_t){.hold = 1, .severity = ALARM_WARNING};
+    if (!next_word(&s, word, sizeof(word)))
+        return "empty rule";
+    int m = 0;
+    while (m < ALARM_METRICS && strcmp(word, metrics[m].name) != 0)
+        m++;
+    if (m == ALARM_METRICS)
+        return "unknown metric, use bitrate, data_bitrate, cc_rate, tei_rate, sync_rate, pcr_jitter, pat_interval or iat";
+    rule->metric = (alarm_metric_t)m;
+
+    if (!next_word(&s, word, sizeof(word)) || (strcmp(word, ">") != 0 && strcmp(word, "<") != 0))
+        return "expected '>' or '<' after the metric";
+    rule->below = word[0] == '<';
+    if (!next_word(&s, word, sizeof(word)) || parse_value(word, &rule->raise) != 0)
+        return "expected a threshold";
+    rule->clear = rule->raise;
+
+    while (next_word(&s, word, sizeof(word)))
+    {
+        if (strcmp(word, "clear") == 0)
+        {
+            if (!next_word(&s, word, sizeof(word)) || parse_value(word, &rule->clear) != 0)
+                return "expected a value after 'clear'";
+            if (rule->below ? rule->clear < rule->raise : rule->clear > rule->raise)
+                return "the clear value has to be on the good side of the threshold";
+        }
+        else if (strcmp(word, "for") == 0)
+        {
+            char *end;
+            if (!next_word(&s, word, sizeof(word)) || !isdigit((unsigned char)word[0]))
+                return "expected a number of intervals after 'for'";
+            unsigned long hold = strtoul(word, &end, 10);
+            if (*end != '\0' || hold == 0 || hold > 1000)
+                return "'for' must be 1 to 1000 intervals";
+            rule->hold = (unsigned)hold;
+        }
+        else if (strcmp(word, "warning") == 0)
+            rule->severity = ALARM_WARNING;
+        else if (strcmp(word, "critical") == 0)
+            rule->severity = ALARM_CRITICAL;
+        else
+            return "expected 'clear', 'for', 'warning' or 'critical'";
+    }
+    return NULL;
+}
+
+/* Plain number for hooks and events, whole numbers without an exponent */
+static void format_number(double v, char *buf, size_t size)
+{
+    if (v == (double)(int64_t)v && v < 1e15 && v > -1e15)
+        snprintf(buf, size, "%" PRId64, (int64_t)v);
+    else
+        snprintf(buf, size, "%g", v);
+}
+
+/* Bitrates with a K/M/G suffix, as they are written in rules */
+static void format_value(alarm_metric_t metric, double v, char *buf, size_t size)
+{
+    if (metric == ALARM_BITRATE || metric == ALARM_DATA_BITRATE)
+    {
+        if (v >= 1e9)
+            snprintf(buf, size, "%gG", v / 1e9);
+        else if (v >= 1e6)
+            snprintf(buf, size, "%gM", v / 1e6);
+        else if (v >= 1e3)
+            snprintf(buf, size, "%gK", v / 1e3);
+        else
+            snprintf(buf, size, "%g", v);
+    }
+    else
+        snprintf(buf, size, "%g", v);
+}
+
+void alarm_format(const alarm_rule_t *rule, char *buf, size_t size)
+{
+    char raise[32], clear[32], hold[16] = "";
+    format_value(rule->metric, rule->raise, raise, sizeof(raise));
+    format_value(rule->metric, rule->clear, clear, sizeof(clear));
+    if (rule->hold > 1)
+        snprintf(hold, sizeof(hold), " for %u", rule->hold);
+    snprintf(buf, size, "%s %c %s%s%s%s%s", metrics[rule->metric].name, rule->below ? '<' : '>', raise,
+             rule->clear != rule->raise ? " clear " : "", rule->clear != rule->raise ? clear : "",
+             hold, rule->severity == ALARM_CRITICAL ? " critical" : "");
+}
+
+void alarm_init(alarm_set_t *set, const char *stream)
+{
+    memset(set, 0, sizeof(*set));
+    set->stream = stream;
+}
+
+int alarm_add(alarm_set_t *set, const alarm_rule_t *rule)
+{
+    if (set->count == ALARM_MAX_RULES)
+        return -1;
+    set->rules[set->count] = *rule;
+    memset(&set->state[set->count], 0, sizeof(set->state[0]));
+    set->count++;
+    return 0;
+}
+
+void alarm_builtin(alarm_set_t *set, unsigned cc_warning, unsigned cc_critical,
+                   uint64_t bitrate, unsigned tolerance)
+{
+    alarm_add(set, &(alarm_rule_t){
+                       .metric = ALARM_CC_RATE,
+                       .raise = cc_warning,
+                       .clear = 0,
+                       .hold = 1,
+                       .severity = ALARM_WARNING,
+                   });
+    alarm_add(set, &(alarm_rule_t){
+                       .metric = ALARM_CC_RATE,
+                       .raise = cc_critical,
+                       .clear = 0,
+                       .hold = 1,
+                       .severity = ALARM_CRITICAL,
+                   });
+    if (!bitrate)
+        return;
+    double expected = (double)bitrate;
+    alarm_add(set, &(alarm_rule_t){
+                       .metric = ALARM_BITRATE,
+                       .below = true,
+                       .raise = expected * (100 - tolerance) / 100,
+                       .clear = expected * (200 - tolerance) / 200,
+                       .hold = 1,
+                       .severity = ALARM_WARNING,
+                   });
+    alarm_add(set, &(alarm_rule_t){
+                       .metric = ALARM_BITRATE,
+                       .raise = expected * (100 + tolerance) / 100,
+                       .clear = expected * (200 + tolerance) / 200,
+                       .hold = 1,
+                       .severity = ALARM_WARNING,
+                   });
+}
+
+/* FNV-1a of the stream name and rule index */
+static unsigned hook_shard(const alarm_set_t *set, const alarm_rule_t *rule)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *c = set->stream; *c; c++)
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    hash = (hash ^ (uint32_t)(rule - set->rules)) * 16777619u;
+    return hash % ALARM_HOOK_THREADS;
+}
+
+static void hook_enqueue(const alarm_set_t *set, const alarm_rule_t *rule, const alarm_state_t *as)
+{
+    if (!hook_thread_count)
+        return;
+    hook_shard_t *shard = &hook_shards[hook_shard(set, rule)];
+    pthread_mutex_lock(&hook_lock);
+    if (shard->count == ALARM_HOOK_QUEUE)
+    {
+        hook_dropped++;
+    }
+    else
+    {
+        hook_job_t *job = &shard->queue[(shard->head + shard->count) % ALARM_HOOK_QUEUE];
+        snprintf(job->stream, sizeof(job->stream), "%s", set->stream);
+        job->raised = as->active;
+        job->metric = rule->metric;
+        job->severity = rule->severity;
+        job->value = as->value;
+        job->threshold = as->active ? rule->raise : rule->clear;
+        shard->count++;
+        pthread_cond_signal(&shard->cond);
+    }
+    pthread_mutex_unlock(&hook_lock);
+}
+
+/* Log, emit and queue a transition, runs on the capture thread */
+static void alarm_notify(const alarm_set_t *set, const alarm_rule_t *rule, const alarm_state_t *as)
+{
+    char text[128], value[32], number[32], threshold[32];
+    alarm_format(rule, text, sizeof(text));
+    format_value(rule->metric, as->value, value, sizeof(value));
+    format_number(as->value, number, sizeof(number));
+    format_number(as->active ? rule->raise : rule->clear, threshold, sizeof(threshold));
+    if (as->active)
+        out_log(rule->severity == ALARM_CRITICAL ? LogLevel_Error : LogLevel_Warning,
+                "%s: alarm raised: %s (%s)", set->stream, text, value);
+    else
+        out_log(LogLevel_Info, "%s: alarm cleared: %s (%s)", set->stream, text, value);
+
+    event_emit(EVENT_ALARM, EVENT_NONE, EVENT_NONE,
+               "\"metric\":\"%s\",\"state\":\"%s\",\"severity\":\"%s\",\"value\":%s,\"threshold\":%s",
+               metrics[rule->metric].name, as->active ? "raised" : "cleared", severities[rule->severity],
+               number, threshold);
+    hook_enqueue(set, rule, as);
+}
+
+void alarm_evaluate(alarm_set_t *set, const stsmon_stats_t *st)
+{
+    double seconds = st->duration / 1000000.0;
+    const double values[ALARM_METRICS] = {
+        [ALARM_BITRATE] = st->bitrate,
+        [ALARM_DATA_BITRATE] = st->data_bitrate,
+        [ALARM_CC_RATE] = seconds > 0 ? st->interval.cc_errors / seconds : 0,
+        [ALARM_TEI_RATE] = seconds > 0 ? st->interval.tei_errors / seconds : 0,
+        [ALARM_SYNC_RATE] = seconds > 0 ? st->interval.sync_errors / seconds : 0,
+        [ALARM_PCR_JITTER] = st->pcr_jitter / 1000.0,
+        [ALARM_PAT_INTERVAL] = st->pat_interval / 1000.0,
+        [ALARM_IAT] = st->max_iat / 1000.0,
+    };
+
+    for (size_t i = 0; i < set->count; i++)
+    {
+        const alarm_rule_t *rule = &set->rules[i];
+        alarm_state_t *as = &set->state[i];
+        double v = values[rule->metric];
+        bool toward;
+        if (as->active)
+            toward = rule->below ? v >= rule->clear : v <= rule->clear;
+        else
+            toward = rule->below ? v < rule->raise : v > rule->raise;
+        as->value = v;
+        as->count = toward ? as->count + 1 : 0;
+        if (as->count < rule->hold)
+            continue;
+
+        as->active = !as->active;
+        as->count = 0;
+        as->since = st->now;
+        if (as->active)
+            set->raised++;
+        alarm_notify(set, rule, as);
+    }
+}
+
+const alarm_rule_t *alarm_worst(const alarm_set_t *set)
+{
+    const alarm_rule_t *worst = NULL;
+    for (size_t i = 0; i < set->count; i++)
+        if (set->state[i].active && (!worst || set->rules[i].severity > worst->severity))
+            worst = &set->rules[i];
+    return worst;
+}
+
+size_t alarm_active(const alarm_set_t *set)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < set->count; i++)
+        n += set->state[i].active;
+    return n;
+}
+
+const char *alarm_label(alarm_metric_t metric)
+{
+    return metrics[metric].label;
+}
+
+#ifndef WIN32
+extern char **environ;
+
+static void run_hook(const hook_job_t *job)
+{
+    char value[32], threshold[32];
+    format_number(job->value, value, sizeof(value));
+    format_number(job->threshold, threshold, sizeof(threshold));
+    char *argv[] = {
+        (char *)hook_command,
+        (char *)job->stream,
+        job->raised ? "raised" : "cleared",
+        (char *)metrics[job->metric].name,
+        (char *)severities[job->severity],
+        value,
+        threshold,
+        NULL,
+    };
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, hook_command, NULL, NULL, argv, environ);
+    if (err != 0)
+    {
+        out_log(LogLevel_Error, "Failed to run alarm hook '%s': %s (%d)", hook_command, strerror(err), err);
+        return;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    if (WIFSIGNALED(status))
+        out_log(LogLevel_Warning, "Alarm hook '%s' for %s killed by signal %d", hook_command, job->stream, WTERMSIG(status));
+    else if (WEXITSTATUS(status) != 0)
+        out_log(LogLevel_Warning, "Alarm hook '%s' for %s exited with status %d", hook_command, job->stream, WEXITSTATUS(status));
+}
+
+static void *hook_worker(void *arg)
+{
+    hook_shard_t *shard = arg;
+    hook_job_t job;
+
+    pthread_mutex_lock(&hook_lock);
+    while (1)
+    {
+        while (shard->count == 0 && !hook_stop)
+            pthread_cond_wait(&shard->cond, &hook_lock);
+        if (shard->count == 0)
+            break;
+        job = shard->queue[shard->head];
+        shard->head = (shard->head + 1) % ALARM_HOOK_QUEUE;
+        shard->count--;
+
+        pthread_mutex_unlock(&hook_lock);
+        run_hook(&job);
+        pthread_mutex_lock(&hook_lock);
+    }
+    pthread_mutex_unlock(&hook_lock);
+    return NULL;
+}
+#endif
+
+int alarm_hooks_start(const char *command)
+{
+#ifdef WIN32
+    (void)command;
+    out_log(LogLevel_Error, "Alarm hooks are not supported on this platform");
+    return -1;
+#else
+    hook_command = command;
+    hook_stop = false;
+    hook_dropped = 0;
+    for (unsigned i = 0; i < ALARM_HOOK_THREADS; i++)
+    {
+        hook_shard_t *shard = &hook_shards[i];
+        shard->head = 0;
+        shard->count = 0;
+        pthread_cond_init(&shard->cond, NULL);
+        if (pthread_create(&shard->thread, NULL, hook_worker, shard) != 0)
+        {
+            pthread_cond_destroy(&shard->cond);
+            out_log(LogLevel_Error, "Failed to start alarm hook thread");
+            alarm_hooks_stop();
+            return -1;
+        }
+        hook_thread_count++;
+    }
+    return 0;
+#endif
+}
+
+void alarm_hooks_stop()
+{
+    if (!hook_thread_count)
+        return;
+    pthread_mutex_lock(&hook_lock);
+    hook_stop = true;
+    for (unsigned i = 0; i < hook_thread_count; i++)
+        pthread_cond_signal(&hook_shards[i].cond);
+    pthread_mutex_unlock(&hook_lock);
+    for (unsigned i = 0; i < hook_thread_count; i++)
+    {
+        pthread_join(hook_shards[i].thread, NULL);
+        pthread_cond_destroy(&hook_shards[i].cond);
+    }
+    hook_thread_count = 0;
+    if (hook_dropped)
+        out_log(LogLevel_Warning, "%" PRIu64 " alarm hook runs dropped, the queue was full", hook_dropped);
+}
@@ -0,0 +1,124 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "stsmon.h"
+
+/*
+ * Threshold alarms on the interval statistics of a stream. A rule
+ * watches one metric, e.g.
+ *
+ *   cc_rate > 10 clear 1 for 3 critical
+ *
+ * raises a critical alarm after 3 intervals in a row with more than 10
+ * CC errors per second and clears it after 3 intervals in a row at or
+ * below 1. Without `clear` the raise threshold is used, without `for`
+ * one interval is enough, the default severity is warning.
+ *
+ * Rules are evaluated once per statistics interval over a flat array of
+ * metric values. Transitions are logged, sent to the event sink and
+ * queued for the alarm hook, which runs on its own threads so a slow
+ * script never holds up the capture loop. Hooks of one rule run in order.
+ */
+typedef enum
+{
+    ALARM_BITRATE,      /* bits per second */
+    ALARM_DATA_BITRATE, /* without null packets */
+    ALARM_CC_RATE,      /* CC errors per second */
+    ALARM_TEI_RATE,
+    ALARM_SYNC_RATE,
+    ALARM_PCR_JITTER, /* ms, see stsmon_stats_t */
+    ALARM_PAT_INTERVAL,
+    ALARM_IAT,
+    ALARM_METRICS
+} alarm_metric_t;
+
+typedef enum
+{
+    ALARM_WARNING,
+    ALARM_CRITICAL
+} alarm_severity_t;
+
+typedef struct alarm_rule
+{
+    alarm_metric_t metric;
+    bool below;   /* raise when the value falls below `raise` */
+    double raise;
+    double clear; /* the value has to get back to this to clear */
+    unsigned hold; /* intervals in a row to raise or clear */
+    alarm_severity_t severity;
+} alarm_rule_t;
+
+typedef struct alarm_state
+{
+    bool active;
+    unsigned count; /* intervals in a row towards the next transition */
+    double value;   /* at the latest evaluation */
+    uint64_t since; /* time of the latest transition, 0 if none */
+} alarm_state_t;
+
+#define ALARM_MAX_RULES 16
+/* Rules alarm_builtin() may add ahead of the configured ones */
+#define ALARM_BUILTIN_RULES 4
+
+typedef struct alarm_set
+{
+    const char *stream; /* name in messages and hook arguments */
+    size_t count;
+    alarm_rule_t rules[ALARM_MAX_RULES];
+    alarm_state_t state[ALARM_MAX_RULES];
+    uint64_t raised; /* transitions to active so far */
+} alarm_set_t;
+
+/* Parse a rule, returns NULL or what is wrong with `spec` */
+const char *alarm_parse(const char *spec, alarm_rule_t *rule);
+/* "cc_rate > 10 clear 1 for 3 critical", the form alarm_parse() reads */
+void alarm_format(const alarm_rule_t *rule, char *buf, size_t size);
+
+void alarm_init(alarm_set_t *set, const char *stream);
+/* Returns -1 when the set is full */
+int alarm_add(alarm_set_t *set, const alarm_rule_t *rule);
+/*
+ * The status thresholds as rules: CC errors per second above `cc_warning`
+ * and `cc_critical`, clearing after an interval without CC errors, and,
+ * with an expected `bitrate`, a deviation of more than `tolerance`
+ * percent, clearing at half of it.
+ */
+void alarm_builtin(alarm_set_t *set, unsigned cc_warning, unsigned cc_critical,
+                   uint64_t bitrate, unsigned tolerance);
+
+void alarm_evaluate(alarm_set_t *set, const stsmon_stats_t *stats);
+/* Active rule of the highest severity, NULL when all is well */
+const alarm_rule_t *alarm_worst(const alarm_set_t *set);
+size_t alarm_active(const alarm_set_t *set);
+/* Short name for the status line: "CC", "RATE", "PCR", ... */
+const char *alarm_label(alarm_metric_t metric);
+
+/*
+ * Run `command` for every transition, with the arguments
+ *
+ *   <stream> raised|cleared <metric> warning|critical <value> <threshold>
+ *
+ * from a small pool of threads. Transitions arriving while the queue is
+ * full are dropped and counted. Not available on Windows.
+ */
+int alarm_hooks_start(const char *command);
+/* Runs the queued hooks, waits for them and reports dropped transitions */
+void alarm_hooks_stop();
@@ -0,0 +1,273 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifdef WIN32
+#include <io.h>
+#endif
+#include "binlog.h"
+#include "binlog_format.h"
+#include "output.h"
+
+/* Write out a partial block after this many milliseconds of data */
+#define BINLOG_BLOCK_SPAN 900000
+
+static FILE *data_file = NULL;
+static FILE *index_file = NULL;
+static uint64_t data_end = 0;
+static binlog_block_t block;
+static uint8_t encoded[BINLOG_BLOCK_MAX_SIZE];
+
+static void binlog_sync_file(FILE *f)
+{
+#ifdef WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+}
+
+static int binlog_truncate(FILE *f, uint64_t size)
+{
+    fflush(f);
+#ifdef WIN32
+    return _chsize_s(_fileno(f), (__int64)size);
+#else
+    return ftruncate(fileno(f), (off_t)size);
+#endif
+}
+
+static FILE *binlog_fopen(const char *path)
+{
+    FILE *f = fopen(path, "r+b");
+    if (!f && errno == ENOENT)
+        f = fopen(path, "w+b");
+    if (!f)
+        out_log(LogLevel_Error, "fopen('%s') failed: %s (%d)", path, strerror(errno), errno);
+    return f;
+}
+
+static int binlog_write_index(const binlog_index_entry_t *entry)
+{
+    if (fseeko(index_file, 0, SEEK_END) != 0 ||
+        fwrite(entry, sizeof(*entry), 1, index_file) != 1 ||
+        fflush(index_file) != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * Bring the index in line with the data file. Blocks written after the
+ * last index entry (stsmon killed between the two writes) are indexed,
+ * a partially written trailing block is cut off.
+ */
+static int binlog_recover()
+{
+    fseeko(index_file, 0, SEEK_END);
+    off_t index_size = ftello(index_file);
+    uint64_t entries = (uint64_t)index_size / sizeof(binlog_index_entry_t);
+    binlog_truncate(index_file, entries * sizeof(binlog_index_entry_t));
+
+    data_end = sizeof(binlog_file_header_t);
+    if (entries > 0)
+    {
+        binlog_index_entry_t last;
+        fseeko(index_file, (off_t)((entries - 1) * sizeof(last)), SEEK_SET);
+        if (fread(&last, sizeof(last), 1, index_file) != 1)
+            return -1;
+        data_end = last.offset + last.size;
+    }
+
+    fseeko(data_file, 0, SEEK_END);
+    uint64_t data_size = (uint64_t)ftello(data_file);
+    if (data_end > data_size)
+    {
+        out_log(LogLevel_Error, "Binary log index does not match data file");
+        return -1;
+    }
+
+    unsigned recovered = 0;
+    while (data_end + sizeof(binlog_block_header_t) <= data_size)
+    {
+        binlog_block_header_t header;
+        fseeko(data_file, (off_t)data_end, SEEK_SET);
+        if (fread(&header, sizeof(header), 1, data_file) != 1 ||
+            header.magic != BINLOG_BLOCK_MAGIC ||
+            data_end + sizeof(header) + header.payload_size > data_size)
+            break;
+
+        binlog_index_entry_t entry = {
+            .t_first = header.t_first,
+            .t_last = header.t_last,
+            .offset = data_end,
+            .rows = header.rows,
+            .size = (uint32_t)(sizeof(header) + header.payload_size),
+        };
+        if (binlog_write_index(&entry) != 0)
+            return -1;
+        data_end += entry.size;
+        recovered++;
+    }
+    if (recovered)
+        out_log(LogLevel_Warning, "Binary log: indexed %u unindexed blocks", recovered);
+    if (data_end < data_size)
+    {
+        out_log(LogLevel_Warning, "Binary log: dropped %llu bytes of incomplete block",
+                (unsigned long long)(data_size - data_end));
+        binlog_truncate(data_file, data_end);
+    }
+    return 0;
+}
+
+static void binlog_flush()
+{
+    if (block.rows == 0)
+        return;
+
+    size_t size = binlog_encode_block(&block, encoded);
+    binlog_index_entry_t entry = {
+        .t_first = block.values[BINLOG_COL_TIMESTAMP][0],
+        .t_last = block.values[BINLOG_COL_TIMESTAMP][block.rows - 1],
+        .offset = data_end,
+        .rows = block.rows,
+        .size = (uint32_t)size,
+    };
+    block.rows = 0;
+
+    /* Block first, so the index never points past the end of the data */
+    if (fseeko(data_file, (off_t)data_end, SEEK_SET) != 0 ||
+        fwrite(encoded, 1, size, data_file) != size ||
+        fflush(data_file) != 0)
+    {
+        out_log(LogLevel_Error, "Binary log write failed: %s (%d)", strerror(errno), errno);
+        return;
+    }
+    data_end += size;
+    if (binlog_write_index(&entry) != 0)
+        out_log(LogLevel_Error, "Binary log index write failed: %s (%d)", strerror(errno), errno);
+}
+
+int binlog_open(const char *path)
+{
+    char index_path[4096];
+    if (snprintf(index_path, sizeof(index_path), "%s.idx", path) >= (int)sizeof(index_path))
+    {
+        out_log(LogLevel_Error, "Binary log path too long");
+        return -1;
+    }
+
+    data_file = binlog_fopen(path);
+    if (!data_file)
+        return -1;
+    index_file = binlog_fopen(index_path);
+    if (!index_file)
+    {
+        binlog_close();
+        return -1;
+    }
+
+    binlog_file_header_t header;
+    if (fread(&header, sizeof(header), 1, data_file) == 1)
+    {
+        if (memcmp(header.magic, BINLOG_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != BINLOG_VERSION || header.columns != BINLOG_COLUMNS)
+        {
+            out_log(LogLevel_Error, "'%s' is not a compatible stsmon binary log", path);
+            binlog_close();
+            return -1;
+        }
+    }
+    else
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BINLOG_MAGIC, sizeof(header.magic));
+        header.version = BINLOG_VERSION;
+        header.columns = BINLOG_COLUMNS;
+        header.block_rows = BINLOG_BLOCK_ROWS;
+        binlog_truncate(data_file, 0);
+        binlog_truncate(index_file, 0);
+        rewind(data_file);
+        if (fwrite(&header, sizeof(header), 1, data_file) != 1 || fflush(data_file) != 0)
+        {
+            out_log(LogLevel_Error, "Binary log write failed: %s (%d)", strerror(errno), errno);
+            binlog_close();
+            return -1;
+        }
+    }
+
+    if (binlog_recover() != 0)
+    {
+        binlog_close();
+        return -1;
+    }
+    block.rows = 0;
+    return 0;
+}
+
+void binlog_append(const stat_record_t *rec)
+{
+    if (!data_file)
+        return;
+
+    if (block.rows > 0 &&
+        (rec->interval_ms != block.interval_ms ||
+         rec->timestamp < block.values[BINLOG_COL_TIMESTAMP][0] ||
+         rec->timestamp - block.values[BINLOG_COL_TIMESTAMP][0] >= BINLOG_BLOCK_SPAN))
+        binlog_flush();
+
+    uint16_t r = block.rows;
+    block.interval_ms = rec->interval_ms;
+    block.values[BINLOG_COL_TIMESTAMP][r] = rec->timestamp;
+    block.values[BINLOG_COL_BITRATE][r] = binlog_double_bits(rec->bitrate);
+    block.values[BINLOG_COL_DATA_BITRATE][r] = binlog_double_bits(rec->data_bitrate);
+    block.values[BINLOG_COL_CC_ERRORS][r] = rec->cc_errors;
+    block.values[BINLOG_COL_SYNC_ERRORS][r] = rec->sync_errors;
+    block.values[BINLOG_COL_TEI_ERRORS][r] = rec->tei_errors;
+    block.values[BINLOG_COL_PACKETS][r] = rec->packets;
+    block.values[BINLOG_COL_DATA_PACKETS][r] = rec->data_packets;
+    block.rows++;
+
+    if (block.rows == BINLOG_BLOCK_ROWS)
+        binlog_flush();
+}
+
+void binlog_sync()
+{
+    if (!data_file)
+        return;
+    binlog_sync_file(data_file);
+    binlog_sync_file(index_file);
+}
+
+void binlog_close()
+{
+    if (data_file)
+    {
+        if (index_file)
+            binlog_flush();
+        fclose(data_file);
+    }
+    if (index_file)
+        fclose(index_file);
+    data_file = NULL;
+    index_file = NULL;
+    block.rows = 0;
+}
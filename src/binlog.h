@@ -0,0 +1,30 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "statlog.h"
+
+/*
+ * Binary statistics log, see binlog_format.h for the on-disk layout.
+ * Only called from the statlog writer thread: rows are collected into a
+ * block in memory and the block is written with its index entry once it
+ * is full, spans BINLOG_BLOCK_SPAN or the log is closed.
+ */
+int binlog_open(const char *path);
+void binlog_append(const stat_record_t *rec);
+void binlog_sync();
+void binlog_close();
@@ -0,0 +1,330 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Binary statistics log (--binlog). Shared by the writer in stsmon and
+ * by stsmon-query.
+ *
+ * Data file:
+ *   binlog_file_header_t
+ *   block*        append-only, each block is self-describing
+ *
+ * Block:
+ *   binlog_block_header_t
+ *   for each column: uint32_t size, `size` bytes of encoded values
+ *
+ * Column encodings (row 0 is encoded against an implicit previous 0):
+ *   BINLOG_TIMESTAMP  zigzag varint delta-of-delta, unix milliseconds
+ *   BINLOG_DOUBLE     XOR with previous value bits, 1 control byte
+ *                     (leading zero bytes << 4 | significant bytes)
+ *                     followed by the significant bytes
+ *   BINLOG_COUNTER    zigzag varint delta from previous value
+ *
+ * Index file (data file name + ".idx") is a plain array of
+ * binlog_index_entry_t, one per block, written after the block itself.
+ * Blocks are in time order so readers binary search the index and seek
+ * straight to the first block of interest.
+ */
+
+#define BINLOG_MAGIC "STSMLOG1"
+#define BINLOG_BLOCK_MAGIC 0x4b4c4253 /* "SBLK" */
+#define BINLOG_VERSION 2
+#define BINLOG_BLOCK_ROWS 256
+
+enum binlog_column
+{
+    BINLOG_COL_TIMESTAMP,
+    BINLOG_COL_BITRATE,
+    BINLOG_COL_DATA_BITRATE,
+    BINLOG_COL_CC_ERRORS,
+    BINLOG_COL_SYNC_ERRORS,
+    BINLOG_COL_TEI_ERRORS,
+    BINLOG_COL_PACKETS,
+    BINLOG_COL_DATA_PACKETS,
+    BINLOG_COLUMNS
+};
+
+enum binlog_encoding
+{
+    BINLOG_TIMESTAMP,
+    BINLOG_DOUBLE,
+    BINLOG_COUNTER
+};
+
+static const enum binlog_encoding binlog_column_encoding[BINLOG_COLUMNS] = {
+    [BINLOG_COL_TIMESTAMP] = BINLOG_TIMESTAMP,
+    [BINLOG_COL_BITRATE] = BINLOG_DOUBLE,
+    [BINLOG_COL_DATA_BITRATE] = BINLOG_DOUBLE,
+    [BINLOG_COL_CC_ERRORS] = BINLOG_COUNTER,
+    [BINLOG_COL_SYNC_ERRORS] = BINLOG_COUNTER,
+    [BINLOG_COL_TEI_ERRORS] = BINLOG_COUNTER,
+    [BINLOG_COL_PACKETS] = BINLOG_COUNTER,
+    [BINLOG_COL_DATA_PACKETS] = BINLOG_COUNTER,
+};
+
+typedef struct binlog_file_header
+{
+    char magic[8];
+    uint16_t version;
+    uint16_t columns;
+    uint32_t block_rows;
+    uint64_t reserved[2];
+} binlog_file_header_t;
+
+typedef struct binlog_block_header
+{
+    uint32_t magic;
+    uint16_t rows;
+    uint16_t columns;
+    uint64_t t_first;
+    uint64_t t_last;
+    uint32_t payload_size;
+    uint32_t interval_ms; /* statistics interval of all rows in the block */
+} binlog_block_header_t;
+
+typedef struct binlog_index_entry
+{
+    uint64_t t_first;
+    uint64_t t_last;
+    uint64_t offset;
+    uint32_t rows;
+    uint32_t size; /* block header + payload */
+} binlog_index_entry_t;
+
+/* One block worth of rows, doubles are stored as their bit patterns */
+typedef struct binlog_block
+{
+    uint16_t rows;
+    uint32_t interval_ms;
+    uint64_t values[BINLOG_COLUMNS][BINLOG_BLOCK_ROWS];
+} binlog_block_t;
+
+/* Worst case: 10 byte varint per value plus a size per column */
+#define BINLOG_BLOCK_MAX_SIZE (sizeof(binlog_block_header_t) + \
+                               BINLOG_COLUMNS * (sizeof(uint32_t) + BINLOG_BLOCK_ROWS * 10))
+
+static inline uint64_t binlog_double_bits(double d)
+{
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static inline double binlog_bits_double(uint64_t u)
+{
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+static inline uint64_t binlog_zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t binlog_unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline size_t binlog_put_varint(uint8_t *p, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+/* Returns 0 on success, -1 on truncated input */
+static inline int binlog_get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+    uint64_t result = 0;
+    int shift = 0;
+    while (*p < end && shift < 64)
+    {
+        uint8_t b = *(*p)++;
+        result |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *v = result;
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+static inline size_t binlog_put_xor(uint8_t *p, uint64_t x)
+{
+    if (x == 0)
+    {
+        p[0] = 0;
+        return 1;
+    }
+    int lead = 0, trail = 0;
+    while (!(x & (0xffULL << (56 - lead * 8))))
+        lead++;
+    while (!(x & (0xffULL << (trail * 8))))
+        trail++;
+    int count = 8 - lead - trail;
+    p[0] = (uint8_t)(lead << 4 | count);
+    for (int i = 0; i < count; i++)
+        p[1 + i] = (uint8_t)(x >> ((trail + i) * 8));
+    return (size_t)(1 + count);
+}
+
+static inline int binlog_get_xor(const uint8_t **p, const uint8_t *end, uint64_t *x)
+{
+    if (*p >= end)
+        return -1;
+    uint8_t control = *(*p)++;
+    int lead = control >> 4, count = control & 0xf;
+    if (lead + count > 8 || *p + count > end)
+        return -1;
+    int trail = 8 - lead - count;
+    uint64_t v = 0;
+    for (int i = 0; i < count; i++)
+        v |= (uint64_t)(*(*p)++) << ((trail + i) * 8);
+    *x = v;
+    return 0;
+}
+
+/* Encode `block` into `out` (BINLOG_BLOCK_MAX_SIZE bytes), returns size */
+static inline size_t binlog_encode_block(const binlog_block_t *block, uint8_t *out)
+{
+    binlog_block_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BINLOG_BLOCK_MAGIC;
+    header.rows = block->rows;
+    header.columns = BINLOG_COLUMNS;
+    header.t_first = block->values[BINLOG_COL_TIMESTAMP][0];
+    header.t_last = block->values[BINLOG_COL_TIMESTAMP][block->rows - 1];
+    header.interval_ms = block->interval_ms;
+
+    size_t pos = sizeof(header);
+    for (int c = 0; c < BINLOG_COLUMNS; c++)
+    {
+        size_t size_pos = pos;
+        pos += sizeof(uint32_t);
+        uint64_t prev = 0;
+        int64_t prev_delta = 0;
+        for (int r = 0; r < block->rows; r++)
+        {
+            uint64_t v = block->values[c][r];
+            switch (binlog_column_encoding[c])
+            {
+            case BINLOG_TIMESTAMP:
+            {
+                int64_t delta = (int64_t)(v - prev);
+                pos += binlog_put_varint(out + pos, binlog_zigzag(r == 0 ? (int64_t)v : delta - prev_delta));
+                prev_delta = r == 0 ? 0 : delta;
+                break;
+            }
+            case BINLOG_DOUBLE:
+                pos += binlog_put_xor(out + pos, v ^ prev);
+                break;
+            case BINLOG_COUNTER:
+                pos += binlog_put_varint(out + pos, binlog_zigzag((int64_t)(v - prev)));
+                break;
+            }
+            prev = v;
+        }
+        uint32_t size = (uint32_t)(pos - size_pos - sizeof(uint32_t));
+        memcpy(out + size_pos, &size, sizeof(size));
+    }
+    header.payload_size = (uint32_t)(pos - sizeof(header));
+    memcpy(out, &header, sizeof(header));
+    return pos;
+}
+
+/* Decode payload of a block whose header was already read, 0 on success */
+static inline int binlog_decode_block(const binlog_block_header_t *header, const uint8_t *payload, binlog_block_t *block)
+{
+    const uint8_t *p = payload;
+    const uint8_t *end = payload + header->payload_size;
+    if (header->rows == 0 || header->rows > BINLOG_BLOCK_ROWS)
+        return -1;
+    block->rows = header->rows;
+    block->interval_ms = header->interval_ms;
+
+    for (int c = 0; c < header->columns; c++)
+    {
+        uint32_t size;
+        if (p + sizeof(size) > end)
+            return -1;
+        memcpy(&size, p, sizeof(size));
+        p += sizeof(size);
+        if (p + size > end)
+            return -1;
+        const uint8_t *col_end = p + size;
+        if (c >= BINLOG_COLUMNS)
+        {
+            /* Column added by a newer writer */
+            p = col_end;
+            continue;
+        }
+
+        uint64_t prev = 0;
+        int64_t prev_delta = 0;
+        for (int r = 0; r < header->rows; r++)
+        {
+            uint64_t raw, v = 0;
+            switch (binlog_column_encoding[c])
+            {
+            case BINLOG_TIMESTAMP:
+            {
+                if (binlog_get_varint(&p, col_end, &raw) != 0)
+                    return -1;
+                if (r == 0)
+                {
+                    v = (uint64_t)binlog_unzigzag(raw);
+                }
+                else
+                {
+                    int64_t delta = prev_delta + binlog_unzigzag(raw);
+                    v = prev + (uint64_t)delta;
+                    prev_delta = delta;
+                }
+                break;
+            }
+            case BINLOG_DOUBLE:
+                if (binlog_get_xor(&p, col_end, &raw) != 0)
+                    return -1;
+                v = prev ^ raw;
+                break;
+            case BINLOG_COUNTER:
+                if (binlog_get_varint(&p, col_end, &raw) != 0)
+                    return -1;
+                v = prev + (uint64_t)binlog_unzigzag(raw);
+                break;
+            }
+            block->values[c][r] = v;
+            prev = v;
+        }
+        p = col_end;
+    }
+    return 0;
+}
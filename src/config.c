@@ -0,0 +1,626 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include "config.h"
+#include "output.h"
+
+extern unsigned gap_threshold_ms;
+extern unsigned dead_threshold_ms;
+extern unsigned cc_warning;
+extern unsigned cc_critical;
+
+#define CONFIG_MAX_CPU 1023
+
+typedef enum
+{
+    KEY_GROUP,
+    KEY_PORT,
+    KEY_INTERFACE,
+    KEY_SOURCE,
+    KEY_BITRATE,
+    KEY_BITRATE_TOLERANCE,
+    KEY_CC_WARNING,
+    KEY_CC_CRITICAL,
+    KEY_GAP,
+    KEY_DEAD,
+    KEY_CSV,
+    KEY_CONSOLE,
+    KEY_WORKER,
+    KEY_WORKERS,
+    KEY_CPUS,
+    KEY_ALARM,
+    KEY_COUNT
+} config_key_t;
+
+/* Where a key may appear */
+#define IN_DEFAULTS 1
+#define IN_STREAM 2
+/* May be given more than once */
+#define REPEATABLE 4
+
+static const struct
+{
+    const char *name;
+    unsigned where;
+} keys[KEY_COUNT] = {
+    [KEY_GROUP] = {"group", IN_STREAM},
+    [KEY_PORT] = {"port", IN_DEFAULTS | IN_STREAM},
+    [KEY_INTERFACE] = {"interface", IN_DEFAULTS | IN_STREAM},
+    [KEY_SOURCE] = {"source", IN_STREAM},
+    [KEY_BITRATE] = {"bitrate", IN_STREAM},
+    [KEY_BITRATE_TOLERANCE] = {"bitrate_tolerance", IN_DEFAULTS | IN_STREAM},
+    [KEY_CC_WARNING] = {"cc_warning", IN_DEFAULTS | IN_STREAM},
+    [KEY_CC_CRITICAL] = {"cc_critical", IN_DEFAULTS | IN_STREAM},
+    [KEY_GAP] = {"gap_ms", IN_DEFAULTS | IN_STREAM},
+    [KEY_DEAD] = {"dead_ms", IN_DEFAULTS | IN_STREAM},
+    [KEY_CSV] = {"csv", IN_STREAM},
+    [KEY_CONSOLE] = {"console", IN_DEFAULTS | IN_STREAM},
+    [KEY_WORKER] = {"worker", IN_STREAM},
+    [KEY_WORKERS] = {"workers", IN_DEFAULTS},
+    [KEY_CPUS] = {"cpus", IN_DEFAULTS},
+    [KEY_ALARM] = {"alarm", IN_DEFAULTS | IN_STREAM | REPEATABLE},
+};
+
+typedef struct parser
+{
+    const char *path;
+    unsigned line;
+    config_t *cfg;
+    stream_config_t defaults;
+    stream_config_t *stream; /* section being parsed, NULL in [defaults] */
+    bool in_section;
+    uint32_t seen; /* keys of the current section, bit per config_key_t */
+    size_t alloc;
+    unsigned cpu_count;
+} parser_t;
+
+static int config_error(parser_t *p, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static int config_error(parser_t *p, const char *fmt, ...)
+{
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    out_log(LogLevel_Error, "%s:%u: %s", p->path, p->line, msg);
+    return -1;
+}
+
+/* Strict dotted quad, host byte order */
+static int parse_ipv4(const char *s, uint32_t *out)
+{
+    uint32_t addr = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (!isdigit((unsigned char)*s))
+            return -1;
+        unsigned octet = 0;
+        int digits = 0;
+        while (isdigit((unsigned char)*s))
+        {
+            octet = octet * 10 + (unsigned)(*s++ - '0');
+            if (++digits > 3 || octet > 255)
+                return -1;
+        }
+        addr = addr << 8 | octet;
+        if (i < 3 && *s++ != '.')
+            return -1;
+    }
+    if (*s != '\0')
+        return -1;
+    *out = addr;
+    return 0;
+}
+
+static int parse_uint(const char *s, unsigned long max, unsigned long *out)
+{
+    char *end;
+    if (!isdigit((unsigned char)*s))
+        return -1;
+    unsigned long v = strtoul(s, &end, 10);
+    if (*end != '\0' || v > max)
+        return -1;
+    *out = v;
+    return 0;
+}
+
+/* "<n>[.<n>][K|M|G]", decimal multiples as for --bitrate of test-tsg */
+static int parse_bitrate(const char *s, uint64_t *out)
+{
+    char *end;
+    if (!isdigit((unsigned char)*s))
+        return -1;
+    double v = strtod(s, &end);
+    switch (*end)
+    {
+    case 'G':
+    case 'g':
+        v *= 1000;
+        /* fall through */
+    case 'M':
+    case 'm':
+        v *= 1000;
+        /* fall through */
+    case 'K':
+    case 'k':
+        v *= 1000;
+        end++;
+        break;
+    }
+    if (*end != '\0' || v < 1 || v > 100e9)
+        return -1;
+    *out = (uint64_t)v;
+    return 0;
+}
+
+static int parse_address(parser_t *p, const char *key, const char *value, bool multicast, char *out)
+{
+    uint32_t addr;
+    if (parse_ipv4(value, &addr) != 0)
+        return config_error(p, "%s: invalid IPv4 address '%s'", key, value);
+    bool is_multicast = (addr >> 28) == 0xe;
+    if (multicast && !is_multicast)
+        return config_error(p, "%s: '%s' is not a multicast address", key, value);
+    if (!multicast && is_multicast)
+        return config_error(p, "%s: '%s' is a multicast address", key, value);
+    memcpy(out, value, strlen(value) + 1);
+    return 0;
+}
+
+static int parse_cpus(parser_t *p, char *value)
+{
+    unsigned n = 0;
+    for (char *tok = value, *comma; tok; tok = comma)
+    {
+        comma = strchr(tok, ',');
+        if (comma)
+            *comma++ = '\0';
+        while (*tok == ' ' || *tok == '\t')
+            tok++;
+        size_t len = strlen(tok);
+        while (len && (tok[len - 1] == ' ' || tok[len - 1] == '\t'))
+            tok[--len] = '\0';
+        unsigned long cpu;
+        if (parse_uint(tok, CONFIG_MAX_CPU, &cpu) != 0)
+            return config_error(p, "cpus: invalid CPU '%s'", tok);
+        if (n == CONFIG_MAX_WORKERS)
+            return config_error(p, "cpus: more than %d entries", CONFIG_MAX_WORKERS);
+        p->cfg->cpus[n++] = (int)cpu;
+    }
+    if (n == 0)
+        return config_error(p, "cpus: empty list");
+    p->cpu_count = n;
+    return 0;
+}
+
+static int set_key(parser_t *p, config_key_t key, char *value)
+{
+    stream_config_t *sc = p->stream ? p->stream : &p->defaults;
+    const char *name = keys[key].name;
+    unsigned long v;
+
+    switch (key)
+    {
+    case KEY_GROUP:
+        return parse_address(p, name, value, true, sc->group);
+    case KEY_INTERFACE:
+    case KEY_SOURCE:
+        return parse_address(p, name, value, false, key == KEY_INTERFACE ? sc->interface : sc->source);
+    case KEY_PORT:
+        if (parse_uint(value, 65535, &v) != 0 || v == 0)
+            return config_error(p, "port: invalid port '%s'", value);
+        sc->port = (uint16_t)v;
+        return 0;
+    case KEY_BITRATE:
+        if (parse_bitrate(value, &sc->bitrate) != 0)
+            return config_error(p, "bitrate: invalid bitrate '%s'", value);
+        return 0;
+    case KEY_BITRATE_TOLERANCE:
+        if (parse_uint(value, 100, &v) != 0 || v == 0)
+            return config_error(p, "bitrate_tolerance: must be 1 to 100 (percent), not '%s'", value);
+        sc->bitrate_tolerance = (unsigned)v;
+        return 0;
+    case KEY_CC_WARNING:
+    case KEY_CC_CRITICAL:
+    case KEY_GAP:
+    case KEY_DEAD:
+        if (parse_uint(value, 1000000000, &v) != 0)
+            return config_error(p, "%s: invalid number '%s'", name, value);
+        if ((key == KEY_GAP || key == KEY_DEAD) && v == 0)
+            return config_error(p, "%s: must be at least 1", name);
+        *(key == KEY_CC_WARNING ? &sc->cc_warning : key == KEY_CC_CRITICAL ? &sc->cc_critical
+                                                  : key == KEY_GAP         ? &sc->gap_ms
+                                                                           : &sc->dead_ms) = (unsigned)v;
+        return 0;
+    case KEY_CSV:
+        sc->csv = strdup(value);
+        if (!sc->csv)
+            return config_error(p, "out of memory");
+        return 0;
+    case KEY_CONSOLE:
+        if (strcmp(value, "yes") == 0)
+            sc->console = true;
+        else if (strcmp(value, "no") == 0)
+            sc->console = false;
+        else
+            return config_error(p, "console: must be yes or no, not '%s'", value);
+        return 0;
+    case KEY_WORKER:
+        if (parse_uint(value, CONFIG_MAX_WORKERS - 1, &v) != 0)
+            return config_error(p, "worker: must be 0 to %d, not '%s'", CONFIG_MAX_WORKERS - 1, value);
+        sc->worker = (int)v;
+        return 0;
+    case KEY_WORKERS:
+        if (parse_uint(value, CONFIG_MAX_WORKERS, &v) != 0 || v == 0)
+            return config_error(p, "workers: must be 1 to %d, not '%s'", CONFIG_MAX_WORKERS, value);
+        p->cfg->workers = (unsigned)v;
+        return 0;
+    case KEY_CPUS:
+        return parse_cpus(p, value);
+    case KEY_ALARM:
+    {
+        if (sc->alarm_count == CONFIG_MAX_ALARMS)
+            return config_error(p, "alarm: more than %d alarms", CONFIG_MAX_ALARMS);
+        const char *error = alarm_parse(value, &sc->alarms[sc->alarm_count]);
+        if (error)
+            return config_error(p, "alarm: %s", error);
+        sc->alarm_count++;
+        return 0;
+    }
+    case KEY_COUNT:
+        break;
+    }
+    return -1;
+}
+
+/* Checks that need the whole section */
+static int end_section(parser_t *p)
+{
+    stream_config_t *sc = p->stream;
+    const char *error = NULL;
+    if (!sc)
+        return 0;
+    if (sc->group[0] == '\0')
+        error = "group is required";
+    else if (sc->port == 0)
+        error = "port is required";
+    else if (sc->cc_warning > sc->cc_critical)
+        error = "cc_warning is above cc_critical";
+    if (error)
+    {
+        out_log(LogLevel_Error, "%s:%u: [%s]: %s", p->path, sc->line, sc->name, error);
+        return -1;
+    }
+    return 0;
+}
+
+static int begin_section(parser_t *p, char *name)
+{
+    if (end_section(p) != 0)
+        return -1;
+    p->seen = 0;
+
+    if (strcmp(name, "defaults") == 0)
+    {
+        if (p->in_section)
+            return config_error(p, "[defaults] must come before the first stream");
+        p->in_section = true;
+        return 0;
+    }
+    size_t len = strlen(name);
+    if (len == 0 || len >= CONFIG_NAME_SIZE)
+        return config_error(p, "stream name must be 1 to %d characters", CONFIG_NAME_SIZE - 1);
+    for (size_t i = 0; i < len; i++)
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '_' && name[i] != '.')
+            return config_error(p, "invalid stream name '%s', use letters, digits, '-', '_' and '.'", name);
+
+    config_t *cfg = p->cfg;
+    if (cfg->count == p->alloc)
+    {
+        size_t alloc = p->alloc ? p->alloc * 2 : 64;
+        stream_config_t *streams = realloc(cfg->streams, alloc * sizeof(*streams));
+        if (!streams)
+            return config_error(p, "out of memory");
+        cfg->streams = streams;
+        p->alloc = alloc;
+    }
+    p->stream = &cfg->streams[cfg->count++];
+    *p->stream = p->defaults;
+    memcpy(p->stream->name, name, len + 1);
+    p->stream->line = p->line;
+    p->in_section = true;
+    return 0;
+}
+
+static int parse_line(parser_t *p, char *line)
+{
+    char *end = line + strlen(line);
+    while (end > line && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    while (isspace((unsigned char)*line))
+        line++;
+    if (*line == '\0' || *line == '#' || *line == ';')
+        return 0;
+
+    if (*line == '[')
+    {
+        if (end[-1] != ']')
+            return config_error(p, "missing ']'");
+        end[-1] = '\0';
+        return begin_section(p, line + 1);
+    }
+
+    char *eq = strchr(line, '=');
+    if (!eq)
+        return config_error(p, "expected 'key = value'");
+    char *key = line;
+    char *value = eq + 1;
+    while (eq > key && isspace((unsigned char)eq[-1]))
+        eq--;
+    *eq = '\0';
+    while (isspace((unsigned char)*value))
+        value++;
+    if (*key == '\0' || *value == '\0')
+        return config_error(p, "expected 'key = value'");
+    if (!p->in_section)
+        return config_error(p, "'%s' outside of a section", key);
+
+    for (int k = 0; k < KEY_COUNT; k++)
+    {
+        if (strcmp(key, keys[k].name) != 0)
+            continue;
+        if (!(keys[k].where & (p->stream ? IN_STREAM : IN_DEFAULTS)))
+            return config_error(p, "'%s' is not allowed in %s", key, p->stream ? "a stream" : "[defaults]");
+        if ((p->seen & (1u << k)) && !(keys[k].where & REPEATABLE))
+            return config_error(p, "'%s' repeated", key);
+        p->seen |= 1u << k;
+        return set_key(p, (config_key_t)k, value);
+    }
+    return config_error(p, "unknown setting '%s'", key);
+}
+
+/* Streams are sorted by these to find duplicates without comparing all pairs */
+typedef struct endpoint
+{
+    uint32_t group;
+    uint32_t source;
+    uint32_t interface;
+    uint16_t port;
+    const stream_config_t *stream;
+} endpoint_t;
+
+static int endpoint_compare(const void *a, const void *b)
+{
+    const endpoint_t *x = a, *y = b;
+    if (x->group != y->group)
+        return x->group < y->group ? -1 : 1;
+    if (x->port != y->port)
+        return x->port < y->port ? -1 : 1;
+    if (x->source != y->source)
+        return x->source < y->source ? -1 : 1;
+    if (x->interface != y->interface)
+        return x->interface < y->interface ? -1 : 1;
+    return 0;
+}
+
+static int name_compare(const void *a, const void *b)
+{
+    const stream_config_t *x = *(const stream_config_t *const *)a;
+    const stream_config_t *y = *(const stream_config_t *const *)b;
+    return strcmp(x->name, y->name);
+}
+
+/* Streams without a CSV file sort first */
+static int csv_compare(const void *a, const void *b)
+{
+    const stream_config_t *x = *(const stream_config_t *const *)a;
+    const stream_config_t *y = *(const stream_config_t *const *)b;
+    if (!x->csv || !y->csv)
+        return (x->csv != NULL) - (y->csv != NULL);
+    return strcmp(x->csv, y->csv);
+}
+
+/* Earlier line first */
+static void order_by_line(const stream_config_t **a, const stream_config_t **b)
+{
+    if ((*a)->line > (*b)->line)
+    {
+        const stream_config_t *t = *a;
+        *a = *b;
+        *b = t;
+    }
+}
+
+static int check_streams(parser_t *p)
+{
+    config_t *cfg = p->cfg;
+    int ret = 0;
+
+    if (cfg->count == 0)
+    {
+        out_log(LogLevel_Error, "%s: no streams", p->path);
+        return -1;
+    }
+    if (p->cpu_count)
+    {
+        if (cfg->workers && cfg->workers != p->cpu_count)
+        {
+            out_log(LogLevel_Error, "%s: %u workers but %u cpus", p->path, cfg->workers, p->cpu_count);
+            return -1;
+        }
+        cfg->workers = p->cpu_count;
+    }
+    if (!cfg->workers)
+        cfg->workers = 1;
+
+    endpoint_t *endpoints = malloc(cfg->count * sizeof(*endpoints));
+    const stream_config_t **names = malloc(cfg->count * sizeof(*names));
+    const stream_config_t **csvs = malloc(cfg->count * sizeof(*csvs));
+    if (!endpoints || !names || !csvs)
+    {
+        free(endpoints);
+        free(names);
+        free(csvs);
+        out_log(LogLevel_Error, "%s: out of memory", p->path);
+        return -1;
+    }
+
+    unsigned next_worker = 0;
+    for (size_t i = 0; i < cfg->count; i++)
+    {
+        stream_config_t *sc = &cfg->streams[i];
+        if (sc->worker >= (int)cfg->workers)
+        {
+            out_log(LogLevel_Error, "%s:%u: [%s]: worker %d does not exist, workers = %u",
+                    p->path, sc->line, sc->name, sc->worker, cfg->workers);
+            ret = -1;
+        }
+        if (sc->worker < 0)
+            sc->worker = (int)(next_worker++ % cfg->workers);
+
+        endpoint_t *e = &endpoints[i];
+        memset(e, 0, sizeof(*e));
+        parse_ipv4(sc->group, &e->group);
+        if (sc->source[0])
+            parse_ipv4(sc->source, &e->source);
+        if (sc->interface[0])
+            parse_ipv4(sc->interface, &e->interface);
+        e->port = sc->port;
+        e->stream = sc;
+        names[i] = sc;
+        csvs[i] = sc;
+    }
+
+    qsort(endpoints, cfg->count, sizeof(*endpoints), endpoint_compare);
+    qsort(names, cfg->count, sizeof(*names), name_compare);
+    qsort(csvs, cfg->count, sizeof(*csvs), csv_compare);
+    for (size_t i = 1; i < cfg->count; i++)
+    {
+        if (endpoint_compare(&endpoints[i - 1], &endpoints[i]) == 0)
+        {
+            const stream_config_t *a = endpoints[i - 1].stream, *b = endpoints[i].stream;
+            order_by_line(&a, &b);
+            out_log(LogLevel_Error, "%s:%u: [%s] receives the same stream as [%s] on line %u",
+                    p->path, b->line, b->name, a->name, a->line);
+            ret = -1;
+        }
+        if (strcmp(names[i - 1]->name, names[i]->name) == 0)
+        {
+            const stream_config_t *a = names[i - 1], *b = names[i];
+            out_log(LogLevel_Error, "%s:%u: stream [%s] repeated, first on line %u",
+                    p->path, a->line > b->line ? a->line : b->line, a->name, a->line < b->line ? a->line : b->line);
+            ret = -1;
+        }
+        /* Two logfiles appending to and rotating one path would mix their rows */
+        if (csvs[i - 1]->csv && csv_compare(&csvs[i - 1], &csvs[i]) == 0)
+        {
+            const stream_config_t *a = csvs[i - 1], *b = csvs[i];
+            order_by_line(&a, &b);
+            out_log(LogLevel_Error, "%s:%u: [%s] writes the same CSV file as [%s] on line %u",
+                    p->path, b->line, b->name, a->name, a->line);
+            ret = -1;
+        }
+    }
+    free(endpoints);
+    free(names);
+    free(csvs);
+    return ret;
+}
+
+int config_load(const char *path, config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    for (int i = 0; i < CONFIG_MAX_WORKERS; i++)
+        cfg->cpus[i] = -1;
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        out_log(LogLevel_Error, "Cannot open %s", path);
+        return -1;
+    }
+    char *buf = NULL;
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0)
+    {
+        buf = malloc((size_t)size + 1);
+        if (buf && fread(buf, 1, (size_t)size, f) != (size_t)size)
+        {
+            free(buf);
+            buf = NULL;
+        }
+    }
+    fclose(f);
+    if (!buf)
+    {
+        out_log(LogLevel_Error, "Cannot read %s", path);
+        return -1;
+    }
+    buf[size] = '\0';
+
+    parser_t p = {
+        .path = path,
+        .cfg = cfg,
+        .defaults = {
+            .bitrate_tolerance = 10,
+            .cc_warning = cc_warning,
+            .cc_critical = cc_critical,
+            .gap_ms = gap_threshold_ms,
+            .dead_ms = dead_threshold_ms,
+            .console = true,
+            .worker = -1,
+        },
+    };
+    int ret = 0;
+    char *line = buf;
+    while (line && ret == 0)
+    {
+        char *next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        p.line++;
+        const char *line_end = next ? next - 1 : buf + size;
+        if (strlen(line) != (size_t)(line_end - line))
+            ret = config_error(&p, "NUL byte in line");
+        else
+            ret = parse_line(&p, line);
+        line = next;
+    }
+    if (ret == 0)
+        ret = end_section(&p);
+    free(buf);
+    if (ret == 0)
+        ret = check_streams(&p);
+    if (ret != 0)
+        config_free(cfg);
+    return ret;
+}
+
+void config_free(config_t *cfg)
+{
+    for (size_t i = 0; i < cfg->count; i++)
+        free(cfg->streams[i].csv);
+    free(cfg->streams);
+    cfg->streams = NULL;
+    cfg->count = 0;
+}
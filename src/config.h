@@ -0,0 +1,82 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "alarm.h"
+
+#define CONFIG_NAME_SIZE 64
+#define CONFIG_ADDR_SIZE 16
+#define CONFIG_MAX_WORKERS 256
+#define CONFIG_MAX_ALARMS (ALARM_MAX_RULES - ALARM_BUILTIN_RULES)
+
+/*
+ * Streams file for monitoring many streams from one process, INI style:
+ *
+ *   # comment
+ *   [defaults]
+ *   workers = 4
+ *   cpus = 2,3,4,5
+ *   interface = 10.0.0.5
+ *
+ *   [news-hd]
+ *   group = 239.1.1.1
+ *   port = 1234
+ *   source = 10.20.0.1
+ *   bitrate = 8M
+ *   alarm = pcr_jitter > 10 clear 5 for 3
+ *   csv = /var/log/stsmon/news-hd.csv
+ *
+ * Settings in [defaults] apply to every stream after it, so it has to
+ * come first; `alarm` may be repeated, a stream adds its own alarms to
+ * those of [defaults]. Anything unknown, repeated or out of range is an error
+ * reported with its line, the file is read once and parsed in place.
+ */
+typedef struct stream_config
+{
+    char name[CONFIG_NAME_SIZE];
+    char group[CONFIG_ADDR_SIZE];
+    uint16_t port;
+    char interface[CONFIG_ADDR_SIZE]; /* "" for any */
+    char source[CONFIG_ADDR_SIZE];    /* "" for any source, else an SSM join */
+    uint64_t bitrate;                 /* expected bits per second, 0: not checked */
+    unsigned bitrate_tolerance;       /* percent */
+    unsigned cc_warning;
+    unsigned cc_critical;
+    unsigned gap_ms;
+    unsigned dead_ms;
+    alarm_rule_t alarms[CONFIG_MAX_ALARMS]; /* besides those of alarm_builtin() */
+    unsigned alarm_count;
+    char *csv;    /* statistics log of this stream, NULL for none */
+    bool console; /* status lines */
+    int worker;   /* -1 until assigned */
+    unsigned line;
+} stream_config_t;
+
+typedef struct config
+{
+    stream_config_t *streams;
+    size_t count;
+    unsigned workers;
+    int cpus[CONFIG_MAX_WORKERS]; /* CPU of each worker, -1: not pinned */
+} config_t;
+
+/* Read and validate `path`, errors are logged. 0 on success. */
+int config_load(const char *path, config_t *cfg);
+void config_free(config_t *cfg);
@@ -0,0 +1,532 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#endif
+#include "control.h"
+#include "stats.h"
+#include "ring.h"
+#include "ratelimit.h"
+#include "output.h"
+#include <bitstream/mpeg/psi.h>
+
+extern int show_cc;
+extern int show_times;
+extern int quiet_mode;
+extern unsigned log_rate;
+extern unsigned gap_threshold_ms;
+extern unsigned dead_threshold_ms;
+extern unsigned cc_warning;
+extern unsigned cc_critical;
+extern uint64_t tsusecs();
+
+#define CONTROL_LINE_MAX 256
+#define CONTROL_MAILBOX_SIZE 64
+/* Sections kept for "psi", PAT + SDT + one PMT per service is far less */
+#define CONTROL_PSI_MAX 1024
+/* Client sending nothing for this long is disconnected */
+#define CONTROL_IDLE_US 30000000
+/* The capture loop polls the mailbox at least once a second */
+#define CONTROL_APPLY_WAIT_MS 2000
+
+/* Runtime settings, `value` is a pointer to the global it changes */
+typedef struct control_setting
+{
+    const char *name;
+    void *value;
+    bool is_int; /* int instead of unsigned */
+    unsigned max;
+} control_setting_t;
+
+static const control_setting_t settings[] = {
+    {"show_cc", &show_cc, true, 1},
+    {"show_times", &show_times, true, 1},
+    {"quiet", &quiet_mode, true, 2},
+    {"log_rate", &log_rate, false, 100000},
+    {"gap_ms", &gap_threshold_ms, false, 3600000},
+    {"dead_ms", &dead_threshold_ms, false, 3600000},
+    {"cc_warning", &cc_warning, false, UINT32_MAX},
+    {"cc_critical", &cc_critical, false, UINT32_MAX},
+};
+#define CONTROL_SETTINGS (sizeof(settings) / sizeof(settings[0]))
+
+typedef struct control_change
+{
+    size_t setting;
+    unsigned value;
+} control_change_t;
+
+typedef struct control_psi
+{
+    uint16_t pid;
+    uint8_t table_id;
+    uint16_t table_ext;
+    uint8_t section_number;
+    uint16_t length;
+    uint8_t *data;
+} control_psi_t;
+
+static bool running = false;
+static ring_t mailbox;
+static pthread_mutex_t psi_lock = PTHREAD_MUTEX_INITIALIZER;
+static control_psi_t psi_sections[CONTROL_PSI_MAX];
+static size_t psi_count = 0;
+
+static unsigned setting_get(const control_setting_t *s)
+{
+    if (s->is_int)
+        return (unsigned)__atomic_load_n((int *)s->value, __ATOMIC_RELAXED);
+    return __atomic_load_n((unsigned *)s->value, __ATOMIC_RELAXED);
+}
+
+void control_poll()
+{
+    if (!running)
+        return;
+    control_change_t *c;
+    while ((c = ring_peek(&mailbox)) != NULL)
+    {
+        const control_setting_t *s = &settings[c->setting];
+        if (s->is_int)
+            __atomic_store_n((int *)s->value, (int)c->value, __ATOMIC_RELAXED);
+        else
+            __atomic_store_n((unsigned *)s->value, c->value, __ATOMIC_RELAXED);
+        if (s->value == &log_rate)
+            ratelimit_configure(log_rate, log_rate * 2);
+        out_log(LogLevel_Info, "Control: %s set to %u", s->name, c->value);
+        ring_release(&mailbox);
+    }
+}
+
+void control_psi_store(uint16_t pid, const uint8_t *section)
+{
+    if (!running)
+        return;
+
+    uint8_t table_id = psi_get_tableid(section);
+    uint16_t table_ext = psi_get_syntax(section) ? psi_get_tableidext(section) : 0;
+    uint8_t number = psi_get_syntax(section) ? psi_get_section(section) : 0;
+    uint8_t last = psi_get_syntax(section) ? psi_get_lastsection(section) : 0;
+    uint16_t length = (uint16_t)(psi_get_length(section) + PSI_HEADER_SIZE);
+
+    pthread_mutex_lock(&psi_lock);
+    control_psi_t *slot = NULL;
+    for (size_t i = 0; i < psi_count;)
+    {
+        control_psi_t *p = &psi_sections[i];
+        if (p->pid == pid && p->table_id == table_id && p->table_ext == table_ext)
+        {
+            if (p->section_number == number)
+            {
+                slot = p;
+            }
+            else if (p->section_number > last)
+            {
+                /* Table got shorter */
+                free(p->data);
+                *p = psi_sections[--psi_count];
+                continue;
+            }
+        }
+        i++;
+    }
+    if (!slot && psi_count < CONTROL_PSI_MAX)
+    {
+        slot = &psi_sections[psi_count++];
+        slot->data = NULL;
+    }
+    if (slot)
+    {
+        uint8_t *copy = realloc(slot->data, length);
+        if (copy)
+        {
+            memcpy(copy, section, length);
+            slot->data = copy;
+            slot->pid = pid;
+            slot->table_id = table_id;
+            slot->table_ext = table_ext;
+            slot->section_number = number;
+            slot->length = length;
+        }
+        else if (!slot->data)
+        {
+            psi_count--;
+        }
+    }
+    pthread_mutex_unlock(&psi_lock);
+}
+
+#ifndef WIN32
+static int listen_fd = -1;
+static pthread_t control_thread;
+static int stop_flag = 0;
+static char socket_path[108];
+static stats_snapshot_t snapshot;
+
+static void reply(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void reply(int fd, const char *fmt, ...)
+{
+    char buf[1024];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n < 0)
+        return;
+    size_t len = (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1;
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+        if (w <= 0)
+        {
+            /* Timed out or gone, the remaining replies fail at once */
+            shutdown(fd, SHUT_RDWR);
+            return;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+}
+
+static void cmd_stats(int fd)
+{
+    const stats_snapshot_t *s = &snapshot;
+    uint64_t now = tsusecs();
+    reply(fd, "stream %s\n", s->stream);
+    reply(fd, "uptime_s %.1f\n", s->start_time ? (now - s->start_time) / 1000000.0 : 0.0);
+    reply(fd, "last_packet_age_s %.3f\n", s->last_packet ? (s->timestamp - s->last_packet) / 1000000.0 : -1.0);
+    reply(fd, "bitrate_bps %.0f\ndata_bitrate_bps %.0f\n", s->bitrate, s->data_bitrate);
+    reply(fd, "packets %" PRIu64 "\ndata_packets %" PRIu64 "\n", s->packets_all, s->packets_data);
+    reply(fd, "cc_errors %" PRIu64 "\nsync_errors %" PRIu64 "\ntei_errors %" PRIu64 "\n",
+          s->cc_errors, s->sync_errors, s->tei_errors);
+    reply(fd, "socket_drops %" PRIu64 "\ncsv_drops %" PRIu64 "\n", s->socket_drops, s->csv_drops);
+    reply(fd, "alarms_active %" PRIu32 "\nalarms_raised %" PRIu64 "\n", s->alarms_active, s->alarms_raised);
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        const rollup_sample_t *r = &s->rollups[l];
+        if (r->ticks)
+            reply(fd, "bitrate_%s_bps avg %.0f min %.0f max %.0f\n", rollup_name(l),
+                  rollup_bitrate(r), r->bitrate_min, r->bitrate_max);
+    }
+}
+
+static void cmd_pids(int fd)
+{
+    reply(fd, "%5s %5s %4s %12s %14s %8s %8s\n", "pid", "sid", "type", "bitrate_bps", "packets", "cc", "tei");
+    for (size_t i = 0; i < snapshot.pid_count; i++)
+    {
+        const stats_pid_t *p = &snapshot.pids[i];
+        reply(fd, "%5u %5u %4s %12.0f %14" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+              p->pid, p->service_id, p->is_psi ? "psi" : p->is_data ? "data" : "-",
+              p->bitrate, p->packets, p->cc_errors, p->tei_errors);
+    }
+}
+
+static void cmd_services(int fd)
+{
+    reply(fd, "%5s %5s %3s %9s %s\n", "sid", "pmt", "ver", "scrambled", "name");
+    for (size_t i = 0; i < snapshot.service_count; i++)
+    {
+        const stats_service_t *sv = &snapshot.services[i];
+        reply(fd, "%5u %5u %3u %9s %s\n", sv->service_id, sv->pmt_pid, sv->pmt_version,
+              sv->scrambled ? "yes" : "no", sv->name);
+    }
+}
+
+/* Sections are copied out under psi_lock and sent after it is released,
+ * a client that stops reading never holds up control_psi_store() */
+static void cmd_psi(int fd, int pid)
+{
+    static control_psi_t copies[CONTROL_PSI_MAX];
+    size_t count = 0;
+    bool oom = false;
+
+    pthread_mutex_lock(&psi_lock);
+    for (size_t i = 0; i < psi_count; i++)
+    {
+        const control_psi_t *p = &psi_sections[i];
+        if (pid >= 0 && p->pid != pid)
+            continue;
+        uint8_t *data = malloc(p->length);
+        if (!data)
+        {
+            oom = true;
+            break;
+        }
+        memcpy(data, p->data, p->length);
+        copies[count] = *p;
+        copies[count++].data = data;
+    }
+    pthread_mutex_unlock(&psi_lock);
+
+    if (oom)
+        reply(fd, "error: out of memory\n");
+    for (size_t i = 0; i < count; i++)
+    {
+        const control_psi_t *p = &copies[i];
+        const uint8_t *d = p->data;
+        reply(fd, "pid %u table_id 0x%02x ext %u version %u section %u/%u length %u\n",
+              p->pid, p->table_id, p->table_ext,
+              psi_get_syntax(d) ? psi_get_version(d) : 0, p->section_number,
+              psi_get_syntax(d) ? psi_get_lastsection(d) : 0, p->length);
+        for (uint16_t o = 0; o < p->length; o += 16)
+        {
+            char line[64];
+            size_t n = 0;
+            for (uint16_t j = o; j < o + 16 && j < p->length; j++)
+                n += (size_t)snprintf(line + n, sizeof(line) - n, " %02x", d[j]);
+            reply(fd, "  %04x:%s\n", o, line);
+        }
+        free(copies[i].data);
+    }
+}
+
+static void cmd_set(int fd, const char *name, const char *value)
+{
+    for (size_t i = 0; i < CONTROL_SETTINGS; i++)
+    {
+        if (strcmp(settings[i].name, name) != 0)
+            continue;
+        char *end;
+        unsigned long v = strtoul(value, &end, 10);
+        if (end == value || *end != '\0' || v > settings[i].max)
+        {
+            reply(fd, "error: %s must be 0..%u\n", name, settings[i].max);
+            return;
+        }
+        control_change_t *c = ring_reserve(&mailbox);
+        if (!c)
+        {
+            reply(fd, "error: busy\n");
+            return;
+        }
+        c->setting = i;
+        c->value = (unsigned)v;
+        ring_commit(&mailbox);
+        /* Answer once applied so a following "get" shows the new value */
+        for (int wait = 0; wait < CONTROL_APPLY_WAIT_MS / 10 && ring_used(&mailbox) > 0; wait++)
+            usleep(10000);
+        reply(fd, "ok\n");
+        return;
+    }
+    reply(fd, "error: unknown setting '%s'\n", name);
+}
+
+static void handle_command(int fd, char *line)
+{
+    char *argv[4] = {NULL, NULL, NULL, NULL};
+    int argc = 0;
+    for (char *tok = strtok(line, " \t\r"); tok && argc < 4; tok = strtok(NULL, " \t\r"))
+        argv[argc++] = tok;
+    if (argc == 0)
+        return;
+
+    if (strcmp(argv[0], "stats") == 0 || strcmp(argv[0], "pids") == 0 || strcmp(argv[0], "services") == 0)
+    {
+        stats_read(&snapshot);
+        if (argv[0][0] == 's' && argv[0][1] == 't')
+            cmd_stats(fd);
+        else if (argv[0][0] == 'p')
+            cmd_pids(fd);
+        else
+            cmd_services(fd);
+    }
+    else if (strcmp(argv[0], "psi") == 0)
+    {
+        cmd_psi(fd, argc > 1 ? atoi(argv[1]) : -1);
+    }
+    else if (strcmp(argv[0], "get") == 0)
+    {
+        for (size_t i = 0; i < CONTROL_SETTINGS; i++)
+            reply(fd, "%s %u\n", settings[i].name, setting_get(&settings[i]));
+    }
+    else if (strcmp(argv[0], "set") == 0 && argc == 3)
+    {
+        /* Answers itself */
+        cmd_set(fd, argv[1], argv[2]);
+        return;
+    }
+    else if (strcmp(argv[0], "help") == 0)
+    {
+        reply(fd, "stats | pids | services | psi [pid] | get | set <name> <value>\nsettings:");
+        for (size_t i = 0; i < CONTROL_SETTINGS; i++)
+            reply(fd, " %s", settings[i].name);
+        reply(fd, "\n");
+    }
+    else
+    {
+        reply(fd, "error: unknown command, try help\n");
+        return;
+    }
+    reply(fd, "ok\n");
+}
+
+static void handle_client(int fd)
+{
+    char buf[CONTROL_LINE_MAX];
+    size_t used = 0;
+    uint64_t last_activity = tsusecs();
+
+    while (!__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE) && tsusecs() - last_activity < CONTROL_IDLE_US)
+    {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(fd, &read_fds);
+        struct timeval timeout = {.tv_sec = 0, .tv_usec = 200000};
+        if (select(fd + 1, &read_fds, NULL, NULL, &timeout) <= 0)
+            continue;
+        ssize_t n = recv(fd, buf + used, sizeof(buf) - 1 - used, 0);
+        if (n <= 0)
+            return;
+        used += (size_t)n;
+        last_activity = tsusecs();
+
+        char *nl;
+        while ((nl = memchr(buf, '\n', used)) != NULL)
+        {
+            *nl = '\0';
+            handle_command(fd, buf);
+            used -= (size_t)(nl + 1 - buf);
+            memmove(buf, nl + 1, used);
+        }
+        if (used == sizeof(buf) - 1)
+        {
+            reply(fd, "error: line too long\n");
+            return;
+        }
+    }
+}
+
+static void *control_run(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE))
+    {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(listen_fd, &read_fds);
+        struct timeval timeout = {.tv_sec = 0, .tv_usec = 200000};
+        if (select(listen_fd + 1, &read_fds, NULL, NULL, &timeout) <= 0)
+            continue;
+        int client = accept(listen_fd, NULL, NULL);
+        if (client < 0)
+            continue;
+        /* Replies to a client that stopped reading give up instead of blocking */
+        struct timeval send_timeout = {.tv_sec = 1, .tv_usec = 0};
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        handle_client(client);
+        close(client);
+    }
+    return NULL;
+}
+
+int control_start(const char *path)
+{
+    if (strlen(path) >= sizeof(socket_path))
+    {
+        out_log(LogLevel_Error, "Control socket path '%s' is too long", path);
+        return -1;
+    }
+    snprintf(socket_path, sizeof(socket_path), "%s", path);
+
+    /* Remove a stale socket left by a previous run, but nothing else */
+    struct stat st;
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        out_log(LogLevel_Error, "control socket() failed: %s (%d)", strerror(errno), errno);
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_path, sizeof(socket_path));
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0)
+    {
+        out_log(LogLevel_Error, "control bind('%s') failed: %s (%d)", socket_path, strerror(errno), errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    if (ring_init(&mailbox, sizeof(control_change_t), CONTROL_MAILBOX_SIZE) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to allocate control mailbox");
+        control_stop();
+        return -1;
+    }
+    stop_flag = 0;
+    running = true;
+    if (pthread_create(&control_thread, NULL, control_run, NULL) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to start control thread");
+        running = false;
+        control_stop();
+        return -1;
+    }
+    out_log(LogLevel_Info, "Control socket at %s", socket_path);
+    return 0;
+}
+
+void control_stop()
+{
+    if (listen_fd < 0)
+        return;
+    if (running)
+    {
+        __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+        pthread_join(control_thread, NULL);
+        running = false;
+    }
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+    ring_free(&mailbox);
+
+    for (size_t i = 0; i < psi_count; i++)
+        free(psi_sections[i].data);
+    psi_count = 0;
+}
+#else
+int control_start(const char *path)
+{
+    (void)path;
+    out_log(LogLevel_Error, "Control socket is not supported on this platform");
+    return -1;
+}
+
+void control_stop()
+{
+}
+#endif
@@ -0,0 +1,43 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+
+/*
+ * Unix stream socket for queries and runtime settings, used by
+ * stsmon-ctl or socat. One command per line, each answer ends with a line
+ * "ok" or "error: <reason>":
+ *
+ *   stats | pids | services | psi [pid] | get | set <name> <value> | help
+ *
+ * Queries are answered on the control thread from the stats snapshot and
+ * copies of PSI sections. Settings are queued in a mailbox and applied by
+ * the capture loop in control_poll(), so nothing is written to state the
+ * capture loop owns from another thread.
+ */
+int control_start(const char *path);
+void control_stop();
+
+/* Capture thread: apply queued settings, cheap when there are none */
+void control_poll();
+
+/*
+ * Capture thread: keep a copy of an accepted PSI section for "psi".
+ * Sections beyond last_section of the same table are dropped.
+ */
+void control_psi_store(uint16_t pid, const uint8_t *section);
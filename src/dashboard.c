@@ -0,0 +1,484 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#endif
+#include "dashboard.h"
+#include "stats.h"
+#include "events.h"
+#include "output.h"
+
+#define DASHBOARD_FPS 4
+/* Events kept for display, newest first */
+#define DASHBOARD_EVENTS 64
+/* Snapshot is published once per second, allow for that */
+#define DASHBOARD_DEAD_US 2000000
+
+#define ATTR_REVERSE 0x40
+#define ATTR_BOLD 0x80
+#define ATTR_COLOR(a) ((a) & 0x3f)
+
+/* One screen position: up to 4 bytes of UTF-8 packed into `ch` */
+typedef struct cell
+{
+    uint32_t ch;
+    uint8_t attr;
+} cell_t;
+
+extern uint64_t tsusecs();
+
+#ifndef WIN32
+static pthread_t render_thread;
+static bool running = false;
+static int stop_flag = 0;
+static struct termios saved_termios;
+static char stream_name[STATS_NAME_SIZE];
+
+static int rows = 0, cols = 0;
+static cell_t *front = NULL; /* what the terminal shows */
+static cell_t *back = NULL;  /* frame being rendered */
+static char *out = NULL;
+static size_t out_len = 0;
+
+static stats_snapshot_t snapshot;
+static uint16_t pid_order[TS_MAX_PID];
+static event_recent_t history[DASHBOARD_EVENTS];
+static size_t history_head = 0;
+static size_t history_count = 0;
+static size_t pid_scroll = 0;
+static bool sort_by_bitrate = false;
+
+static void terminal_restore();
+
+static void term_write(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void out_str(const char *s, size_t len)
+{
+    memcpy(out + out_len, s, len);
+    out_len += len;
+}
+
+static bool resize()
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_row == 0 || ws.ws_col == 0)
+    {
+        ws.ws_row = 24;
+        ws.ws_col = 80;
+    }
+    if (ws.ws_row == rows && ws.ws_col == cols)
+        return true;
+
+    rows = ws.ws_row;
+    cols = ws.ws_col;
+    size_t cells = (size_t)rows * cols;
+    free(front);
+    free(back);
+    free(out);
+    front = malloc(cells * sizeof(cell_t));
+    back = malloc(cells * sizeof(cell_t));
+    /* Worst case per cell: cursor move, attributes and 4 bytes of text */
+    out = malloc(cells * 40 + 64);
+    if (!front || !back || !out)
+        return false;
+
+    /* Nothing on screen matches, forces a full redraw */
+    for (size_t i = 0; i < cells; i++)
+        front[i] = (cell_t){.ch = 0xffffffff, .attr = 0};
+    term_write("\033[0m\033[2J", 8);
+    return true;
+}
+
+static void clear_back()
+{
+    for (size_t i = 0; i < (size_t)rows * cols; i++)
+        back[i] = (cell_t){.ch = ' ', .attr = 0};
+}
+
+static void fill_row(int row, uint8_t attr)
+{
+    if (row < 0 || row >= rows)
+        return;
+    for (int c = 0; c < cols; c++)
+        back[row * cols + c] = (cell_t){.ch = ' ', .attr = attr};
+}
+
+/* Draw formatted text at row/col, clipped to the screen, returns the column after it */
+static int put(int row, int col, uint8_t attr, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+static int put(int row, int col, uint8_t attr, const char *fmt, ...)
+{
+    char text[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    if (row < 0 || row >= rows)
+        return col;
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p && col < cols)
+    {
+        int len = *p < 0x80 ? 1 : (*p >> 5) == 6 ? 2 : (*p >> 4) == 14 ? 3 : (*p >> 3) == 30 ? 4 : 1;
+        uint32_t ch = 0;
+        for (int i = 0; i < len && p[i]; i++)
+            ch |= (uint32_t)p[i] << (i * 8);
+        for (int i = 0; i < len && *p; i++)
+            p++;
+        /* Text starting left of the screen is clipped, e.g. the clock on a narrow terminal */
+        if (col >= 0)
+            back[row * cols + col] = (cell_t){.ch = ch, .attr = attr};
+        col++;
+    }
+    return col;
+}
+
+static void flush_frame()
+{
+    uint8_t cur_attr = 0xff;
+    int cur_row = -1, cur_col = -1;
+    out_len = 0;
+
+    for (int r = 0; r < rows; r++)
+    {
+        for (int c = 0; c < cols; c++)
+        {
+            cell_t *b = &back[r * cols + c];
+            cell_t *f = &front[r * cols + c];
+            if (b->ch == f->ch && b->attr == f->attr)
+                continue;
+
+            char seq[48];
+            if (r != cur_row || c != cur_col)
+                out_str(seq, (size_t)snprintf(seq, sizeof(seq), "\033[%d;%dH", r + 1, c + 1));
+            if (b->attr != cur_attr)
+            {
+                int n = snprintf(seq, sizeof(seq), "\033[0%s%s", b->attr & ATTR_REVERSE ? ";7" : "", b->attr & ATTR_BOLD ? ";1" : "");
+                if (ATTR_COLOR(b->attr))
+                    n += snprintf(seq + n, sizeof(seq) - (size_t)n, ";%d", ATTR_COLOR(b->attr));
+                seq[n++] = 'm';
+                out_str(seq, (size_t)n);
+                cur_attr = b->attr;
+            }
+            uint32_t ch = b->ch;
+            do
+            {
+                char byte = (char)(ch & 0xff);
+                out_str(&byte, 1);
+                ch >>= 8;
+            } while (ch);
+            *f = *b;
+            cur_row = r;
+            cur_col = c + 1;
+        }
+    }
+    if (out_len == 0)
+        return;
+    out_str("\033[0m", 4);
+    term_write(out, out_len);
+}
+
+static void format_duration(char *buf, size_t size, uint64_t us)
+{
+    uint64_t s = us / 1000000;
+    snprintf(buf, size, "%" PRIu64 ":%02u:%02u", s / 3600, (unsigned)(s / 60 % 60), (unsigned)(s % 60));
+}
+
+static int compare_bitrate(const void *a, const void *b)
+{
+    double ba = snapshot.pids[*(const uint16_t *)a].bitrate;
+    double bb = snapshot.pids[*(const uint16_t *)b].bitrate;
+    return ba < bb ? 1 : ba > bb ? -1 : 0;
+}
+
+static void render(uint64_t now)
+{
+    const stats_snapshot_t *s = &snapshot;
+    clear_back();
+
+    /* Title bar */
+    fill_row(0, ATTR_REVERSE);
+    put(0, 1, ATTR_REVERSE | ATTR_BOLD, "stsmon %s  %s", VERSION, stream_name);
+    char clock[32];
+    time_t t = time(NULL);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(clock, sizeof(clock), "%Y-%m-%d %H:%M:%S", &tm);
+    put(0, cols - (int)strlen(clock) - 1, ATTR_REVERSE, "%s", clock);
+
+    /* Stream status */
+    int col = put(1, 1, 0, "Status ");
+    if (s->last_packet == 0 || now - s->last_packet > DASHBOARD_DEAD_US)
+        col = put(1, col, ATTR_BOLD | COLOR_RED, "DEAD");
+    else if (s->alarm[0])
+        col = put(1, col, ATTR_BOLD | (s->alarm_critical ? COLOR_RED : COLOR_YELLOW), "%s", s->alarm);
+    else
+        col = put(1, col, ATTR_BOLD | COLOR_GREEN, "OK");
+    char uptime[32] = "-";
+    if (s->start_time)
+        format_duration(uptime, sizeof(uptime), now - s->start_time);
+    put(1, col, 0, "   Bitrate %.2f Mbps (data %.2f)   Uptime %s   Last packet %.1f s ago",
+        s->bitrate / 1000000.0, s->data_bitrate / 1000000.0, uptime,
+        s->last_packet ? (s->timestamp - s->last_packet) / 1000000.0 : 0.0);
+
+    col = put(2, 1, 0, "Packets %" PRIu64 "   CC ", s->packets_all);
+    col = put(2, col, s->cc_errors ? COLOR_RED : 0, "%" PRIu64, s->cc_errors);
+    col = put(2, col, 0, "   Sync ");
+    col = put(2, col, s->sync_errors ? COLOR_RED : 0, "%" PRIu64, s->sync_errors);
+    col = put(2, col, 0, "   TEI ");
+    col = put(2, col, s->tei_errors ? COLOR_RED : 0, "%" PRIu64, s->tei_errors);
+    col = put(2, col, 0, "   Local drops ");
+    put(2, col, s->socket_drops + s->csv_drops ? COLOR_YELLOW : 0, "%" PRIu64, s->socket_drops + s->csv_drops);
+
+    col = 1;
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        const rollup_sample_t *r = &s->rollups[l];
+        if (r->ticks)
+            col = put(3, col, 0, "%s avg %.2f min %.2f max %.2f Mbps   ", rollup_name(l),
+                      rollup_bitrate(r) / 1000000.0, r->bitrate_min / 1000000.0, r->bitrate_max / 1000000.0);
+    }
+
+    /* Vertical space: services get up to a quarter, events a fifth */
+    int svc_rows = (int)s->service_count;
+    if (svc_rows > rows / 4)
+        svc_rows = rows / 4;
+    int ev_rows = rows / 5 < 8 ? rows / 5 : 8;
+    int row = 5;
+
+    fill_row(row, ATTR_REVERSE);
+    put(row++, 1, ATTR_REVERSE | ATTR_BOLD, "Services (%zu)", s->service_count);
+    put(row++, 1, ATTR_BOLD, "%5s %5s %4s %1s  %s", "SID", "PMT", "Ver", "$", "Name");
+    for (int i = 0; i < svc_rows; i++)
+    {
+        const stats_service_t *sv = &s->services[i];
+        put(row++, 1, 0, "%5u %5u %4u %1s  %s", sv->service_id, sv->pmt_pid, sv->pmt_version,
+            sv->scrambled ? "$" : "", sv->name);
+    }
+    row++;
+
+    /* Header and column titles, blank line, events header, events, footer */
+    int pid_rows = rows - row - 2 - 1 - 1 - ev_rows - 1;
+    if (pid_rows < 0)
+        pid_rows = 0;
+    for (size_t i = 0; i < s->pid_count; i++)
+        pid_order[i] = (uint16_t)i;
+    if (sort_by_bitrate)
+        qsort(pid_order, s->pid_count, sizeof(pid_order[0]), compare_bitrate);
+    if (pid_scroll + (size_t)pid_rows > s->pid_count)
+        pid_scroll = s->pid_count > (size_t)pid_rows ? s->pid_count - (size_t)pid_rows : 0;
+
+    fill_row(row, ATTR_REVERSE);
+    put(row++, 1, ATTR_REVERSE | ATTR_BOLD, "PIDs (%zu) by %s", s->pid_count, sort_by_bitrate ? "bitrate" : "PID");
+    put(row++, 1, ATTR_BOLD, "%6s %5s %4s %10s %14s %8s %8s", "PID", "SID", "Type", "kbps", "Packets", "CC", "TEI");
+    for (int i = 0; i < pid_rows && pid_scroll + (size_t)i < s->pid_count; i++)
+    {
+        const stats_pid_t *p = &s->pids[pid_order[pid_scroll + (size_t)i]];
+        char sid[8] = "-";
+        if (p->service_id)
+            snprintf(sid, sizeof(sid), "%u", p->service_id);
+        col = put(row, 1, 0, "%6u %5s %4s %10.1f %14" PRIu64 " ", p->pid, sid,
+                  p->pid == 0x1fff ? "NULL" : p->is_psi ? "PSI" : p->is_data ? "Data" : "",
+                  p->bitrate / 1000.0, p->packets);
+        col = put(row, col, p->cc_errors ? COLOR_RED : 0, "%8" PRIu64, p->cc_errors);
+        put(row, col, p->tei_errors ? COLOR_RED : 0, " %8" PRIu64, p->tei_errors);
+        row++;
+    }
+
+    row = rows - ev_rows - 2;
+    fill_row(row, ATTR_REVERSE);
+    put(row++, 1, ATTR_REVERSE | ATTR_BOLD, "Recent events");
+    for (int i = 0; i < ev_rows && (size_t)i < history_count; i++)
+    {
+        const event_recent_t *e = &history[(history_head + DASHBOARD_EVENTS - 1 - (size_t)i) % DASHBOARD_EVENTS];
+        time_t et = (time_t)(e->timestamp / 1000000);
+        localtime_r(&et, &tm);
+        strftime(clock, sizeof(clock), "%H:%M:%S", &tm);
+        uint8_t attr = e->type == EVENT_CC_ERROR || e->type == EVENT_PSI_ERROR ? COLOR_RED
+                       : e->type == EVENT_PACKET_GAP || e->type == EVENT_ALARM ? COLOR_YELLOW
+                                                                               : 0;
+        col = put(row, 1, 0, "%s.%03u ", clock, (unsigned)(e->timestamp / 1000 % 1000));
+        col = put(row, col, attr, "%-18s", event_name(e->type));
+        if (e->pid >= 0)
+            col = put(row, col, 0, " pid %d", e->pid);
+        if (e->service_id >= 0)
+            col = put(row, col, 0, " service %d", e->service_id);
+        put(row, col, 0, " %s", e->values);
+        row++;
+    }
+
+    fill_row(rows - 1, ATTR_REVERSE);
+    put(rows - 1, 1, ATTR_REVERSE, "q quit   Up/Down PgUp/PgDn scroll PIDs   s sort by %s", sort_by_bitrate ? "PID" : "bitrate");
+}
+
+static void handle_keys()
+{
+    char keys[32];
+    ssize_t n = read(STDIN_FILENO, keys, sizeof(keys));
+    for (ssize_t i = 0; i < n; i++)
+    {
+        if (keys[i] == 'q' || keys[i] == 'Q')
+        {
+            /* Same path as Ctrl-C, monitor_stream does the cleanup */
+            kill(getpid(), SIGINT);
+        }
+        else if (keys[i] == 's' || keys[i] == 'S')
+        {
+            sort_by_bitrate = !sort_by_bitrate;
+        }
+        else if (keys[i] == '\033' && i + 2 < n && keys[i + 1] == '[')
+        {
+            char code = keys[i + 2];
+            size_t page = rows > 20 ? (size_t)rows / 2 : 10;
+            if (code == 'A' && pid_scroll > 0)
+                pid_scroll--;
+            else if (code == 'B')
+                pid_scroll++;
+            else if (code == '5')
+                pid_scroll = pid_scroll > page ? pid_scroll - page : 0;
+            else if (code == '6')
+                pid_scroll += page;
+            i += code == '5' || code == '6' ? 3 : 2;
+        }
+    }
+}
+
+static void *dashboard_thread(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE))
+    {
+        struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+        if (poll(&pfd, 1, 1000 / DASHBOARD_FPS) > 0)
+            handle_keys();
+
+        event_recent_t e;
+        while (events_recent_pop(&e))
+        {
+            history[history_head] = e;
+            history_head = (history_head + 1) % DASHBOARD_EVENTS;
+            if (history_count < DASHBOARD_EVENTS)
+                history_count++;
+        }
+
+        if (!resize())
+            break;
+        stats_read(&snapshot);
+        render(tsusecs());
+        flush_frame();
+    }
+    return NULL;
+}
+
+int dashboard_start(const char *stream)
+{
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+    {
+        out_log(LogLevel_Error, "Dashboard requires a terminal");
+        return -1;
+    }
+    snprintf(stream_name, sizeof(stream_name), "%s", stream);
+    if (events_recent_open() != 0)
+    {
+        out_log(LogLevel_Error, "Failed to allocate dashboard event queue");
+        return -1;
+    }
+
+    tcgetattr(STDIN_FILENO, &saved_termios);
+    struct termios raw = saved_termios;
+    raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    /* Alternate screen, hidden cursor */
+    term_write("\033[?1049h\033[?25l", 14);
+    out_mute(1);
+
+    stop_flag = 0;
+    if (pthread_create(&render_thread, NULL, dashboard_thread, NULL) != 0)
+    {
+        terminal_restore();
+        out_log(LogLevel_Error, "Failed to start dashboard thread");
+        return -1;
+    }
+    running = true;
+    return 0;
+}
+
+void dashboard_stop()
+{
+    if (!running)
+        return;
+    __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+    pthread_join(render_thread, NULL);
+    running = false;
+    terminal_restore();
+}
+
+static void terminal_restore()
+{
+    term_write("\033[0m\033[?25h\033[?1049l", 18);
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+    out_mute(0);
+    events_recent_close();
+    free(front);
+    free(back);
+    free(out);
+    front = back = NULL;
+    out = NULL;
+    rows = cols = 0;
+}
+#else
+int dashboard_start(const char *stream)
+{
+    (void)stream;
+    out_log(LogLevel_Error, "Dashboard is not supported on this platform");
+    return -1;
+}
+
+void dashboard_stop()
+{
+}
+#endif
@@ -0,0 +1,27 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+/*
+ * Full-screen terminal dashboard. A separate thread redraws the screen at
+ * a fixed frame rate from the stats snapshot and the recent event queue,
+ * writing only cells that changed since the previous frame. The capture
+ * loop never writes to the terminal while the dashboard is active.
+ */
+int dashboard_start(const char *stream);
+void dashboard_stop();
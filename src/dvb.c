@@ -28,7 +28,6 @@
 #include <bitstream/dvb/si/strings.h>
 #include <ctype.h>
 #include <string.h>
-#include "output.h"
 
 
 #ifdef WIN32
@@ -0,0 +1,424 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "events.h"
+#include "ring.h"
+#include "output.h"
+#include "logfile.h"
+
+/* One queue slot holds one complete NDJSON line */
+#define EVENT_RECORD_SIZE 1024
+#define EVENT_QUEUE_SIZE 4096
+#define EVENT_BATCH_SIZE 65536
+#define EVENT_POLL_US 20000
+/* Delay between attempts to reach a Unix socket consumer */
+#define EVENT_RECONNECT_US 1000000
+
+typedef struct event_record
+{
+    uint16_t length;
+    char text[EVENT_RECORD_SIZE - sizeof(uint16_t)];
+} event_record_t;
+
+static const char *event_names[] = {
+    [EVENT_START] = "start",
+    [EVENT_STOP] = "stop",
+    [EVENT_PROGRAM_NEW] = "program_new",
+    [EVENT_PROGRAM_PID_CHANGE] = "program_pid_change",
+    [EVENT_PMT_VERSION] = "pmt_version",
+    [EVENT_SDT_UPDATE] = "sdt_update",
+    [EVENT_SERVICE] = "service",
+    [EVENT_PSI_ERROR] = "psi_error",
+    [EVENT_CC_ERROR] = "cc_error",
+    [EVENT_PACKET_GAP] = "packet_gap",
+    [EVENT_ALARM] = "alarm",
+};
+
+/* Enough for a screen of history between two dashboard frames */
+#define EVENT_RECENT_SIZE 256
+
+static ring_t queue;
+static ring_t recent;
+static bool recent_enabled = false;
+static bool events_running = false;
+static int events_stop_flag = 0;
+static pthread_t writer_thread;
+static int sink_fd = -1;
+static bool sink_is_socket = false;
+static bool sink_is_file = false;
+static logfile_t sink_log;
+/* Matches sun_path in struct sockaddr_un */
+static char sink_path[108];
+static char stream_name[128];
+static uint64_t dropped = 0;
+
+/* Seconds part of the timestamp is reused until it changes */
+static time_t ts_cached_sec = (time_t)-1;
+static char ts_cached[32];
+
+const char *json_escape(char *dst, size_t size, const char *src)
+{
+    size_t o = 0;
+    for (const unsigned char *p = (const unsigned char *)src; *p && o + 7 < size; p++)
+    {
+        switch (*p)
+        {
+        case '"':
+            dst[o++] = '\\';
+            dst[o++] = '"';
+            break;
+        case '\\':
+            dst[o++] = '\\';
+            dst[o++] = '\\';
+            break;
+        case '\n':
+            dst[o++] = '\\';
+            dst[o++] = 'n';
+            break;
+        default:
+            if (*p < 0x20)
+                o += (size_t)snprintf(dst + o, size - o, "\\u%04x", *p);
+            else
+                dst[o++] = (char)*p;
+        }
+    }
+    if (size)
+        dst[o < size ? o : size - 1] = '\0';
+    return dst;
+}
+
+#ifndef WIN32
+static int sink_connect()
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, sink_path, sizeof(sink_path));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+#endif
+
+static void sink_write(const char *data, size_t len)
+{
+    if (sink_is_file)
+    {
+        if (logfile_write(&sink_log, data, len) != 0)
+            out_log(LogLevel_Error, "Event write failed: %s (%d)", strerror(errno), errno);
+        return;
+    }
+    while (len > 0)
+    {
+#ifndef WIN32
+        if (sink_fd < 0 && sink_is_socket)
+        {
+            sink_fd = sink_connect();
+            if (sink_fd < 0)
+                return;
+        }
+#endif
+        if (sink_fd < 0)
+            return;
+#if defined(MSG_NOSIGNAL) && !defined(WIN32)
+        ssize_t n = sink_is_socket ? send(sink_fd, data, len, MSG_NOSIGNAL) : write(sink_fd, data, len);
+#else
+        ssize_t n = write(sink_fd, data, len);
+#endif
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (sink_is_socket)
+            {
+                /* Consumer went away, reconnect on the next batch */
+                close(sink_fd);
+                sink_fd = -1;
+            }
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void *events_writer(void *arg)
+{
+    (void)arg;
+    static char batch[EVENT_BATCH_SIZE];
+
+    while (1)
+    {
+        bool stopping = __atomic_load_n(&events_stop_flag, __ATOMIC_ACQUIRE);
+        size_t used = 0;
+        event_record_t *rec;
+
+        if (sink_is_socket && sink_fd < 0 && !stopping)
+        {
+#ifndef WIN32
+            sink_fd = sink_connect();
+#endif
+            if (sink_fd < 0)
+            {
+                /* Keep events queued until the consumer shows up */
+                usleep(EVENT_RECONNECT_US);
+                continue;
+            }
+        }
+
+        if (sink_is_file)
+            logfile_check(&sink_log);
+
+        while ((rec = ring_peek(&queue)) != NULL && used + rec->length <= sizeof(batch))
+        {
+            memcpy(batch + used, rec->text, rec->length);
+            used += rec->length;
+            ring_release(&queue);
+        }
+        if (used > 0)
+            sink_write(batch, used);
+
+        if (ring_used(&queue) == 0)
+        {
+            if (stopping)
+                break;
+            usleep(EVENT_POLL_US);
+        }
+        else if (stopping && sink_is_socket && sink_fd < 0)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int events_open(const char *sink, const char *stream)
+{
+    snprintf(stream_name, sizeof(stream_name), "%s", stream);
+    sink_is_socket = false;
+    sink_is_file = false;
+
+    if (strcmp(sink, "-") == 0)
+    {
+        sink_fd = STDOUT_FILENO;
+    }
+    else if (strncmp(sink, "unix:", 5) == 0)
+    {
+#ifdef WIN32
+        out_log(LogLevel_Error, "Unix socket event sink is not supported on this platform");
+        return -1;
+#else
+        if (strlen(sink + 5) >= sizeof(sink_path))
+        {
+            out_log(LogLevel_Error, "Event socket path '%s' is too long", sink + 5);
+            return -1;
+        }
+        memset(sink_path, 0, sizeof(sink_path));
+        memcpy(sink_path, sink + 5, strlen(sink + 5));
+        sink_is_socket = true;
+        sink_fd = sink_connect();
+        if (sink_fd < 0)
+            out_log(LogLevel_Warning, "Event socket '%s' not available (%s), will retry", sink_path, strerror(errno));
+#endif
+    }
+    else
+    {
+        if (logfile_open(&sink_log, sink, NULL) != 0)
+            return -1;
+        sink_is_file = true;
+    }
+
+    if (ring_init(&queue, sizeof(event_record_t), EVENT_QUEUE_SIZE) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to allocate event queue");
+        return -1;
+    }
+
+    events_stop_flag = 0;
+    if (pthread_create(&writer_thread, NULL, events_writer, NULL) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to start event writer thread");
+        ring_free(&queue);
+        return -1;
+    }
+    events_running = true;
+    return 0;
+}
+
+void events_close()
+{
+    if (!events_running)
+        return;
+    __atomic_store_n(&events_stop_flag, 1, __ATOMIC_RELEASE);
+    pthread_join(writer_thread, NULL);
+    events_running = false;
+    if (sink_fd >= 0 && sink_fd != STDOUT_FILENO)
+        close(sink_fd);
+    sink_fd = -1;
+    if (sink_is_file)
+        logfile_close(&sink_log);
+    sink_is_file = false;
+    ring_free(&queue);
+
+    if (dropped)
+        out_log(LogLevel_Warning, "Event writer could not keep up, %" PRIu64 " events dropped", dropped);
+}
+
+uint64_t events_dropped()
+{
+    return dropped;
+}
+
+const char *event_name(event_type_t type)
+{
+    return event_names[type];
+}
+
+int events_recent_open()
+{
+    if (ring_init(&recent, sizeof(event_recent_t), EVENT_RECENT_SIZE) != 0)
+        return -1;
+    recent_enabled = true;
+    return 0;
+}
+
+void events_recent_close()
+{
+    recent_enabled = false;
+    ring_free(&recent);
+}
+
+bool events_recent_pop(event_recent_t *out)
+{
+    event_recent_t *rec = ring_peek(&recent);
+    if (rec == NULL)
+        return false;
+    *out = *rec;
+    ring_release(&recent);
+    return true;
+}
+
+static void event_recent_push(const struct timeval *tv, event_type_t type, int pid, int service_id,
+                              const char *values_fmt, va_list args)
+{
+    /* Oldest entries are the least interesting, drop the new one quietly */
+    event_recent_t *rec = ring_reserve(&recent);
+    if (rec == NULL)
+        return;
+    rec->timestamp = (uint64_t)tv->tv_sec * 1000000 + (uint64_t)tv->tv_usec;
+    rec->type = type;
+    rec->pid = pid;
+    rec->service_id = service_id;
+    rec->values[0] = '\0';
+    if (values_fmt)
+        vsnprintf(rec->values, sizeof(rec->values), values_fmt, args);
+    ring_commit(&recent);
+}
+
+void event_emit(event_type_t type, int pid, int service_id, const char *values_fmt, ...)
+{
+    if (!events_running && !recent_enabled)
+        return;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    if (recent_enabled)
+    {
+        va_list args;
+        va_start(args, values_fmt);
+        event_recent_push(&tv, type, pid, service_id, values_fmt, args);
+        va_end(args);
+    }
+    if (!events_running)
+        return;
+
+    event_record_t *rec = ring_reserve(&queue);
+    if (rec == NULL)
+    {
+        dropped++;
+        return;
+    }
+
+    time_t sec = tv.tv_sec;
+    if (sec != ts_cached_sec)
+    {
+        struct tm tm;
+#ifdef WIN32
+        gmtime_s(&tm, &sec);
+#else
+        gmtime_r(&sec, &tm);
+#endif
+        strftime(ts_cached, sizeof(ts_cached), "%Y-%m-%dT%H:%M:%S", &tm);
+        ts_cached_sec = sec;
+    }
+
+    char *p = rec->text;
+    size_t size = sizeof(rec->text) - 2; /* room for "}\n" */
+    int n = snprintf(p, size, "{\"ts\":\"%s.%06ldZ\",\"stream\":\"%s\",\"type\":\"%s\"",
+                     ts_cached, (long)tv.tv_usec, stream_name, event_names[type]);
+    size_t len = (size_t)n;
+    if (pid != EVENT_NONE)
+        len += (size_t)snprintf(p + len, size - len, ",\"pid\":%d", pid);
+    if (service_id != EVENT_NONE)
+        len += (size_t)snprintf(p + len, size - len, ",\"service\":%d", service_id);
+
+    if (values_fmt)
+    {
+        size_t base_len = len;
+        len += (size_t)snprintf(p + len, size - len, ",\"values\":{");
+        va_list args;
+        va_start(args, values_fmt);
+        int v = vsnprintf(p + len, size - len, values_fmt, args);
+        va_end(args);
+        if (v < 0 || len + (size_t)v + 1 >= size)
+        {
+            /* Never emit a broken line, drop the values instead */
+            len = base_len + (size_t)snprintf(p + base_len, size - base_len, ",\"truncated\":true");
+        }
+        else
+        {
+            len += (size_t)v;
+            p[len++] = '}';
+        }
+    }
+    p[len++] = '}';
+    p[len++] = '\n';
+    rec->length = (uint16_t)len;
+    ring_commit(&queue);
+}
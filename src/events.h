@@ -0,0 +1,81 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum {
+    EVENT_START,
+    EVENT_STOP,
+    EVENT_PROGRAM_NEW,
+    EVENT_PROGRAM_PID_CHANGE,
+    EVENT_PMT_VERSION,
+    EVENT_SDT_UPDATE,
+    EVENT_SERVICE,
+    EVENT_PSI_ERROR,
+    EVENT_CC_ERROR,
+    EVENT_PACKET_GAP,
+    EVENT_ALARM,
+} event_type_t;
+
+/* PID/service argument value when the event is not tied to one */
+#define EVENT_NONE -1
+
+/*
+ * Structured event sink. Each event becomes one JSON object per line:
+ *
+ *   {"ts":"2025-11-25T10:00:00.123456Z","stream":"239.1.1.1:1234",
+ *    "type":"cc_error","pid":256,"service":1,"values":{"last_cc":3,"cc":5}}
+ *
+ * `sink` is "-" for stdout, "unix:<path>" for a Unix stream socket or a
+ * file name to append to. Records are formatted into a preallocated
+ * queue on the calling thread and written by a background thread.
+ */
+int events_open(const char *sink, const char *stream);
+void events_close();
+uint64_t events_dropped();
+
+/*
+ * Emit an event. `values_fmt` produces the members of the "values" object
+ * (without braces), e.g. "\"last_cc\":%u,\"cc\":%u", or NULL for none.
+ * Strings must be escaped with json_escape. No-op when no sink is open.
+ */
+void event_emit(event_type_t type, int pid, int service_id, const char *values_fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/*
+ * Copy of recent events for the dashboard, independent of the sink.
+ * Filled by event_emit() on the capture thread, drained by one consumer.
+ */
+typedef struct event_recent
+{
+    uint64_t timestamp; /* unix microseconds */
+    event_type_t type;
+    int pid;
+    int service_id;
+    char values[116]; /* members of the "values" object, possibly cut */
+} event_recent_t;
+
+int events_recent_open();
+void events_recent_close();
+bool events_recent_pop(event_recent_t *out);
+const char *event_name(event_type_t type);
+
+/* Escape `src` for use inside a JSON string, always NUL terminates `dst` */
+const char *json_escape(char *dst, size_t size, const char *src);
@@ -0,0 +1,348 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#endif
+#include "logfile.h"
+#include "output.h"
+
+/* Rotated files waiting for the compressor */
+#define LOGFILE_COMPRESS_QUEUE 16
+/* Path plus ".YYYYmmdd-HHMMSS-NN" */
+#define LOGFILE_ROTATED_SIZE (LOGFILE_PATH_SIZE + 32)
+
+static uint64_t rotate_size = 0;
+static unsigned rotate_age = 0;
+static const char *compressor = NULL;
+static unsigned reopen_generation = 0;
+
+static pthread_t compress_thread;
+static bool compress_running = false;
+static bool compress_stop = false;
+static pthread_mutex_t compress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compress_cond = PTHREAD_COND_INITIALIZER;
+static char compress_queue[LOGFILE_COMPRESS_QUEUE][LOGFILE_ROTATED_SIZE];
+static size_t compress_head = 0;
+static size_t compress_count = 0;
+
+#ifndef WIN32
+extern char **environ;
+
+static void compress_file(const char *path)
+{
+    char *gzip_argv[] = {"gzip", "-f", "-q", (char *)path, NULL};
+    char *zstd_argv[] = {"zstd", "-f", "-q", "--rm", (char *)path, NULL};
+    char **argv = strcmp(compressor, "zstd") == 0 ? zstd_argv : gzip_argv;
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+    if (err != 0)
+    {
+        out_log(LogLevel_Error, "Failed to run %s: %s (%d)", argv[0], strerror(err), err);
+        return;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        out_log(LogLevel_Warning, "%s '%s' failed", argv[0], path);
+}
+
+static void *compress_worker(void *arg)
+{
+    (void)arg;
+    char path[sizeof(compress_queue[0])];
+
+    pthread_mutex_lock(&compress_lock);
+    while (1)
+    {
+        while (compress_count == 0 && !compress_stop)
+            pthread_cond_wait(&compress_cond, &compress_lock);
+        if (compress_count == 0)
+            break;
+        memcpy(path, compress_queue[compress_head], sizeof(path));
+        compress_head = (compress_head + 1) % LOGFILE_COMPRESS_QUEUE;
+        compress_count--;
+
+        pthread_mutex_unlock(&compress_lock);
+        compress_file(path);
+        pthread_mutex_lock(&compress_lock);
+    }
+    pthread_mutex_unlock(&compress_lock);
+    return NULL;
+}
+#endif
+
+static void compress_enqueue(const char *path)
+{
+    pthread_mutex_lock(&compress_lock);
+    if (compress_count == LOGFILE_COMPRESS_QUEUE)
+    {
+        out_log(LogLevel_Warning, "Compression queue full, leaving '%s' uncompressed", path);
+    }
+    else
+    {
+        size_t slot = (compress_head + compress_count) % LOGFILE_COMPRESS_QUEUE;
+        snprintf(compress_queue[slot], sizeof(compress_queue[slot]), "%s", path);
+        compress_count++;
+        pthread_cond_signal(&compress_cond);
+    }
+    pthread_mutex_unlock(&compress_lock);
+}
+
+int logfile_configure(uint64_t max_size, unsigned max_age, const char *compress)
+{
+    rotate_size = max_size;
+    rotate_age = max_age;
+    compressor = compress;
+    if (!compressor || compress_running)
+        return 0;
+
+#ifdef WIN32
+    out_log(LogLevel_Error, "Compression of rotated logs is not supported on this platform");
+    return -1;
+#else
+    if (strcmp(compressor, "gzip") != 0 && strcmp(compressor, "zstd") != 0)
+    {
+        out_log(LogLevel_Error, "Unknown compression '%s', use gzip or zstd", compressor);
+        return -1;
+    }
+    compress_stop = false;
+    if (pthread_create(&compress_thread, NULL, compress_worker, NULL) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to start compression thread");
+        return -1;
+    }
+    compress_running = true;
+    return 0;
+#endif
+}
+
+static int logfile_reopen(logfile_t *lf)
+{
+    lf->fd = open(lf->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (lf->fd < 0)
+    {
+        out_log(LogLevel_Error, "open('%s') failed: %s (%d)", lf->path, strerror(errno), errno);
+        return -1;
+    }
+    struct stat st;
+    lf->size = fstat(lf->fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    lf->opened = time(NULL);
+    if (lf->size == 0 && lf->header)
+        return logfile_write(lf, lf->header, strlen(lf->header));
+    return 0;
+}
+
+int logfile_open(logfile_t *lf, const char *path, const char *header)
+{
+    memset(lf, 0, sizeof(*lf));
+    lf->header = header;
+    lf->reopen_seen = __atomic_load_n(&reopen_generation, __ATOMIC_RELAXED);
+    if (strcmp(path, "-") == 0)
+    {
+        lf->fd = STDOUT_FILENO;
+        lf->is_stdout = true;
+        if (header)
+            return logfile_write(lf, header, strlen(header));
+        return 0;
+    }
+    if (strlen(path) >= sizeof(lf->path))
+    {
+        out_log(LogLevel_Error, "Log file path '%s' is too long", path);
+        lf->fd = -1;
+        return -1;
+    }
+    snprintf(lf->path, sizeof(lf->path), "%s", path);
+    return logfile_reopen(lf);
+}
+
+static void logfile_rotate(logfile_t *lf)
+{
+    char rotated[LOGFILE_ROTATED_SIZE];
+    char stamp[16];
+    time_t now = time(NULL);
+    struct tm tm;
+#ifdef WIN32
+    localtime_s(&tm, &now);
+#else
+    localtime_r(&now, &tm);
+#endif
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(rotated, sizeof(rotated), "%s.%s", lf->path, stamp);
+    /* Two rotations within a second */
+    for (int i = 1; access(rotated, F_OK) == 0 && i < 100; i++)
+        snprintf(rotated, sizeof(rotated), "%s.%s-%d", lf->path, stamp, i);
+
+    close(lf->fd);
+    lf->fd = -1;
+    if (rename(lf->path, rotated) != 0)
+        out_log(LogLevel_Error, "rename('%s') failed: %s (%d)", lf->path, strerror(errno), errno);
+    else if (compressor)
+        compress_enqueue(rotated);
+    logfile_reopen(lf);
+}
+
+int logfile_write(logfile_t *lf, const void *data, size_t len)
+{
+    if (!lf->is_stdout && rotate_size && lf->size > 0 && lf->size + len > rotate_size)
+        logfile_rotate(lf);
+    if (lf->fd < 0)
+        return -1;
+
+    const char *p = data;
+    while (len > 0)
+    {
+        ssize_t n = write(lf->fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+        lf->size += (uint64_t)n;
+    }
+    return 0;
+}
+
+void logfile_check(logfile_t *lf)
+{
+    if (lf->is_stdout)
+        return;
+
+    unsigned generation = __atomic_load_n(&reopen_generation, __ATOMIC_RELAXED);
+    if (generation != lf->reopen_seen)
+    {
+        /* External rotation (SIGHUP) or retry after a failed open */
+        lf->reopen_seen = generation;
+        if (lf->fd >= 0)
+            close(lf->fd);
+        logfile_reopen(lf);
+        return;
+    }
+
+    if (rotate_age && lf->fd >= 0 && lf->size > 0)
+    {
+        time_t now = time(NULL);
+        if (now / rotate_age != lf->opened / rotate_age)
+            logfile_rotate(lf);
+    }
+}
+
+void logfile_sync(logfile_t *lf)
+{
+    if (lf->is_stdout || lf->fd < 0)
+        return;
+#ifdef WIN32
+    _commit(lf->fd);
+#else
+    fsync(lf->fd);
+#endif
+}
+
+void logfile_close(logfile_t *lf)
+{
+    if (lf->fd >= 0 && !lf->is_stdout)
+        close(lf->fd);
+    lf->fd = -1;
+}
+
+void logfile_request_reopen()
+{
+    __atomic_add_fetch(&reopen_generation, 1, __ATOMIC_RELAXED);
+}
+
+void logfile_shutdown()
+{
+    if (!compress_running)
+        return;
+    pthread_mutex_lock(&compress_lock);
+    compress_stop = true;
+    pthread_cond_signal(&compress_cond);
+    pthread_mutex_unlock(&compress_lock);
+    pthread_join(compress_thread, NULL);
+    compress_running = false;
+}
+
+int logfile_parse_size(const char *s, uint64_t *out)
+{
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s)
+        return -1;
+    switch (*end)
+    {
+    case 'G':
+    case 'g':
+        v *= 1024;
+        /* fall through */
+    case 'M':
+    case 'm':
+        v *= 1024;
+        /* fall through */
+    case 'K':
+    case 'k':
+        v *= 1024;
+        end++;
+        break;
+    }
+    if (*end != '\0')
+        return -1;
+    *out = v;
+    return 0;
+}
+
+int logfile_parse_duration(const char *s, unsigned *out)
+{
+    char *end;
+    unsigned long v = strtoul(s, &end, 10);
+    if (end == s)
+        return -1;
+    switch (*end)
+    {
+    case 'd':
+        v *= 24;
+        /* fall through */
+    case 'h':
+        v *= 60;
+        /* fall through */
+    case 'm':
+        v *= 60;
+        /* fall through */
+    case 's':
+        end++;
+        break;
+    }
+    if (*end != '\0')
+        return -1;
+    *out = (unsigned)v;
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define LOGFILE_PATH_SIZE 4096
+
+/*
+ * Append-only log file with size and time based rotation, used by the
+ * CSV and event writer threads. All calls are made from the owning writer
+ * thread, the capture loop never touches a logfile_t.
+ *
+ * On rotation the file is closed, renamed to "<path>.<YYYYmmdd-HHMMSS>"
+ * and a new file is started with `header`. Rotated files are optionally
+ * compressed by an external gzip/zstd process run from a separate
+ * compression thread.
+ */
+typedef struct logfile
+{
+    char path[LOGFILE_PATH_SIZE];
+    int fd;
+    bool is_stdout;
+    uint64_t size;
+    time_t opened;
+    const char *header; /* written to every new (empty) file, may be NULL */
+    unsigned reopen_seen;
+} logfile_t;
+
+/*
+ * Rotation settings shared by all log files, call before logfile_open().
+ * `max_size` in bytes and `max_age` in seconds, 0 disables. Age based
+ * rotation happens on multiples of `max_age` since the epoch (UTC), so
+ * 86400 rotates at midnight UTC. `compress` is NULL, "gzip" or "zstd".
+ */
+int logfile_configure(uint64_t max_size, unsigned max_age, const char *compress);
+
+/* `path` "-" means stdout, which is never rotated */
+int logfile_open(logfile_t *lf, const char *path, const char *header);
+int logfile_write(logfile_t *lf, const void *data, size_t len);
+/* Time based rotation and SIGHUP reopen, call periodically */
+void logfile_check(logfile_t *lf);
+void logfile_sync(logfile_t *lf);
+void logfile_close(logfile_t *lf);
+
+/* Ask all log files to reopen their path, async-signal-safe */
+void logfile_request_reopen();
+/* Wait for queued compressions, call after all log files are closed */
+void logfile_shutdown();
+
+/* Parse "<n>[K|M|G]" / "<n>[s|m|h|d]", 0 on success */
+int logfile_parse_size(const char *s, uint64_t *out);
+int logfile_parse_duration(const char *s, unsigned *out);
@@ -21,11 +21,82 @@
 #include <string.h>
 #include <stdint.h>
 #include <locale.h>
+#include <ctype.h>
+#include "logfile.h"
+#include "config.h"
+#include "workers.h"
+#include "alarm.h"
 
 int show_cc = 0;
 int show_times = 0;
 int quiet_mode = 0;
+int dashboard = 0;
+unsigned log_rate = 10;
+unsigned gap_threshold_ms = 1000;
+unsigned dead_threshold_ms = 500;
+unsigned cc_warning = 1; /* CC errors per second */
+unsigned cc_critical = 10;
 const char *csv_file = NULL;
+unsigned csv_fsync_interval = 0;
+unsigned stats_interval_ms = 10000;
+const char *binlog_file = NULL;
+uint64_t rotate_size = 0;
+unsigned rotate_age = 0;
+const char *rotate_compress = NULL;
+const char *metrics_listen = NULL;
+const char *shm_name = NULL;
+const char *events_sink = NULL;
+const char *control_path = NULL;
+const char *push_target = NULL;
+const char *trigger_dir = NULL;
+unsigned trigger_pre = 5;
+unsigned trigger_post = 5;
+uint64_t trigger_buffer = 64 * 1024 * 1024;
+int trigger_hugepages = 0;
+const char *record_dir = NULL;
+unsigned record_segment = 600;
+uint64_t record_buffer = 16 * 1024 * 1024;
+uint64_t record_quota = 0;
+const char *relay_target = NULL;
+const char *relay_pids = NULL;
+int relay_service = -1;
+const char *pcap_file = NULL;
+alarm_rule_t alarm_rules[ALARM_MAX_RULES - ALARM_BUILTIN_RULES];
+size_t alarm_rule_count = 0;
+const char *alarm_hook = NULL;
+
+/* Options without a short equivalent */
+enum {
+    OPT_CSV_FSYNC = 256,
+    OPT_METRICS,
+    OPT_SHM,
+    OPT_EVENTS,
+    OPT_BINLOG,
+    OPT_INTERVAL,
+    OPT_ROTATE_SIZE,
+    OPT_ROTATE_TIME,
+    OPT_ROTATE_COMPRESS,
+    OPT_LOG_RATE,
+    OPT_CONTROL,
+    OPT_PUSH,
+    OPT_TRIGGER,
+    OPT_TRIGGER_PRE,
+    OPT_TRIGGER_POST,
+    OPT_TRIGGER_BUFFER,
+    OPT_TRIGGER_HUGEPAGES,
+    OPT_RECORD,
+    OPT_RECORD_SEGMENT,
+    OPT_RECORD_BUFFER,
+    OPT_RECORD_QUOTA,
+    OPT_RELAY,
+    OPT_RELAY_PIDS,
+    OPT_RELAY_SERVICE,
+    OPT_PCAP,
+    OPT_CONFIG,
+    OPT_CHECK_CONFIG,
+    OPT_ALARM,
+    OPT_ALARM_HOOK,
+};
 
 extern int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_interface);
 
@@ -40,7 +111,37 @@ int main(int argc, char **argv)
         {"port", required_argument, 0, 'p'},
         {"show-cc", no_argument, 0, 'c'},
         {"show-times", no_argument, 0, 't'},
+        {"interval", required_argument, 0, OPT_INTERVAL},
         {"csv", required_argument, 0, 'l'},
+        {"csv-fsync", required_argument, 0, OPT_CSV_FSYNC},
+        {"binlog", required_argument, 0, OPT_BINLOG},
+        {"rotate-size", required_argument, 0, OPT_ROTATE_SIZE},
+        {"rotate-time", required_argument, 0, OPT_ROTATE_TIME},
+        {"rotate-compress", required_argument, 0, OPT_ROTATE_COMPRESS},
+        {"metrics", required_argument, 0, OPT_METRICS},
+        {"shm", required_argument, 0, OPT_SHM},
+        {"events", required_argument, 0, OPT_EVENTS},
+        {"dashboard", no_argument, 0, 'd'},
+        {"log-rate", required_argument, 0, OPT_LOG_RATE},
+        {"control", required_argument, 0, OPT_CONTROL},
+        {"push", required_argument, 0, OPT_PUSH},
+        {"trigger", required_argument, 0, OPT_TRIGGER},
+        {"trigger-pre", required_argument, 0, OPT_TRIGGER_PRE},
+        {"trigger-post", required_argument, 0, OPT_TRIGGER_POST},
+        {"trigger-buffer", required_argument, 0, OPT_TRIGGER_BUFFER},
+        {"trigger-hugepages", no_argument, 0, OPT_TRIGGER_HUGEPAGES},
+        {"record", required_argument, 0, OPT_RECORD},
+        {"record-segment", required_argument, 0, OPT_RECORD_SEGMENT},
+        {"record-buffer", required_argument, 0, OPT_RECORD_BUFFER},
+        {"record-quota", required_argument, 0, OPT_RECORD_QUOTA},
+        {"relay", required_argument, 0, OPT_RELAY},
+        {"relay-pids", required_argument, 0, OPT_RELAY_PIDS},
+        {"relay-service", required_argument, 0, OPT_RELAY_SERVICE},
+        {"pcap", required_argument, 0, OPT_PCAP},
+        {"config", required_argument, 0, OPT_CONFIG},
+        {"check-config", no_argument, 0, OPT_CHECK_CONFIG},
+        {"alarm", required_argument, 0, OPT_ALARM},
+        {"alarm-hook", required_argument, 0, OPT_ALARM_HOOK},
         {"quiet", no_argument, 0, 'q'},
         {"help", no_argument, 0, 'h'},
         {"version", no_argument, 0, 'v'},
@@ -48,7 +149,9 @@ int main(int argc, char **argv)
 
     int opt;
     char *local_interface = NULL;
-    while ((opt = getopt_long(argc, argv, "m:i:p:ctql:hv", long_options, NULL)) != -1)
+    const char *config_file = NULL;
+    int check_config = 0;
+    while ((opt = getopt_long(argc, argv, "m:i:p:ctqdl:hv", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -61,6 +164,149 @@ int main(int argc, char **argv)
         case 'l':
             csv_file = optarg;
             break;
+        case OPT_INTERVAL:
+        {
+            /* strtoul() would take "-5" as a huge number */
+            char *end;
+            unsigned long ms = isdigit((unsigned char)optarg[0]) ? strtoul(optarg, &end, 10) : 0;
+            if (ms < 100 || ms > 3600000 || *end != '\0')
+            {
+                fprintf(stderr, "Statistics interval must be 100 to 3600000 ms.\n");
+                return 1;
+            }
+            stats_interval_ms = (unsigned)ms;
+            break;
+        }
+        case OPT_CSV_FSYNC:
+            csv_fsync_interval = (unsigned)atoi(optarg);
+            break;
+        case OPT_BINLOG:
+            binlog_file = optarg;
+            break;
+        case OPT_ROTATE_SIZE:
+            if (logfile_parse_size(optarg, &rotate_size) != 0)
+            {
+                fprintf(stderr, "Invalid size '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_ROTATE_TIME:
+            if (logfile_parse_duration(optarg, &rotate_age) != 0)
+            {
+                fprintf(stderr, "Invalid duration '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_ROTATE_COMPRESS:
+            if (strcmp(optarg, "gzip") != 0 && strcmp(optarg, "zstd") != 0)
+            {
+                fprintf(stderr, "Compression must be gzip or zstd.\n");
+                return 1;
+            }
+            rotate_compress = optarg;
+            break;
+        case OPT_METRICS:
+            metrics_listen = optarg;
+            break;
+        case OPT_SHM:
+            shm_name = optarg;
+            break;
+        case OPT_EVENTS:
+            events_sink = optarg;
+            break;
+        case 'd':
+            dashboard = 1;
+            break;
+        case OPT_LOG_RATE:
+            log_rate = (unsigned)atoi(optarg);
+            break;
+        case OPT_CONTROL:
+            control_path = optarg;
+            break;
+        case OPT_PUSH:
+            push_target = optarg;
+            break;
+        case OPT_TRIGGER:
+            trigger_dir = optarg;
+            break;
+        case OPT_TRIGGER_PRE:
+        case OPT_TRIGGER_POST:
+            if (logfile_parse_duration(optarg, opt == OPT_TRIGGER_PRE ? &trigger_pre : &trigger_post) != 0)
+            {
+                fprintf(stderr, "Invalid duration '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_TRIGGER_BUFFER:
+            if (logfile_parse_size(optarg, &trigger_buffer) != 0)
+            {
+                fprintf(stderr, "Invalid size '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_TRIGGER_HUGEPAGES:
+            trigger_hugepages = 1;
+            break;
+        case OPT_RECORD:
+            record_dir = optarg;
+            break;
+        case OPT_RECORD_SEGMENT:
+            if (logfile_parse_duration(optarg, &record_segment) != 0 || record_segment == 0)
+            {
+                fprintf(stderr, "Invalid duration '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_RELAY:
+            relay_target = optarg;
+            break;
+        case OPT_RELAY_PIDS:
+            relay_pids = optarg;
+            break;
+        case OPT_RELAY_SERVICE:
+            relay_service = atoi(optarg);
+            if (relay_service < 0 || relay_service > 65535)
+            {
+                fprintf(stderr, "Invalid service ID '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_PCAP:
+            pcap_file = optarg;
+            break;
+        case OPT_CONFIG:
+            config_file = optarg;
+            break;
+        case OPT_CHECK_CONFIG:
+            check_config = 1;
+            break;
+        case OPT_ALARM:
+        {
+            if (alarm_rule_count == sizeof(alarm_rules) / sizeof(alarm_rules[0]))
+            {
+                fprintf(stderr, "At most %zu --alarm rules.\n", alarm_rule_count);
+                return 1;
+            }
+            const char *error = alarm_parse(optarg, &alarm_rules[alarm_rule_count]);
+            if (error)
+            {
+                fprintf(stderr, "Invalid alarm '%s': %s.\n", optarg, error);
+                return 1;
+            }
+            alarm_rule_count++;
+            break;
+        }
+        case OPT_ALARM_HOOK:
+            alarm_hook = optarg;
+            break;
+        case OPT_RECORD_BUFFER:
+        case OPT_RECORD_QUOTA:
+            if (logfile_parse_size(optarg, opt == OPT_RECORD_BUFFER ? &record_buffer : &record_quota) != 0)
+            {
+                fprintf(stderr, "Invalid size '%s'.\n", optarg);
+                return 1;
+            }
+            break;
         case 'q':
             quiet_mode = 1;
             break;
@@ -81,7 +327,37 @@ int main(int argc, char **argv)
             printf("  -i, --interface <address>   Set local interface address (required on Windows)\n");
             printf("  -c, --show-cc               Show congestion control info\n");
             printf("  -t, --show-times            Show timing information\n");
+            printf("      --interval <ms>         Statistics interval (default: 10000, 100 to 3600000)\n");
             printf("  -l, --csv <file>            Log data to CSV file\n");
+            printf("      --csv-fsync <seconds>   fsync CSV and binary log at most this often (default: 0, never)\n");
+            printf("      --binlog <file>         Log data to compact binary file (read with stsmon-query)\n");
+            printf("      --rotate-size <n>[K|M|G] Rotate CSV and event files at this size\n");
+            printf("      --rotate-time <n>[s|m|h|d] Rotate CSV and event files this often\n");
+            printf("      --rotate-compress <gzip|zstd> Compress rotated files\n");
+            printf("      --metrics [addr:]port   Serve Prometheus metrics over HTTP (default addr: 127.0.0.1)\n");
+            printf("      --shm <name>            Publish statistics in POSIX shared memory segment\n");
+            printf("      --push <target>         Push metrics over UDP every interval, influx://host:port or statsd://host:port\n");
+            printf("      --events <sink>         Write NDJSON events to file, - (stdout) or unix:<path>\n");
+            printf("      --trigger <dir>         Write raw TS around CC bursts, TEI, PSI errors and outages to <dir>\n");
+            printf("      --trigger-pre <n>[s|m]  Seconds before the trigger to write (default: 5)\n");
+            printf("      --trigger-post <n>[s|m] Seconds after the trigger to write (default: 5)\n");
+            printf("      --trigger-buffer <n>[K|M|G] Memory for datagrams before the trigger (default: 64M)\n");
+            printf("      --trigger-hugepages     Allocate the trigger buffer from huge pages\n");
+            printf("      --record <dir>          Record the stream to time segmented .ts files in <dir>\n");
+            printf("      --record-segment <n>[s|m|h] Segment length (default: 10m)\n");
+            printf("      --record-buffer <n>[K|M|G] Memory between capture and disk writes (default: 16M)\n");
+            printf("      --record-quota <n>[K|M|G] Remove the oldest segments above this total size\n");
+            printf("      --relay <host:port>     Re-send the stream to another multicast or unicast destination\n");
+            printf("      --relay-pids <list>     Relay only these PIDs, e.g. 0,17,256-259\n");
+            printf("      --relay-service <id>    Relay only this service, with a PAT listing just it\n");
+            printf("      --pcap <file>           Write received datagrams with receive timestamps to a pcapng file\n");
+            printf("      --alarm <rule>          Alarm on a metric, e.g. \"cc_rate > 10 clear 1 for 3 critical\"\n");
+            printf("      --alarm-hook <command>  Run <command> when an alarm is raised or cleared\n");
+            printf("      --config <file>         Monitor the streams listed in <file> instead of -m/-p\n");
+            printf("      --check-config          Only validate the --config file\n");
+            printf("  -d, --dashboard             Full-screen live dashboard instead of status lines\n");
+            printf("      --log-rate <n>          Repeated messages per second and PID before summarising (default: 10, 0: no limit)\n");
+            printf("      --control <path>        Accept queries and setting changes on a unix socket (see stsmon-ctl)\n");
             printf("  -q, --quiet                 Quiet mode reduces console output (use -qq to disable completely)\n");
             printf("  -h, --help                  Show this help message\n");
             printf("  -v, --version               Show version information\n");
@@ -100,6 +376,39 @@ int main(int argc, char **argv)
         }
     }
 
+    if (config_file || check_config)
+    {
+        if (!config_file)
+        {
+            fprintf(stderr, "--check-config needs --config. Use -h for help.\n");
+            return 1;
+        }
+        if (multicast_addr)
+        {
+            fprintf(stderr, "--config and --multicast cannot be combined.\n");
+            return 1;
+        }
+        /* Sinks of a single stream, a streams file sets csv per stream */
+        if (csv_file || binlog_file || metrics_listen || shm_name || events_sink || dashboard ||
+            control_path || push_target || trigger_dir || record_dir || relay_target || pcap_file ||
+            alarm_rule_count)
+        {
+            fprintf(stderr, "--config supports only --interval, --csv-fsync, --rotate-*, --log-rate, --alarm-hook, -c and -q.\n");
+            return 1;
+        }
+        setlocale(LC_ALL, "C");
+        config_t cfg;
+        if (config_load(config_file, &cfg) != 0)
+            return 1;
+        int ret = 0;
+        if (check_config)
+            printf("%s: %zu streams on %u workers\n", config_file, cfg.count, cfg.workers);
+        else
+            ret = monitor_config(&cfg);
+        config_free(&cfg);
+        return ret;
+    }
+
     if (!multicast_addr)
     {
         fprintf(stderr, "Multicast address is required. Use -h for help.\n");
@@ -113,7 +422,7 @@ int main(int argc, char **argv)
     }
     #endif
 
-    if (quiet_mode > 1 && csv_file == NULL)
+    if (quiet_mode > 1 && csv_file == NULL && binlog_file == NULL)
     {
         fprintf(stderr, "Console output is disabled and not log file specified.\n");        
         fprintf(stderr, "Will not report any data.\n");
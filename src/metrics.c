@@ -0,0 +1,365 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+#include "metrics.h"
+#include "stats.h"
+#include "output.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifdef WIN32
+#define metrics_close_socket closesocket
+#else
+#define metrics_close_socket close
+#endif
+
+#define METRICS_REQUEST_MAX 4096
+
+static int listen_fd = -1;
+static pthread_t metrics_thread;
+static int metrics_stop_flag = 0;
+
+/* Response body, grown on demand and reused between scrapes */
+static char *body = NULL;
+static size_t body_len = 0;
+static size_t body_cap = 0;
+
+static void body_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void body_printf(const char *fmt, ...)
+{
+    while (1)
+    {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(body + body_len, body_cap - body_len, fmt, args);
+        va_end(args);
+        if (n < 0)
+            return;
+        if ((size_t)n < body_cap - body_len)
+        {
+            body_len += (size_t)n;
+            return;
+        }
+        size_t cap = body_cap ? body_cap * 2 : 65536;
+        while (cap - body_len <= (size_t)n)
+            cap *= 2;
+        char *grown = realloc(body, cap);
+        if (grown == NULL)
+            return;
+        body = grown;
+        body_cap = cap;
+    }
+}
+
+/* Label values may contain backslash, double-quote and line feed */
+static void body_label_value(const char *value)
+{
+    for (const char *p = value; *p; p++)
+    {
+        if (*p == '\\')
+            body_printf("\\\\");
+        else if (*p == '"')
+            body_printf("\\\"");
+        else if (*p == '\n')
+            body_printf("\\n");
+        else
+            body_printf("%c", *p);
+    }
+}
+
+static void body_help(const char *name, const char *type, const char *help)
+{
+    body_printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void format_metrics(const stats_snapshot_t *s)
+{
+    const char *st = s->stream;
+    body_len = 0;
+
+    body_help("stsmon_info", "gauge", "Build information.");
+    body_printf("stsmon_info{version=\"%s\"} 1\n", VERSION);
+
+    body_help("stsmon_packets_total", "counter", "Transport stream packets received.");
+    body_printf("stsmon_packets_total{stream=\"%s\"} %" PRIu64 "\n", st, s->packets_all);
+    body_help("stsmon_data_packets_total", "counter", "Transport stream packets received, excluding null packets.");
+    body_printf("stsmon_data_packets_total{stream=\"%s\"} %" PRIu64 "\n", st, s->packets_data);
+    body_help("stsmon_bitrate_bps", "gauge", "Total bitrate over the last second.");
+    body_printf("stsmon_bitrate_bps{stream=\"%s\"} %.0f\n", st, s->bitrate);
+    body_help("stsmon_data_bitrate_bps", "gauge", "Bitrate excluding null packets over the last second.");
+    body_printf("stsmon_data_bitrate_bps{stream=\"%s\"} %.0f\n", st, s->data_bitrate);
+    body_help("stsmon_bitrate_avg_bps", "gauge", "Average bitrate over the last complete window.");
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+        if (s->rollups[l].ticks)
+            body_printf("stsmon_bitrate_avg_bps{stream=\"%s\",window=\"%s\"} %.0f\n", st, rollup_name(l), rollup_bitrate(&s->rollups[l]));
+    body_help("stsmon_bitrate_min_bps", "gauge", "Lowest statistics interval bitrate in the last complete window.");
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+        if (s->rollups[l].ticks)
+            body_printf("stsmon_bitrate_min_bps{stream=\"%s\",window=\"%s\"} %.0f\n", st, rollup_name(l), s->rollups[l].bitrate_min);
+    body_help("stsmon_bitrate_max_bps", "gauge", "Highest statistics interval bitrate in the last complete window.");
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+        if (s->rollups[l].ticks)
+            body_printf("stsmon_bitrate_max_bps{stream=\"%s\",window=\"%s\"} %.0f\n", st, rollup_name(l), s->rollups[l].bitrate_max);
+    body_help("stsmon_cc_errors_total", "counter", "Continuity counter errors.");
+    body_printf("stsmon_cc_errors_total{stream=\"%s\"} %" PRIu64 "\n", st, s->cc_errors);
+    body_help("stsmon_sync_errors_total", "counter", "Packets without sync byte.");
+    body_printf("stsmon_sync_errors_total{stream=\"%s\"} %" PRIu64 "\n", st, s->sync_errors);
+    body_help("stsmon_tei_errors_total", "counter", "Packets with transport error indicator set.");
+    body_printf("stsmon_tei_errors_total{stream=\"%s\"} %" PRIu64 "\n", st, s->tei_errors);
+    body_help("stsmon_local_drops_total", "counter", "Data dropped locally by stsmon or the kernel.");
+    body_printf("stsmon_local_drops_total{stream=\"%s\",source=\"socket\"} %" PRIu64 "\n", st, s->socket_drops);
+    body_printf("stsmon_local_drops_total{stream=\"%s\",source=\"csv\"} %" PRIu64 "\n", st, s->csv_drops);
+    body_help("stsmon_alarms_active", "gauge", "Alarms currently raised.");
+    body_printf("stsmon_alarms_active{stream=\"%s\"} %" PRIu32 "\n", st, s->alarms_active);
+    body_help("stsmon_alarms_raised_total", "counter", "Alarms raised since start.");
+    body_printf("stsmon_alarms_raised_total{stream=\"%s\"} %" PRIu64 "\n", st, s->alarms_raised);
+    body_help("stsmon_last_packet_age_seconds", "gauge", "Time since the last datagram was received.");
+    if (s->last_packet)
+        body_printf("stsmon_last_packet_age_seconds{stream=\"%s\"} %.3f\n", st, (s->timestamp - s->last_packet) / 1000000.0);
+
+    body_help("stsmon_pid_packets_total", "counter", "Packets received per PID.");
+    for (size_t i = 0; i < s->pid_count; i++)
+        body_printf("stsmon_pid_packets_total{stream=\"%s\",pid=\"%u\"} %" PRIu64 "\n", st, s->pids[i].pid, s->pids[i].packets);
+    body_help("stsmon_pid_bitrate_bps", "gauge", "Bitrate per PID over the last second.");
+    for (size_t i = 0; i < s->pid_count; i++)
+        body_printf("stsmon_pid_bitrate_bps{stream=\"%s\",pid=\"%u\"} %.0f\n", st, s->pids[i].pid, s->pids[i].bitrate);
+    body_help("stsmon_pid_cc_errors_total", "counter", "Continuity counter errors per PID.");
+    for (size_t i = 0; i < s->pid_count; i++)
+        body_printf("stsmon_pid_cc_errors_total{stream=\"%s\",pid=\"%u\"} %" PRIu64 "\n", st, s->pids[i].pid, s->pids[i].cc_errors);
+    body_help("stsmon_pid_tei_errors_total", "counter", "Transport errors per PID.");
+    for (size_t i = 0; i < s->pid_count; i++)
+        body_printf("stsmon_pid_tei_errors_total{stream=\"%s\",pid=\"%u\"} %" PRIu64 "\n", st, s->pids[i].pid, s->pids[i].tei_errors);
+
+    body_help("stsmon_service_packets_total", "counter", "Packets on PIDs referenced by the service PMT.");
+    for (size_t i = 0; i < s->service_count; i++)
+    {
+        const stats_service_t *sv = &s->services[i];
+        uint64_t packets = 0;
+        for (size_t j = 0; j < s->pid_count; j++)
+            if (s->pids[j].service_id == sv->service_id)
+                packets += s->pids[j].packets;
+        body_printf("stsmon_service_packets_total{stream=\"%s\",service_id=\"%u\",service_name=\"", st, sv->service_id);
+        body_label_value(sv->name);
+        body_printf("\"} %" PRIu64 "\n", packets);
+    }
+    body_help("stsmon_service_bitrate_bps", "gauge", "Bitrate of PIDs referenced by the service PMT.");
+    for (size_t i = 0; i < s->service_count; i++)
+    {
+        const stats_service_t *sv = &s->services[i];
+        double bitrate = 0;
+        for (size_t j = 0; j < s->pid_count; j++)
+            if (s->pids[j].service_id == sv->service_id)
+                bitrate += s->pids[j].bitrate;
+        body_printf("stsmon_service_bitrate_bps{stream=\"%s\",service_id=\"%u\",service_name=\"", st, sv->service_id);
+        body_label_value(sv->name);
+        body_printf("\"} %.0f\n", bitrate);
+    }
+    body_help("stsmon_service_cc_errors_total", "counter", "Continuity counter errors on PIDs of the service.");
+    for (size_t i = 0; i < s->service_count; i++)
+    {
+        const stats_service_t *sv = &s->services[i];
+        uint64_t errors = 0;
+        for (size_t j = 0; j < s->pid_count; j++)
+            if (s->pids[j].service_id == sv->service_id)
+                errors += s->pids[j].cc_errors;
+        body_printf("stsmon_service_cc_errors_total{stream=\"%s\",service_id=\"%u\",service_name=\"", st, sv->service_id);
+        body_label_value(sv->name);
+        body_printf("\"} %" PRIu64 "\n", errors);
+    }
+    body_help("stsmon_service_scrambled", "gauge", "1 if the SDT marks the service as scrambled.");
+    for (size_t i = 0; i < s->service_count; i++)
+    {
+        const stats_service_t *sv = &s->services[i];
+        body_printf("stsmon_service_scrambled{stream=\"%s\",service_id=\"%u\",service_name=\"", st, sv->service_id);
+        body_label_value(sv->name);
+        body_printf("\"} %d\n", sv->scrambled ? 1 : 0);
+    }
+}
+
+static void send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        int n = (int)send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return;
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void handle_client(int fd)
+{
+    static stats_snapshot_t snapshot;
+    char request[METRICS_REQUEST_MAX];
+    size_t used = 0;
+
+#ifdef WIN32
+    DWORD timeout = 1000;
+#else
+    struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+#endif
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+
+    /* Headers are not interesting, just wait until they are complete */
+    while (used < sizeof(request) - 1)
+    {
+        int n = (int)recv(fd, request + used, sizeof(request) - 1 - used, 0);
+        if (n <= 0)
+            break;
+        used += (size_t)n;
+        request[used] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+    request[used] = '\0';
+
+    char header[256];
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0)
+    {
+        stats_read(&snapshot);
+        format_metrics(&snapshot);
+        int n = snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\n"
+                         "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                         "Content-Length: %zu\r\n"
+                         "Connection: close\r\n\r\n",
+                         body_len);
+        send_all(fd, header, (size_t)n);
+        send_all(fd, body, body_len);
+    }
+    else
+    {
+        static const char not_found[] = "HTTP/1.0 404 Not Found\r\n"
+                                        "Content-Type: text/plain\r\n"
+                                        "Content-Length: 22\r\n"
+                                        "Connection: close\r\n\r\n"
+                                        "Metrics are /metrics\r\n";
+        send_all(fd, not_found, sizeof(not_found) - 1);
+    }
+}
+
+static void *metrics_run(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&metrics_stop_flag, __ATOMIC_ACQUIRE))
+    {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(listen_fd, &read_fds);
+        struct timeval timeout = {.tv_sec = 0, .tv_usec = 200000};
+        if (select(listen_fd + 1, &read_fds, NULL, NULL, &timeout) <= 0)
+            continue;
+
+        int client = (int)accept(listen_fd, NULL, NULL);
+        if (client < 0)
+            continue;
+        handle_client(client);
+        metrics_close_socket(client);
+    }
+    return NULL;
+}
+
+int metrics_start(const char *listen_addr)
+{
+    char host[64] = "127.0.0.1";
+    const char *port_str = listen_addr;
+    const char *colon = strrchr(listen_addr, ':');
+    if (colon)
+    {
+        size_t len = (size_t)(colon - listen_addr);
+        if (len >= sizeof(host))
+        {
+            out_log(LogLevel_Error, "invalid metrics address '%s'", listen_addr);
+            return -1;
+        }
+        memcpy(host, listen_addr, len);
+        host[len] = '\0';
+        port_str = colon + 1;
+    }
+    int port = atoi(port_str);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = inet_addr(host);
+    if (port <= 0 || port > 65535 || addr.sin_addr.s_addr == INADDR_NONE)
+    {
+        out_log(LogLevel_Error, "invalid metrics address '%s'", listen_addr);
+        return -1;
+    }
+
+    listen_fd = (int)socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        out_log(LogLevel_Error, "metrics socket() failed: %s (%d)", strerror(errno), errno);
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0)
+    {
+        out_log(LogLevel_Error, "metrics bind(%s:%d) failed: %s (%d)", host, port, strerror(errno), errno);
+        metrics_close_socket(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    metrics_stop_flag = 0;
+    if (pthread_create(&metrics_thread, NULL, metrics_run, NULL) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to start metrics thread");
+        metrics_close_socket(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    out_log(LogLevel_Info, "Serving metrics on http://%s:%d/metrics", host, port);
+    return 0;
+}
+
+void metrics_stop()
+{
+    if (listen_fd < 0)
+        return;
+    __atomic_store_n(&metrics_stop_flag, 1, __ATOMIC_RELEASE);
+    pthread_join(metrics_thread, NULL);
+    metrics_close_socket(listen_fd);
+    listen_fd = -1;
+    free(body);
+    body = NULL;
+    body_len = body_cap = 0;
+}
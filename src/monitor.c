@@ -24,6 +24,7 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #else
+#include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #endif
@@ -40,14 +41,63 @@
 #include <bitstream/mpeg/psi/pmt.h>
 #include <bitstream/dvb/si/sdt.h>
 #pragma GCC diagnostic pop
-#include "pid.h"
-#include "services.h"
+#include "stsmon.h"
 #include "output.h"
+#include "statlog.h"
+#include "rollup.h"
+#include "logfile.h"
+#include "dashboard.h"
+#include "ratelimit.h"
+#include "stats.h"
+#include "metrics.h"
+#include "shm.h"
+#include "events.h"
+#include "control.h"
+#include "push.h"
+#include "trigger.h"
+#include "record.h"
+#include "relay.h"
+#include "pcapng.h"
+#include "profile.h"
+#include "monitor.h"
 
 extern int show_cc;
 extern int show_times;
 extern int quiet_mode;
+extern int dashboard;
+extern unsigned log_rate;
 extern const char *csv_file;
+extern unsigned csv_fsync_interval;
+extern unsigned stats_interval_ms;
+extern uint64_t rotate_size;
+extern unsigned rotate_age;
+extern const char *rotate_compress;
+extern const char *binlog_file;
+extern const char *metrics_listen;
+extern const char *shm_name;
+extern const char *events_sink;
+extern const char *control_path;
+extern const char *push_target;
+extern const char *trigger_dir;
+extern unsigned trigger_pre;
+extern unsigned trigger_post;
+extern uint64_t trigger_buffer;
+extern int trigger_hugepages;
+extern const char *record_dir;
+extern unsigned record_segment;
+extern uint64_t record_buffer;
+extern uint64_t record_quota;
+extern const char *relay_target;
+extern const char *relay_pids;
+extern int relay_service;
+extern const char *pcap_file;
+extern unsigned gap_threshold_ms;
+extern unsigned dead_threshold_ms;
+extern unsigned cc_warning;
+extern unsigned cc_critical;
+extern alarm_rule_t alarm_rules[];
+extern size_t alarm_rule_count;
+extern const char *alarm_hook;
 
 /* Return monotonic-ish wallclock time in microseconds.
  * Used for packet timing, deltas and statistics intervals.
@@ -59,53 +109,245 @@ uint64_t tsusecs()
     return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
 }
 
-uint64_t sync_errors = 0;
-uint64_t cc_errors = 0;
-uint64_t tei_errors = 0;
-uint64_t packets_all = 0;
-uint64_t packets_data = 0;
+uint64_t socket_drops = 0;
 
-ts_pid_t pid_table[TS_MAX_PID];
+/* The analysis core, see stsmon.h, everything else here is the application around it */
+static stsmon_stream_t *stream = NULL;
+/* alarm_builtin() rules first, then those of --alarm */
+static alarm_set_t alarms;
 
-extern void handle_pat_section(uint16_t pid, uint8_t *section);
-extern void handle_sdt_section(uint16_t pid, uint8_t *section);
-extern void handle_pmt(uint16_t pid, uint8_t *section);
+/* Snapshot for metrics readers is refreshed this often (us) */
+#define STATS_PUBLISH_INTERVAL 1000000
 
-extern void pat_cleanup();
-extern void sdt_cleanup();
+/* What the stream callbacks need to know about the capture loop */
+typedef struct monitor_context
+{
+    bool log_stats;
+    uint64_t last_ts;    /* receive time of the latest datagram */
+    uint64_t last_stats; /* end of the latest statistics interval */
+} monitor_context_t;
+
+/* Format doubles as rate limiter key */
+static const char cc_fmt[] = " Discontinuity detected on PID %u: last CC %u, current CC %u";
 
-static void handle_section(uint16_t pid, uint8_t *section)
+/* Events of the stream go to the event sink, the triggers and the console */
+static void on_event(void *opaque, const stsmon_event_t *ev)
 {
-    uint8_t table_id = psi_get_tableid(section);
-    if (!psi_validate(section))
-    {
-        out_log(LogLevel_Error, "Invalid section on PID %u", pid);
-        free(section);
-        return;
-    }
-    /*
-     * Dispatch a fully assembled PSI/SI section to the appropriate
-     * handler based on its table id. Note ownership rules:
-     * - `section` is a heap buffer returned by `psi_assemble_payload`.
-     * - Handlers take ownership of `section` and must free it if they
-     *   do not keep a reference to it (see `handle_pat_section`, etc.).
-     * - For unknown table ids we free the section here to avoid leaks.
-     */
-    switch (table_id)
+    (void)opaque;
+    switch (ev->type)
     {
-    case PAT_TABLE_ID:
-        handle_pat_section(pid, section);
+    case STSMON_EVENT_CC_ERROR:
+        event_emit(EVENT_CC_ERROR, ev->pid, ev->service_id, "\"last_cc\":%u,\"cc\":%u", ev->last_cc, ev->cc);
+        trigger_cc_error(ev->now);
+        if (show_cc && ratelimit_allow(NULL, cc_fmt, ev->pid, "CC errors", ev->now))
+        {
+            out_timestamp();
+            out_color(COLOR_YELLOW);
+            out_printf(cc_fmt, ev->pid, ev->last_cc, ev->cc);
+            out_reset();
+            out_newline();
+        }
+        break;
+    case STSMON_EVENT_TEI:
+        trigger_fire("tei", ev->now);
+        break;
+    case STSMON_EVENT_PSI_ERROR:
+        if (ev->table)
+        {
+            event_emit(EVENT_PSI_ERROR, ev->pid, ev->service_id, "\"table\":\"%s\"", ev->table);
+        }
+        else
+        {
+            /* A section with a bad CRC or length */
+            static const char invalid_fmt[] = "Invalid section on PID %u";
+            if (ratelimit_allow(NULL, invalid_fmt, ev->pid, "Invalid sections", ev->now))
+                out_log(LogLevel_Error, invalid_fmt, ev->pid);
+            event_emit(EVENT_PSI_ERROR, ev->pid, ev->service_id, "\"table_id\":%u", ev->table_id);
+            trigger_fire("psi", ev->now);
+        }
+        break;
+    case STSMON_EVENT_PROGRAM_NEW:
+        event_emit(EVENT_PROGRAM_NEW, ev->pid, ev->service_id, NULL);
         break;
-    case PMT_TABLE_ID:
-        handle_pmt(pid, section);
+    case STSMON_EVENT_PROGRAM_PID_CHANGE:
+        event_emit(EVENT_PROGRAM_PID_CHANGE, ev->pid, ev->service_id, "\"old_pid\":%u", ev->old_pid);
         break;
-    case SDT_TABLE_ID_ACTUAL:
-        handle_sdt_section(pid, section);
+    case STSMON_EVENT_PMT_VERSION:
+        event_emit(EVENT_PMT_VERSION, ev->pid, ev->service_id,
+                   "\"old_version\":%u,\"version\":%u,\"es_count\":%u",
+                   ev->old_version, ev->version, ev->es_count);
         break;
-    default:
-        // Unhandled table
-        free(section);
+    case STSMON_EVENT_SDT_UPDATE:
+        event_emit(EVENT_SDT_UPDATE, ev->pid, ev->service_id, "\"version\":%u,\"last_section\":%u",
+                   ev->version, ev->last_section);
         break;
+    case STSMON_EVENT_SERVICE:
+    {
+        char provider_json[256];
+        char service_json[256];
+        event_emit(EVENT_SERVICE, ev->pid, ev->service_id,
+                   "\"service_type\":%u,\"provider\":\"%s\",\"name\":\"%s\",\"scrambled\":%s",
+                   ev->service_type,
+                   json_escape(provider_json, sizeof(provider_json), ev->provider),
+                   json_escape(service_json, sizeof(service_json), ev->name),
+                   ev->scrambled ? "true" : "false");
+        break;
+    }
+    case STSMON_EVENT_SECTION:
+        control_psi_store((uint16_t)ev->pid, ev->section);
+        break;
+    }
+}
+
+static void on_log(void *opaque, stsmon_log_level_t level, const char *fmt, va_list ap)
+{
+    (void)opaque;
+    out_vlog((OutLogLevel)level, fmt, ap);
+}
+
+/*
+ * Status line of one statistics interval for the stream named `label`,
+ * coloured by `limits` and `alarm_set`, which have been evaluated for `st`;
+ * `last_ts` is the receive time of the latest datagram. The line is left
+ * open for the caller to finish.
+ */
+void monitor_status(const char *label, const stsmon_stream_t *s, const stsmon_stats_t *st,
+                    uint64_t last_ts, const monitor_limits_t *limits, const alarm_set_t *alarm_set)
+{
+    const stsmon_counters_t *delta = &st->interval;
+    //[igmp://239.239.2.1:1234 UDP|0.2 s|SPTS$|1] OK bitrate: 0.00  (effective: 0.00 peak: 0.00) Mbps cc: 0 (data: 0) sync: 0 tei: 0
+    size_t services = stsmon_stream_service_count(s);
+    out_timestamp();
+    out_printf(" [%s|", label);
+    if (services > 1)
+    {
+        out_color(COLOR_CYAN);
+        out_puts("MPTS");
+        out_reset();
+        out_printf("%zu] ", services);
+    }
+    else if (services == 1)
+    {
+        stsmon_service_info_t service;
+        stsmon_stream_services(s, &service, 1);
+        out_color(COLOR_GREEN);
+        out_puts(service.name ? service.name : "unknown");
+        if (service.scrambled)
+        {
+            out_color(COLOR_RED);
+            out_puts("$");
+        }
+        out_reset();
+        out_puts("] ");
+    }
+
+    const alarm_rule_t *worst = alarm_worst(alarm_set);
+    if (tsusecs() - last_ts > (uint64_t)limits->dead_ms * 1000 || last_ts == 0)
+    {
+        out_color(COLOR_RED);
+        out_puts("DEAD");
+    }
+    else if (worst)
+    {
+        out_color(worst->severity == ALARM_CRITICAL ? COLOR_RED : COLOR_YELLOW);
+        out_puts(alarm_label(worst->metric));
+        size_t active = alarm_active(alarm_set);
+        if (active > 1)
+            out_printf("+%zu", active - 1);
+    }
+    else
+    {
+        out_color(COLOR_GREEN);
+        out_puts("OK");
+    }
+    out_reset();
+    out_printf(" bitrate %.2f (data: %.2f) Mbps cc=",
+               st->bitrate / 1000000.0, st->data_bitrate / 1000000.0);
+    /* The limits are per second like the CC alarms, coloured from the
+       first count of this interval whose rate is above them */
+    double seconds = st->duration / 1000000.0;
+    out_number((out_number_t){
+        .value = delta->cc_errors,
+        .format = Dec,
+        .warning = (uint64_t)(limits->cc_warning * seconds) + 1,
+        .critical = (uint64_t)(limits->cc_critical * seconds) + 1,
+    });
+    out_puts(" sync=");
+    out_number((out_number_t){
+        .value = delta->sync_errors,
+        .format = Dec,
+        .warning = 1,
+        .critical = 10,
+    });
+    out_puts(" tei=");
+    out_number((out_number_t){
+        .value = delta->tei_errors,
+        .format = Dec,
+        .warning = 1,
+        .critical = 10,
+    });
+}
+
+/* Once per statistics interval: status line, rollups and the CSV/binary log */
+static void on_stats(void *opaque, const stsmon_stats_t *st)
+{
+    monitor_context_t *ctx = opaque;
+    const stsmon_counters_t *total = &st->total;
+    const stsmon_counters_t *delta = &st->interval;
+#ifdef STSMON_PROFILE
+    static uint64_t profile_last[PROFILE_STAGES];
+    double profile[PROFILE_STAGES + 1];
+    profile_interval(stsmon_stream_profile(stream), profile_last, delta->packets, profile);
+#endif
+    ctx->last_stats = st->now;
+    /* The CC rules of alarm_builtin(), their thresholds may be changed over the control socket */
+    alarms.rules[0].raise = cc_warning;
+    alarms.rules[1].raise = cc_critical;
+    alarm_evaluate(&alarms, st);
+    if (!quiet_mode)
+    {
+        monitor_status(alarms.stream, stream, st, ctx->last_ts,
+                       &(monitor_limits_t){
+                           .cc_warning = cc_warning,
+                           .cc_critical = cc_critical,
+                           .dead_ms = dead_threshold_ms,
+                       },
+                       &alarms);
+#ifdef STSMON_PROFILE
+        profile_print(profile);
+#endif
+        out_newline();
+    }
+
+    rollup_add(st->now, &(rollup_sample_t){
+                            .duration = st->duration,
+                            .ticks = 1,
+                            .packets = delta->packets,
+                            .data_packets = delta->data_packets,
+                            .cc_errors = delta->cc_errors,
+                            .sync_errors = delta->sync_errors,
+                            .tei_errors = delta->tei_errors,
+                            .bitrate_min = st->bitrate,
+                            .bitrate_max = st->bitrate,
+                        });
+
+    if (ctx->log_stats)
+    {
+        stat_record_t rec = {
+            .timestamp = st->now / 1000,
+            .interval_ms = stats_interval_ms,
+            .bitrate = st->bitrate,
+            .data_bitrate = st->data_bitrate,
+            .cc_errors = total->cc_errors,
+            .sync_errors = total->sync_errors,
+            .tei_errors = total->tei_errors,
+            .packets = delta->packets,
+            .data_packets = delta->data_packets,
+        };
+#ifdef STSMON_PROFILE
+        memcpy(rec.profile, profile, sizeof(rec.profile));
+#endif
+        statlog_push(&rec);
     }
 }
 
@@ -117,6 +359,103 @@ static void signal_handler(int signum)
     {
         terminate = 1;
     }
+#ifndef WIN32
+    else if (signum == SIGHUP)
+    {
+        /* Writer threads reopen their files on the next poll */
+        logfile_request_reopen();
+    }
+#endif
+}
+
+/* SIGINT/SIGTERM set `terminate`, SIGHUP reopens the log files */
+void monitor_signals()
+{
+#ifndef WIN32
+    struct sigaction sa;
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+#endif
+}
+
+/*
+ * Copy current counters into the shared statistics snapshot. Runs on the
+ * capture thread once per STATS_PUBLISH_INTERVAL, readers never block it.
+ */
+static void publish_stats(const char *stream_name, uint64_t now, uint64_t start_ts, uint64_t last_ts)
+{
+    static uint64_t last_publish = 0;
+    static uint64_t last_packets_all = 0;
+    static uint64_t last_packets_data = 0;
+    static uint64_t pid_last_packets[TS_MAX_PID];
+    static stsmon_service_info_t services[STATS_MAX_SERVICES];
+    const stsmon_counters_t *c = stsmon_stream_counters(stream);
+
+    double elapsed = last_publish ? (now - last_publish) / 1000000.0 : 0;
+
+    stats_snapshot_t *s = stats_write_begin();
+    snprintf(s->stream, sizeof(s->stream), "%s", stream_name);
+    s->timestamp = now;
+    s->start_time = start_ts;
+    s->last_packet = start_ts ? last_ts : 0;
+    s->packets_all = c->packets;
+    s->packets_data = c->data_packets;
+    s->cc_errors = c->cc_errors;
+    s->sync_errors = c->sync_errors;
+    s->tei_errors = c->tei_errors;
+    s->socket_drops = socket_drops;
+    s->csv_drops = statlog_dropped();
+    s->bitrate = elapsed > 0 ? (c->packets - last_packets_all) * TS_SIZE * 8 / elapsed : 0;
+    s->data_bitrate = elapsed > 0 ? (c->data_packets - last_packets_data) * TS_SIZE * 8 / elapsed : 0;
+    const alarm_rule_t *worst = alarm_worst(&alarms);
+    snprintf(s->alarm, sizeof(s->alarm), "%s", worst ? alarm_label(worst->metric) : "");
+    s->alarm_critical = worst && worst->severity == ALARM_CRITICAL;
+    s->alarms_active = (uint32_t)alarm_active(&alarms);
+    s->alarms_raised = alarms.raised;
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+        if (!rollup_last(l, &s->rollups[l]))
+            memset(&s->rollups[l], 0, sizeof(s->rollups[l]));
+
+    size_t n = 0;
+    for (int pid = 0; pid < TS_MAX_PID; pid++)
+    {
+        const ts_pid_t *pe = stsmon_stream_pid(stream, (uint16_t)pid);
+        if (pe->packets == 0)
+            continue;
+        stats_pid_t *sp = &s->pids[n++];
+        sp->pid = (uint16_t)pid;
+        sp->service_id = pe->service_id;
+        sp->is_psi = pe->is_psi;
+        sp->is_data = pe->is_data;
+        sp->packets = pe->packets;
+        sp->cc_errors = pe->cc_errors;
+        sp->tei_errors = pe->tei_errors;
+        sp->bitrate = elapsed > 0 ? (pe->packets - pid_last_packets[pid]) * TS_SIZE * 8 / elapsed : 0;
+        pid_last_packets[pid] = pe->packets;
+    }
+    s->pid_count = n;
+    s->service_count = stsmon_stream_services(stream, services, STATS_MAX_SERVICES);
+    for (size_t i = 0; i < s->service_count; i++)
+    {
+        stats_service_t *ss = &s->services[i];
+        ss->service_id = services[i].service_id;
+        ss->pmt_pid = services[i].pmt_pid;
+        ss->pmt_version = services[i].pmt_version;
+        ss->scrambled = services[i].scrambled;
+        snprintf(ss->name, sizeof(ss->name), "%s", services[i].name ? services[i].name : "");
+    }
+    stats_write_end();
+
+    /* Only this thread writes the snapshot, reading it back is safe */
+    shm_update(s);
+
+    last_publish = now;
+    last_packets_all = c->packets;
+    last_packets_data = c->data_packets;
 }
 
 static int socketErrno()
@@ -141,41 +480,40 @@ static const char* socketStrError(int err)
 #endif
 }
 
-int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_interface)
+/*
+ * Open a UDP socket bound to `port` and join `multicast_addr` on
+ * `local_interface` (NULL: any), only from `source` when it is not NULL.
+ * Returns the socket or -1.
+ */
+int monitor_socket(const char *multicast_addr, uint16_t port, const char *local_interface, const char *source)
 {
-#ifdef WIN32
-    WSADATA wsaData;
-    int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
-    if (iResult != 0)
-    {
-        out_log(LogLevel_Error, "WSAStartup failed: %d", iResult);
-        return 1;
-    }
-#endif
-    // Initialize PID table
-    for (int i = 0; i < TS_MAX_PID; i++)
-    {
-        pid_table[i].last_cc = 0xFF;
-        pid_table[i].packets = 0;
-        pid_table[i].psi_buffer = NULL;
-        pid_table[i].psi_buffer_used = 0;
-        pid_table[i].is_psi = false;
-    }
-    pid_table[PAT_PID].is_psi = true; // PAT PID
-    pid_table[SDT_PID].is_psi = true; // SDT PID
-
-    out_log(LogLevel_Info, "Monitoring stream at %s:%d", multicast_addr, port);
     int fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (fd < 0)
     {
         out_log(LogLevel_Error, "socket() failed: %s (%d)", socketStrError(socketErrno()), socketErrno());
-        return 1;
+        return -1;
     }
     int opt = 1;
     if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt)) < 0)
     {
         out_log(LogLevel_Warning, "setsockopt(SO_REUSEADDR) failed: %s (%d)", socketStrError(socketErrno()), socketErrno());        
     }
+#ifdef SO_RXQ_OVFL
+    /* Ask the kernel to report datagrams dropped on a full receive queue */
+    if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, (const char *)&opt, sizeof(opt)) < 0)
+    {
+        out_log(LogLevel_Warning, "setsockopt(SO_RXQ_OVFL) failed: %s (%d)", socketStrError(socketErrno()), socketErrno());
+    }
+#endif
+#ifdef IP_MULTICAST_ALL
+    /*
+     * The socket is bound to INADDR_ANY, by default Linux would also deliver
+     * groups joined by other sockets on the same port, e.g. a second stsmon
+     * or the --relay destination.
+     */
+    int multicast_all = 0;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, (const char *)&multicast_all, sizeof(multicast_all));
+#endif
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
@@ -186,7 +524,7 @@ int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_
     {
         out_log(LogLevel_Error, "bind(%s:%d) failed: %s (%d)", multicast_addr, port, socketStrError(socketErrno()), socketErrno());
         close(fd);
-        return 1;
+        return -1;
     }
 
     struct ip_mreq mreq;
@@ -196,7 +534,7 @@ int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_
     {
         out_log(LogLevel_Error, "invalid multicast address '%s'", multicast_addr);
         close(fd);
-        return 1;
+        return -1;
     }
     mreq.imr_multiaddr = group_addr;
     /* If a local interface IP was provided, use it; otherwise use INADDR_ANY */
@@ -208,7 +546,7 @@ int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_
         {
             out_log(LogLevel_Error, "invalid local interface address '%s'", local_interface);
             close(fd);
-            return 1;
+            return -1;
         }
         mreq.imr_interface = iface_addr;
     }
@@ -216,6 +554,28 @@ int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_
     {
         mreq.imr_interface.s_addr = htonl(INADDR_ANY);
     }
+    if (source && source[0] != '\0')
+    {
+        /* Source-specific join (SSM), only datagrams from `source` are delivered */
+        struct ip_mreq_source smreq;
+        memset(&smreq, 0, sizeof(smreq));
+        smreq.imr_multiaddr = mreq.imr_multiaddr;
+        smreq.imr_interface = mreq.imr_interface;
+        smreq.imr_sourceaddr.s_addr = inet_addr(source);
+        if (smreq.imr_sourceaddr.s_addr == INADDR_NONE)
+        {
+            out_log(LogLevel_Error, "invalid source address '%s'", source);
+            close(fd);
+            return -1;
+        }
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP, (const char *)&smreq, sizeof(smreq)) < 0)
+        {
+            out_log(LogLevel_Error, "setsockopt(IP_ADD_SOURCE_MEMBERSHIP) failed: %s (%d)", socketStrError(socketErrno()), socketErrno());
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
 #if defined(WIN32)
     if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&mreq, sizeof(mreq)) < 0)
 #else
@@ -224,48 +584,147 @@ int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_
     {
         out_log(LogLevel_Error, "setsockopt(IP_ADD_MEMBERSHIP) failed: %s (%d)", socketStrError(socketErrno()), socketErrno());
         close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Receive one datagram. Where the kernel reports datagrams dropped on a
+ * full receive queue (SO_RXQ_OVFL) their running total is stored in `drops`.
+ */
+ssize_t monitor_recv(int fd, char *buffer, size_t size, struct sockaddr_in *src_addr, uint64_t *drops)
+{
+#ifdef SO_RXQ_OVFL
+    struct iovec iov = {.iov_base = buffer, .iov_len = size};
+    char control[CMSG_SPACE(sizeof(uint32_t))];
+    struct msghdr msg = {
+        .msg_name = src_addr,
+        .msg_namelen = sizeof(*src_addr),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    ssize_t nbytes = recvmsg(fd, &msg, 0);
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); nbytes >= 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            /* Kernel reports a running total for the socket */
+            uint32_t dropped;
+            memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+            *drops = dropped;
+        }
+    }
+    return nbytes;
+#else
+    (void)drops;
+    socklen_t addrlen = sizeof(*src_addr);
+    return recvfrom(fd, buffer, size, 0, (struct sockaddr *)src_addr, &addrlen);
+#endif
+}
+
+int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_interface)
+{
+#ifdef WIN32
+    WSADATA wsaData;
+    int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (iResult != 0)
+    {
+        out_log(LogLevel_Error, "WSAStartup failed: %d", iResult);
         return 1;
     }
-    uint64_t last_ts = tsusecs();
+#endif
+    out_log(LogLevel_Info, "Monitoring stream at %s:%d", multicast_addr, port);
+    int fd = monitor_socket(multicast_addr, port, local_interface, NULL);
+    if (fd < 0)
+        return 1;
+    monitor_context_t ctx = {
+        .log_stats = csv_file || binlog_file,
+        .last_ts = tsusecs(),
+    };
+    stream = stsmon_stream_new(&(stsmon_callbacks_t){
+                                   .event = on_event,
+                                   .log = on_log,
+                                   .stats = on_stats,
+                               },
+                               &ctx);
+    if (!stream)
+    {
+        out_log(LogLevel_Error, "Failed to allocate the stream state");
+        close(fd);
+        return 1;
+    }
+
     uint64_t start_ts = 0;
-    uint64_t last_stats = last_ts;
+    uint64_t stats_interval = (uint64_t)stats_interval_ms * 1000;
+    /* Starts the first statistics interval */
+    stsmon_stream_tick(stream, ctx.last_ts, stats_interval);
+    ctx.last_stats = ctx.last_ts;
 
-    uint64_t last_packet_count = 0;
-    uint64_t last_sync_errors = 0;
-    uint64_t last_cc_errors = 0;
-    uint64_t last_tei_errors = 0;
-    uint64_t last_packets_data = 0;
+    monitor_signals();
+    if (logfile_configure(rotate_size, rotate_age, rotate_compress) != 0)
+    {
+        stsmon_stream_free(stream);
+        close(fd);
+        return 1;
+    }
+    /* CSV and binary log rows are written by a background thread, see statlog.c */
+    bool log_stats = ctx.log_stats;
+    if (log_stats && statlog_open(csv_file, binlog_file, csv_fsync_interval) != 0)
+    {
+        logfile_shutdown();
+        stsmon_stream_free(stream);
+        close(fd);
+        return 1;
+    }
 
-// Install signal handlers
-#ifndef WIN32
-    struct sigaction sa;
-    sa.sa_handler = signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGTERM, &sa, NULL);
-#endif
-    FILE *log_file = NULL;
-    if (csv_file)
+    char stream_name[STATS_NAME_SIZE];
+    snprintf(stream_name, sizeof(stream_name), "%s:%d", multicast_addr, port);
+    alarm_init(&alarms, stream_name);
+    alarm_builtin(&alarms, cc_warning, cc_critical, 0, 0);
+    for (size_t i = 0; i < alarm_rule_count; i++)
+        alarm_add(&alarms, &alarm_rules[i]);
+    uint64_t last_publish = 0;
+    bool publish = metrics_listen || shm_name || dashboard || control_path || push_target;
+
+    if ((metrics_listen && metrics_start(metrics_listen) != 0) ||
+        (shm_name && shm_open_segment(shm_name, stream_name) != 0) ||
+        (events_sink && events_open(events_sink, stream_name) != 0) ||
+        (dashboard && dashboard_start(stream_name) != 0) ||
+        (control_path && control_start(control_path) != 0) ||
+        (push_target && push_start(push_target, stats_interval_ms) != 0) ||
+        (trigger_dir && trigger_open(trigger_dir, trigger_pre, trigger_post, trigger_buffer, trigger_hugepages) != 0) ||
+        (record_dir && record_open(record_dir, stream_name, record_segment, record_buffer, record_quota) != 0) ||
+        (relay_target && relay_start(stream, relay_target, relay_pids, relay_service, local_interface, multicast_addr, port) != 0) ||
+        (pcap_file && pcapng_open(pcap_file, multicast_addr, port) != 0) ||
+        (alarm_hook && alarm_hooks_start(alarm_hook) != 0))
     {
-        if (strcmp(csv_file, "-") == 0)
-        {
-            log_file = stdout;
-        }
-        else
-        {
-            log_file = fopen(csv_file, "a");
-            if (!log_file)
-            {
-                out_log(LogLevel_Error, "fopen('%s') failed: %s (%d)", csv_file, strerror(errno), errno);
-                close(fd);
-                return 1;
-            }
-        }
+        alarm_hooks_stop();
+        pcapng_close();
+        relay_stop();
+        record_close();
+        trigger_close();
+        push_stop();
+        control_stop();
+        dashboard_stop();
+        metrics_stop();
+        shm_close_segment();
+        events_close();
+        if (log_stats)
+            statlog_close();
+        logfile_shutdown();
+        stsmon_stream_free(stream);
+        close(fd);
+        return 1;
     }
 
-    if (log_file)
-        fprintf(log_file, "Timestamp,Bitrate (kbps),Data Bitrate (kbps),CC Errors,Sync Errors,TEI Errors,Total Packets,Data Packets\n");
+    event_emit(EVENT_START, EVENT_NONE, EVENT_NONE, NULL);
+
+    /* Format doubles as rate limiter key */
+    static const char gap_fmt[] = " %s: Packet gap detected, last packet was %.2f s ago";
+    ratelimit_configure(log_rate, log_rate * 2);
 
     while (1)
     {
@@ -277,11 +736,25 @@ int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_
         fd_set read_fds;
         FD_ZERO(&read_fds);
         FD_SET(fd, &read_fds);
+        /* Wake up in time for the next statistics tick even without traffic */
+        uint64_t wait = 1000000;
+        uint64_t before = tsusecs();
+        uint64_t next_tick = ctx.last_stats + stats_interval;
+        if (publish && last_publish + STATS_PUBLISH_INTERVAL < next_tick)
+            next_tick = last_publish + STATS_PUBLISH_INTERVAL;
+        uint64_t relay_due = relay_deadline();
+        if (relay_due && relay_due < next_tick)
+            next_tick = relay_due;
+        if (next_tick <= before)
+            wait = 0;
+        else if (next_tick - before < wait)
+            wait = next_tick - before;
         struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        timeout.tv_sec = (long)(wait / 1000000);
+        timeout.tv_usec = (long)(wait % 1000000);
         int ret = select(fd + 1, &read_fds, NULL, NULL, &timeout);
         uint64_t now = tsusecs();
+        PROFILE_BEGIN(t);
 
         if (ret < 0)
         {
@@ -298,9 +771,14 @@ int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_
         }
 
         struct sockaddr_in src_addr;
-        socklen_t addrlen = sizeof(src_addr);
-        char buffer[2048];
-        ssize_t nbytes = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&src_addr, &addrlen);
+        char recv_buffer[RELAY_DATAGRAM_SIZE];
+        /* When relaying, receive into the relay's next send slot, see relay.h */
+        char *buffer = relay_buffer();
+        if (!buffer)
+            buffer = recv_buffer;
+        ssize_t nbytes = monitor_recv(fd, buffer, sizeof(recv_buffer), &src_addr, &socket_drops);
+
+        PROFILE_LAP(stsmon_stream_profile(stream), PROFILE_RECV, t);
 
         if (nbytes < 0)
         {
@@ -311,289 +789,155 @@ int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_
         if (start_ts == 0)
             start_ts = now;
 
-        uint64_t delta = now - last_ts;
+        trigger_packet((const uint8_t *)buffer, (size_t)nbytes, now);
+        record_packet((const uint8_t *)buffer, (size_t)nbytes, now);
+        pcapng_packet((const uint8_t *)buffer, (size_t)nbytes, src_addr.sin_addr.s_addr, src_addr.sin_port, now);
+
+        uint64_t delta = now - ctx.last_ts;
+        uint64_t gap_us = (uint64_t)gap_threshold_ms * 1000;
 
         if (show_times)
         {
             out_timestamp();
-            if (delta > 1000000)
+            if (delta > gap_us)
                 out_color(COLOR_RED);
-            else if (delta > 500000)
+            else if (delta > gap_us / 2)
                 out_color(COLOR_YELLOW);
             else
                 out_color(COLOR_GREEN);
-            printf(" Packet received (delta %" PRIu64 " us)\n", delta);
+            out_printf(" Packet received (delta %" PRIu64 " us)", delta);
             out_reset();
+            out_newline();
         }
-        else if (delta > 1000000)
+        else if (delta > gap_us && ratelimit_allow(NULL, gap_fmt, EVENT_NONE, "Packet gaps", now))
         {
             out_timestamp();
-            out_color(delta > 1000000 ? COLOR_RED : COLOR_YELLOW);
-            printf(" %s: Packet gap detected, last packet was %.2f s ago\n",
-                   delta > 1000000 ? "Error" : "Warning", (double)delta / 1000000.0);
+            out_color(delta > gap_us ? COLOR_RED : COLOR_YELLOW);
+            out_printf(gap_fmt,
+                       delta > gap_us ? "Error" : "Warning", (double)delta / 1000000.0);
             out_reset();
+            out_newline();
         }
 
-        last_ts = now;
-
-        for (ssize_t i = 0; i + TS_SIZE <= nbytes; i += TS_SIZE)
+        if (delta > gap_us && start_ts != now)
         {
-            uint8_t *ts_packet = (uint8_t *)(buffer + i);
+            trigger_fire("gap", now);
+            event_emit(EVENT_PACKET_GAP, EVENT_NONE, EVENT_NONE, "\"gap_us\":%" PRIu64, delta);
+        }
 
-            packets_all++;
+        ctx.last_ts = now;
+        PROFILE_LAP(stsmon_stream_profile(stream), PROFILE_OUTPUT, t);
 
-            if (!ts_validate(ts_packet))
-            {
-                sync_errors++;
-                continue;
-            }
-
-            uint16_t pid = ts_get_pid(ts_packet);
-            if (pid == TS_MAX_PID)
-            {
-                continue; // Ignore null packets
-            }
-
-            packets_data++;
-
-            ts_pid_t *pe = &pid_table[pid];
-            uint8_t cc = ts_get_cc(ts_packet);
-            bool had_errors = false;
-            if (pe->last_cc != 0xFF)
-            {
-                if (ts_check_discontinuity(cc, pe->last_cc))
-                {
-                    cc_errors++;
-                    had_errors = true;
-                    if (show_cc)
-                    {
-                        out_timestamp();
-                        out_color(COLOR_YELLOW);
-                        printf(" Discontinuity detected on PID %u: last CC %u, current CC %u\n", pid, pe->last_cc, cc);
-                        out_reset();
-                    }
-                }
-            }
-            pe->last_cc = cc;
-
-            pe->packets++;
-
-            if (ts_get_transporterror(ts_packet))
-            {
-                had_errors = true;
-                tei_errors++;
-            }
-
-            if (pe->is_psi)
-            {
-                if (had_errors)
-                {
-                    // Reset PSI collection on error
-                    psi_assemble_reset(&pe->psi_buffer, &pe->psi_buffer_used);
-                    continue;
-                }
-
-                uint8_t *payload = ts_section(ts_packet);
-                uint8_t payload_length = TS_SIZE - (payload - ts_packet);
-
-                uint8_t *section = psi_assemble_payload(&pe->psi_buffer, &pe->psi_buffer_used,
-                                                        (const uint8_t **)&payload, &payload_length);
-                if (section)
-                {
-                    if (!psi_validate(section))
-                    {
-                        // Invalid PSI section, discard
-                        psi_assemble_reset(&pe->psi_buffer, &pe->psi_buffer_used);
-                        free(section);
-                        continue;
-                    }
-
-                    handle_section(pid, section);
-                }
-
-                payload = ts_next_section(ts_packet);
-                payload_length = TS_SIZE - (payload - ts_packet);
-                /*
-                 * There may be multiple sections in a single TS packet payload
-                 * (pointer_field may point to the start of a following section).
-                 * Loop until we've consumed the payload. Each completed `section`
-                 * is validated and dispatched.
-                 */
-                while (payload_length)
-                {
-                    section = psi_assemble_payload(&pe->psi_buffer, &pe->psi_buffer_used,
-                                                   (const uint8_t **)&payload, &payload_length);
-                    if (section)
-                    {
-                        if (!psi_validate(section))
-                        {
-                            // Invalid PSI section, discard
-                            psi_assemble_reset(&pe->psi_buffer, &pe->psi_buffer_used);
-                            free(section);
-                            break;
-                        }
-
-                        handle_section(pid, section);
-                    }
-                }
-            }
-        }
+        stsmon_stream_feed(stream, (uint8_t *)buffer, (size_t)nbytes, now);
+        PROFILE_RESET(t);
+
+        relay_packet((size_t)nbytes, now);
 
     stats_print:
+        ratelimit_report(now);
+        relay_poll(now);
+        control_poll();
 
-        if (now - last_stats >= 10000000)
+        if (publish && now - last_publish >= STATS_PUBLISH_INTERVAL)
         {
-            //[igmp://239.239.2.1:1234 UDP|0.2 s|SPTS$|1] OK bitrate: 0.00  (effective: 0.00 peak: 0.00) Mbps cc: 0 (data: 0) sync: 0 tei: 0
-            double bitrate = (packets_all - last_packet_count) * TS_SIZE * 8 / ((now - last_stats) / 1000000.0);
-            double data_bitrate = (packets_data - last_packets_data) * TS_SIZE * 8 / ((now - last_stats) / 1000000.0);
-            if (!quiet_mode)
-            {
-                out_timestamp();
-                printf(" [%s:%d|", multicast_addr, port);
-                if (service_count() > 1)
-                {
-                    out_color(COLOR_CYAN);
-                    printf("MPTS");
-                    out_reset();
-                    printf("%zu] ", service_count());
-                }
-                else if (service_count() == 1)
-                {
-                    out_color(COLOR_GREEN);
-                    const char *name = service_get_name(1);
-                    if (name)
-                    {
-                        fputs(name, stdout);
-                    }
-                    else
-                    {
-                        // FIXME: get service id
-                        printf("unknown");
-                    }
-                    if (service_scrambled(0))
-                    {
-                        out_color(COLOR_RED);
-                        printf("$");
-                    }
-                    out_reset();
-                    printf("] ");
-                }
-
-                if (cc_errors > 100)
-                {
-                    out_color(COLOR_RED);
-                    printf("CC");
-                }
-                else if (cc_errors > 10)
-                {
-                    out_color(COLOR_YELLOW);
-                    printf("CC");
-                }
-                else if (tsusecs() - last_ts > 500000 || last_ts == 0)
-                {
-                    out_color(COLOR_RED);
-                    printf("DEAD");
-                }
-                else
-                {
-                    out_color(COLOR_GREEN);
-                    printf("OK");
-                }
-                out_reset();
-                printf(" bitrate %.2f (data: %.2f) Mbps cc=",
-                       bitrate / 1000000.0, data_bitrate / 1000000.0);
-                out_number((out_number_t){
-                    .value = cc_errors - last_cc_errors,
-                    .format = Dec,
-                    .warning = 10,
-                    .critical = 100,
-                });
-                printf(" sync=");
-                out_number((out_number_t){
-                    .value = sync_errors - last_sync_errors,
-                    .format = Dec,
-                    .warning = 1,
-                    .critical = 10,
-                });
-                printf(" tei=");
-                out_number((out_number_t){
-                    .value = tei_errors - last_tei_errors,
-                    .format = Dec,
-                    .warning = 1,
-                    .critical = 10,
-                });
-                printf("\n");
-            }
-
-            if (log_file)
-            {
-                uint64_t timestamp = now / 1000000;
-                fprintf(log_file, "%" PRIu64 ",%.2f,%.2f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
-                        timestamp,
-                        bitrate / 1000.0,
-                        data_bitrate / 1000.0,
-                        cc_errors,
-                        sync_errors,
-                        tei_errors,
-                        packets_all - last_packet_count,
-                        packets_data - last_packets_data);
-                fflush(log_file);
-            }
-
-            last_stats = now;
-            last_packet_count = packets_all;
-            last_packets_data = packets_data;
-            last_sync_errors = sync_errors;
-            last_cc_errors = cc_errors;
-            last_tei_errors = tei_errors;
+            publish_stats(stream_name, now, start_ts, ctx.last_ts);
+            last_publish = now;
         }
+
+        stsmon_stream_tick(stream, now, stats_interval);
+        PROFILE_LAP(stsmon_stream_profile(stream), PROFILE_OUTPUT, t);
     }
     close(fd);
-    if (log_file)
+    dashboard_stop();
+    control_stop();
+    push_stop();
+    trigger_close();
+    record_close();
+    relay_stop();
+    pcapng_close();
+    alarm_hooks_stop();
+    if (metrics_listen)
     {
-        fclose(log_file);
+        metrics_stop();
     }
+    if (shm_name)
+    {
+        shm_close_segment();
+    }
+    const stsmon_counters_t *c = stsmon_stream_counters(stream);
+    if (events_sink)
+    {
+        event_emit(EVENT_STOP, EVENT_NONE, EVENT_NONE,
+                   "\"packets\":%" PRIu64 ",\"cc_errors\":%" PRIu64 ",\"sync_errors\":%" PRIu64 ",\"tei_errors\":%" PRIu64,
+                   c->packets, c->cc_errors, c->sync_errors, c->tei_errors);
+        events_close();
+    }
+    if (log_stats)
+    {
+        statlog_close();
+    }
+    logfile_shutdown();
 
     // Print summary
     if (!quiet_mode)
     {
         uint64_t total_time = tsusecs() - start_ts;
-        double total_bitrate = packets_all * TS_SIZE * 8 / (total_time / 1000000.0);
-        double total_data_bitrate = packets_data * TS_SIZE * 8 / (total_time / 1000000.0);
-        printf("Final stats:\n");
-        printf("  total bitrate: %.2f Mbps\n", total_bitrate / 1000000.0);
-        printf("  total data bitrate: %.2f Mbps\n", total_data_bitrate / 1000000.0);
-        printf("  total packets: %" PRIu64 "\n", packets_all);
-        printf("  sync errors: ");
+        double total_bitrate = c->packets * TS_SIZE * 8 / (total_time / 1000000.0);
+        double total_data_bitrate = c->data_packets * TS_SIZE * 8 / (total_time / 1000000.0);
+        out_puts("Final stats:");
+        out_newline();
+        out_printf("  total bitrate: %.2f Mbps", total_bitrate / 1000000.0);
+        out_newline();
+        out_printf("  total data bitrate: %.2f Mbps", total_data_bitrate / 1000000.0);
+        out_newline();
+        out_printf("  total packets: %" PRIu64, c->packets);
+        out_newline();
+        out_puts("  sync errors: ");
         out_number((out_number_t){
-            .value = sync_errors,
+            .value = c->sync_errors,
             .format = Dec,
             .warning = 1,
             .critical = 10,
         });
-        printf("\n");
-        printf("  cc errors: ");
+        out_newline();
+        out_puts("  cc errors: ");
         out_number((out_number_t){
-            .value = cc_errors,
+            .value = c->cc_errors,
             .format = Dec,
             .warning = 10,
             .critical = 100,
         });
-        printf("\n");
-        printf("  tei errors: ");
+        out_newline();
+        out_puts("  tei errors: ");
         out_number((out_number_t){
-            .value = tei_errors,
+            .value = c->tei_errors,
             .format = Dec,
             .warning = 1,
             .critical = 10,
         });
-        printf("\n");
+        out_newline();
+        out_puts("  local drops: ");
+        out_number((out_number_t){
+            .value = socket_drops + statlog_dropped(),
+            .format = Dec,
+            .warning = 1,
+            .critical = 100,
+        });
+        out_newline();
+        out_printf("  alarms raised: %" PRIu64, alarms.raised);
+        out_newline();
+#ifdef STSMON_PROFILE
+        double profile[PROFILE_STAGES + 1];
+        profile_total(stsmon_stream_profile(stream), c->packets, profile);
+        out_puts("  profile:");
+        profile_print(profile);
+        out_newline();
+#endif
     }
 
     // Cleanup to make myself happy and valgrind quiet
-    pat_cleanup();
-    sdt_cleanup();
-    service_free_all();
+    stsmon_stream_free(stream);
+    stream = NULL;
 
     return 0;
 }
\ No newline at end of file
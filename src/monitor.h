@@ -0,0 +1,56 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <netinet/in.h>
+#endif
+#include "stsmon.h"
+#include "alarm.h"
+
+/*
+ * Capture helpers of monitor.c, shared by the single stream loop
+ * (monitor_stream) and the workers of a configuration file (workers.c).
+ */
+
+/* Set by SIGINT/SIGTERM, capture loops stop when it is set */
+extern volatile sig_atomic_t terminate;
+
+/* Colours of the status line besides the alarms */
+typedef struct monitor_limits
+{
+    unsigned cc_warning; /* CC errors per second */
+    unsigned cc_critical;
+    unsigned dead_ms; /* no datagram for this long */
+} monitor_limits_t;
+
+uint64_t tsusecs();
+void monitor_signals();
+int monitor_socket(const char *multicast_addr, uint16_t port, const char *local_interface, const char *source);
+ssize_t monitor_recv(int fd, char *buffer, size_t size, struct sockaddr_in *src_addr, uint64_t *drops);
+/* Status line up to the counters, the state is DEAD or the worst active alarm */
+void monitor_status(const char *label, const stsmon_stream_t *stream, const stsmon_stats_t *stats,
+                    uint64_t last_ts, const monitor_limits_t *limits, const alarm_set_t *alarms);
+
+int monitor_stream(const char *multicast_addr, uint16_t port, const char *local_interface);
@@ -17,35 +17,143 @@
  */
 #include "output.h"
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <stdarg.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
 #ifdef WIN32
 #include <windows.h>
 #endif
 
 extern int quiet_mode;
-void out_timestamp()
-{
-    time_t t = time(NULL);
 
-    struct tm *tmp = localtime(&t);
-    if (tmp == NULL)
+/*
+ * Line buffer: every out_* call appends here and the completed line is
+ * emitted with a single write. OUT_LINE_MAX is a soft limit, longer lines
+ * are written out in several chunks. The buffer is per thread so
+ * background writers can log without tearing lines of the capture loop.
+ */
+#define OUT_LINE_MAX 1024
+static __thread char line_buf[OUT_LINE_MAX];
+static __thread size_t line_len = 0;
+
+/* -1 until the first call decides whether stdout is a terminal */
+static int use_colors = -1;
+
+/* Formatted timestamp is reused until the second changes */
+static __thread time_t ts_cached_sec = (time_t)-1;
+static __thread char ts_cached[32];
+static __thread size_t ts_cached_len = 0;
+
+/* Set while the dashboard owns the terminal */
+static int muted = 0;
+
+static void out_write_pending()
+{
+    if (line_len == 0)
+        return;
+    if (__atomic_load_n(&muted, __ATOMIC_RELAXED))
     {
+        line_len = 0;
         return;
     }
-    char buf[64];
-    if (strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tmp) == 0)
+#ifdef WIN32
+    fwrite(line_buf, 1, line_len, stdout);
+    fflush(stdout);
+#else
+    const char *p = line_buf;
+    size_t left = line_len;
+    while (left > 0)
     {
-        return;
+        ssize_t n = write(STDOUT_FILENO, p, left);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // Nothing sensible to do if the console is gone
+            break;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+#endif
+    line_len = 0;
+}
+
+static void out_append(const char *str, size_t len)
+{
+    while (len > 0)
+    {
+        size_t space = sizeof(line_buf) - line_len;
+        if (space == 0)
+        {
+            out_write_pending();
+            space = sizeof(line_buf);
+        }
+        size_t n = len < space ? len : space;
+        memcpy(line_buf + line_len, str, n);
+        line_len += n;
+        str += n;
+        len -= n;
+    }
+}
+
+static void out_vprintf(const char *fmt, va_list args)
+{
+    va_list args_copy;
+    va_copy(args_copy, args);
+    size_t space = sizeof(line_buf) - line_len;
+    int n = vsnprintf(line_buf + line_len, space, fmt, args);
+    if (n >= 0 && (size_t)n >= space)
+    {
+        /* Did not fit, emit what we have and retry into an empty buffer */
+        out_write_pending();
+        n = vsnprintf(line_buf, sizeof(line_buf), fmt, args_copy);
+        if ((size_t)n >= sizeof(line_buf))
+            n = sizeof(line_buf) - 1;
+    }
+    if (n > 0)
+        line_len += (size_t)n;
+    va_end(args_copy);
+}
+
+static int out_colors_enabled()
+{
+    if (use_colors < 0)
+        use_colors = isatty(fileno(stdout)) ? 1 : 0;
+    return use_colors;
+}
+
+void out_timestamp()
+{
+    time_t t = time(NULL);
+
+    if (t != ts_cached_sec)
+    {
+        struct tm tm;
+#ifdef WIN32
+        if (localtime_s(&tm, &t) != 0)
+            return;
+#else
+        if (localtime_r(&t, &tm) == NULL)
+            return;
+#endif
+        ts_cached_len = strftime(ts_cached, sizeof(ts_cached), "%Y-%m-%d %H:%M:%S", &tm);
+        if (ts_cached_len == 0)
+            return;
+        ts_cached_sec = t;
     }
     out_color(COLOR_WHITE);
-    fputs(buf, stdout);
+    out_append(ts_cached, ts_cached_len);
     out_reset();
 }
 
 void out_color(enum ConsoleColors color)
 {
+    if (!out_colors_enabled())
+        return;
     #ifdef WIN32
     // Windows CMD does not support ANSI escape codes by default
     // Consider using SetConsoleTextAttribute for better compatibility
@@ -60,9 +168,13 @@ void out_color(enum ConsoleColors color)
         case COLOR_WHITE: wColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE; break;
         case COLOR_RESET: default: wColor = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE; break;
     }
+    // Attribute applies to text written after the call, so emit what we have
+    out_write_pending();
     SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), wColor);
     #else
-    printf("\e[%dm", color);
+    char esc[8];
+    int n = snprintf(esc, sizeof(esc), "\e[%dm", color);
+    out_append(esc, (size_t)n);
     #endif
 }
 
@@ -71,8 +183,33 @@ void out_reset()
     out_color(COLOR_RESET);    
 }
 
+void out_printf(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    out_vprintf(fmt, args);
+    va_end(args);
+}
+
+void out_puts(const char* str)
+{
+    out_append(str, strlen(str));
+}
+
+void out_mute(int mute)
+{
+    __atomic_store_n(&muted, mute, __ATOMIC_RELAXED);
+}
+
+void out_newline()
+{
+    out_append("\n", 1);
+    out_write_pending();
+}
+
 void out_flush()
 {
+    out_write_pending();
     fflush(stdout);
 }
 
@@ -92,17 +229,17 @@ void out_number(out_number_t num)
     }
     if (num.format == Hex)
     {
-        printf("0x%" PRIx64, (uint64_t)num.value);
+        out_printf("0x%" PRIx64, (uint64_t)num.value);
     }
     else
     {
         if (num.precision > 0)
         {
-            printf("%.*f", num.precision, num.value_f);
+            out_printf("%.*f", num.precision, num.value_f);
         }
         else
         {
-            printf("%" PRIu64, (uint64_t)num.value);
+            out_printf("%" PRIu64, (uint64_t)num.value);
         }
     }
 
@@ -110,7 +247,7 @@ void out_number(out_number_t num)
         out_reset();
 }
 
-void out_log(OutLogLevel level, const char* fmt, ...)
+void out_vlog(OutLogLevel level, const char* fmt, va_list args)
 {
     if(quiet_mode && level == LogLevel_Info)
         return;
@@ -118,31 +255,34 @@ void out_log(OutLogLevel level, const char* fmt, ...)
     if(quiet_mode > 1)
         return;
 
-    va_list args;
-    va_start(args, fmt);
-
     out_timestamp();
-    printf(" ");
+    out_append(" ", 1);
 
     switch (level)
     {
         case LogLevel_Info:
             out_color(COLOR_GREEN);
-            fputs("Info: ", stdout);
+            out_append("Info: ", 6);
             break;
         case LogLevel_Warning:
             out_color(COLOR_YELLOW);
-            fputs("Warning: ", stdout);
+            out_append("Warning: ", 9);
             break;
         case LogLevel_Error:
             out_color(COLOR_RED);
-            fputs("Error: ", stdout);
+            out_append("Error: ", 7);
             break;
     }
 
-    vprintf(fmt, args);
+    out_vprintf(fmt, args);
     out_reset();
-    printf("\n");
+    out_newline();
+}
 
+void out_log(OutLogLevel level, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    out_vlog(level, fmt, args);
     va_end(args);
 }
\ No newline at end of file
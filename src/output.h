@@ -17,6 +17,7 @@
  */
 #pragma once
 #include <stdint.h>
+#include <stdarg.h>
 
 enum ConsoleColors {
     COLOR_RESET = 0,
@@ -28,10 +29,20 @@ enum ConsoleColors {
     COLOR_CYAN = 36,
     COLOR_WHITE = 37
 };
+/*
+ * Console output is assembled into a line buffer and written out with a
+ * single write() when the line is terminated (out_newline or out_log).
+ * Escape codes are omitted when stdout is not a terminal.
+ */
 void out_timestamp();
 void out_color(enum ConsoleColors color);
 void out_reset();
+void out_printf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void out_puts(const char* str);
+void out_newline();
 void out_flush();
+/* Discard console lines from all threads while set (dashboard mode) */
+void out_mute(int mute);
 typedef struct {
     uint64_t value;
     double value_f;
@@ -52,4 +63,5 @@ typedef enum {
     LogLevel_Error
 } OutLogLevel;
 
-void out_log(OutLogLevel level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
\ No newline at end of file
+void out_log(OutLogLevel level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+void out_vlog(OutLogLevel level, const char* fmt, va_list args);
\ No newline at end of file
@@ -24,58 +24,69 @@
 #include <bitstream/dvb/si/nit.h>
 #pragma GCC diagnostic pop
 
-#include "pid.h"
+#include "stream.h"
 #include "services.h"
-#include "output.h"
 
 /*
  * PAT section storage: next/current model similar to SDT.
- * `pat_sections_next` collects incoming sections; when a full table is
- * available `handle_pat` swaps it into `pat_sections_current`.
+ * `pat_next` of the stream collects incoming sections; when a full table
+ * is available `handle_pat` swaps it into `pat_current`.
  */
-static PSI_TABLE_DECLARE(pat_sections_current);
-static PSI_TABLE_DECLARE(pat_sections_next);
-
-void pat_cleanup()
+void pat_cleanup(stsmon_stream_t *s)
 {
-    psi_table_free(pat_sections_current);
-    psi_table_free(pat_sections_next);
+    psi_table_free(s->pat_current);
+    psi_table_free(s->pat_next);
+    psi_table_init(s->pat_current);
+    psi_table_init(s->pat_next);
 }
 
-void handle_pat()
+static void handle_pat(stsmon_stream_t *s)
 {
     PSI_TABLE_DECLARE(old_sections);
-    uint8_t last_section = psi_table_get_lastsection(pat_sections_next);
+    uint8_t last_section = psi_table_get_lastsection(s->pat_next);
     uint8_t i;
 
-    if (psi_table_validate(pat_sections_current) &&
-        psi_table_compare(pat_sections_current, pat_sections_next))
+    if (psi_table_validate(s->pat_current) &&
+        psi_table_compare(s->pat_current, s->pat_next))
     {
         /* Identical PAT. Shortcut. */
-        psi_table_free(pat_sections_next);
-        psi_table_init(pat_sections_next);
+        psi_table_free(s->pat_next);
+        psi_table_init(s->pat_next);
         return;
     }
 
-    if (!pat_table_validate(pat_sections_next))
+    if (!pat_table_validate(s->pat_next))
     {
-        out_log(LogLevel_Error, "Invalid PAT received");
-        psi_table_free(pat_sections_next);
-        psi_table_init(pat_sections_next);
+        stream_log(s, STSMON_LOG_ERROR, "Invalid PAT received");
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_PSI_ERROR,
+                            .pid = PAT_PID,
+                            .service_id = STSMON_NONE,
+                            .table = "PAT",
+                        });
+        psi_table_free(s->pat_next);
+        psi_table_init(s->pat_next);
         return;
     }
 
     /* Switch tables. */
-    psi_table_copy(old_sections, pat_sections_current);
-    psi_table_copy(pat_sections_current, pat_sections_next);
-    psi_table_init(pat_sections_next);
+    psi_table_copy(old_sections, s->pat_current);
+    psi_table_copy(s->pat_current, s->pat_next);
+    psi_table_init(s->pat_next);
 
     for (i = 0; i <= last_section; i++)
     {
-        uint8_t *section = psi_table_get_section(pat_sections_current, i);
+        uint8_t *section = psi_table_get_section(s->pat_current, i);
         const uint8_t *program;
         int j = 0;
 
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_SECTION,
+                            .pid = PAT_PID,
+                            .service_id = STSMON_NONE,
+                            .section = section,
+                        });
+
         while ((program = pat_get_program(section, j)) != NULL)
         {
             const uint8_t *old_program = NULL;
@@ -86,7 +97,7 @@ void handle_pat()
             if (sid == 0)
             {
                 if (pid != NIT_PID)
-                    out_log(LogLevel_Warning,
+                    stream_log(s, STSMON_LOG_WARNING,
                             "NIT is carried on PID %hu which isn't DVB compliant",
                             pid);
                 continue; /* NIT */
@@ -98,20 +109,34 @@ void handle_pat()
             if (!psi_table_validate(old_sections) || (old_program =
                                                           pat_table_find_program(old_sections, sid)) == NULL)
             {
-                out_log(LogLevel_Info, "New program found: SID %hu on PID %hu", sid, pid);
-                pid_table[pid].is_psi = true;
-                service_set_pmt_pid(sid, pid);
+                stream_log(s, STSMON_LOG_INFO, "New program found: SID %hu on PID %hu", sid, pid);
+                stream_event(s, &(stsmon_event_t){
+                                    .type = STSMON_EVENT_PROGRAM_NEW,
+                                    .pid = pid,
+                                    .service_id = sid,
+                                });
+                s->pids[pid].is_psi = true;
+                s->pids[pid].service_id = sid;
+                service_set_pmt_pid(s, sid, pid);
             }
             else
             {
                 uint16_t old_pid = patn_get_pid(old_program);
                   if (old_pid != pid)
                 {
-                    out_log(LogLevel_Info, "Program SID %hu changed PID from %hu to %hu", sid, old_pid, pid);
-                    pid_table[pid].is_psi = true;
-                    ts_pid_t *old_pid_entry = &pid_table[old_pid];
+                    stream_log(s, STSMON_LOG_INFO, "Program SID %hu changed PID from %hu to %hu", sid, old_pid, pid);
+                    stream_event(s, &(stsmon_event_t){
+                                        .type = STSMON_EVENT_PROGRAM_PID_CHANGE,
+                                        .pid = pid,
+                                        .service_id = sid,
+                                        .old_pid = old_pid,
+                                    });
+                    s->pids[pid].is_psi = true;
+                    s->pids[pid].service_id = sid;
+                    ts_pid_t *old_pid_entry = &s->pids[old_pid];
                     old_pid_entry->is_psi = false;
-                    service_set_pmt_pid(sid, pid);
+                    old_pid_entry->service_id = 0;
+                    service_set_pmt_pid(s, sid, pid);
                     psi_assemble_reset(&old_pid_entry->psi_buffer,
                                        &old_pid_entry->psi_buffer_used);
                 }
@@ -123,20 +148,24 @@ void handle_pat()
         psi_table_free(old_sections);
 }
 
-void handle_pat_section(uint16_t pid, uint8_t *section)
+void handle_pat_section(stsmon_stream_t *s, uint16_t pid, uint8_t *section)
 {
     if (pid != PAT_PID || !pat_validate(section))
     {
-        out_log(LogLevel_Error, "Invalid PAT section on PID %u", pid);
+        stream_log(s, STSMON_LOG_ERROR, "Invalid PAT section on PID %u", pid);
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_PSI_ERROR,
+                            .pid = pid,
+                            .service_id = STSMON_NONE,
+                            .table = "PAT",
+                        });
         free(section);
         return;
     }
 
-    if (!psi_table_section(pat_sections_next, section))
-    {
-        free(section);
+    /* The table owns the section from here on, also while incomplete */
+    if (!psi_table_section(s->pat_next, section))
         return;
-    }
 
-    handle_pat();
+    handle_pat(s);
 }
\ No newline at end of file
@@ -0,0 +1,328 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include "pcapng.h"
+#include "ring.h"
+#include "output.h"
+
+/* Queue depth in datagrams, ~0.5 s at 100 Mbps with 7 packet datagrams */
+#define PCAPNG_QUEUE_SIZE 4096
+#define PCAPNG_MAX_DATAGRAM 2048
+/* stdio buffer of the output file, blocks are written with one fwrite each */
+#define PCAPNG_FILE_BUFFER (1024 * 1024)
+/* How long the writer sleeps when the queue is empty */
+#define PCAPNG_POLL_US 10000
+/* Flush at least this often in capture time */
+#define PCAPNG_FLUSH_US 1000000
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_ISB 0x00000005
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_LINKTYPE_RAW 101
+#define PCAPNG_IP_UDP_SIZE 28
+
+typedef struct pcapng_record
+{
+    uint64_t timestamp;
+    uint32_t src_addr;
+    uint16_t src_port;
+    uint16_t length;
+    uint8_t data[PCAPNG_MAX_DATAGRAM];
+} pcapng_record_t;
+
+static ring_t queue;
+static FILE *file = NULL;
+static pthread_t writer_thread;
+static bool running = false;
+static int writer_stop = 0;
+static uint32_t dst_addr;
+static uint16_t dst_port;
+static uint16_t ip_id = 0;
+static uint64_t received = 0;
+static uint64_t dropped = 0;
+static uint64_t last_timestamp = 0;
+static bool write_failed = false;
+
+/* Block buffer, the largest block is an EPB with a full datagram */
+static uint8_t block[64 + PCAPNG_IP_UDP_SIZE + PCAPNG_MAX_DATAGRAM];
+static size_t block_len = 0;
+
+static void put8(uint8_t v)
+{
+    block[block_len++] = v;
+}
+
+/* Blocks use host byte order, the byte-order magic tells readers which */
+static void put16(uint16_t v)
+{
+    memcpy(block + block_len, &v, 2);
+    block_len += 2;
+}
+
+static void put32(uint32_t v)
+{
+    memcpy(block + block_len, &v, 4);
+    block_len += 4;
+}
+
+static void put64(uint64_t v)
+{
+    memcpy(block + block_len, &v, 8);
+    block_len += 8;
+}
+
+static void put_pad()
+{
+    while (block_len % 4)
+        put8(0);
+}
+
+static void put_option(uint16_t code, const void *value, uint16_t len)
+{
+    put16(code);
+    put16(len);
+    memcpy(block + block_len, value, len);
+    block_len += len;
+    put_pad();
+}
+
+static void block_begin(uint32_t type)
+{
+    block_len = 0;
+    put32(type);
+    put32(0); /* total length, set in block_end */
+}
+
+static void block_end()
+{
+    uint32_t total = (uint32_t)block_len + 4;
+    memcpy(block + 4, &total, 4);
+    put32(total);
+    if (!write_failed && fwrite(block, 1, block_len, file) != block_len)
+    {
+        out_log(LogLevel_Error, "pcapng write failed: %s (%d)", strerror(errno), errno);
+        write_failed = true;
+    }
+}
+
+static uint16_t ip_checksum(const uint8_t *p, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2)
+        sum += (uint32_t)(p[i] << 8 | p[i + 1]);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+static void write_packet(const pcapng_record_t *rec)
+{
+    uint32_t captured = PCAPNG_IP_UDP_SIZE + rec->length;
+
+    block_begin(PCAPNG_EPB);
+    put32(0); /* interface */
+    put32((uint32_t)(rec->timestamp >> 32));
+    put32((uint32_t)rec->timestamp);
+    put32(captured);
+    put32(captured);
+
+    /* IPv4 header, network byte order */
+    uint8_t *ip = block + block_len;
+    uint16_t total = htons((uint16_t)captured);
+    uint16_t id = htons(ip_id++);
+    uint16_t udp_len = htons((uint16_t)(8 + rec->length));
+    memset(ip, 0, PCAPNG_IP_UDP_SIZE);
+    ip[0] = 0x45;
+    memcpy(ip + 2, &total, 2);
+    memcpy(ip + 4, &id, 2);
+    ip[8] = 64; /* TTL is not visible to a socket */
+    ip[9] = 17; /* UDP */
+    memcpy(ip + 12, &rec->src_addr, 4);
+    memcpy(ip + 16, &dst_addr, 4);
+    uint16_t checksum = htons(ip_checksum(ip, 20));
+    memcpy(ip + 10, &checksum, 2);
+    /* UDP header, checksum 0 means none */
+    memcpy(ip + 20, &rec->src_port, 2);
+    memcpy(ip + 22, &dst_port, 2);
+    memcpy(ip + 24, &udp_len, 2);
+    block_len += PCAPNG_IP_UDP_SIZE;
+
+    memcpy(block + block_len, rec->data, rec->length);
+    block_len += rec->length;
+    put_pad();
+    block_end();
+}
+
+static void write_header(const char *group, uint16_t port)
+{
+    static const char application[] = "stsmon " VERSION;
+    block_begin(PCAPNG_SHB);
+    put32(0x1A2B3C4D);
+    put16(1);
+    put16(0);
+    put64(UINT64_MAX); /* section length unknown */
+    put_option(4, application, sizeof(application) - 1); /* shb_userappl */
+    put32(0);                                             /* opt_endofopt */
+    block_end();
+
+    char name[64];
+    int n = snprintf(name, sizeof(name), "%s:%u", group, port);
+    uint8_t tsresol = 6; /* microseconds */
+    block_begin(PCAPNG_IDB);
+    put16(PCAPNG_LINKTYPE_RAW);
+    put16(0);
+    put32(0); /* no snaplen limit */
+    put_option(2, name, (uint16_t)n); /* if_name */
+    put_option(9, &tsresol, 1);       /* if_tsresol */
+    put32(0);
+    block_end();
+}
+
+static void write_statistics()
+{
+    static const char comment[] = "ifdrop: datagrams not written because the stsmon pcapng queue was full";
+    block_begin(PCAPNG_ISB);
+    put32(0);
+    put32((uint32_t)(last_timestamp >> 32));
+    put32((uint32_t)last_timestamp);
+    uint64_t recv = __atomic_load_n(&received, __ATOMIC_RELAXED);
+    uint64_t drop = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    put_option(1, comment, sizeof(comment) - 1); /* opt_comment */
+    put_option(4, &recv, 8);                     /* isb_ifrecv */
+    put_option(5, &drop, 8);                     /* isb_ifdrop */
+    put32(0);
+    block_end();
+}
+
+static void *pcapng_writer(void *arg)
+{
+    (void)arg;
+    uint64_t unflushed = 0;
+
+    while (1)
+    {
+        bool stopping = __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE);
+        pcapng_record_t *rec;
+        bool wrote = false;
+        while ((rec = ring_peek(&queue)) != NULL)
+        {
+            write_packet(rec);
+            last_timestamp = rec->timestamp;
+            ring_release(&queue);
+            wrote = true;
+        }
+        if (stopping)
+            break;
+
+        /* Keep the file readable while capturing, e.g. for tail -f | tshark */
+        if (wrote && unflushed == 0)
+            unflushed = last_timestamp;
+        if (unflushed && last_timestamp - unflushed >= PCAPNG_FLUSH_US)
+        {
+            fflush(file);
+            unflushed = 0;
+        }
+        if (!wrote)
+            usleep(PCAPNG_POLL_US);
+    }
+    write_statistics();
+    return NULL;
+}
+
+void pcapng_packet(const uint8_t *data, size_t len, uint32_t src_addr, uint16_t src_port, uint64_t now)
+{
+    if (!running)
+        return;
+    __atomic_store_n(&received, received + 1, __ATOMIC_RELAXED);
+    pcapng_record_t *rec = ring_reserve(&queue);
+    if (!rec)
+    {
+        __atomic_store_n(&dropped, dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (len > PCAPNG_MAX_DATAGRAM)
+        len = PCAPNG_MAX_DATAGRAM;
+    rec->timestamp = now;
+    rec->src_addr = src_addr;
+    rec->src_port = src_port;
+    rec->length = (uint16_t)len;
+    memcpy(rec->data, data, len);
+    ring_commit(&queue);
+}
+
+int pcapng_open(const char *path, const char *group, uint16_t port)
+{
+    file = fopen(path, "wb");
+    if (!file)
+    {
+        out_log(LogLevel_Error, "Cannot create pcapng file '%s': %s (%d)", path, strerror(errno), errno);
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, PCAPNG_FILE_BUFFER);
+    if (ring_init(&queue, sizeof(pcapng_record_t), PCAPNG_QUEUE_SIZE) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to allocate pcapng queue");
+        fclose(file);
+        file = NULL;
+        return -1;
+    }
+    dst_addr = inet_addr(group);
+    dst_port = htons(port);
+    write_header(group, port);
+
+    writer_stop = 0;
+    if (pthread_create(&writer_thread, NULL, pcapng_writer, NULL) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to start pcapng writer thread");
+        ring_free(&queue);
+        fclose(file);
+        file = NULL;
+        return -1;
+    }
+    running = true;
+    return 0;
+}
+
+void pcapng_close()
+{
+    if (!running)
+        return;
+    running = false;
+    __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(writer_thread, NULL);
+    ring_free(&queue);
+    if (fclose(file) != 0 && !write_failed)
+        out_log(LogLevel_Error, "pcapng write failed: %s (%d)", strerror(errno), errno);
+    file = NULL;
+    if (dropped)
+        out_log(LogLevel_Warning, "pcapng: %" PRIu64 " of %" PRIu64 " datagrams dropped, writer too slow",
+                dropped, received);
+}
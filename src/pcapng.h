@@ -0,0 +1,38 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * pcapng capture of the received datagrams. Sockets do not see the IP
+ * and UDP headers, so every datagram is written with a synthetic IPv4/UDP
+ * header (sender address and port as reported by recvmsg, destination the
+ * monitored group) and the receive timestamp used for the packet timing
+ * statistics, in microseconds.
+ *
+ * The capture loop copies datagrams into a bounded queue; a writer thread
+ * formats the blocks and writes them through a large stdio buffer. When
+ * the queue is full datagrams are dropped and counted, the count is
+ * recorded in an interface statistics block at the end of the file.
+ */
+int pcapng_open(const char *path, const char *group, uint16_t port);
+void pcapng_close();
+
+/* Capture thread. `src_addr` and `src_port` in network byte order */
+void pcapng_packet(const uint8_t *data, size_t len, uint32_t src_addr, uint16_t src_port, uint64_t now);
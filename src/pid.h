@@ -25,10 +25,16 @@ typedef struct ts_pid
 {
     uint8_t last_cc;
     uint64_t packets;
+    uint64_t cc_errors;
+    uint64_t tei_errors;
+    uint16_t service_id; /* service whose PMT references this PID */
     bool is_psi;
     bool is_data;
     uint8_t *psi_buffer;
     uint16_t psi_buffer_used;
+    /* PCR minus arrival time (us) within the current statistics interval */
+    uint32_t pcr_interval;
+    int64_t pcr_offset;
+    int64_t pcr_offset_min;
+    int64_t pcr_offset_max;
 } ts_pid_t;
-
-extern ts_pid_t pid_table[TS_MAX_PID];
\ No newline at end of file
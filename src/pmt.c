@@ -22,26 +22,36 @@
 #include <bitstream/mpeg/psi.h>
 #include <bitstream/mpeg/psi/pmt.h>
 #pragma GCC diagnostic pop
-#include "pid.h"
-
+#include "stream.h"
 #include "services.h"
-#include "output.h"
 
-void handle_pmt(uint16_t pid, uint8_t *section)
+void handle_pmt(stsmon_stream_t *s, uint16_t pid, uint8_t *section)
 {
     if (!pmt_validate(section))
     {
-        out_log(LogLevel_Error, "Invalid PMT section on PID %u", pid);
+        stream_log(s, STSMON_LOG_ERROR, "Invalid PMT section on PID %u", pid);
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_PSI_ERROR,
+                            .pid = pid,
+                            .service_id = s->pids[pid].service_id ? s->pids[pid].service_id : STSMON_NONE,
+                            .table = "PMT",
+                        });
         free(section);
         return;
     }
     uint16_t service_id = pmt_get_program(section);
-    uint8_t last_pmt_version = service_get_pmt_version(service_id);
+    uint8_t last_pmt_version = service_get_pmt_version(s, service_id);
     uint8_t current_pmt_version = psi_get_version(section);
     if (current_pmt_version != last_pmt_version)
     {
-        service_set_pmt_version(service_id, current_pmt_version);
-        out_log(LogLevel_Info, "PMT version change for service ID %u: %u -> %u",
+        service_set_pmt_version(s, service_id, current_pmt_version);
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_SECTION,
+                            .pid = pid,
+                            .service_id = service_id,
+                            .section = section,
+                        });
+        stream_log(s, STSMON_LOG_INFO, "PMT version change for service ID %u: %u -> %u",
                 service_id, last_pmt_version, current_pmt_version);
         uint8_t *es;
         int i = 0;
@@ -87,12 +97,25 @@ void handle_pmt(uint16_t pid, uint8_t *section)
                  * This influences statistics/monitoring and can be used to ignore
                  * purely signalling streams.
                  */
-                pid_table[es_pid].is_data = has_data;
+                s->pids[es_pid].is_data = has_data;
+                s->pids[es_pid].service_id = service_id;
 
-                out_log(LogLevel_Info, "  ES PID: %u, Stream Type: 0x%02X Data: %s",
+                stream_log(s, STSMON_LOG_INFO, "  ES PID: %u, Stream Type: 0x%02X Data: %s",
                     es_pid, es_type, has_data ? "Yes" : "No");
             i++;
         }
+        /* A PCR carried on its own PID belongs to the service too, 0x1fff means none */
+        uint16_t pcr_pid = pmt_get_pcrpid(section);
+        if (pcr_pid != 0x1fff)
+            s->pids[pcr_pid].service_id = service_id;
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_PMT_VERSION,
+                            .pid = pid,
+                            .service_id = service_id,
+                            .old_version = last_pmt_version,
+                            .version = current_pmt_version,
+                            .es_count = i,
+                        });
     }
     free(section);
 }
@@ -0,0 +1,64 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include "profile.h"
+#include "output.h"
+
+static const char *stage_names[PROFILE_STAGES] = {"recv", "parse", "cc", "psi", "tables", "output"};
+
+static void per_packet(const uint64_t *ticks, uint64_t packets, double out[PROFILE_STAGES + 1])
+{
+    out[0] = 0;
+    for (int s = 0; s < PROFILE_STAGES; s++)
+    {
+        out[s + 1] = packets ? (double)ticks[s] / (double)packets : 0;
+        out[0] += out[s + 1];
+    }
+}
+
+void profile_interval(const uint64_t ticks[PROFILE_STAGES], uint64_t last[PROFILE_STAGES],
+                      uint64_t packets, double out[PROFILE_STAGES + 1])
+{
+    uint64_t delta[PROFILE_STAGES];
+    for (int s = 0; s < PROFILE_STAGES; s++)
+    {
+        delta[s] = ticks[s] - last[s];
+        last[s] = ticks[s];
+    }
+    per_packet(delta, packets, out);
+}
+
+void profile_total(const uint64_t ticks[PROFILE_STAGES], uint64_t packets, double out[PROFILE_STAGES + 1])
+{
+    per_packet(ticks, packets, out);
+}
+
+void profile_print(const double v[PROFILE_STAGES + 1])
+{
+    out_printf(" %s/pkt=%.0f (", PROFILE_UNIT, v[0]);
+    for (int s = 0; s < PROFILE_STAGES; s++)
+        out_printf("%s%s %.0f", s ? " " : "", stage_names[s], v[s + 1]);
+    out_puts(")");
+}
+
+int profile_csv_format(char *buf, size_t size, const double v[PROFILE_STAGES + 1])
+{
+    return snprintf(buf, size, ",%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f",
+                    v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+
+/*
+ * Time spent per processing stage, compiled in with -DENABLE_PROFILE=ON
+ * (STSMON_PROFILE). Without it the PROFILE_* macros expand to nothing, so
+ * the capture loop carries no overhead.
+ *
+ * The capture loop takes a timestamp and calls PROFILE_LAP(ticks, stage, t)
+ * at every stage boundary, the time since the previous lap is charged to
+ * that stage in `ticks`, the counters of the stream being fed (see
+ * stsmon_stream_profile()), so concurrent streams never share them. x86
+ * uses the TSC and reports cycles, other platforms CLOCK_MONOTONIC
+ * nanoseconds.
+ */
+typedef enum
+{
+    PROFILE_RECV,   /* recvmsg() */
+    PROFILE_PARSE,  /* TS header, sync byte and PID */
+    PROFILE_CC,     /* continuity counter and TEI checks */
+    PROFILE_PSI,    /* section assembly and CRC */
+    PROFILE_TABLES, /* PAT, PMT and SDT handlers */
+    PROFILE_OUTPUT, /* gap logic, recording hooks, status line and logs */
+    PROFILE_STAGES
+} profile_stage_t;
+
+#ifdef STSMON_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_UNIT "cycles"
+static inline uint64_t profile_now() { return __rdtsc(); }
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILE_UNIT "cycles"
+static inline uint64_t profile_now() { return __rdtsc(); }
+#else
+#include <time.h>
+#define PROFILE_UNIT "ns"
+static inline uint64_t profile_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+#define PROFILE_BEGIN(t) uint64_t t = profile_now()
+#define PROFILE_RESET(t) ((t) = profile_now())
+#define PROFILE_LAP(ticks, stage, t)           \
+    do                                         \
+    {                                          \
+        uint64_t profile_lap_ = profile_now(); \
+        (ticks)[stage] += profile_lap_ - (t);  \
+        (t) = profile_lap_;                    \
+    } while (0)
+
+/*
+ * Average per packet, total first and then per stage, of a stream's
+ * `ticks` over the packets since the previous call (interval, `last`
+ * keeps the counters of that call) or since the start (total).
+ */
+void profile_interval(const uint64_t ticks[PROFILE_STAGES], uint64_t last[PROFILE_STAGES],
+                      uint64_t packets, double out[PROFILE_STAGES + 1]);
+void profile_total(const uint64_t ticks[PROFILE_STAGES], uint64_t packets, double out[PROFILE_STAGES + 1]);
+/* Append " <unit>/pkt N (recv N parse N ...)" to the current console line */
+void profile_print(const double v[PROFILE_STAGES + 1]);
+/* CSV header columns and values, each starting with a comma */
+#define PROFILE_CSV_HEADER ",Profile (" PROFILE_UNIT "/packet),Recv,Parse,CC,PSI,Tables,Output"
+int profile_csv_format(char *buf, size_t size, const double v[PROFILE_STAGES + 1]);
+
+#else
+
+#define PROFILE_BEGIN(t) do { } while (0)
+#define PROFILE_RESET(t) do { } while (0)
+#define PROFILE_LAP(ticks, stage, t) do { } while (0)
+
+#endif
@@ -0,0 +1,421 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+/* sendmmsg */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <time.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#endif
+#include "push.h"
+#include "stats.h"
+#include "pid.h"
+#include "output.h"
+
+#ifndef WIN32
+/* Datagrams formatted before a sendmmsg call */
+#define PUSH_BATCH 64
+
+typedef enum
+{
+    PUSH_INFLUX,
+    PUSH_STATSD,
+} push_format_t;
+
+static int push_fd = -1;
+static pthread_t push_thread;
+static int stop_flag = 0;
+static push_format_t format;
+static unsigned period_ms;
+static uint64_t datagrams_sent = 0;
+static uint64_t datagrams_failed = 0;
+
+/* Everything below is only touched by the push thread */
+static stats_snapshot_t snapshot;
+static char datagrams[PUSH_BATCH][PUSH_DATAGRAM_SIZE];
+static struct mmsghdr messages[PUSH_BATCH];
+static struct iovec iovecs[PUSH_BATCH];
+static size_t current = 0; /* datagram being filled */
+static size_t current_len = 0;
+/* Metric line being formatted, lines never span datagrams */
+static char line[PUSH_DATAGRAM_SIZE];
+static size_t line_len = 0;
+static char stream_key[STATS_NAME_SIZE * 2];
+static bool send_failing = false;
+
+/* Previous counter values, StatsD counters are sent as increments */
+static uint64_t prev_packets, prev_data_packets, prev_cc, prev_sync, prev_tei;
+static uint64_t prev_pid_packets[TS_MAX_PID];
+static uint64_t prev_pid_cc[TS_MAX_PID];
+static uint64_t prev_pid_tei[TS_MAX_PID];
+
+static void flush_datagrams()
+{
+    if (current_len > 0)
+    {
+        iovecs[current].iov_len = current_len;
+        current++;
+        current_len = 0;
+    }
+    size_t sent = 0;
+    while (sent < current)
+    {
+        int n = sendmmsg(push_fd, messages + sent, (unsigned)(current - sent), 0);
+        if (n <= 0)
+        {
+            /* Collector down or unreachable, drop the rest of the batch */
+            if (!send_failing)
+                out_log(LogLevel_Warning, "Push: sendmmsg failed: %s (%d)", strerror(errno), errno);
+            send_failing = true;
+            datagrams_failed += current - sent;
+            break;
+        }
+        if (send_failing)
+            out_log(LogLevel_Info, "Push: sending again");
+        send_failing = false;
+        sent += (size_t)n;
+        datagrams_sent += (size_t)n;
+    }
+    current = 0;
+}
+
+static void line_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void line_printf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line + line_len, sizeof(line) - line_len, fmt, args);
+    va_end(args);
+    if (n > 0)
+        line_len += (size_t)n;
+    if (line_len >= sizeof(line))
+        line_len = sizeof(line) - 1; /* truncated, dropped by line_end */
+}
+
+/* Escape a tag value for the line protocol: comma, space and equals */
+static void line_tag(const char *value)
+{
+    for (const char *p = value; *p && line_len < sizeof(line) - 2; p++)
+    {
+        if (*p == ',' || *p == ' ' || *p == '=')
+            line[line_len++] = '\\';
+        line[line_len++] = *p == '\n' ? ' ' : *p;
+    }
+    line[line_len] = '\0';
+}
+
+/* Move the finished line into the current datagram */
+static void line_end()
+{
+    if (line_len >= sizeof(line) - 1)
+    {
+        /* Cannot be packed, a service name would have to be 1 KB */
+        line_len = 0;
+        return;
+    }
+    line[line_len++] = '\n';
+    if (current_len + line_len > PUSH_DATAGRAM_SIZE)
+    {
+        iovecs[current].iov_len = current_len;
+        current++;
+        current_len = 0;
+        if (current == PUSH_BATCH)
+            flush_datagrams();
+    }
+    memcpy(datagrams[current] + current_len, line, line_len);
+    current_len += line_len;
+    line_len = 0;
+}
+
+static void statsd_counter(const char *name, uint64_t value, uint64_t previous)
+{
+    /* The first push reports everything counted so far */
+    uint64_t delta = value >= previous ? value - previous : value;
+    if (delta == 0)
+        return;
+    line_printf("%s.%s:%" PRIu64 "|c", stream_key, name, delta);
+    line_end();
+}
+
+static void statsd_gauge(const char *name, double value)
+{
+    line_printf("%s.%s:%.0f|g", stream_key, name, value);
+    line_end();
+}
+
+static void format_influx(const stats_snapshot_t *s)
+{
+    uint64_t ts = s->timestamp * 1000;
+
+    line_printf("stsmon,stream=");
+    line_tag(s->stream);
+    line_printf(" bitrate=%.0f,data_bitrate=%.0f,packets=%" PRIu64 "i,data_packets=%" PRIu64 "i,"
+                "cc_errors=%" PRIu64 "i,sync_errors=%" PRIu64 "i,tei_errors=%" PRIu64 "i,"
+                "socket_drops=%" PRIu64 "i,csv_drops=%" PRIu64 "i",
+                s->bitrate, s->data_bitrate, s->packets_all, s->packets_data,
+                s->cc_errors, s->sync_errors, s->tei_errors, s->socket_drops, s->csv_drops);
+    if (s->last_packet)
+        line_printf(",last_packet_age=%.3f", (s->timestamp - s->last_packet) / 1000000.0);
+    line_printf(" %" PRIu64, ts);
+    line_end();
+
+    for (size_t i = 0; i < s->pid_count; i++)
+    {
+        const stats_pid_t *p = &s->pids[i];
+        line_printf("stsmon_pid,stream=");
+        line_tag(s->stream);
+        line_printf(",pid=%u,service_id=%u bitrate=%.0f,packets=%" PRIu64 "i,cc_errors=%" PRIu64 "i,tei_errors=%" PRIu64 "i %" PRIu64,
+                    p->pid, p->service_id, p->bitrate, p->packets, p->cc_errors, p->tei_errors, ts);
+        line_end();
+    }
+
+    for (size_t i = 0; i < s->service_count; i++)
+    {
+        const stats_service_t *sv = &s->services[i];
+        double bitrate = 0;
+        uint64_t packets = 0, errors = 0;
+        for (size_t j = 0; j < s->pid_count; j++)
+        {
+            if (s->pids[j].service_id != sv->service_id)
+                continue;
+            bitrate += s->pids[j].bitrate;
+            packets += s->pids[j].packets;
+            errors += s->pids[j].cc_errors;
+        }
+        line_printf("stsmon_service,stream=");
+        line_tag(s->stream);
+        line_printf(",service_id=%u", sv->service_id);
+        if (sv->name[0])
+        {
+            line_printf(",service_name=");
+            line_tag(sv->name);
+        }
+        line_printf(" bitrate=%.0f,packets=%" PRIu64 "i,cc_errors=%" PRIu64 "i,scrambled=%di,pmt_version=%ui %" PRIu64,
+                    bitrate, packets, errors, sv->scrambled ? 1 : 0, sv->pmt_version, ts);
+        line_end();
+    }
+}
+
+static void format_statsd(const stats_snapshot_t *s)
+{
+    statsd_gauge("bitrate", s->bitrate);
+    statsd_gauge("data_bitrate", s->data_bitrate);
+    statsd_counter("packets", s->packets_all, prev_packets);
+    statsd_counter("data_packets", s->packets_data, prev_data_packets);
+    statsd_counter("cc_errors", s->cc_errors, prev_cc);
+    statsd_counter("sync_errors", s->sync_errors, prev_sync);
+    statsd_counter("tei_errors", s->tei_errors, prev_tei);
+    prev_packets = s->packets_all;
+    prev_data_packets = s->packets_data;
+    prev_cc = s->cc_errors;
+    prev_sync = s->sync_errors;
+    prev_tei = s->tei_errors;
+
+    char name[64];
+    for (size_t i = 0; i < s->pid_count; i++)
+    {
+        const stats_pid_t *p = &s->pids[i];
+        snprintf(name, sizeof(name), "pid.%u.bitrate", p->pid);
+        statsd_gauge(name, p->bitrate);
+        snprintf(name, sizeof(name), "pid.%u.packets", p->pid);
+        statsd_counter(name, p->packets, prev_pid_packets[p->pid]);
+        snprintf(name, sizeof(name), "pid.%u.cc_errors", p->pid);
+        statsd_counter(name, p->cc_errors, prev_pid_cc[p->pid]);
+        snprintf(name, sizeof(name), "pid.%u.tei_errors", p->pid);
+        statsd_counter(name, p->tei_errors, prev_pid_tei[p->pid]);
+        prev_pid_packets[p->pid] = p->packets;
+        prev_pid_cc[p->pid] = p->cc_errors;
+        prev_pid_tei[p->pid] = p->tei_errors;
+    }
+
+    /* Service names are not valid in StatsD metric names, use the ID */
+    for (size_t i = 0; i < s->service_count; i++)
+    {
+        const stats_service_t *sv = &s->services[i];
+        double bitrate = 0;
+        for (size_t j = 0; j < s->pid_count; j++)
+            if (s->pids[j].service_id == sv->service_id)
+                bitrate += s->pids[j].bitrate;
+        snprintf(name, sizeof(name), "service.%u.bitrate", sv->service_id);
+        statsd_gauge(name, bitrate);
+        snprintf(name, sizeof(name), "service.%u.scrambled", sv->service_id);
+        statsd_gauge(name, sv->scrambled ? 1 : 0);
+    }
+}
+
+static void *push_run(void *arg)
+{
+    (void)arg;
+    uint64_t last_timestamp = 0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE))
+    {
+        /* Sleep in short steps so push_stop() does not wait a whole period */
+        next.tv_nsec += (long)(period_ms % 1000) * 1000000;
+        next.tv_sec += (time_t)(period_ms / 1000) + next.tv_nsec / 1000000000;
+        next.tv_nsec %= 1000000000;
+        while (!__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE))
+        {
+            struct timespec now, step = {.tv_sec = 0, .tv_nsec = 200000000};
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t left = (int64_t)(next.tv_sec - now.tv_sec) * 1000000000 + (next.tv_nsec - now.tv_nsec);
+            if (left <= 0)
+                break;
+            if (left < step.tv_nsec)
+                step.tv_nsec = (long)left;
+            nanosleep(&step, NULL);
+        }
+        if (__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE))
+            break;
+
+        stats_read(&snapshot);
+        /* Nothing published yet, or no new snapshot since the last push */
+        if (snapshot.timestamp == 0 || snapshot.timestamp == last_timestamp)
+            continue;
+        last_timestamp = snapshot.timestamp;
+
+        if (format == PUSH_INFLUX)
+            format_influx(&snapshot);
+        else
+        {
+            /* "239.0.0.1:1234" -> "stsmon.239_0_0_1_1234" */
+            size_t k = (size_t)snprintf(stream_key, sizeof(stream_key), "stsmon.");
+            for (const char *p = snapshot.stream; *p && k < sizeof(stream_key) - 1; p++)
+                stream_key[k++] = (*p == '.' || *p == ':') ? '_' : *p;
+            stream_key[k] = '\0';
+            format_statsd(&snapshot);
+        }
+        flush_datagrams();
+    }
+    return NULL;
+}
+
+int push_start(const char *target, unsigned interval_ms)
+{
+    const char *rest;
+    if (strncmp(target, "influx://", 9) == 0)
+    {
+        format = PUSH_INFLUX;
+        rest = target + 9;
+    }
+    else if (strncmp(target, "statsd://", 9) == 0)
+    {
+        format = PUSH_STATSD;
+        rest = target + 9;
+    }
+    else
+    {
+        out_log(LogLevel_Error, "Push target '%s' must start with influx:// or statsd://", target);
+        return -1;
+    }
+
+    /* host:port, [v6]:port */
+    char host[256];
+    const char *colon = strrchr(rest, ':');
+    if (!colon || colon == rest || (size_t)(colon - rest) >= sizeof(host) || atoi(colon + 1) <= 0)
+    {
+        out_log(LogLevel_Error, "invalid push address '%s'", target);
+        return -1;
+    }
+    memcpy(host, rest, (size_t)(colon - rest));
+    host[colon - rest] = '\0';
+    if (host[0] == '[' && host[strlen(host) - 1] == ']')
+    {
+        memmove(host, host + 1, strlen(host));
+        host[strlen(host) - 1] = '\0';
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    int rc = getaddrinfo(host, colon + 1, &hints, &res);
+    if (rc != 0)
+    {
+        out_log(LogLevel_Error, "Cannot resolve push address '%s': %s", target, gai_strerror(rc));
+        return -1;
+    }
+    push_fd = socket(res->ai_family, SOCK_DGRAM, 0);
+    /* Connected, so sendmmsg needs no per-message address */
+    if (push_fd < 0 || connect(push_fd, res->ai_addr, res->ai_addrlen) < 0)
+    {
+        out_log(LogLevel_Error, "push socket for '%s' failed: %s (%d)", target, strerror(errno), errno);
+        if (push_fd >= 0)
+            close(push_fd);
+        push_fd = -1;
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    for (size_t i = 0; i < PUSH_BATCH; i++)
+    {
+        iovecs[i].iov_base = datagrams[i];
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    period_ms = interval_ms;
+    stop_flag = 0;
+    if (pthread_create(&push_thread, NULL, push_run, NULL) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to start push thread");
+        close(push_fd);
+        push_fd = -1;
+        return -1;
+    }
+    out_log(LogLevel_Info, "Pushing %s metrics to %s every %u ms",
+            format == PUSH_INFLUX ? "InfluxDB" : "StatsD", rest, period_ms);
+    return 0;
+}
+
+void push_stop()
+{
+    if (push_fd < 0)
+        return;
+    __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+    pthread_join(push_thread, NULL);
+    close(push_fd);
+    push_fd = -1;
+    if (datagrams_failed)
+        out_log(LogLevel_Warning, "Push: %" PRIu64 " of %" PRIu64 " datagrams could not be sent",
+                datagrams_failed, datagrams_sent + datagrams_failed);
+}
+#else
+int push_start(const char *target, unsigned interval_ms)
+{
+    (void)target;
+    (void)interval_ms;
+    out_log(LogLevel_Error, "Push exporter is not supported on this platform");
+    return -1;
+}
+
+void push_stop()
+{
+}
+#endif
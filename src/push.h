@@ -0,0 +1,31 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+/*
+ * Push exporter sending stream, PID and service metrics to a UDP
+ * collector once per statistics interval. `target` is
+ * "influx://host:port" for InfluxDB line protocol or "statsd://host:port"
+ * for StatsD. Metrics are taken from the published snapshot (see stats.h)
+ * on a separate thread, packed into datagrams of at most PUSH_DATAGRAM_SIZE
+ * bytes and sent in batches with sendmmsg.
+ */
+#define PUSH_DATAGRAM_SIZE 1400
+
+int push_start(const char *target, unsigned interval_ms);
+void push_stop();
@@ -0,0 +1,159 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include "ratelimit.h"
+#include "output.h"
+
+#define RATELIMIT_SLOTS 1024 /* power of two */
+#define RATELIMIT_PROBE 8
+#define RATELIMIT_REPORT_US 1000000
+/* Bucket levels are kept in millionths of a token */
+#define TOKEN 1000000ULL
+
+typedef struct ratelimit_entry
+{
+    const char *stream; /* NULL in single-stream mode */
+    const char *fmt;    /* NULL for a free slot */
+    int key;
+    const char *what;
+    uint64_t tokens;
+    uint64_t last_refill;
+    uint64_t last_used;
+    uint64_t suppressed;
+    bool reported; /* already on the pending list */
+} ratelimit_entry_t;
+
+/* Every capture thread limits and reports the lines of its own streams */
+static __thread ratelimit_entry_t table[RATELIMIT_SLOTS];
+/* Entries with suppressed lines, so reporting does not scan the table */
+static __thread uint16_t pending[RATELIMIT_SLOTS];
+static __thread size_t pending_count = 0;
+static __thread uint64_t last_report = 0;
+static uint64_t rate_per_s = 10;
+static uint64_t burst = 20;
+
+void ratelimit_configure(unsigned rate, unsigned max_burst)
+{
+    rate_per_s = rate;
+    burst = max_burst < 1 ? 1 : max_burst;
+}
+
+static void report_entry(ratelimit_entry_t *e, uint64_t now)
+{
+    double secs = (now - last_report) / 1000000.0;
+    const char *sep = e->stream ? ": " : "";
+    const char *stream = e->stream ? e->stream : "";
+    if (e->key >= 0)
+        out_log(LogLevel_Warning, "%s%s%s on PID %d repeated %" PRIu64 " times in last %.1f s",
+                stream, sep, e->what, e->key, e->suppressed, secs);
+    else
+        out_log(LogLevel_Warning, "%s%s%s repeated %" PRIu64 " times in last %.1f s",
+                stream, sep, e->what, e->suppressed, secs);
+    e->suppressed = 0;
+}
+
+static inline uint32_t ratelimit_hash(const char *stream, const char *fmt, int key)
+{
+    uint64_t h = (uint64_t)(uintptr_t)fmt ^ ((uint64_t)(uint32_t)key * 0x9e3779b97f4a7c15ULL) ^
+                 ((uint64_t)(uintptr_t)stream * 0xc2b2ae3d27d4eb4fULL);
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return (uint32_t)h & (RATELIMIT_SLOTS - 1);
+}
+
+static ratelimit_entry_t *ratelimit_lookup(const char *stream, const char *fmt, int key, const char *what,
+                                           uint64_t now)
+{
+    uint32_t slot = ratelimit_hash(stream, fmt, key);
+    ratelimit_entry_t *victim = NULL;
+    for (int i = 0; i < RATELIMIT_PROBE; i++)
+    {
+        ratelimit_entry_t *e = &table[(slot + (uint32_t)i) & (RATELIMIT_SLOTS - 1)];
+        if (e->fmt == fmt && e->key == key && e->stream == stream)
+            return e;
+        if (e->fmt == NULL)
+        {
+            victim = e;
+            break;
+        }
+        if (!e->reported && (!victim || e->last_used < victim->last_used))
+            victim = e;
+    }
+    if (!victim)
+        return NULL;
+
+    victim->stream = stream;
+    victim->fmt = fmt;
+    victim->key = key;
+    victim->what = what;
+    victim->tokens = burst * TOKEN;
+    victim->last_refill = now;
+    victim->suppressed = 0;
+    victim->reported = false;
+    return victim;
+}
+
+bool ratelimit_allow(const char *stream, const char *fmt, int key, const char *what, uint64_t now)
+{
+    if (rate_per_s == 0)
+        return true;
+    if (last_report == 0)
+        last_report = now;
+
+    ratelimit_entry_t *e = ratelimit_lookup(stream, fmt, key, what, now);
+    if (!e)
+        return true; /* table region busy with pending summaries, fail open */
+    e->last_used = now;
+
+    if (now > e->last_refill)
+    {
+        uint64_t refill = (now - e->last_refill) * rate_per_s;
+        e->tokens = e->tokens + refill > burst * TOKEN ? burst * TOKEN : e->tokens + refill;
+        e->last_refill = now;
+    }
+    if (e->tokens >= TOKEN)
+    {
+        e->tokens -= TOKEN;
+        return true;
+    }
+
+    e->suppressed++;
+    if (!e->reported)
+    {
+        e->reported = true;
+        pending[pending_count++] = (uint16_t)(e - table);
+    }
+    return false;
+}
+
+void ratelimit_report(uint64_t now)
+{
+    if (now - last_report < RATELIMIT_REPORT_US)
+        return;
+    for (size_t i = 0; i < pending_count; i++)
+    {
+        ratelimit_entry_t *e = &table[pending[i]];
+        report_entry(e, now);
+        e->reported = false;
+    }
+    pending_count = 0;
+    last_report = now;
+}
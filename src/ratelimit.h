@@ -0,0 +1,42 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Token bucket rate limiting for repetitive console messages. Each message
+ * is keyed by its format string (pointer identity) and a small integer,
+ * usually the PID, so a suppressed message costs one hash lookup and an
+ * increment and is never formatted.
+ *
+ * Every key may print `burst` lines at once and `rate` lines per second
+ * after that. Suppressed lines are summarised once per second by
+ * ratelimit_report(), e.g.
+ *   "CC errors on PID 256 repeated 4312 times in last 1.0 s"
+ *
+ * The table is per thread, each capture thread calls ratelimit_report()
+ * for its own lines. With `--config` the stream name, compared by
+ * pointer, is part of the key and prefixes the summary.
+ */
+void ratelimit_configure(unsigned rate, unsigned burst);
+
+/* `what` names the message in the summary, `key` < 0 means no PID,
+   `stream` is NULL in single-stream mode */
+bool ratelimit_allow(const char *stream, const char *fmt, int key, const char *what, uint64_t now);
+void ratelimit_report(uint64_t now);
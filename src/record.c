@@ -0,0 +1,437 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+/* O_DIRECT */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#ifndef WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+#include "record.h"
+#include "ring.h"
+#include "output.h"
+
+#ifndef WIN32
+#define RECORD_ALIGN 4096
+#define RECORD_PATH_SIZE 4096
+/* Segments of one stream looked at when enforcing the quota */
+#define RECORD_MAX_SEGMENTS 65536
+
+/* Chunk handed to the writer */
+typedef struct record_chunk
+{
+    uint32_t index;
+    uint32_t length;
+    uint64_t segment; /* segment start, unix seconds */
+} record_chunk_t;
+
+static uint8_t **chunks = NULL;
+static size_t chunk_count = 0;
+static ring_t filled; /* capture -> writer */
+static ring_t spare;  /* writer -> capture */
+
+static char record_dir[RECORD_PATH_SIZE];
+static char prefix[128];
+static unsigned segment_length;
+static uint64_t record_quota;
+
+/* Capture thread state */
+static bool running = false;
+static int64_t current = -1; /* chunk being filled */
+static uint32_t current_len = 0;
+static uint64_t current_segment = 0;
+static uint64_t dropped = 0;
+static bool dropping = false;
+
+static pthread_t writer_thread;
+static int stop_flag = 0;
+
+/* Writer thread state */
+static int fd = -1;
+static bool direct = false;
+static uint64_t fd_segment = 0;
+static uint64_t fd_size = 0;
+static char fd_path[RECORD_PATH_SIZE + 160];
+static uint64_t write_errors = 0;
+
+static void segment_path(char *out, size_t size, uint64_t segment)
+{
+    char stamp[16];
+    time_t t = (time_t)segment;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(out, size, "%s/%s-%s.ts", record_dir, prefix, stamp);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Writer thread: remove the oldest segments of this stream over the quota */
+static void enforce_quota()
+{
+    DIR *d = opendir(record_dir);
+    if (!d)
+        return;
+    char **names = malloc(RECORD_MAX_SEGMENTS * sizeof(char *));
+    if (!names)
+    {
+        closedir(d);
+        return;
+    }
+    size_t n = 0;
+    size_t prefix_len = strlen(prefix);
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL && n < RECORD_MAX_SEGMENTS)
+    {
+        size_t len = strlen(e->d_name);
+        /* "<prefix>-YYYYmmdd-HHMMSS.ts" */
+        if (len != prefix_len + 19 || strncmp(e->d_name, prefix, prefix_len) != 0 ||
+            e->d_name[prefix_len] != '-' || strcmp(e->d_name + len - 3, ".ts") != 0)
+            continue;
+        names[n] = strdup(e->d_name);
+        if (names[n])
+            n++;
+    }
+    closedir(d);
+
+    /* Names sort by time, newest last */
+    qsort(names, n, sizeof(char *), compare_names);
+    uint64_t *sizes = calloc(n ? n : 1, sizeof(uint64_t));
+    uint64_t total = 0;
+    char path[RECORD_PATH_SIZE + 160];
+    for (size_t i = 0; sizes && i < n; i++)
+    {
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", record_dir, names[i]);
+        if (stat(path, &st) == 0)
+            sizes[i] = (uint64_t)st.st_size;
+        total += sizes[i];
+    }
+    /* The segment being written is never removed */
+    for (size_t i = 0; sizes && i + 1 < n && total > record_quota; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", record_dir, names[i]);
+        if (unlink(path) == 0)
+        {
+            out_log(LogLevel_Info, "Recording quota: removed %s", path);
+            total -= sizes[i];
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+        free(names[i]);
+    free(names);
+    free(sizes);
+}
+
+static void close_segment()
+{
+    if (fd < 0)
+        return;
+    /* The last write was padded to the O_DIRECT alignment */
+    if (direct && ftruncate(fd, (off_t)fd_size) != 0)
+        out_log(LogLevel_Error, "Recording: truncate '%s' failed: %s (%d)", fd_path, strerror(errno), errno);
+    close(fd);
+    fd = -1;
+}
+
+static int open_segment(uint64_t segment)
+{
+    segment_path(fd_path, sizeof(fd_path), segment);
+    /* Appending keeps a segment that was started before a restart */
+    fd = open(fd_path, O_WRONLY | O_CREAT | O_DIRECT, 0644);
+    direct = fd >= 0;
+    if (fd < 0 && errno == EINVAL)
+        fd = open(fd_path, O_WRONLY | O_CREAT, 0644); /* e.g. tmpfs */
+    if (fd < 0)
+    {
+        out_log(LogLevel_Error, "Recording: cannot create '%s': %s (%d)", fd_path, strerror(errno), errno);
+        return -1;
+    }
+    struct stat st;
+    fd_size = fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    /* O_DIRECT offsets must stay aligned, finish an unaligned file buffered */
+    if (direct && fd_size % RECORD_ALIGN != 0)
+    {
+        close(fd);
+        direct = false;
+        fd = open(fd_path, O_WRONLY);
+        if (fd < 0)
+        {
+            out_log(LogLevel_Error, "Recording: cannot reopen '%s': %s (%d)", fd_path, strerror(errno), errno);
+            return -1;
+        }
+    }
+    /* A new segment, the one just finished now counts against the quota.
+       The file is usually closed already after its short last chunk */
+    bool rollover = fd_segment != 0 && segment != fd_segment;
+    fd_segment = segment;
+    if (rollover && record_quota)
+        enforce_quota();
+    return 0;
+}
+
+static void write_chunk(const record_chunk_t *c)
+{
+    if (fd >= 0 && c->segment != fd_segment)
+        close_segment();
+    if (fd < 0 && open_segment(c->segment) != 0)
+    {
+        write_errors++;
+        return;
+    }
+
+    /* Only the last chunk of a segment is short, pad it for O_DIRECT */
+    size_t len = c->length;
+    if (direct && len % RECORD_ALIGN != 0)
+    {
+        size_t padded = (len + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+        memset(chunks[c->index] + len, 0, padded - len);
+        len = padded;
+    }
+    const uint8_t *p = chunks[c->index];
+    uint64_t offset = fd_size;
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, (off_t)offset);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (write_errors++ == 0)
+                out_log(LogLevel_Error, "Recording: write to '%s' failed: %s (%d)", fd_path, strerror(errno), errno);
+            return;
+        }
+        p += n;
+        offset += (uint64_t)n;
+        len -= (size_t)n;
+    }
+    fd_size += c->length;
+    if (direct && c->length % RECORD_ALIGN != 0)
+    {
+        /* Anything after a short chunk starts a new file, see record_packet */
+        close_segment();
+    }
+}
+
+static void *writer_run(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        record_chunk_t *c = ring_peek(&filled);
+        if (!c)
+        {
+            if (__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE))
+                break;
+            struct timespec step = {.tv_sec = 0, .tv_nsec = 10000000};
+            nanosleep(&step, NULL);
+            continue;
+        }
+        record_chunk_t chunk = *c;
+        ring_release(&filled);
+        write_chunk(&chunk);
+
+        uint32_t *slot = ring_reserve(&spare);
+        *slot = chunk.index; /* never full, it holds every chunk */
+        ring_commit(&spare);
+    }
+    close_segment();
+    if (record_quota)
+        enforce_quota();
+    return NULL;
+}
+
+/* Capture thread: hand the current chunk to the writer */
+static void submit_chunk()
+{
+    if (current < 0)
+        return;
+    if (current_len == 0)
+        return;
+    record_chunk_t *c = ring_reserve(&filled);
+    c->index = (uint32_t)current;
+    c->length = current_len;
+    c->segment = current_segment;
+    ring_commit(&filled);
+    current = -1;
+    current_len = 0;
+}
+
+void record_packet(const uint8_t *data, size_t len, uint64_t now)
+{
+    if (!running)
+        return;
+
+    uint64_t segment = now / 1000000 / segment_length * segment_length;
+    if (segment != current_segment)
+    {
+        submit_chunk();
+        current_segment = segment;
+    }
+
+    while (len > 0)
+    {
+        if (current < 0)
+        {
+            uint32_t *index = ring_peek(&spare);
+            if (!index)
+            {
+                if (!dropping)
+                    out_log(LogLevel_Warning, "Recording: writer is behind, dropping data");
+                dropping = true;
+                dropped += len;
+                return;
+            }
+            current = *index;
+            ring_release(&spare);
+            dropping = false;
+        }
+        size_t n = RECORD_CHUNK_SIZE - current_len;
+        if (n > len)
+            n = len;
+        memcpy(chunks[current] + current_len, data, n);
+        current_len += (uint32_t)n;
+        data += n;
+        len -= n;
+        if (current_len == RECORD_CHUNK_SIZE)
+            submit_chunk();
+    }
+}
+
+int record_open(const char *dir, const char *stream, unsigned segment_seconds,
+                uint64_t buffer_size, uint64_t quota)
+{
+    if (strlen(dir) >= sizeof(record_dir))
+    {
+        out_log(LogLevel_Error, "Recording directory '%s' is too long", dir);
+        return -1;
+    }
+    if (access(dir, W_OK) != 0)
+    {
+        out_log(LogLevel_Error, "Recording directory '%s' is not writable: %s (%d)", dir, strerror(errno), errno);
+        return -1;
+    }
+    snprintf(record_dir, sizeof(record_dir), "%s", dir);
+    /* "239.0.0.1:1234" -> "239.0.0.1_1234", ':' is awkward in file names */
+    size_t k = 0;
+    for (const char *p = stream; *p && k < sizeof(prefix) - 1; p++)
+        prefix[k++] = (*p == ':' || *p == '/') ? '_' : *p;
+    prefix[k] = '\0';
+    segment_length = segment_seconds ? segment_seconds : 1;
+    record_quota = quota;
+
+    chunk_count = buffer_size / RECORD_CHUNK_SIZE;
+    if (chunk_count < 2)
+        chunk_count = 2;
+    chunks = calloc(chunk_count, sizeof(uint8_t *));
+    if (!chunks || ring_init(&filled, sizeof(record_chunk_t), chunk_count) != 0 ||
+        ring_init(&spare, sizeof(uint32_t), chunk_count) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to allocate recording buffers");
+        record_close();
+        return -1;
+    }
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        if (posix_memalign((void **)&chunks[i], RECORD_ALIGN, RECORD_CHUNK_SIZE) != 0)
+        {
+            chunks[i] = NULL;
+            out_log(LogLevel_Error, "Failed to allocate recording buffers");
+            record_close();
+            return -1;
+        }
+        /* Touch it now rather than on the capture thread */
+        memset(chunks[i], 0, RECORD_CHUNK_SIZE);
+        uint32_t *slot = ring_reserve(&spare);
+        *slot = (uint32_t)i;
+        ring_commit(&spare);
+    }
+
+    stop_flag = 0;
+    if (pthread_create(&writer_thread, NULL, writer_run, NULL) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to start recording thread");
+        record_close();
+        return -1;
+    }
+    running = true;
+    out_log(LogLevel_Info, "Recording to %s/%s-*.ts, %u s segments, %zu MiB buffer",
+            record_dir, prefix, segment_length, chunk_count * (RECORD_CHUNK_SIZE >> 20));
+    return 0;
+}
+
+void record_close()
+{
+    if (running)
+    {
+        submit_chunk();
+        running = false;
+        __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+        pthread_join(writer_thread, NULL);
+        if (dropped || write_errors)
+            out_log(LogLevel_Warning, "Recording: %" PRIu64 " bytes dropped, %" PRIu64 " write errors",
+                    dropped, write_errors);
+    }
+    if (chunks)
+    {
+        for (size_t i = 0; i < chunk_count; i++)
+            free(chunks[i]);
+        free(chunks);
+        chunks = NULL;
+        ring_free(&filled);
+        ring_free(&spare);
+    }
+    current = -1;
+    current_len = 0;
+}
+#else
+int record_open(const char *dir, const char *stream, unsigned segment_seconds,
+                uint64_t buffer_size, uint64_t quota)
+{
+    (void)dir;
+    (void)stream;
+    (void)segment_seconds;
+    (void)buffer_size;
+    (void)quota;
+    out_log(LogLevel_Error, "Recording is not supported on this platform");
+    return -1;
+}
+
+void record_close()
+{
+}
+
+void record_packet(const uint8_t *data, size_t len, uint64_t now)
+{
+    (void)data;
+    (void)len;
+    (void)now;
+}
+#endif
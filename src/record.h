@@ -0,0 +1,45 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* Size of one write, a multiple of any O_DIRECT alignment */
+#define RECORD_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * Continuous recording of the received stream into time segmented .ts
+ * files "<dir>/<stream>-<YYYYmmdd-HHMMSS>.ts", one segment per
+ * `segment_seconds` aligned to the epoch (UTC).
+ *
+ * The capture loop copies datagrams into one of `buffer_size` /
+ * RECORD_CHUNK_SIZE page aligned chunks and passes full chunks to a writer
+ * thread through a ring (see ring.h); the writer returns them through a
+ * second ring. Files are opened with O_DIRECT where the filesystem allows
+ * it, so the page cache is not filled with stream data. When no chunk is
+ * free the data is dropped and counted, the capture loop never waits.
+ *
+ * After each segment the oldest segments of this stream are removed until
+ * all of them fit in `quota` bytes (0: no limit).
+ */
+int record_open(const char *dir, const char *stream, unsigned segment_seconds,
+                uint64_t buffer_size, uint64_t quota);
+void record_close();
+
+/* Capture thread, every datagram */
+void record_packet(const uint8_t *data, size_t len, uint64_t now);
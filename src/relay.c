@@ -0,0 +1,387 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+/* sendmmsg */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
+#include "relay.h"
+#include "stsmon.h"
+#include "output.h"
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/mpeg/psi.h>
+#include <bitstream/mpeg/psi/pat.h>
+
+#ifndef WIN32
+#define RELAY_BATCH 32
+#define RELAY_FILTER_REFRESH_US 1000000
+
+static int relay_fd = -1;
+static char slots[RELAY_BATCH][RELAY_DATAGRAM_SIZE];
+static struct mmsghdr messages[RELAY_BATCH];
+static struct iovec iovecs[RELAY_BATCH];
+static size_t pending = 0;
+static uint64_t first_pending = 0;
+
+/* Filtering, `pass` is only used when `filtered` */
+static bool filtered = false;
+static bool pass[TS_MAX_PID];
+static int relay_service = -1;
+static const stsmon_stream_t *relay_stream = NULL;
+static uint64_t last_refresh = 0;
+
+/* Replacement PAT for service mode */
+static uint8_t pat_packet[TS_SIZE];
+static uint16_t pat_tsid = 0;
+static uint16_t pat_pmt_pid = 0;
+static uint8_t pat_version = 0;
+static uint8_t pat_cc = 0;
+static bool pat_ready = false;
+
+static uint64_t sent = 0;
+static uint64_t dropped = 0;
+
+static void flush_batch()
+{
+    size_t done = 0;
+    while (done < pending)
+    {
+        int n = sendmmsg(relay_fd, messages + done, (unsigned)(pending - done), MSG_DONTWAIT);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            /* Never wait for the network, drop what did not fit */
+            if (!dropped)
+                out_log(LogLevel_Warning, "Relay: sendmmsg failed: %s (%d), dropping datagrams", strerror(errno), errno);
+            dropped += pending - done;
+            break;
+        }
+        done += (size_t)n;
+        sent += (size_t)n;
+    }
+    pending = 0;
+}
+
+static void build_pat()
+{
+    uint8_t section[PSI_MAX_SIZE + PSI_HEADER_SIZE];
+    pat_init(section);
+    psi_set_version(section, pat_version);
+    psi_set_current(section);
+    pat_set_tsid(section, pat_tsid);
+    psi_set_section(section, 0);
+    psi_set_lastsection(section, 0);
+    pat_set_length(section, PAT_PROGRAM_SIZE);
+    uint8_t *program = pat_get_program(section, 0);
+    patn_init(program);
+    patn_set_program(program, (uint16_t)relay_service);
+    patn_set_pid(program, pat_pmt_pid);
+    psi_set_crc(section);
+
+    uint8_t ts_offset = 0;
+    uint16_t section_offset = 0;
+    memset(pat_packet, 0xff, TS_SIZE);
+    psi_split_section(pat_packet, &ts_offset, section, &section_offset);
+    psi_split_end(pat_packet, &ts_offset);
+    ts_set_pid(pat_packet, PAT_PID);
+}
+
+/* Replace a PAT packet in place, false to drop it */
+static bool rewrite_pat(uint8_t *packet)
+{
+    /* One packet carries the whole replacement, drop continuations */
+    if (!ts_get_unitstart(packet) || !ts_has_payload(packet))
+        return false;
+
+    uint8_t *payload = ts_payload(packet);
+    uint8_t *section = ts_section(packet);
+    uint16_t tsid = pat_tsid;
+    if (payload[0] == 0 && section + PSI_HEADER_SIZE_SYNTAX1 <= packet + TS_SIZE &&
+        psi_get_tableid(section) == PAT_TABLE_ID)
+        tsid = psi_get_tableidext(section);
+
+    uint16_t pmt_pid = stsmon_stream_pmt_pid(relay_stream, (uint16_t)relay_service);
+    if (pmt_pid == 0)
+        return false;
+    if (!pat_ready || tsid != pat_tsid || pmt_pid != pat_pmt_pid)
+    {
+        if (pat_ready)
+            pat_version = (pat_version + 1) & 0x1f;
+        pat_tsid = tsid;
+        pat_pmt_pid = pmt_pid;
+        build_pat();
+        pat_ready = true;
+    }
+    memcpy(packet, pat_packet, TS_SIZE);
+    ts_set_cc(packet, pat_cc);
+    pat_cc = (pat_cc + 1) & 0xf;
+    return true;
+}
+
+static void refresh_service_filter()
+{
+    for (int pid = 0; pid < TS_MAX_PID; pid++)
+        pass[pid] = stsmon_stream_pid(relay_stream, (uint16_t)pid)->service_id == relay_service;
+    pass[PAT_PID] = true;
+}
+
+char *relay_buffer()
+{
+    if (relay_fd < 0)
+        return NULL;
+    return slots[pending];
+}
+
+void relay_packet(size_t len, uint64_t now)
+{
+    if (relay_fd < 0)
+        return;
+
+    uint8_t *data = (uint8_t *)slots[pending];
+    if (filtered)
+    {
+        size_t out = 0;
+        for (size_t i = 0; i + TS_SIZE <= len; i += TS_SIZE)
+        {
+            uint8_t *packet = data + i;
+            uint16_t pid = ts_get_pid(packet);
+            if (!pass[pid])
+                continue;
+            if (pid == PAT_PID && relay_service >= 0 && !rewrite_pat(packet))
+                continue;
+            if (out != i)
+                memcpy(data + out, packet, TS_SIZE);
+            out += TS_SIZE;
+        }
+        len = out;
+    }
+    if (len == 0)
+        return;
+
+    iovecs[pending].iov_len = len;
+    if (pending++ == 0)
+        first_pending = now;
+    if (pending == RELAY_BATCH)
+        flush_batch();
+}
+
+void relay_poll(uint64_t now)
+{
+    if (relay_fd < 0)
+        return;
+    if (pending && now - first_pending >= RELAY_MAX_DELAY_US)
+        flush_batch();
+    if (relay_service >= 0 && now - last_refresh >= RELAY_FILTER_REFRESH_US)
+    {
+        refresh_service_filter();
+        last_refresh = now;
+    }
+}
+
+uint64_t relay_deadline()
+{
+    return relay_fd >= 0 && pending ? first_pending + RELAY_MAX_DELAY_US : 0;
+}
+
+/* "0,17,256-259" */
+static int parse_pids(const char *list)
+{
+    const char *p = list;
+    while (*p)
+    {
+        char *end;
+        unsigned long first = strtoul(p, &end, 0);
+        unsigned long last = first;
+        if (end == p)
+            return -1;
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtoul(p, &end, 0);
+            if (end == p)
+                return -1;
+        }
+        if (first > last || last >= TS_MAX_PID)
+            return -1;
+        for (unsigned long pid = first; pid <= last; pid++)
+            pass[pid] = true;
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
+    }
+    return 0;
+}
+
+int relay_start(const stsmon_stream_t *stream, const char *target, const char *pids, int service_id,
+                const char *local_interface, const char *source_group, uint16_t source_port)
+{
+    char host[256];
+    const char *colon = strrchr(target, ':');
+    if (!colon || colon == target || (size_t)(colon - target) >= sizeof(host) || atoi(colon + 1) <= 0)
+    {
+        out_log(LogLevel_Error, "invalid relay address '%s'", target);
+        return -1;
+    }
+    memcpy(host, target, (size_t)(colon - target));
+    host[colon - target] = '\0';
+    int port = atoi(colon + 1);
+    /* With multicast loopback this would feed stsmon its own output */
+    if (strcmp(host, source_group) == 0 && port == source_port)
+    {
+        out_log(LogLevel_Error, "Relay destination %s is the monitored stream", target);
+        return -1;
+    }
+
+    memset(pass, 0, sizeof(pass));
+    filtered = false;
+    relay_service = -1;
+    relay_stream = stream;
+    if (pids && service_id >= 0)
+    {
+        out_log(LogLevel_Error, "Relay PID list and service cannot be combined");
+        return -1;
+    }
+    if (pids)
+    {
+        if (parse_pids(pids) != 0)
+        {
+            out_log(LogLevel_Error, "invalid relay PID list '%s'", pids);
+            return -1;
+        }
+        filtered = true;
+    }
+    if (service_id >= 0)
+    {
+        relay_service = service_id;
+        filtered = true;
+        refresh_service_filter();
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    int rc = getaddrinfo(host, colon + 1, &hints, &res);
+    if (rc != 0)
+    {
+        out_log(LogLevel_Error, "Cannot resolve relay address '%s': %s", target, gai_strerror(rc));
+        return -1;
+    }
+    relay_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (relay_fd < 0)
+    {
+        out_log(LogLevel_Error, "relay socket() failed: %s (%d)", strerror(errno), errno);
+        freeaddrinfo(res);
+        return -1;
+    }
+    if (local_interface && local_interface[0] != '\0')
+    {
+        struct in_addr iface;
+        iface.s_addr = inet_addr(local_interface);
+        setsockopt(relay_fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+    }
+    /* Connected, so sendmmsg needs no per-message address */
+    if (connect(relay_fd, res->ai_addr, res->ai_addrlen) < 0)
+    {
+        out_log(LogLevel_Error, "relay connect(%s) failed: %s (%d)", target, strerror(errno), errno);
+        close(relay_fd);
+        relay_fd = -1;
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    for (size_t i = 0; i < RELAY_BATCH; i++)
+    {
+        iovecs[i].iov_base = slots[i];
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    pending = 0;
+    if (relay_service >= 0)
+        out_log(LogLevel_Info, "Relaying service %d to %s", relay_service, target);
+    else
+        out_log(LogLevel_Info, "Relaying %s to %s", pids ? pids : "stream", target);
+    return 0;
+}
+
+void relay_stop()
+{
+    if (relay_fd < 0)
+        return;
+    flush_batch();
+    close(relay_fd);
+    relay_fd = -1;
+    if (dropped)
+        out_log(LogLevel_Warning, "Relay: %" PRIu64 " of %" PRIu64 " datagrams could not be sent",
+                dropped, sent + dropped);
+}
+#else
+int relay_start(const stsmon_stream_t *stream, const char *target, const char *pids, int service_id,
+                const char *local_interface, const char *source_group, uint16_t source_port)
+{
+    (void)stream;
+    (void)target;
+    (void)pids;
+    (void)service_id;
+    (void)local_interface;
+    (void)source_group;
+    (void)source_port;
+    out_log(LogLevel_Error, "Relay is not supported on this platform");
+    return -1;
+}
+
+void relay_stop()
+{
+}
+
+char *relay_buffer()
+{
+    return NULL;
+}
+
+void relay_packet(size_t len, uint64_t now)
+{
+    (void)len;
+    (void)now;
+}
+
+void relay_poll(uint64_t now)
+{
+    (void)now;
+}
+
+uint64_t relay_deadline()
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,52 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "stsmon.h"
+
+/* Receive buffer size the capture loop may use in a relay slot */
+#define RELAY_DATAGRAM_SIZE 2048
+
+/*
+ * Re-emit received datagrams to another multicast or unicast destination,
+ * "host:port". `pids` ("0,17,256-259") or `service_id` restrict what is
+ * relayed; with a service the PAT is replaced by one listing only that
+ * service, and the PMT and elementary PIDs follow the service's PMT.
+ * Without either the stream is relayed unchanged.
+ *
+ * The capture loop receives straight into the relay's next send slot
+ * (relay_buffer), packets are filtered in place and slots are sent in
+ * batches with sendmmsg, so relayed data is never copied. A batch is sent
+ * when full or RELAY_MAX_DELAY_US after its first datagram.
+ */
+#define RELAY_MAX_DELAY_US 2000
+
+/* `stream` is the monitored stream, service mode follows its PAT and PMTs */
+int relay_start(const stsmon_stream_t *stream, const char *target, const char *pids, int service_id,
+                const char *local_interface, const char *source_group, uint16_t source_port);
+void relay_stop();
+
+/* Capture thread: buffer of RELAY_DATAGRAM_SIZE bytes to receive into, NULL if not relaying */
+char *relay_buffer();
+/* Capture thread: the datagram in relay_buffer() has been processed */
+void relay_packet(size_t len, uint64_t now);
+/* Capture thread: send late batches, refresh the service filter */
+void relay_poll(uint64_t now);
+/* Time the pending batch must be sent by, 0 if none */
+uint64_t relay_deadline();
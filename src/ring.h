@@ -0,0 +1,51 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Bounded single-producer/single-consumer queue of fixed-size records.
+ * The producer (normally the capture loop) never blocks: when the ring is
+ * full `ring_reserve` returns NULL and the caller decides what to drop.
+ * Head and tail live on separate cache lines so the two threads do not
+ * bounce the same line on every record.
+ */
+typedef struct ring
+{
+    uint8_t *buffer;
+    size_t record_size;
+    size_t mask;
+    size_t head __attribute__((aligned(64)));
+    size_t tail __attribute__((aligned(64)));
+} ring_t;
+
+/* `capacity` is rounded up to a power of two. Returns 0 on success. */
+int ring_init(ring_t *ring, size_t record_size, size_t capacity);
+void ring_free(ring_t *ring);
+
+/* Producer side: get a free slot, fill it, then publish it with commit. */
+void *ring_reserve(ring_t *ring);
+void ring_commit(ring_t *ring);
+
+/* Consumer side: get the oldest record, then hand the slot back. */
+void *ring_peek(ring_t *ring);
+void ring_release(ring_t *ring);
+
+size_t ring_used(ring_t *ring);
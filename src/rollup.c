@@ -0,0 +1,113 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <pthread.h>
+#include "rollup.h"
+
+#define TS_PACKET_BITS (188 * 8)
+
+typedef struct rollup_ring
+{
+    uint64_t period;   /* microseconds */
+    size_t capacity;   /* closed periods kept */
+    rollup_sample_t *samples;
+    size_t head;       /* next slot to write */
+    size_t count;
+    rollup_sample_t current;
+} rollup_ring_t;
+
+/* 1 hour of seconds, 1 day of minutes, 30 days of hours */
+static rollup_sample_t samples_1s[3600];
+static rollup_sample_t samples_1min[1440];
+static rollup_sample_t samples_1h[720];
+
+static rollup_ring_t rings[ROLLUP_LEVELS] = {
+    [ROLLUP_1S] = {1000000ULL, 3600, samples_1s, 0, 0, {0}},
+    [ROLLUP_1MIN] = {60000000ULL, 1440, samples_1min, 0, 0, {0}},
+    [ROLLUP_1H] = {3600000000ULL, 720, samples_1h, 0, 0, {0}},
+};
+
+/* Held by the capture thread only while moving a period into a ring */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void rollup_merge(rollup_sample_t *dst, const rollup_sample_t *src)
+{
+    if (dst->ticks == 0 || src->bitrate_min < dst->bitrate_min)
+        dst->bitrate_min = src->bitrate_min;
+    if (dst->ticks == 0 || src->bitrate_max > dst->bitrate_max)
+        dst->bitrate_max = src->bitrate_max;
+    dst->duration += src->duration;
+    dst->ticks += src->ticks;
+    dst->packets += src->packets;
+    dst->data_packets += src->data_packets;
+    dst->cc_errors += src->cc_errors;
+    dst->sync_errors += src->sync_errors;
+    dst->tei_errors += src->tei_errors;
+}
+
+void rollup_add(uint64_t now, const rollup_sample_t *tick)
+{
+    for (int level = 0; level < ROLLUP_LEVELS; level++)
+    {
+        rollup_ring_t *r = &rings[level];
+        /* A tick ending exactly on a boundary belongs to the period before */
+        uint64_t start = (now - 1) / r->period * r->period;
+
+        if (r->current.ticks && r->current.start != start)
+        {
+            pthread_mutex_lock(&lock);
+            r->samples[r->head] = r->current;
+            r->head = (r->head + 1) % r->capacity;
+            if (r->count < r->capacity)
+                r->count++;
+            pthread_mutex_unlock(&lock);
+            memset(&r->current, 0, sizeof(r->current));
+        }
+        r->current.start = start;
+        rollup_merge(&r->current, tick);
+    }
+}
+
+bool rollup_last(rollup_level_t level, rollup_sample_t *out)
+{
+    return rollup_read(level, out, 1) == 1;
+}
+
+size_t rollup_read(rollup_level_t level, rollup_sample_t *out, size_t max)
+{
+    rollup_ring_t *r = &rings[level];
+    pthread_mutex_lock(&lock);
+    size_t n = r->count < max ? r->count : max;
+    for (size_t i = 0; i < n; i++)
+        out[i] = r->samples[(r->head + r->capacity - n + i) % r->capacity];
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+const char *rollup_name(rollup_level_t level)
+{
+    static const char *names[ROLLUP_LEVELS] = {"1s", "1m", "1h"};
+    return names[level];
+}
+
+double rollup_bitrate(const rollup_sample_t *s)
+{
+    if (s->duration == 0)
+        return 0;
+    return s->packets * TS_PACKET_BITS / (s->duration / 1000000.0);
+}
@@ -0,0 +1,64 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum rollup_level
+{
+    ROLLUP_1S,
+    ROLLUP_1MIN,
+    ROLLUP_1H,
+    ROLLUP_LEVELS
+} rollup_level_t;
+
+/*
+ * Statistics of one period. Also used to pass a single base interval
+ * tick to rollup_add(). Error counters are increases within the period.
+ */
+typedef struct rollup_sample
+{
+    uint64_t start;    /* period start, tsusecs() */
+    uint64_t duration; /* microseconds of ticks accumulated */
+    uint32_t ticks;
+    uint64_t packets;
+    uint64_t data_packets;
+    uint64_t cc_errors;
+    uint64_t sync_errors;
+    uint64_t tei_errors;
+    double bitrate_min; /* lowest and highest base interval bitrate */
+    double bitrate_max;
+} rollup_sample_t;
+
+/*
+ * Fold one base interval tick ending at `now` into all levels. Constant
+ * time: each level only keeps its current period open and moves it into
+ * a fixed-size ring once a tick falls into the next period. Periods
+ * shorter than the base interval simply receive one tick each.
+ */
+void rollup_add(uint64_t now, const rollup_sample_t *tick);
+
+/* Latest closed period of `level`, false if there is none yet */
+bool rollup_last(rollup_level_t level, rollup_sample_t *out);
+
+/* Copy up to `max` most recent closed periods, oldest first */
+size_t rollup_read(rollup_level_t level, rollup_sample_t *out, size_t max);
+
+const char *rollup_name(rollup_level_t level);
+double rollup_bitrate(const rollup_sample_t *s);
@@ -23,62 +23,78 @@
 #include <bitstream/mpeg/psi.h>
 #include <bitstream/dvb/si/desc_48.h>
 #pragma GCC diagnostic pop
-#include "pid.h"
+#include "stream.h"
 #include "services.h"
 #include "dvb.h"
-#include "output.h"
 
 /*
- * SDT section tables:
- * - `sdt_sections_next` accumulates incoming sections until a full table
+ * SDT section tables of the stream:
+ * - `sdt_next` accumulates incoming sections until a full table
  *   is available (managed via `psi_table_section`).
- * - When complete, `handle_sdt` swaps `sdt_sections_next` into
- *   `sdt_sections_current` and processes services. Keeping these as
- *   static makes them module-local and avoids exposing pointers.
+ * - When complete, `handle_sdt` swaps `sdt_next` into `sdt_current`
+ *   and processes services.
  */
-static PSI_TABLE_DECLARE(sdt_sections_current);
-static PSI_TABLE_DECLARE(sdt_sections_next);
-
-void sdt_cleanup()
+void sdt_cleanup(stsmon_stream_t *s)
 {
-    psi_table_free(sdt_sections_current);
-    psi_table_free(sdt_sections_next);
+    psi_table_free(s->sdt_current);
+    psi_table_free(s->sdt_next);
+    psi_table_init(s->sdt_current);
+    psi_table_init(s->sdt_next);
 }
 
-void handle_sdt()
+static void handle_sdt(stsmon_stream_t *s)
 {
     PSI_TABLE_DECLARE(old_sections);
-    uint8_t last_section = psi_table_get_lastsection(sdt_sections_next);
+    uint8_t last_section = psi_table_get_lastsection(s->sdt_next);
     uint8_t i;
 
-    if (psi_table_validate(sdt_sections_current) &&
-        psi_table_compare(sdt_sections_current, sdt_sections_next))
+    if (psi_table_validate(s->sdt_current) &&
+        psi_table_compare(s->sdt_current, s->sdt_next))
     {
         /* Identical SDT. Shortcut. */
-        psi_table_free(sdt_sections_next);
-        psi_table_init(sdt_sections_next);
+        psi_table_free(s->sdt_next);
+        psi_table_init(s->sdt_next);
         return;
     }
 
-    if (!sdt_table_validate(sdt_sections_next))
+    if (!sdt_table_validate(s->sdt_next))
     {
-        out_log(LogLevel_Error, "Invalid SDT received");
-        psi_table_free(sdt_sections_next);
-        psi_table_init(sdt_sections_next);
+        stream_log(s, STSMON_LOG_ERROR, "Invalid SDT received");
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_PSI_ERROR,
+                            .pid = SDT_PID,
+                            .service_id = STSMON_NONE,
+                            .table = "SDT",
+                        });
+        psi_table_free(s->sdt_next);
+        psi_table_init(s->sdt_next);
         return;
     }
 
     /* Switch tables. */
-    psi_table_copy(old_sections, sdt_sections_current);
-    psi_table_copy(sdt_sections_current, sdt_sections_next);
-    psi_table_init(sdt_sections_next);
+    psi_table_copy(old_sections, s->sdt_current);
+    psi_table_copy(s->sdt_current, s->sdt_next);
+    psi_table_init(s->sdt_next);
 
     /* Log the update (version and last_section of the newly installed table). */
-    out_log(LogLevel_Info, "SDT updated, version %u last_section %u", psi_table_get_version(sdt_sections_current), last_section);
+    stream_log(s, STSMON_LOG_INFO, "SDT updated, version %u last_section %u", psi_table_get_version(s->sdt_current), last_section);
+    stream_event(s, &(stsmon_event_t){
+                        .type = STSMON_EVENT_SDT_UPDATE,
+                        .pid = SDT_PID,
+                        .service_id = STSMON_NONE,
+                        .version = psi_table_get_version(s->sdt_current),
+                        .last_section = last_section,
+                    });
 
     for (i = 0; i <= last_section; i++)
     {
-        uint8_t *section = psi_table_get_section(sdt_sections_current, i);
+        uint8_t *section = psi_table_get_section(s->sdt_current, i);
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_SECTION,
+                            .pid = SDT_PID,
+                            .service_id = STSMON_NONE,
+                            .section = section,
+                        });
         /*
          * Iterate services in the SDT section. `sdt_get_service` returns
          * a pointer to the service descriptor within the section buffer.
@@ -91,7 +107,7 @@ void handle_sdt()
         {
             uint16_t sid = sdtn_get_sid(service);
             bool scrambled = sdtn_get_ca(service);
-            out_log(LogLevel_Info, "  Service SID: %u", sid);
+            stream_log(s, STSMON_LOG_INFO, "  Service SID: %u", sid);
             uint16_t k = 0;
             uint8_t *desc;
             while ((desc = descl_get_desc(sdtn_get_descs(service) + DESCS_HEADER_SIZE, descs_get_length(sdtn_get_descs(service)), k)) != NULL)
@@ -117,15 +133,25 @@ void handle_sdt()
                     char* service_name_decoded = dvb_string_decode(service_name, service_name_length);
 
                     
-                    out_log(LogLevel_Info, "    Service Descriptor:");
-                    out_log(LogLevel_Info, "      Service Type: 0x%02X", service_type);
-                    out_log(LogLevel_Info, "      Provider Name: %s", provider_name_decoded);
-                    out_log(LogLevel_Info, "      Service Name: %s", service_name_decoded);
+                    stream_log(s, STSMON_LOG_INFO, "    Service Descriptor:");
+                    stream_log(s, STSMON_LOG_INFO, "      Service Type: 0x%02X", service_type);
+                    stream_log(s, STSMON_LOG_INFO, "      Provider Name: %s", provider_name_decoded);
+                    stream_log(s, STSMON_LOG_INFO, "      Service Name: %s", service_name_decoded);
+
+                    stream_event(s, &(stsmon_event_t){
+                                        .type = STSMON_EVENT_SERVICE,
+                                        .pid = SDT_PID,
+                                        .service_id = sid,
+                                        .service_type = service_type,
+                                        .provider = provider_name_decoded,
+                                        .name = service_name_decoded,
+                                        .scrambled = scrambled,
+                                    });
 
                     /* Register or update the service name and scrambled flag.
                      * PMT PID is unknown here (0) so it will be set later by PAT processing.
                      */
-                    service_update(sid, (const char*)service_name_decoded, 0, scrambled);
+                    service_update(s, sid, (const char*)service_name_decoded, 0, scrambled);
                     free(provider_name_decoded);
                     free(service_name_decoded);
                 }
@@ -141,20 +167,24 @@ void handle_sdt()
         psi_table_free(old_sections);
 }
 
-void handle_sdt_section(uint16_t pid, uint8_t *section)
+void handle_sdt_section(stsmon_stream_t *s, uint16_t pid, uint8_t *section)
 {
     if (pid != SDT_PID || !sdt_validate(section))
     {
-        out_log(LogLevel_Error, "Invalid SDT section on PID %u", pid);
+        stream_log(s, STSMON_LOG_ERROR, "Invalid SDT section on PID %u", pid);
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_PSI_ERROR,
+                            .pid = pid,
+                            .service_id = STSMON_NONE,
+                            .table = "SDT",
+                        });
         free(section);
         return;
     }
 
-    if (!psi_table_section(sdt_sections_next, section))
-    {
-        free(section);
+    /* The table owns the section from here on, also while incomplete */
+    if (!psi_table_section(s->sdt_next, section))
         return;
-    }
 
-    handle_sdt();
+    handle_sdt(s);
 }
\ No newline at end of file
@@ -18,7 +18,7 @@
 #include "services.h"
 #include <string.h>
 #include <stdlib.h>
-#include "output.h"
+#include "stream.h"
 
 typedef struct service_entry_t
 {
@@ -32,18 +32,17 @@ typedef struct service_entry_t
 
 /*
  * Simple singly-linked list to hold discovered services.
- * The list head is `service_list`. New entries are pushed to the head
- * for simplicity (O(1) insert). This is sufficient for a small number
- * of services typical in monitoring tools.
+ * The list head is `services` of the stream. New entries are pushed to
+ * the head for simplicity (O(1) insert). This is sufficient for a small
+ * number of services typical in monitoring tools.
  */
-static service_entry_t *service_list = NULL;
 
-static service_entry_t *_service_get(uint16_t service_id)
+static service_entry_t *_service_get(stsmon_stream_t *s, uint16_t service_id)
 {
     if(service_id == 0)
-        return service_list;
+        return s->services;
 
-    service_entry_t *se = service_list;
+    service_entry_t *se = s->services;
     while (se)
     {
         if (se->service_id == service_id)
@@ -55,9 +54,9 @@ static service_entry_t *_service_get(uint16_t service_id)
     return NULL;
 }
 
-static service_entry_t *_service_get_or_create(uint16_t service_id)
+static service_entry_t *_service_get_or_create(stsmon_stream_t *s, uint16_t service_id)
 {
-    service_entry_t *se = _service_get(service_id);
+    service_entry_t *se = _service_get(s, service_id);
     if (se)
     {
         return se;
@@ -69,20 +68,20 @@ static service_entry_t *_service_get_or_create(uint16_t service_id)
     service_entry_t *new_se = malloc(sizeof(service_entry_t));
     if(new_se == NULL)
     {
-        out_log(LogLevel_Error, "Failed to allocate memory for new service entry");
+        stream_log(s, STSMON_LOG_ERROR, "Failed to allocate memory for new service entry");
         abort();
     }
     memset(new_se, 0, sizeof(service_entry_t));
     new_se->service_id = service_id;
     new_se->pmt_version = 0xff;
-    new_se->next = service_list;
-    service_list = new_se;
+    new_se->next = s->services;
+    s->services = new_se;
     return new_se;
 }
 
-void service_update(uint16_t service_id, const char* name, uint16_t pmt_pid, bool scrambled)
+void service_update(stsmon_stream_t *s, uint16_t service_id, const char* name, uint16_t pmt_pid, bool scrambled)
 {
-    service_entry_t *se = _service_get_or_create(service_id);
+    service_entry_t *se = _service_get_or_create(s, service_id);
     if (name)
     {
         if (se->name)
@@ -92,17 +91,19 @@ void service_update(uint16_t service_id, const char* name, uint16_t pmt_pid, boo
         se->name = strdup(name);
         if(se->name == NULL)
         {
-            out_log(LogLevel_Error, "Failed to allocate memory for service name");
+            stream_log(s, STSMON_LOG_ERROR, "Failed to allocate memory for service name");
             abort();
         }
     }
-    se->pmt_pid = pmt_pid;
+    /* SDT does not know the PMT PID, keep the one learned from PAT */
+    if (pmt_pid)
+        se->pmt_pid = pmt_pid;
     se->scrambled = scrambled;
 }
 
-uint16_t service_get_pmt_pid(uint16_t service_id)
+uint16_t service_get_pmt_pid(stsmon_stream_t *s, uint16_t service_id)
 {
-    service_entry_t *se = _service_get(service_id);
+    service_entry_t *se = _service_get(s, service_id);
     if (!se)
     {
         return 0;
@@ -110,15 +111,15 @@ uint16_t service_get_pmt_pid(uint16_t service_id)
     return se->pmt_pid;
 }
 
-void service_set_pmt_pid(uint16_t service_id, uint16_t pmt_pid)
+void service_set_pmt_pid(stsmon_stream_t *s, uint16_t service_id, uint16_t pmt_pid)
 {
-    service_entry_t *se = _service_get_or_create(service_id);
+    service_entry_t *se = _service_get_or_create(s, service_id);
     se->pmt_pid = pmt_pid;
 }
 
-const char* service_get_name(uint16_t service_id)
+const char* service_get_name(stsmon_stream_t *s, uint16_t service_id)
 {
-    service_entry_t *se = _service_get(service_id);
+    service_entry_t *se = _service_get(s, service_id);
     if (!se)
     {
         return NULL;
@@ -126,9 +127,9 @@ const char* service_get_name(uint16_t service_id)
     return se->name ? se->name : "";
 }
 
-void service_set_name(uint16_t service_id, const char* name)
+void service_set_name(stsmon_stream_t *s, uint16_t service_id, const char* name)
 {
-    service_entry_t *se = _service_get_or_create(service_id);
+    service_entry_t *se = _service_get_or_create(s, service_id);
     if (se->name)
     {
         free(se->name);
@@ -136,14 +137,14 @@ void service_set_name(uint16_t service_id, const char* name)
     se->name = strdup(name);
     if(se->name == NULL)
     {
-        out_log(LogLevel_Error, "Failed to allocate memory for service name");
+        stream_log(s, STSMON_LOG_ERROR, "Failed to allocate memory for service name");
         abort();
     }
 }
 
-bool service_scrambled(uint16_t service_id)
+bool service_scrambled(stsmon_stream_t *s, uint16_t service_id)
 {
-    service_entry_t *se = _service_get(service_id);
+    service_entry_t *se = _service_get(s, service_id);
     if (!se)
     {
         return false;
@@ -151,15 +152,15 @@ bool service_scrambled(uint16_t service_id)
     return se->scrambled;
 }
 
-void service_set_scrambled(uint16_t service_id, bool scrambled)
+void service_set_scrambled(stsmon_stream_t *s, uint16_t service_id, bool scrambled)
 {
-    service_entry_t *se = _service_get_or_create(service_id);
+    service_entry_t *se = _service_get_or_create(s, service_id);
     se->scrambled = scrambled;
 }
 
-uint8_t service_get_pmt_version(uint16_t service_id)
+uint8_t service_get_pmt_version(stsmon_stream_t *s, uint16_t service_id)
 {
-    service_entry_t *se = _service_get(service_id);
+    service_entry_t *se = _service_get(s, service_id);
     if (!se)
     {
         return 0xff;
@@ -167,16 +168,24 @@ uint8_t service_get_pmt_version(uint16_t service_id)
     return se->pmt_version;
 }
 
-void service_set_pmt_version(uint16_t service_id, uint8_t version)
+void service_set_pmt_version(stsmon_stream_t *s, uint16_t service_id, uint8_t version)
 {
-    service_entry_t *se = _service_get_or_create(service_id);
+    service_entry_t *se = _service_get_or_create(s, service_id);
     se->pmt_version = version;
 }
 
-size_t service_count()
+uint16_t stsmon_stream_pmt_pid(const stsmon_stream_t *s, uint16_t service_id)
+{
+    const service_entry_t *se = s->services;
+    while (se && se->service_id != service_id)
+        se = se->next;
+    return se ? se->pmt_pid : 0;
+}
+
+size_t stsmon_stream_service_count(const stsmon_stream_t *s)
 {
     size_t count = 0;
-    service_entry_t *se = service_list;
+    const service_entry_t *se = s->services;
     while (se)
     {
         count++;
@@ -185,9 +194,26 @@ size_t service_count()
     return count;
 }
 
-void service_free(uint16_t service_id)
+size_t stsmon_stream_services(const stsmon_stream_t *s, stsmon_service_info_t *out, size_t max)
+{
+    size_t count = 0;
+    const service_entry_t *se = s->services;
+    while (se && count < max)
+    {
+        stsmon_service_info_t *si = &out[count++];
+        si->service_id = se->service_id;
+        si->pmt_pid = se->pmt_pid;
+        si->pmt_version = se->pmt_version;
+        si->scrambled = se->scrambled;
+        si->name = se->name;
+        se = se->next;
+    }
+    return count;
+}
+
+void service_free(stsmon_stream_t *s, uint16_t service_id)
 {
-    service_entry_t **se_ptr = &service_list;
+    service_entry_t **se_ptr = &s->services;
     while (*se_ptr)
     {
         if ((*se_ptr)->service_id == service_id)
@@ -205,9 +231,9 @@ void service_free(uint16_t service_id)
     }
 }
 
-void service_free_all()
+void service_free_all(stsmon_stream_t *s)
 {
-    service_entry_t *se = service_list;
+    service_entry_t *se = s->services;
     while (se)
     {
         service_entry_t *to_free = se;
@@ -218,5 +244,5 @@ void service_free_all()
         }
         free(to_free);
     }
-    service_list = NULL;
+    s->services = NULL;
 }
\ No newline at end of file
@@ -24,6 +24,7 @@
 #pragma GCC diagnostic ignored "-Wformat-extra-args"
 #include <bitstream/mpeg/psi.h>
 #pragma GCC diagnostic pop
+#include "stsmon.h"
 
 typedef struct service_psi_buffer_t
 {
@@ -32,21 +33,19 @@ typedef struct service_psi_buffer_t
     PSI_TABLE_DECLARE(next);
 } service_psi_buffer_t;
 
-void service_update(uint16_t service_id, const char* name, uint16_t pmt_pid, bool scrambled);
+void service_update(stsmon_stream_t *s, uint16_t service_id, const char* name, uint16_t pmt_pid, bool scrambled);
 
-uint16_t service_get_pmt_pid(uint16_t service_id);
-void service_set_pmt_pid(uint16_t service_id, uint16_t pmt_pid);
+uint16_t service_get_pmt_pid(stsmon_stream_t *s, uint16_t service_id);
+void service_set_pmt_pid(stsmon_stream_t *s, uint16_t service_id, uint16_t pmt_pid);
 
-const char* service_get_name(uint16_t service_id);
-void service_set_name(uint16_t service_id, const char* name);
+const char* service_get_name(stsmon_stream_t *s, uint16_t service_id);
+void service_set_name(stsmon_stream_t *s, uint16_t service_id, const char* name);
 
-bool service_scrambled(uint16_t service_id);
-void service_set_scrambled(uint16_t service_id, bool scrambled);
+bool service_scrambled(stsmon_stream_t *s, uint16_t service_id);
+void service_set_scrambled(stsmon_stream_t *s, uint16_t service_id, bool scrambled);
 
-uint8_t service_get_pmt_version(uint16_t service_id);
-void service_set_pmt_version(uint16_t service_id, uint8_t version);
+uint8_t service_get_pmt_version(stsmon_stream_t *s, uint16_t service_id);
+void service_set_pmt_version(stsmon_stream_t *s, uint16_t service_id, uint8_t version);
 
-size_t service_count();
-
-void service_free(uint16_t service_id);
-void service_free_all();
\ No newline at end of file
+void service_free(stsmon_stream_t *s, uint16_t service_id);
+void service_free_all(stsmon_stream_t *s);
\ No newline at end of file
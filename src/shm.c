@@ -0,0 +1,188 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "shm.h"
+#include "stsmon_shm.h"
+#include "output.h"
+
+#ifdef WIN32
+
+int shm_open_segment(const char *name, const char *stream)
+{
+    (void)name;
+    (void)stream;
+    out_log(LogLevel_Error, "Shared memory statistics are not supported on this platform");
+    return -1;
+}
+
+void shm_update(const stats_snapshot_t *s)
+{
+    (void)s;
+}
+
+void shm_close_segment()
+{
+}
+
+#else
+
+static stsmon_shm_header_t *header = NULL;
+static stsmon_shm_pid_t *pids = NULL;
+static stsmon_shm_service_t *services = NULL;
+static char segment_name[256];
+
+/* Writer side of the per-record sequence lock */
+static void seq_begin(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void seq_end(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+int shm_open_segment(const char *name, const char *stream)
+{
+    if (name[0] == '/')
+        snprintf(segment_name, sizeof(segment_name), "%s", name);
+    else
+        snprintf(segment_name, sizeof(segment_name), "/%s", name);
+
+    int fd = shm_open(segment_name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        out_log(LogLevel_Error, "shm_open('%s') failed: %s (%d)", segment_name, strerror(errno), errno);
+        return -1;
+    }
+    if (ftruncate(fd, STSMON_SHM_SIZE) < 0)
+    {
+        out_log(LogLevel_Error, "ftruncate('%s') failed: %s (%d)", segment_name, strerror(errno), errno);
+        close(fd);
+        return -1;
+    }
+    void *base = mmap(NULL, STSMON_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        out_log(LogLevel_Error, "mmap('%s') failed: %s (%d)", segment_name, strerror(errno), errno);
+        return -1;
+    }
+
+    /* Readers treat the segment as invalid until magic is set */
+    memset(base, 0, STSMON_SHM_SIZE);
+    header = base;
+    pids = (stsmon_shm_pid_t *)((uint8_t *)base + sizeof(stsmon_shm_header_t));
+    services = (stsmon_shm_service_t *)(pids + STSMON_SHM_MAX_PIDS);
+
+    header->version = STSMON_SHM_VERSION;
+    header->header_size = sizeof(stsmon_shm_header_t);
+    header->pid_record_size = sizeof(stsmon_shm_pid_t);
+    header->service_record_size = sizeof(stsmon_shm_service_t);
+    header->pid_offset = (uint32_t)((uint8_t *)pids - (uint8_t *)base);
+    header->service_offset = (uint32_t)((uint8_t *)services - (uint8_t *)base);
+    header->max_pids = STSMON_SHM_MAX_PIDS;
+    header->max_services = STSMON_SHM_MAX_SERVICES;
+    header->writer_pid = (uint32_t)getpid();
+    header->running = 1;
+    snprintf(header->stream, sizeof(header->stream), "%s", stream);
+    for (int i = 0; i < STSMON_SHM_MAX_PIDS; i++)
+        pids[i].pid = (uint16_t)i;
+    __atomic_store_n(&header->magic, STSMON_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    out_log(LogLevel_Info, "Publishing statistics in shared memory '%s'", segment_name);
+    return 0;
+}
+
+void shm_update(const stats_snapshot_t *s)
+{
+    if (header == NULL)
+        return;
+
+    stsmon_shm_stream_t *st = &header->stream_stats;
+    seq_begin(&st->seq);
+    st->pid_count = (uint32_t)s->pid_count;
+    st->service_count = (uint32_t)s->service_count;
+    st->timestamp_us = s->timestamp;
+    st->start_time_us = s->start_time;
+    st->last_packet_us = s->last_packet;
+    st->packets_all = s->packets_all;
+    st->packets_data = s->packets_data;
+    st->cc_errors = s->cc_errors;
+    st->sync_errors = s->sync_errors;
+    st->tei_errors = s->tei_errors;
+    st->socket_drops = s->socket_drops;
+    st->csv_drops = s->csv_drops;
+    st->bitrate_bps = (uint64_t)s->bitrate;
+    st->data_bitrate_bps = (uint64_t)s->data_bitrate;
+    seq_end(&st->seq);
+
+    /* Snapshot only lists PIDs that have seen packets, which never go away */
+    for (size_t i = 0; i < s->pid_count; i++)
+    {
+        const stats_pid_t *sp = &s->pids[i];
+        stsmon_shm_pid_t *rec = &pids[sp->pid];
+        seq_begin(&rec->seq);
+        rec->flags = STSMON_SHM_PID_PRESENT |
+                     (sp->is_psi ? STSMON_SHM_PID_PSI : 0) |
+                     (sp->is_data ? STSMON_SHM_PID_DATA : 0);
+        rec->service_id = sp->service_id;
+        rec->packets = sp->packets;
+        rec->cc_errors = sp->cc_errors;
+        rec->tei_errors = sp->tei_errors;
+        rec->bitrate_bps = (uint64_t)sp->bitrate;
+        seq_end(&rec->seq);
+    }
+
+    for (size_t i = 0; i < s->service_count && i < STSMON_SHM_MAX_SERVICES; i++)
+    {
+        const stats_service_t *ss = &s->services[i];
+        stsmon_shm_service_t *rec = &services[i];
+        seq_begin(&rec->seq);
+        rec->service_id = ss->service_id;
+        rec->pmt_pid = ss->pmt_pid;
+        rec->pmt_version = ss->pmt_version;
+        rec->scrambled = ss->scrambled;
+        memcpy(rec->name, ss->name, sizeof(rec->name));
+        rec->name[sizeof(rec->name) - 1] = '\0';
+        seq_end(&rec->seq);
+    }
+}
+
+void shm_close_segment()
+{
+    if (header == NULL)
+        return;
+    __atomic_store_n(&header->running, 0, __ATOMIC_RELEASE);
+    munmap(header, STSMON_SHM_SIZE);
+    shm_unlink(segment_name);
+    header = NULL;
+    pids = NULL;
+    services = NULL;
+}
+
+#endif
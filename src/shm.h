@@ -0,0 +1,28 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "stats.h"
+
+/*
+ * Publish live counters into a POSIX shared-memory segment, layout is
+ * described in stsmon_shm.h. `shm_update` is called from the capture
+ * thread right after a statistics snapshot has been published.
+ */
+int shm_open_segment(const char *name, const char *stream);
+void shm_update(const stats_snapshot_t *s);
+void shm_close_segment();
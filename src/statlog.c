@@ -0,0 +1,259 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "statlog.h"
+#include "binlog.h"
+#include "logfile.h"
+#include "ring.h"
+#include "output.h"
+
+/* Queue depth in records, at the default 10 s interval this is ~3 hours */
+#define STATLOG_QUEUE_SIZE 1024
+/* Records are formatted into this buffer and written with one fwrite */
+#define STATLOG_BATCH_SIZE 65536
+/* How long the writer sleeps when the queue is empty */
+#define STATLOG_POLL_US 50000
+
+static ring_t queue;
+/* Records from several capture threads (see workers.c) are queued one at a time */
+static pthread_mutex_t push_lock = PTHREAD_MUTEX_INITIALIZER;
+static logfile_t *csv_logs = NULL;
+static size_t csv_count = 0;
+static pthread_t writer_thread;
+static bool writer_running = false;
+static bool binlog_enabled = false;
+static int writer_stop = 0;
+static unsigned fsync_every = 0;
+static uint64_t dropped = 0;
+
+static void statlog_sync()
+{
+    if (binlog_enabled)
+        binlog_sync();
+    for (size_t i = 0; i < csv_count; i++)
+        logfile_sync(&csv_logs[i]);
+}
+
+static size_t statlog_format(char *buf, size_t size, const stat_record_t *rec)
+{
+    char ts[32];
+    /* Whole seconds unless the interval is shorter than that */
+    if (rec->interval_ms < 1000)
+        snprintf(ts, sizeof(ts), "%" PRIu64 ".%03u", rec->timestamp / 1000, (unsigned)(rec->timestamp % 1000));
+    else
+        snprintf(ts, sizeof(ts), "%" PRIu64, rec->timestamp / 1000);
+
+    int n = snprintf(buf, size, "%s,%.2f,%.2f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+                     ts,
+                     rec->bitrate / 1000.0,
+                     rec->data_bitrate / 1000.0,
+                     rec->cc_errors,
+                     rec->sync_errors,
+                     rec->tei_errors,
+                     rec->packets,
+                     rec->data_packets);
+    if (n < 0 || (size_t)n >= size)
+        return 0;
+#ifdef STSMON_PROFILE
+    int p = profile_csv_format(buf + n, size - (size_t)n, rec->profile);
+    if (p < 0 || (size_t)(n + p) >= size)
+        return 0;
+    n += p;
+#endif
+    if ((size_t)n + 1 >= size)
+        return 0;
+    buf[n++] = '\n';
+    buf[n] = '\0';
+    return (size_t)n;
+}
+
+static void *statlog_writer(void *arg)
+{
+    (void)arg;
+    static char batch[STATLOG_BATCH_SIZE];
+    time_t last_sync = time(NULL);
+    bool unsynced = false;
+
+    while (1)
+    {
+        bool stopping = __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE);
+        size_t used = 0;
+        size_t sink = 0;
+        stat_record_t *rec;
+
+        /* Drain as much as fits into one batch for one file */
+        while ((rec = ring_peek(&queue)) != NULL)
+        {
+            if (rec->sink < csv_count)
+            {
+                if (used > 0 && rec->sink != sink)
+                    break;
+                size_t n = statlog_format(batch + used, sizeof(batch) - used, rec);
+                if (n == 0)
+                    break;
+                used += n;
+                sink = rec->sink;
+            }
+            if (binlog_enabled)
+            {
+                binlog_append(rec);
+                unsynced = true;
+            }
+            ring_release(&queue);
+        }
+
+        for (size_t i = 0; i < csv_count; i++)
+            logfile_check(&csv_logs[i]);
+        if (used > 0)
+        {
+            if (logfile_write(&csv_logs[sink], batch, used) != 0)
+                out_log(LogLevel_Error, "CSV write failed: %s: %s (%d)", csv_logs[sink].path, strerror(errno), errno);
+            unsynced = true;
+        }
+
+        if (fsync_every && unsynced && time(NULL) - last_sync >= (time_t)fsync_every)
+        {
+            statlog_sync();
+            last_sync = time(NULL);
+            unsynced = false;
+        }
+
+        if (stopping && ring_used(&queue) == 0)
+            break;
+        if (ring_used(&queue) == 0)
+            usleep(STATLOG_POLL_US);
+    }
+
+    if (fsync_every && unsynced)
+        statlog_sync();
+    return NULL;
+}
+
+int statlog_open(const char *path, const char *binlog_path, unsigned fsync_interval)
+{
+    return statlog_open_files(path ? &path : NULL, path ? 1 : 0, binlog_path, fsync_interval);
+}
+
+int statlog_open_files(const char *const *paths, size_t count, const char *binlog_path, unsigned fsync_interval)
+{
+#ifdef STSMON_PROFILE
+    static const char header[] = "Timestamp,Bitrate (kbps),Data Bitrate (kbps),CC Errors,Sync Errors,TEI Errors,Total Packets,Data Packets" PROFILE_CSV_HEADER "\n";
+#else
+    static const char header[] = "Timestamp,Bitrate (kbps),Data Bitrate (kbps),CC Errors,Sync Errors,TEI Errors,Total Packets,Data Packets\n";
+#endif
+
+    if (count)
+    {
+        csv_logs = calloc(count, sizeof(*csv_logs));
+        if (!csv_logs)
+        {
+            out_log(LogLevel_Error, "Failed to allocate CSV files");
+            return -1;
+        }
+        for (; csv_count < count; csv_count++)
+        {
+            if (logfile_open(&csv_logs[csv_count], paths[csv_count], header) != 0)
+            {
+                logfile_close(&csv_logs[csv_count]);
+                statlog_close();
+                return -1;
+            }
+        }
+    }
+
+    if (binlog_path)
+    {
+        if (binlog_open(binlog_path) != 0)
+        {
+            statlog_close();
+            return -1;
+        }
+        binlog_enabled = true;
+    }
+
+    if (ring_init(&queue, sizeof(stat_record_t), STATLOG_QUEUE_SIZE) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to allocate CSV queue");
+        statlog_close();
+        return -1;
+    }
+
+    fsync_every = fsync_interval;
+    writer_stop = 0;
+    if (pthread_create(&writer_thread, NULL, statlog_writer, NULL) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to start CSV writer thread");
+        statlog_close();
+        return -1;
+    }
+    writer_running = true;
+    return 0;
+}
+
+bool statlog_push(const stat_record_t *rec)
+{
+    if (!writer_running)
+        return false;
+
+    pthread_mutex_lock(&push_lock);
+    stat_record_t *slot = ring_reserve(&queue);
+    if (slot == NULL)
+    {
+        dropped++;
+        pthread_mutex_unlock(&push_lock);
+        return false;
+    }
+    *slot = *rec;
+    ring_commit(&queue);
+    pthread_mutex_unlock(&push_lock);
+    return true;
+}
+
+uint64_t statlog_dropped()
+{
+    return dropped;
+}
+
+void statlog_close()
+{
+    if (writer_running)
+    {
+        __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(writer_thread, NULL);
+        writer_running = false;
+    }
+    for (size_t i = 0; i < csv_count; i++)
+        logfile_close(&csv_logs[i]);
+    free(csv_logs);
+    csv_logs = NULL;
+    csv_count = 0;
+    if (binlog_enabled)
+        binlog_close();
+    binlog_enabled = false;
+    ring_free(&queue);
+
+    if (dropped)
+        out_log(LogLevel_Warning, "Statistics writer could not keep up, %" PRIu64 " records dropped", dropped);
+}
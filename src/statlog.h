@@ -0,0 +1,58 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "profile.h"
+
+/*
+ * One statistics interval as produced by the capture loop. Error counters
+ * are cumulative, packet counters cover the interval only (this matches
+ * the CSV columns).
+ */
+typedef struct stat_record
+{
+    uint64_t timestamp;   /* unix milliseconds */
+    uint32_t interval_ms; /* configured statistics interval */
+    double bitrate;       /* bits per second */
+    double data_bitrate;
+    uint64_t cc_errors;
+    uint64_t sync_errors;
+    uint64_t tei_errors;
+    uint64_t packets;
+    uint64_t data_packets;
+    uint16_t sink; /* CSV file, index into `paths` of statlog_open_files() */
+#ifdef STSMON_PROFILE
+    double profile[PROFILE_STAGES + 1]; /* per packet, see profile.h */
+#endif
+} stat_record_t;
+
+/*
+ * Statistics log runs on its own thread. The capture loop only copies a
+ * record into a bounded queue, formatting and disk I/O happen on the
+ * writer thread. `path` "-" means stdout. `binlog_path` additionally
+ * (or instead, with `path` NULL) writes the binary log from binlog.h.
+ * `fsync_interval` is in seconds, 0 disables fsync.
+ */
+int statlog_open(const char *path, const char *binlog_path, unsigned fsync_interval);
+/* Several CSV files on the same writer thread, records choose one by `sink` */
+int statlog_open_files(const char *const *paths, size_t count, const char *binlog_path, unsigned fsync_interval);
+bool statlog_push(const stat_record_t *rec);
+uint64_t statlog_dropped();
+void statlog_close();
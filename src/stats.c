@@ -0,0 +1,64 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stddef.h>
+#include <sched.h>
+#include "stats.h"
+
+static stats_snapshot_t snapshot;
+static unsigned seq = 0;
+
+stats_snapshot_t *stats_write_begin()
+{
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return &snapshot;
+}
+
+void stats_write_end()
+{
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+void stats_read(stats_snapshot_t *out)
+{
+    while (1)
+    {
+        unsigned begin = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        if (begin & 1)
+        {
+            sched_yield();
+            continue;
+        }
+
+        /* Copy only the valid part of the arrays */
+        memcpy(out, &snapshot, offsetof(stats_snapshot_t, pids));
+        size_t pid_count = out->pid_count < TS_MAX_PID ? out->pid_count : TS_MAX_PID;
+        size_t service_count = out->service_count < STATS_MAX_SERVICES ? out->service_count : STATS_MAX_SERVICES;
+        memcpy(out->pids, snapshot.pids, pid_count * sizeof(stats_pid_t));
+        memcpy(out->services, snapshot.services, service_count * sizeof(stats_service_t));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seq, __ATOMIC_RELAXED) == begin)
+        {
+            out->pid_count = pid_count;
+            out->service_count = service_count;
+            return;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "pid.h"
+#include "rollup.h"
+
+#define STATS_MAX_SERVICES 256
+#define STATS_NAME_SIZE 64
+
+typedef struct stats_pid
+{
+    uint16_t pid;
+    uint16_t service_id; /* 0 when not referenced by any PMT */
+    bool is_psi;
+    bool is_data;
+    uint64_t packets;
+    uint64_t cc_errors;
+    uint64_t tei_errors;
+    double bitrate; /* over the last publish period */
+} stats_pid_t;
+
+typedef struct stats_service
+{
+    uint16_t service_id;
+    uint16_t pmt_pid;
+    uint8_t pmt_version;
+    bool scrambled;
+    char name[STATS_NAME_SIZE];
+} stats_service_t;
+
+/*
+ * Point-in-time copy of everything the monitor knows. Only the first
+ * `pid_count` entries of `pids` and `service_count` entries of `services`
+ * are valid.
+ */
+typedef struct stats_snapshot
+{
+    char stream[STATS_NAME_SIZE]; /* "group:port" */
+    uint64_t timestamp;           /* tsusecs() at publish time */
+    uint64_t start_time;          /* first packet, 0 if none yet */
+    uint64_t last_packet;
+    uint64_t packets_all;
+    uint64_t packets_data;
+    uint64_t cc_errors;
+    uint64_t sync_errors;
+    uint64_t tei_errors;
+    uint64_t socket_drops; /* datagrams dropped by the kernel */
+    uint64_t csv_drops;    /* rows dropped by the CSV writer */
+    double bitrate;
+    double data_bitrate;
+    char alarm[8]; /* status label of the worst active alarm, "" if none */
+    bool alarm_critical;
+    uint32_t alarms_active;
+    uint64_t alarms_raised;
+    rollup_sample_t rollups[ROLLUP_LEVELS]; /* last closed period, ticks 0 if none */
+    size_t pid_count;
+    size_t service_count;
+    stats_pid_t pids[TS_MAX_PID];
+    stats_service_t services[STATS_MAX_SERVICES];
+} stats_snapshot_t;
+
+/*
+ * The snapshot is protected by a sequence lock. The capture thread is the
+ * only writer and never waits; readers copy the snapshot out and retry if
+ * it changed underneath them.
+ */
+stats_snapshot_t *stats_write_begin();
+void stats_write_end();
+void stats_read(stats_snapshot_t *out);
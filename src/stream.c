@@ -0,0 +1,396 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat"
+#pragma GCC diagnostic ignored "-Wformat-extra-args"
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/mpeg/psi.h>
+#include <bitstream/mpeg/psi/pat.h>
+#include <bitstream/mpeg/psi/pmt.h>
+#include <bitstream/dvb/si/sdt.h>
+#pragma GCC diagnostic pop
+
+#include "stream.h"
+#include "services.h"
+#include "profile.h"
+
+/* PCR offsets moving by more than this (us) are a discontinuity or a wrap, not jitter */
+#define PCR_JUMP 100000
+
+void stream_event(stsmon_stream_t *s, stsmon_event_t *event)
+{
+    if (!s->callbacks.event)
+        return;
+    event->now = s->now;
+    s->callbacks.event(s->opaque, event);
+}
+
+void stream_log(stsmon_stream_t *s, stsmon_log_level_t level, const char *fmt, ...)
+{
+    if (!s->callbacks.log)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    s->callbacks.log(s->opaque, level, fmt, ap);
+    va_end(ap);
+}
+
+static void pid_init(stsmon_stream_t *s)
+{
+    for (int i = 0; i < TS_MAX_PID; i++)
+    {
+        ts_pid_t *pe = &s->pids[i];
+        psi_assemble_reset(&pe->psi_buffer, &pe->psi_buffer_used);
+        memset(pe, 0, sizeof(*pe));
+        pe->last_cc = 0xFF;
+    }
+    s->pids[PAT_PID].is_psi = true; // PAT PID
+    s->pids[SDT_PID].is_psi = true; // SDT PID
+}
+
+stsmon_stream_t *stsmon_stream_new(const stsmon_callbacks_t *callbacks, void *opaque)
+{
+    stsmon_stream_t *s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+    if (callbacks)
+        s->callbacks = *callbacks;
+    s->opaque = opaque;
+    psi_table_init(s->pat_current);
+    psi_table_init(s->pat_next);
+    psi_table_init(s->sdt_current);
+    psi_table_init(s->sdt_next);
+    pid_init(s);
+    s->pcr_interval = 1;
+    return s;
+}
+
+void stsmon_stream_reset(stsmon_stream_t *s)
+{
+    pid_init(s);
+    pat_cleanup(s);
+    sdt_cleanup(s);
+    service_free_all(s);
+    memset(&s->counters, 0, sizeof(s->counters));
+    memset(&s->last_counters, 0, sizeof(s->last_counters));
+    s->last_stats = 0;
+    s->last_feed = 0;
+    s->max_iat = 0;
+    s->last_pat = 0;
+    s->pat_interval = 0;
+    s->pcr_interval = 1;
+    s->pcr_jitter = 0;
+    memset(s->profile_ticks, 0, sizeof(s->profile_ticks));
+}
+
+void stsmon_stream_free(stsmon_stream_t *s)
+{
+    if (!s)
+        return;
+    stsmon_stream_reset(s);
+    free(s);
+}
+
+static void handle_section(stsmon_stream_t *s, uint16_t pid, uint8_t *section)
+{
+    /*
+     * Dispatch a fully assembled and validated PSI/SI section to the
+     * appropriate handler based on its table id. Note ownership rules:
+     * - `section` is a heap buffer returned by `psi_assemble_payload`.
+     * - Handlers take ownership of `section` and must free it if they
+     *   do not keep a reference to it (see `handle_pat_section`, etc.).
+     * - For unknown table ids we free the section here to avoid leaks.
+     */
+    switch (psi_get_tableid(section))
+    {
+    case PAT_TABLE_ID:
+        if (pid == PAT_PID)
+        {
+            if (s->last_pat && s->now > s->last_pat && s->now - s->last_pat > s->pat_interval)
+                s->pat_interval = s->now - s->last_pat;
+            s->last_pat = s->now;
+        }
+        handle_pat_section(s, pid, section);
+        break;
+    case PMT_TABLE_ID:
+        handle_pmt(s, pid, section);
+        break;
+    case SDT_TABLE_ID_ACTUAL:
+        handle_sdt_section(s, pid, section);
+        break;
+    default:
+        // Unhandled table
+        free(section);
+        break;
+    }
+}
+
+/* Validate and dispatch an assembled section, false if it was invalid */
+static bool section_complete(stsmon_stream_t *s, uint16_t pid, ts_pid_t *pe, uint8_t *section)
+{
+    if (!psi_validate(section))
+    {
+        // Invalid PSI section, discard
+        stream_event(s, &(stsmon_event_t){
+                            .type = STSMON_EVENT_PSI_ERROR,
+                            .pid = pid,
+                            .service_id = pe->service_id ? pe->service_id : STSMON_NONE,
+                            .table_id = psi_get_tableid(section),
+                        });
+        psi_assemble_reset(&pe->psi_buffer, &pe->psi_buffer_used);
+        free(section);
+        return false;
+    }
+    handle_section(s, pid, section);
+    return true;
+}
+
+/*
+ * Track the difference between the PCR and the arrival time of its
+ * packet. Its range within an interval is the jitter the network and
+ * the sender added (plus the clock drift between sender and receiver).
+ */
+static void pcr_arrival(stsmon_stream_t *s, ts_pid_t *pe, const uint8_t *ts_packet)
+{
+    uint64_t pcr = tsaf_get_pcr(ts_packet) * 300 + tsaf_get_pcrext(ts_packet); /* 27 MHz */
+    int64_t offset = (int64_t)(pcr / 27) - (int64_t)s->now;
+
+    if (pe->pcr_interval != s->pcr_interval ||
+        offset - pe->pcr_offset > PCR_JUMP || pe->pcr_offset - offset > PCR_JUMP)
+    {
+        pe->pcr_interval = s->pcr_interval;
+        pe->pcr_offset_min = offset;
+        pe->pcr_offset_max = offset;
+    }
+    else if (offset < pe->pcr_offset_min)
+        pe->pcr_offset_min = offset;
+    else if (offset > pe->pcr_offset_max)
+        pe->pcr_offset_max = offset;
+    pe->pcr_offset = offset;
+
+    uint64_t jitter = (uint64_t)(pe->pcr_offset_max - pe->pcr_offset_min);
+    if (jitter > s->pcr_jitter)
+        s->pcr_jitter = jitter;
+}
+
+/*
+ * The hot path: sync, CC and TEI checks and PSI section assembly and
+ * dispatch for every TS packet.
+ */
+void stsmon_stream_feed(stsmon_stream_t *s, uint8_t *data, size_t len, uint64_t now)
+{
+    stsmon_counters_t *c = &s->counters;
+    s->now = now;
+    if (s->last_feed && now > s->last_feed && now - s->last_feed > s->max_iat)
+        s->max_iat = now - s->last_feed;
+    s->last_feed = now;
+
+    PROFILE_BEGIN(t);
+    for (size_t i = 0; i + TS_SIZE <= len; i += TS_SIZE)
+    {
+        uint8_t *ts_packet = data + i;
+
+        c->packets++;
+
+        if (!ts_validate(ts_packet))
+        {
+            c->sync_errors++;
+            continue;
+        }
+
+        uint16_t pid = ts_get_pid(ts_packet);
+        PROFILE_LAP(s->profile_ticks, PROFILE_PARSE, t);
+        if (pid == TS_MAX_PID - 1)
+        {
+            continue; // Ignore null packets
+        }
+
+        c->data_packets++;
+
+        ts_pid_t *pe = &s->pids[pid];
+        uint8_t cc = ts_get_cc(ts_packet);
+        bool had_errors = false;
+        if (pe->last_cc != 0xFF)
+        {
+            if (ts_check_discontinuity(cc, pe->last_cc))
+            {
+                c->cc_errors++;
+                pe->cc_errors++;
+                had_errors = true;
+                stream_event(s, &(stsmon_event_t){
+                                    .type = STSMON_EVENT_CC_ERROR,
+                                    .pid = pid,
+                                    .service_id = pe->service_id ? pe->service_id : STSMON_NONE,
+                                    .last_cc = pe->last_cc,
+                                    .cc = cc,
+                                });
+            }
+        }
+        pe->last_cc = cc;
+
+        pe->packets++;
+
+        if (ts_get_transporterror(ts_packet))
+        {
+            had_errors = true;
+            c->tei_errors++;
+            pe->tei_errors++;
+            stream_event(s, &(stsmon_event_t){
+                                .type = STSMON_EVENT_TEI,
+                                .pid = pid,
+                                .service_id = pe->service_id ? pe->service_id : STSMON_NONE,
+                            });
+        }
+        else if (ts_has_adaptation(ts_packet) && ts_get_adaptation(ts_packet) && tsaf_has_pcr(ts_packet))
+        {
+            pcr_arrival(s, pe, ts_packet);
+        }
+        PROFILE_LAP(s->profile_ticks, PROFILE_CC, t);
+
+        if (pe->is_psi)
+        {
+            if (had_errors)
+            {
+                // Reset PSI collection on error
+                psi_assemble_reset(&pe->psi_buffer, &pe->psi_buffer_used);
+                continue;
+            }
+
+            uint8_t *payload = ts_section(ts_packet);
+            uint8_t payload_length = TS_SIZE - (payload - ts_packet);
+
+            /*
+             * The bytes before the pointer_field target only continue a
+             * section already being assembled. With nothing pending they
+             * are skipped: a section starting here is picked up by the
+             * loop below and must not be fed twice.
+             */
+            uint8_t *section = NULL;
+            if (!psi_assemble_empty(&pe->psi_buffer, &pe->psi_buffer_used))
+                section = psi_assemble_payload(&pe->psi_buffer, &pe->psi_buffer_used,
+                                               (const uint8_t **)&payload, &payload_length);
+            if (section)
+            {
+                PROFILE_LAP(s->profile_ticks, PROFILE_PSI, t);
+                bool valid = section_complete(s, pid, pe, section);
+                PROFILE_LAP(s->profile_ticks, PROFILE_TABLES, t);
+                if (!valid)
+                    continue;
+            }
+
+            payload = ts_next_section(ts_packet);
+            payload_length = TS_SIZE - (payload - ts_packet);
+            /*
+             * There may be multiple sections in a single TS packet payload
+             * (pointer_field may point to the start of a following section).
+             * Loop until we've consumed the payload. Each completed `section`
+             * is validated and dispatched.
+             */
+            while (payload_length)
+            {
+                section = psi_assemble_payload(&pe->psi_buffer, &pe->psi_buffer_used,
+                                               (const uint8_t **)&payload, &payload_length);
+                if (section)
+                {
+                    PROFILE_LAP(s->profile_ticks, PROFILE_PSI, t);
+                    bool valid = section_complete(s, pid, pe, section);
+                    PROFILE_LAP(s->profile_ticks, PROFILE_TABLES, t);
+                    if (!valid)
+                        break;
+                }
+            }
+            PROFILE_LAP(s->profile_ticks, PROFILE_PSI, t);
+        }
+    }
+}
+
+/* Longest of the gaps seen in the interval and the one still open at `now` */
+static uint64_t longest_gap(uint64_t longest, uint64_t last, uint64_t now)
+{
+    uint64_t open = last && now > last ? now - last : 0;
+    return open > longest ? open : longest;
+}
+
+static void counters_delta(stsmon_counters_t *out, const stsmon_counters_t *a, const stsmon_counters_t *b)
+{
+    out->packets = a->packets - b->packets;
+    out->data_packets = a->data_packets - b->data_packets;
+    out->cc_errors = a->cc_errors - b->cc_errors;
+    out->sync_errors = a->sync_errors - b->sync_errors;
+    out->tei_errors = a->tei_errors - b->tei_errors;
+}
+
+void stsmon_stream_tick(stsmon_stream_t *s, uint64_t now, uint64_t interval)
+{
+    if (!s->last_stats)
+    {
+        s->last_stats = now;
+        s->last_counters = s->counters;
+        /* Gaps count from here until the first datagram and PAT */
+        if (!s->last_feed)
+            s->last_feed = now;
+        if (!s->last_pat)
+            s->last_pat = now;
+        return;
+    }
+    if (now - s->last_stats < interval)
+        return;
+
+    stsmon_stats_t stats = {
+        .now = now,
+        .duration = now - s->last_stats,
+        .total = s->counters,
+    };
+    counters_delta(&stats.interval, &s->counters, &s->last_counters);
+    double seconds = stats.duration / 1000000.0;
+    stats.bitrate = seconds > 0 ? stats.interval.packets * TS_SIZE * 8 / seconds : 0;
+    stats.data_bitrate = seconds > 0 ? stats.interval.data_packets * TS_SIZE * 8 / seconds : 0;
+    stats.max_iat = longest_gap(s->max_iat, s->last_feed, now);
+    stats.pat_interval = longest_gap(s->pat_interval, s->last_pat, now);
+    stats.pcr_jitter = s->pcr_jitter;
+
+    s->last_stats = now;
+    s->last_counters = s->counters;
+    s->max_iat = 0;
+    s->pat_interval = 0;
+    s->pcr_jitter = 0;
+    if (++s->pcr_interval == 0)
+        s->pcr_interval = 1;
+    if (s->callbacks.stats)
+        s->callbacks.stats(s->opaque, &stats);
+}
+
+uint64_t *stsmon_stream_profile(stsmon_stream_t *s)
+{
+    return s->profile_ticks;
+}
+
+const stsmon_counters_t *stsmon_stream_counters(const stsmon_stream_t *s)
+{
+    return &s->counters;
+}
+
+const ts_pid_t *stsmon_stream_pid(const stsmon_stream_t *s, uint16_t pid)
+{
+    return pid < TS_MAX_PID ? &s->pids[pid] : NULL;
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "stsmon.h"
+#include "profile.h"
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat"
+#pragma GCC diagnostic ignored "-Wformat-extra-args"
+#include <bitstream/mpeg/psi.h>
+#pragma GCC diagnostic pop
+
+/*
+ * Internals of libstsmon shared by stream.c and the table handlers, not
+ * part of the API in stsmon.h.
+ */
+struct service_entry_t;
+
+struct stsmon_stream
+{
+    stsmon_callbacks_t callbacks;
+    void *opaque;
+    uint64_t now; /* receive time of the packets being fed */
+
+    stsmon_counters_t counters;
+    ts_pid_t pids[TS_MAX_PID];
+
+    /* next/current model: `*_next` collects sections until a complete
+     * table is available, then it is swapped into `*_current` */
+    PSI_TABLE_DECLARE(pat_current);
+    PSI_TABLE_DECLARE(pat_next);
+    PSI_TABLE_DECLARE(sdt_current);
+    PSI_TABLE_DECLARE(sdt_next);
+
+    struct service_entry_t *services;
+
+    /* stsmon_stream_tick() */
+    uint64_t last_stats;
+    stsmon_counters_t last_counters;
+
+    /* Timing of the current interval, see stsmon_stats_t */
+    uint64_t last_feed;
+    uint64_t max_iat;
+    uint64_t last_pat;
+    uint64_t pat_interval;
+    uint32_t pcr_interval; /* bumped every interval, restarts the per PID PCR ranges */
+    uint64_t pcr_jitter;
+
+    uint64_t profile_ticks[PROFILE_STAGES]; /* see profile.h, zero without STSMON_PROFILE */
+};
+
+/* Report an event, fills in `now`; no-op without an event callback */
+void stream_event(stsmon_stream_t *s, stsmon_event_t *event);
+void stream_log(stsmon_stream_t *s, stsmon_log_level_t level, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/* Table handlers take ownership of `section` */
+void handle_pat_section(stsmon_stream_t *s, uint16_t pid, uint8_t *section);
+void handle_pmt(stsmon_stream_t *s, uint16_t pid, uint8_t *section);
+void handle_sdt_section(stsmon_stream_t *s, uint16_t pid, uint8_t *section);
+void pat_cleanup(stsmon_stream_t *s);
+void sdt_cleanup(stsmon_stream_t *s);
@@ -0,0 +1,165 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include "pid.h"
+
+/*
+ * libstsmon - the transport stream analysis core of stsmon
+ *
+ * All state of one monitored stream lives in a stsmon_stream_t: the PID
+ * table, the error counters, the PAT/SDT tables and the service list.
+ * Streams are independent, a process may run any number of them, one
+ * thread per stream at a time. The library does no I/O of its own, the
+ * application feeds TS packets (a datagram, a file buffer) and is told
+ * about events, log messages and statistics through callbacks.
+ */
+typedef struct stsmon_stream stsmon_stream_t;
+
+typedef enum
+{
+    STSMON_EVENT_CC_ERROR,           /* last_cc, cc */
+    STSMON_EVENT_TEI,                /* transport_error_indicator set */
+    STSMON_EVENT_PSI_ERROR,          /* table ("PAT", "PMT", "SDT") or, when NULL, table_id */
+    STSMON_EVENT_PROGRAM_NEW,        /* pid is the PMT PID */
+    STSMON_EVENT_PROGRAM_PID_CHANGE, /* old_pid */
+    STSMON_EVENT_PMT_VERSION,        /* old_version, version, es_count */
+    STSMON_EVENT_SDT_UPDATE,         /* version, last_section */
+    STSMON_EVENT_SERVICE,            /* service_type, provider, name, scrambled */
+    STSMON_EVENT_SECTION,            /* section: a PAT, PMT or SDT section was accepted */
+} stsmon_event_type_t;
+
+/* pid/service_id value when the event is not tied to one */
+#define STSMON_NONE -1
+
+typedef struct stsmon_event
+{
+    stsmon_event_type_t type;
+    int pid;
+    int service_id;
+    uint64_t now; /* as passed to stsmon_stream_feed() */
+    /* Type specific members, see stsmon_event_type_t, zero otherwise */
+    unsigned last_cc;
+    unsigned cc;
+    unsigned old_pid;
+    unsigned old_version;
+    unsigned version;
+    unsigned es_count;
+    unsigned last_section;
+    unsigned table_id;
+    const char *table;
+    unsigned service_type;
+    const char *provider; /* UTF-8 */
+    const char *name;     /* UTF-8 */
+    bool scrambled;
+    const uint8_t *section;
+} stsmon_event_t;
+
+/* Same order as the console levels of stsmon, see output.h */
+typedef enum
+{
+    STSMON_LOG_INFO,
+    STSMON_LOG_WARNING,
+    STSMON_LOG_ERROR
+} stsmon_log_level_t;
+
+typedef struct stsmon_counters
+{
+    uint64_t packets;      /* all TS packets */
+    uint64_t data_packets; /* without sync errors and null packets */
+    uint64_t cc_errors;
+    uint64_t sync_errors;
+    uint64_t tei_errors;
+} stsmon_counters_t;
+
+/* Passed to the stats callback once per interval, see stsmon_stream_tick() */
+typedef struct stsmon_stats
+{
+    uint64_t now;      /* end of the interval, same clock as `now` of the feed */
+    uint64_t duration; /* length of the interval, us */
+    stsmon_counters_t total;
+    stsmon_counters_t interval; /* increase during the interval */
+    double bitrate;             /* bits per second over the interval */
+    double data_bitrate;
+    /*
+     * Timing over the interval, us. A gap still open at the end of the
+     * interval counts, so a stream that stopped shows a growing value.
+     */
+    uint64_t max_iat;      /* longest time between two fed datagrams */
+    uint64_t pat_interval; /* longest time between PAT sections */
+    uint64_t pcr_jitter;   /* peak to peak PCR arrival jitter of the worst PID, 0 without PCRs */
+} stsmon_stats_t;
+
+typedef struct stsmon_service_info
+{
+    uint16_t service_id;
+    uint16_t pmt_pid;
+    uint8_t pmt_version; /* 0xff before the first PMT */
+    bool scrambled;
+    const char *name; /* NULL before the SDT, valid until the next feed */
+} stsmon_service_info_t;
+
+/*
+ * Callbacks are optional (NULL) and run on the thread feeding the stream.
+ * Pointers in events are only valid during the call.
+ */
+typedef struct stsmon_callbacks
+{
+    void (*event)(void *opaque, const stsmon_event_t *event);
+    void (*log)(void *opaque, stsmon_log_level_t level, const char *fmt, va_list ap);
+    void (*stats)(void *opaque, const stsmon_stats_t *stats);
+} stsmon_callbacks_t;
+
+/* `callbacks` is copied, returns NULL when out of memory */
+stsmon_stream_t *stsmon_stream_new(const stsmon_callbacks_t *callbacks, void *opaque);
+void stsmon_stream_free(stsmon_stream_t *stream);
+/* Forget everything learned from the stream, as if it was just created */
+void stsmon_stream_reset(stsmon_stream_t *stream);
+
+/*
+ * Process TS packets, `len` is a multiple of 188 (a trailing partial
+ * packet is ignored). `now` is the receive time in microseconds and is
+ * only passed on to events and statistics.
+ */
+void stsmon_stream_feed(stsmon_stream_t *stream, uint8_t *data, size_t len, uint64_t now);
+
+/*
+ * Call the stats callback when `interval` (us) has passed since the
+ * previous statistics, e.g. from the application's timer or once per
+ * datagram. The first call only starts the interval. An `interval` of
+ * 0 ends the current interval at `now`, for callers with their own
+ * schedule.
+ */
+void stsmon_stream_tick(stsmon_stream_t *stream, uint64_t now, uint64_t interval);
+
+const stsmon_counters_t *stsmon_stream_counters(const stsmon_stream_t *stream);
+/*
+ * Time per processing stage of this stream with -DENABLE_PROFILE=ON,
+ * PROFILE_STAGES counters indexed by profile_stage_t (profile.h). The
+ * application adds its own stages (receive, output) through it.
+ */
+uint64_t *stsmon_stream_profile(stsmon_stream_t *stream);
+const ts_pid_t *stsmon_stream_pid(const stsmon_stream_t *stream, uint16_t pid);
+/* PMT PID of a service from the PAT, 0 when unknown */
+uint16_t stsmon_stream_pmt_pid(const stsmon_stream_t *stream, uint16_t service_id);
+size_t stsmon_stream_service_count(const stsmon_stream_t *stream);
+/* Copy up to `max` services, returns the count */
+size_t stsmon_stream_services(const stsmon_stream_t *stream, stsmon_service_info_t *out, size_t max);
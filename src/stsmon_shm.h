@@ -0,0 +1,124 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+
+/*
+ * Layout of the shared-memory statistics segment published with --shm.
+ *
+ * The segment is created with shm_open(name) and has a fixed size:
+ *
+ *   stsmon_shm_header_t                         at offset 0
+ *   stsmon_shm_pid_t[STSMON_SHM_MAX_PIDS]       at header.pid_offset
+ *   stsmon_shm_service_t[STSMON_SHM_MAX_SERVICES] at header.service_offset
+ *
+ * PID records are indexed directly by PID. All integers are in host byte
+ * order. Readers must check `magic` and `version`; new fields are only
+ * ever appended to records, so a reader may rely on the record sizes in
+ * the header to skip unknown trailing fields.
+ *
+ * Every record (the stream record inside the header, each PID and each
+ * service) carries its own sequence counter. The writer increments it
+ * before and after updating the record, so a reader copies the record and
+ * accepts it only if `seq` was even and unchanged across the copy:
+ *
+ *   do {
+ *       s1 = atomic_load_acquire(&rec->seq);
+ *       copy = *rec;
+ *       atomic_thread_fence_acquire();
+ *       s2 = atomic_load_relaxed(&rec->seq);
+ *   } while ((s1 & 1) || s1 != s2);
+ *
+ * Records are refreshed once per second.
+ */
+
+#define STSMON_SHM_MAGIC 0x4e4f4d53 /* "SMON" */
+#define STSMON_SHM_VERSION 1
+#define STSMON_SHM_MAX_PIDS 8192
+#define STSMON_SHM_MAX_SERVICES 256
+#define STSMON_SHM_NAME_SIZE 64
+
+/* stsmon_shm_pid_t.flags */
+#define STSMON_SHM_PID_PRESENT 0x1 /* at least one packet received */
+#define STSMON_SHM_PID_PSI 0x2
+#define STSMON_SHM_PID_DATA 0x4
+
+typedef struct stsmon_shm_stream
+{
+    uint32_t seq;
+    uint32_t pid_count;     /* PIDs with STSMON_SHM_PID_PRESENT */
+    uint32_t service_count; /* valid entries in the service array */
+    uint32_t reserved;
+    uint64_t timestamp_us; /* wallclock of the last update */
+    uint64_t start_time_us;
+    uint64_t last_packet_us;
+    uint64_t packets_all;
+    uint64_t packets_data;
+    uint64_t cc_errors;
+    uint64_t sync_errors;
+    uint64_t tei_errors;
+    uint64_t socket_drops;
+    uint64_t csv_drops;
+    uint64_t bitrate_bps;
+    uint64_t data_bitrate_bps;
+} stsmon_shm_stream_t;
+
+typedef struct stsmon_shm_pid
+{
+    uint32_t seq;
+    uint32_t flags;
+    uint16_t pid;
+    uint16_t service_id;
+    uint32_t reserved;
+    uint64_t packets;
+    uint64_t cc_errors;
+    uint64_t tei_errors;
+    uint64_t bitrate_bps;
+} stsmon_shm_pid_t;
+
+typedef struct stsmon_shm_service
+{
+    uint32_t seq;
+    uint16_t service_id;
+    uint16_t pmt_pid;
+    uint8_t pmt_version;
+    uint8_t scrambled;
+    uint8_t reserved[6];
+    char name[STSMON_SHM_NAME_SIZE]; /* UTF-8, NUL terminated */
+} stsmon_shm_service_t;
+
+typedef struct stsmon_shm_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t pid_record_size;
+    uint32_t service_record_size;
+    uint32_t pid_offset;
+    uint32_t service_offset;
+    uint32_t max_pids;
+    uint32_t max_services;
+    uint32_t writer_pid;
+    uint32_t running; /* cleared when stsmon exits */
+    char stream[STSMON_SHM_NAME_SIZE]; /* "group:port" */
+    stsmon_shm_stream_t stream_stats;
+} stsmon_shm_header_t;
+
+#define STSMON_SHM_SIZE (sizeof(stsmon_shm_header_t) + \
+                         STSMON_SHM_MAX_PIDS * sizeof(stsmon_shm_pid_t) + \
+                         STSMON_SHM_MAX_SERVICES * sizeof(stsmon_shm_service_t))
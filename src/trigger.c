@@ -0,0 +1,404 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+#include "trigger.h"
+#include "output.h"
+
+extern unsigned cc_warning;
+
+#define TRIGGER_MAX_EXTEND_S 60
+/* Records are 16 byte aligned, so a header always fits before the end */
+#define TRIGGER_ALIGN 16
+#define TRIGGER_MAX_RECORD (sizeof(trigger_record_t) + TRIGGER_MAX_DATAGRAM)
+/* Marks the unused space at the end of the buffer, next record is at 0 */
+#define TRIGGER_WRAP UINT32_MAX
+#define TRIGGER_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct trigger_record
+{
+    uint64_t timestamp;
+    uint32_t length;
+    uint32_t reserved;
+} trigger_record_t;
+
+#ifndef WIN32
+static uint8_t *ring = NULL;
+static uint64_t ring_size = 0;
+static bool ring_mapped = false;
+/*
+ * Byte offsets since start, the position in `ring` is offset % ring_size.
+ * Written by the capture thread only, read by the dump thread.
+ */
+static uint64_t head = 0;
+static uint64_t tail = 0;
+
+static char dump_dir[1024];
+static uint64_t pre_us;
+static uint64_t post_us;
+
+/* Dump request, set by the capture thread while `dump_active` is 0 */
+static int dump_active = 0;
+static uint64_t dump_trigger;
+static uint64_t dump_end; /* extended by later triggers */
+static const char *dump_reason;
+
+static uint64_t cc_window = 0;
+static unsigned cc_count = 0;
+static uint64_t suppressed = 0;
+
+static pthread_t dump_thread;
+static int stop_flag = 0;
+static bool running = false;
+
+static inline uint64_t align_record(uint64_t n)
+{
+    return (n + TRIGGER_ALIGN - 1) & ~(uint64_t)(TRIGGER_ALIGN - 1);
+}
+
+/* Capture thread: drop the oldest records until `need` more bytes fit */
+static void make_room(uint64_t need)
+{
+    while (head + need - tail > ring_size)
+    {
+        const trigger_record_t *r = (const trigger_record_t *)(ring + tail % ring_size);
+        if (r->length == TRIGGER_WRAP)
+            tail += ring_size - tail % ring_size;
+        else
+            tail += align_record(sizeof(*r) + r->length);
+    }
+    /* Publish the new tail before the space is overwritten */
+    __atomic_store_n(&tail, tail, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void trigger_packet(const uint8_t *data, size_t len, uint64_t now)
+{
+    if (!running)
+        return;
+    if (len > TRIGGER_MAX_DATAGRAM)
+        len = TRIGGER_MAX_DATAGRAM;
+
+    uint64_t need = align_record(sizeof(trigger_record_t) + len);
+    uint64_t left = ring_size - head % ring_size;
+    if (left < need)
+    {
+        make_room(left);
+        ((trigger_record_t *)(ring + head % ring_size))->length = TRIGGER_WRAP;
+        head += left;
+    }
+    make_room(need);
+    trigger_record_t *r = (trigger_record_t *)(ring + head % ring_size);
+    r->timestamp = now;
+    r->length = (uint32_t)len;
+    memcpy(r + 1, data, len);
+    __atomic_store_n(&head, head + need, __ATOMIC_RELEASE);
+}
+
+void trigger_fire(const char *reason, uint64_t now)
+{
+    if (!running)
+        return;
+    if (__atomic_load_n(&dump_active, __ATOMIC_ACQUIRE))
+    {
+        uint64_t end = __atomic_load_n(&dump_end, __ATOMIC_RELAXED);
+        /* Still in the post period: extend it */
+        if (now <= end && now + post_us <= dump_trigger + TRIGGER_MAX_EXTEND_S * 1000000ULL)
+            __atomic_store_n(&dump_end, now + post_us, __ATOMIC_RELAXED);
+        else if (now > end)
+            suppressed++;
+        return;
+    }
+    dump_trigger = now;
+    dump_reason = reason;
+    __atomic_store_n(&dump_end, now + post_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&dump_active, 1, __ATOMIC_RELEASE);
+}
+
+void trigger_cc_error(uint64_t now)
+{
+    if (!running)
+        return;
+    if (now - cc_window >= 1000000)
+    {
+        cc_window = now;
+        cc_count = 0;
+    }
+    if (++cc_count == cc_warning + 1)
+        trigger_fire("cc", now);
+}
+
+/*
+ * Dump thread: copy the record at `pos` into `out`. Returns its size,
+ * 0 when `pos` was overwritten before or during the copy (seqlock style
+ * check against `tail`, see make_room()).
+ */
+static uint64_t read_record(uint64_t pos, trigger_record_t *hdr, uint8_t *out)
+{
+    memcpy(hdr, ring + pos % ring_size, sizeof(*hdr));
+    uint64_t size;
+    if (hdr->length == TRIGGER_WRAP)
+    {
+        size = ring_size - pos % ring_size;
+    }
+    else if (hdr->length <= TRIGGER_MAX_DATAGRAM)
+    {
+        memcpy(out, ring + pos % ring_size + sizeof(*hdr), hdr->length);
+        size = align_record(sizeof(*hdr) + hdr->length);
+    }
+    else
+    {
+        size = 0;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (pos < __atomic_load_n(&tail, __ATOMIC_RELAXED))
+        return 0;
+    return size;
+}
+
+static void write_dump()
+{
+    uint64_t trigger_ts = dump_trigger;
+    uint64_t start_ts = trigger_ts > pre_us ? trigger_ts - pre_us : 0;
+
+    char stamp[16];
+    time_t t = (time_t)(trigger_ts / 1000000);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    char path[sizeof(dump_dir) + 64];
+    snprintf(path, sizeof(path), "%s/stsmon-%s-%s.ts", dump_dir, stamp, dump_reason);
+
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        out_log(LogLevel_Error, "Cannot create trigger dump '%s': %s (%d)", path, strerror(errno), errno);
+        return;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    out_log(LogLevel_Info, "Trigger '%s', writing %s", dump_reason, path);
+
+    static uint8_t payload[TRIGGER_MAX_DATAGRAM];
+    trigger_record_t hdr;
+    uint64_t pos = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    uint64_t first_ts = 0;
+    uint64_t bytes = 0;
+    uint64_t lost = 0;
+    bool write_failed = false;
+
+    while (1)
+    {
+        uint64_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+        if (pos == h)
+        {
+            /* Shutting down, everything buffered is written */
+            if (__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE))
+                break;
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            uint64_t now_us = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+            /* No traffic, stop once the post period is over */
+            if (now_us > __atomic_load_n(&dump_end, __ATOMIC_RELAXED))
+                break;
+            struct timespec step = {.tv_sec = 0, .tv_nsec = 10000000};
+            nanosleep(&step, NULL);
+            continue;
+        }
+
+        uint64_t size = read_record(pos, &hdr, payload);
+        if (size == 0)
+        {
+            /* Overwritten, continue with the oldest data still there */
+            uint64_t oldest = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+            if (first_ts)
+                lost += oldest - pos;
+            pos = oldest;
+            continue;
+        }
+        pos += size;
+        if (hdr.length == TRIGGER_WRAP || hdr.timestamp < start_ts)
+            continue;
+        if (hdr.timestamp > __atomic_load_n(&dump_end, __ATOMIC_RELAXED))
+            break;
+        if (!first_ts)
+            first_ts = hdr.timestamp;
+        if (!write_failed && fwrite(payload, 1, hdr.length, f) != hdr.length)
+        {
+            out_log(LogLevel_Error, "Trigger dump write to '%s' failed: %s (%d)", path, strerror(errno), errno);
+            write_failed = true;
+        }
+        bytes += hdr.length;
+    }
+    if (fclose(f) != 0 && !write_failed)
+        out_log(LogLevel_Error, "Trigger dump write to '%s' failed: %s (%d)", path, strerror(errno), errno);
+
+    double before = first_ts && first_ts < trigger_ts ? (trigger_ts - first_ts) / 1000000.0 : 0;
+    if (lost)
+        out_log(LogLevel_Warning, "Trigger dump %s incomplete, %" PRIu64 " bytes overwritten before they were written out",
+                path, lost);
+    else if (before + 0.5 < pre_us / 1000000.0)
+        out_log(LogLevel_Info, "Trigger dump %s: %" PRIu64 " bytes, only %.1f s before trigger available",
+                path, bytes, before);
+    else
+        out_log(LogLevel_Info, "Trigger dump %s: %" PRIu64 " bytes", path, bytes);
+}
+
+static void *dump_run(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        if (__atomic_load_n(&dump_active, __ATOMIC_ACQUIRE))
+        {
+            write_dump();
+            __atomic_store_n(&dump_active, 0, __ATOMIC_RELEASE);
+            continue;
+        }
+        if (__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE))
+            break;
+        struct timespec step = {.tv_sec = 0, .tv_nsec = 50000000};
+        nanosleep(&step, NULL);
+    }
+    return NULL;
+}
+
+int trigger_open(const char *dir, unsigned pre_seconds, unsigned post_seconds,
+                 uint64_t buffer_size, bool hugepages)
+{
+    if (strlen(dir) >= sizeof(dump_dir))
+    {
+        out_log(LogLevel_Error, "Trigger directory '%s' is too long", dir);
+        return -1;
+    }
+    if (buffer_size < 16 * TRIGGER_MAX_RECORD)
+    {
+        out_log(LogLevel_Error, "Trigger buffer must be at least %zu bytes", 16 * TRIGGER_MAX_RECORD);
+        return -1;
+    }
+    if (access(dir, W_OK) != 0)
+    {
+        out_log(LogLevel_Error, "Trigger directory '%s' is not writable: %s (%d)", dir, strerror(errno), errno);
+        return -1;
+    }
+    snprintf(dump_dir, sizeof(dump_dir), "%s", dir);
+    pre_us = (uint64_t)pre_seconds * 1000000;
+    post_us = (uint64_t)post_seconds * 1000000;
+
+    /* Prefaulted, so the capture loop never takes a page fault on it */
+    ring_size = buffer_size & ~(uint64_t)(TRIGGER_ALIGN - 1);
+    ring = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugepages)
+    {
+        ring_size = (buffer_size + TRIGGER_HUGEPAGE_SIZE - 1) & ~(uint64_t)(TRIGGER_HUGEPAGE_SIZE - 1);
+        ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (ring == MAP_FAILED)
+        {
+            out_log(LogLevel_Warning, "No huge pages for trigger buffer (%s), using normal pages", strerror(errno));
+            ring_size = buffer_size & ~(uint64_t)(TRIGGER_ALIGN - 1);
+        }
+    }
+#else
+    if (hugepages)
+        out_log(LogLevel_Warning, "Huge pages are not supported on this platform, using normal pages");
+#endif
+    if (ring == MAP_FAILED)
+        ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (ring == MAP_FAILED)
+    {
+        out_log(LogLevel_Error, "Cannot allocate %" PRIu64 " byte trigger buffer: %s (%d)", ring_size, strerror(errno), errno);
+        ring = NULL;
+        return -1;
+    }
+    ring_mapped = true;
+    head = tail = 0;
+
+    stop_flag = 0;
+    if (pthread_create(&dump_thread, NULL, dump_run, NULL) != 0)
+    {
+        out_log(LogLevel_Error, "Failed to start trigger dump thread");
+        munmap(ring, ring_size);
+        ring = NULL;
+        ring_mapped = false;
+        return -1;
+    }
+    running = true;
+    out_log(LogLevel_Info, "Trigger capture to %s, %u s before and %u s after, %.1f MiB buffer",
+            dump_dir, pre_seconds, post_seconds, ring_size / 1048576.0);
+    return 0;
+}
+
+void trigger_close()
+{
+    if (!ring_mapped)
+        return;
+    /* A dump in progress is finished with what is buffered */
+    running = false;
+    __atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+    pthread_join(dump_thread, NULL);
+    munmap(ring, ring_size);
+    ring = NULL;
+    ring_mapped = false;
+    if (suppressed)
+        out_log(LogLevel_Info, "Trigger: %" PRIu64 " triggers ignored while a dump was being written", suppressed);
+}
+#else
+int trigger_open(const char *dir, unsigned pre_seconds, unsigned post_seconds,
+                 uint64_t buffer_size, bool hugepages)
+{
+    (void)dir;
+    (void)pre_seconds;
+    (void)post_seconds;
+    (void)buffer_size;
+    (void)hugepages;
+    out_log(LogLevel_Error, "Trigger capture is not supported on this platform");
+    return -1;
+}
+
+void trigger_close()
+{
+}
+
+void trigger_packet(const uint8_t *data, size_t len, uint64_t now)
+{
+    (void)data;
+    (void)len;
+    (void)now;
+}
+
+void trigger_fire(const char *reason, uint64_t now)
+{
+    (void)reason;
+    (void)now;
+}
+
+void trigger_cc_error(uint64_t now)
+{
+    (void)now;
+}
+#endif
@@ -0,0 +1,48 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Largest datagram kept, the capture loop reads at most 2048 bytes */
+#define TRIGGER_MAX_DATAGRAM 2048
+
+/*
+ * Evidence capture around stream errors. Every received datagram is
+ * copied into a preallocated circular buffer of `buffer_size` bytes. When
+ * a trigger fires, a background thread writes the datagrams from
+ * `pre_seconds` before the trigger until `post_seconds` after it to
+ * "<dir>/stsmon-<YYYYmmdd-HHMMSS>-<reason>.ts". Triggers during the post
+ * period extend it, up to TRIGGER_MAX_EXTEND_S after the first one.
+ *
+ * The capture thread never waits for the dump. If the dump falls more
+ * than the buffer size behind, the missing part is skipped and the file
+ * is reported as incomplete.
+ */
+int trigger_open(const char *dir, unsigned pre_seconds, unsigned post_seconds,
+                 uint64_t buffer_size, bool hugepages);
+void trigger_close();
+
+/* Capture thread, every datagram */
+void trigger_packet(const uint8_t *data, size_t len, uint64_t now);
+
+/* Capture thread, `reason` is a short static string used in the file name */
+void trigger_fire(const char *reason, uint64_t now);
+/* CC errors fire when more than cc_warning arrive within one second */
+void trigger_cc_error(uint64_t now);
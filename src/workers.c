@@ -0,0 +1,399 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+/* pthread_setaffinity_np */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "workers.h"
+#include "monitor.h"
+#include "output.h"
+#include "statlog.h"
+#include "logfile.h"
+#include "ratelimit.h"
+#include "profile.h"
+
+extern int show_cc;
+extern int quiet_mode;
+extern unsigned log_rate;
+extern unsigned csv_fsync_interval;
+extern unsigned stats_interval_ms;
+extern uint64_t rotate_size;
+extern unsigned rotate_age;
+extern const char *rotate_compress;
+extern const char *alarm_hook;
+
+#ifndef WIN32
+/* Datagrams read from one socket before the others get their turn */
+#define WORKER_BURST 64
+#define WORKER_DATAGRAM_SIZE 2048
+
+typedef struct worker_stream
+{
+    const stream_config_t *cfg;
+    stsmon_stream_t *stream;
+    int fd;
+    int sink; /* statistics log, -1 for none */
+    monitor_limits_t limits;
+    alarm_set_t alarms;
+    uint64_t start_ts;
+    uint64_t last_ts;
+    uint64_t drops;
+#ifdef STSMON_PROFILE
+    uint64_t profile_last[PROFILE_STAGES]; /* see profile_interval() */
+#endif
+} worker_stream_t;
+
+typedef struct worker
+{
+    unsigned id;
+    int cpu;
+    pthread_t thread;
+    bool running;
+    worker_stream_t *streams;
+    size_t count;
+    struct pollfd *fds;
+} worker_t;
+
+/* Formats double as rate limiter keys, see ratelimit.h */
+static const char cc_fmt[] = "%s: Discontinuity detected on PID %d: last CC %u, current CC %u";
+static const char invalid_fmt[] = "%s: Invalid section on PID %d";
+static const char gap_fmt[] = "%s: Packet gap detected, last packet was %.2f s ago";
+
+static void on_event(void *opaque, const stsmon_event_t *ev)
+{
+    worker_stream_t *ws = opaque;
+    const char *name = ws->cfg->name;
+    if (ev->type == STSMON_EVENT_CC_ERROR && show_cc &&
+        ratelimit_allow(name, cc_fmt, ev->pid, "CC errors", ev->now))
+        out_log(LogLevel_Warning, cc_fmt, name, ev->pid, ev->last_cc, ev->cc);
+    else if (ev->type == STSMON_EVENT_PSI_ERROR && !ev->table &&
+             ratelimit_allow(name, invalid_fmt, ev->pid, "Invalid sections", ev->now))
+        out_log(LogLevel_Error, invalid_fmt, name, ev->pid);
+}
+
+static void on_log(void *opaque, stsmon_log_level_t level, const char *fmt, va_list ap)
+{
+    worker_stream_t *ws = opaque;
+    char msg[512];
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    out_log((OutLogLevel)level, "%s: %s", ws->cfg->name, msg);
+}
+
+static void on_stats(void *opaque, const stsmon_stats_t *st)
+{
+    worker_stream_t *ws = opaque;
+    alarm_evaluate(&ws->alarms, st);
+    if (!quiet_mode && ws->cfg->console)
+    {
+        monitor_status(ws->cfg->name, ws->stream, st, ws->last_ts, &ws->limits, &ws->alarms);
+        out_newline();
+    }
+    if (ws->sink >= 0)
+    {
+        stat_record_t rec = {
+            .timestamp = st->now / 1000,
+            .interval_ms = stats_interval_ms,
+            .bitrate = st->bitrate,
+            .data_bitrate = st->data_bitrate,
+            .cc_errors = st->total.cc_errors,
+            .sync_errors = st->total.sync_errors,
+            .tei_errors = st->total.tei_errors,
+            .packets = st->interval.packets,
+            .data_packets = st->interval.data_packets,
+            .sink = (uint16_t)ws->sink,
+        };
+#ifdef STSMON_PROFILE
+        /* The CSV header has the profile columns for every file */
+        profile_interval(stsmon_stream_profile(ws->stream), ws->profile_last, st->interval.packets, rec.profile);
+#endif
+        statlog_push(&rec);
+    }
+}
+
+static void receive(worker_stream_t *ws, char *buffer)
+{
+    for (int i = 0; i < WORKER_BURST; i++)
+    {
+        struct sockaddr_in src_addr;
+        PROFILE_BEGIN(t);
+        ssize_t nbytes = monitor_recv(ws->fd, buffer, WORKER_DATAGRAM_SIZE, &src_addr, &ws->drops);
+        PROFILE_LAP(stsmon_stream_profile(ws->stream), PROFILE_RECV, t);
+        if (nbytes < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                out_log(LogLevel_Error, "%s: recvmsg() failed: %s (%d)", ws->cfg->name, strerror(errno), errno);
+            return;
+        }
+        uint64_t now = tsusecs();
+        if (ws->start_ts == 0)
+            ws->start_ts = now;
+        else if (now - ws->last_ts > (uint64_t)ws->cfg->gap_ms * 1000 &&
+                 ratelimit_allow(ws->cfg->name, gap_fmt, STSMON_NONE, "Packet gaps", now))
+            out_log(LogLevel_Warning, gap_fmt, ws->cfg->name, (double)(now - ws->last_ts) / 1000000.0);
+        ws->last_ts = now;
+        PROFILE_LAP(stsmon_stream_profile(ws->stream), PROFILE_OUTPUT, t);
+        stsmon_stream_feed(ws->stream, (uint8_t *)buffer, (size_t)nbytes, now);
+    }
+}
+
+static void *worker_run(void *arg)
+{
+    worker_t *w = arg;
+    char buffer[WORKER_DATAGRAM_SIZE];
+    uint64_t interval = (uint64_t)stats_interval_ms * 1000;
+
+#ifdef __linux__
+    if (w->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0)
+            out_log(LogLevel_Warning, "Worker %u: cannot run on CPU %d: %s", w->id, w->cpu, strerror(err));
+    }
+#endif
+
+    uint64_t now = tsusecs();
+    for (size_t i = 0; i < w->count; i++)
+        stsmon_stream_tick(w->streams[i].stream, now, 0);
+    uint64_t next_tick = now + interval;
+
+    while (!terminate)
+    {
+        /* Wake up at least once a second to notice `terminate` */
+        uint64_t wait = next_tick > now ? next_tick - now : 0;
+        if (wait > 1000000)
+            wait = 1000000;
+        int ret = poll(w->fds, w->count, (int)((wait + 999) / 1000));
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            out_log(LogLevel_Error, "Worker %u: poll() failed: %s (%d)", w->id, strerror(errno), errno);
+            break;
+        }
+        for (size_t i = 0; ret > 0 && i < w->count; i++)
+        {
+            if (w->fds[i].revents & POLLIN)
+                receive(&w->streams[i], buffer);
+        }
+
+        now = tsusecs();
+        ratelimit_report(now);
+        if (now >= next_tick)
+        {
+            /* The schedule decides, a late tick must not make the next one
+               look early to stsmon_stream_tick() and skip an interval */
+            for (size_t i = 0; i < w->count; i++)
+                stsmon_stream_tick(w->streams[i].stream, now, 0);
+            next_tick += interval;
+            if (next_tick <= now)
+                next_tick = now + interval;
+        }
+    }
+    return NULL;
+}
+
+static void print_summary(const worker_t *workers, unsigned count)
+{
+    out_puts("Final stats:");
+    out_newline();
+    for (unsigned w = 0; w < count; w++)
+    {
+        for (size_t i = 0; i < workers[w].count; i++)
+        {
+            const worker_stream_t *ws = &workers[w].streams[i];
+            const stsmon_counters_t *c = stsmon_stream_counters(ws->stream);
+            out_printf("  %s: packets %" PRIu64 " cc errors %" PRIu64 " sync errors %" PRIu64
+                       " tei errors %" PRIu64 " local drops %" PRIu64 " alarms raised %" PRIu64,
+                       ws->cfg->name, c->packets, c->cc_errors, c->sync_errors, c->tei_errors, ws->drops,
+                       ws->alarms.raised);
+            out_newline();
+        }
+    }
+}
+
+static void workers_free(worker_t *workers, unsigned count)
+{
+    for (unsigned w = 0; w < count; w++)
+    {
+        for (size_t i = 0; i < workers[w].count; i++)
+        {
+            worker_stream_t *ws = &workers[w].streams[i];
+            if (ws->fd >= 0)
+                close(ws->fd);
+            stsmon_stream_free(ws->stream);
+        }
+        free(workers[w].streams);
+        free(workers[w].fds);
+    }
+    free(workers);
+}
+
+int monitor_config(const config_t *cfg)
+{
+    worker_t *workers = calloc(cfg->workers, sizeof(*workers));
+    const char **csv_paths = calloc(cfg->count, sizeof(*csv_paths));
+    if (!workers || !csv_paths)
+    {
+        out_log(LogLevel_Error, "Failed to allocate workers");
+        free(workers);
+        free(csv_paths);
+        return 1;
+    }
+
+    /* Streams per worker first, so every worker gets one allocation */
+    for (size_t i = 0; i < cfg->count; i++)
+        workers[cfg->streams[i].worker].count++;
+    int ret = 0;
+    for (unsigned w = 0; w < cfg->workers; w++)
+    {
+        workers[w].id = w;
+        workers[w].cpu = cfg->cpus[w];
+        workers[w].streams = calloc(workers[w].count ? workers[w].count : 1, sizeof(worker_stream_t));
+        workers[w].fds = calloc(workers[w].count ? workers[w].count : 1, sizeof(struct pollfd));
+        if (!workers[w].streams || !workers[w].fds)
+            ret = 1;
+        workers[w].count = 0;
+    }
+    if (ret != 0)
+    {
+        out_log(LogLevel_Error, "Failed to allocate workers");
+        workers_free(workers, cfg->workers);
+        free(csv_paths);
+        return 1;
+    }
+
+    out_log(LogLevel_Info, "Monitoring %zu streams on %u workers", cfg->count, cfg->workers);
+    size_t csv_count = 0;
+    for (size_t i = 0; i < cfg->count && ret == 0; i++)
+    {
+        const stream_config_t *sc = &cfg->streams[i];
+        worker_t *w = &workers[sc->worker];
+        worker_stream_t *ws = &w->streams[w->count];
+        ws->cfg = sc;
+        ws->fd = -1;
+        ws->sink = -1;
+        ws->limits = (monitor_limits_t){
+            .cc_warning = sc->cc_warning,
+            .cc_critical = sc->cc_critical,
+            .dead_ms = sc->dead_ms,
+        };
+        alarm_init(&ws->alarms, sc->name);
+        alarm_builtin(&ws->alarms, sc->cc_warning, sc->cc_critical, sc->bitrate, sc->bitrate_tolerance);
+        for (unsigned a = 0; a < sc->alarm_count; a++)
+            alarm_add(&ws->alarms, &sc->alarms[a]);
+        ws->stream = stsmon_stream_new(&(stsmon_callbacks_t){
+                                           .event = on_event,
+                                           .log = on_log,
+                                           .stats = on_stats,
+                                       },
+                                       ws);
+        w->count++;
+        if (!ws->stream)
+        {
+            out_log(LogLevel_Error, "%s: failed to allocate the stream state", sc->name);
+            ret = 1;
+            break;
+        }
+        ws->fd = monitor_socket(sc->group, sc->port, sc->interface, sc->source);
+        if (ws->fd < 0 || fcntl(ws->fd, F_SETFL, fcntl(ws->fd, F_GETFL) | O_NONBLOCK) != 0)
+        {
+            out_log(LogLevel_Error, "%s: cannot receive %s:%u", sc->name, sc->group, sc->port);
+            ret = 1;
+            break;
+        }
+        w->fds[w->count - 1] = (struct pollfd){.fd = ws->fd, .events = POLLIN};
+        if (sc->csv)
+        {
+            ws->sink = (int)csv_count;
+            csv_paths[csv_count++] = sc->csv;
+        }
+    }
+
+    bool log_stats = csv_count > 0;
+    if (ret == 0 && logfile_configure(rotate_size, rotate_age, rotate_compress) != 0)
+        ret = 1;
+    if (ret == 0 && log_stats && statlog_open_files(csv_paths, csv_count, NULL, csv_fsync_interval) != 0)
+    {
+        logfile_shutdown();
+        ret = 1;
+    }
+    if (ret == 0 && alarm_hook && alarm_hooks_start(alarm_hook) != 0)
+    {
+        if (log_stats)
+            statlog_close();
+        logfile_shutdown();
+        ret = 1;
+    }
+    free(csv_paths);
+    if (ret != 0)
+    {
+        workers_free(workers, cfg->workers);
+        return ret;
+    }
+
+    monitor_signals();
+    ratelimit_configure(log_rate, log_rate * 2);
+    for (unsigned w = 0; w < cfg->workers; w++)
+    {
+        if (workers[w].count == 0)
+            continue;
+        if (pthread_create(&workers[w].thread, NULL, worker_run, &workers[w]) != 0)
+        {
+            out_log(LogLevel_Error, "Failed to start worker %u", w);
+            terminate = 1;
+            ret = 1;
+            break;
+        }
+        workers[w].running = true;
+    }
+    for (unsigned w = 0; w < cfg->workers; w++)
+    {
+        if (workers[w].running)
+            pthread_join(workers[w].thread, NULL);
+    }
+
+    alarm_hooks_stop();
+    if (log_stats)
+        statlog_close();
+    logfile_shutdown();
+    if (!quiet_mode)
+        print_summary(workers, cfg->workers);
+    workers_free(workers, cfg->workers);
+    return ret;
+}
+#else
+int monitor_config(const config_t *cfg)
+{
+    (void)cfg;
+    out_log(LogLevel_Error, "Streams files are not supported on this platform");
+    return 1;
+}
+#endif
@@ -0,0 +1,27 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "config.h"
+
+/*
+ * Monitor every stream of a streams file. Each stream gets its own socket
+ * and libstsmon stream; worker threads, optionally pinned to a CPU, each
+ * poll the sockets of the streams assigned to them. Runs until SIGINT or
+ * SIGTERM, returns the exit code.
+ */
+int monitor_config(const config_t *cfg);
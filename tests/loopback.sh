@@ -0,0 +1,139 @@
+#!/bin/sh
+#
+# This file is part of stsmon - a simple DVB transport stream monitor
+# Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+#
+# stsmon is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# stsmon is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+#
+# Loopback end-to-end test, driven by CTest (see tests/CMakeLists.txt):
+#
+#   loopback.sh init <results>
+#   loopback.sh run <results> <stsmon> <test-tsg> <rate Mbit/s> <seconds> <port> <required>
+#   loopback.sh summary <results> <gate rate Mbit/s>
+#   loopback.sh intervals <stsmon> <test-tsg> <seconds> <port>
+#
+# `run` streams from test-tsg to stsmon over multicast on 127.0.0.1 and
+# appends one CSV row to <results>. A rate is clean when stsmon saw every
+# TS packet test-tsg sent, with no CC errors and no local drops. Failing
+# a required rate fails the test, the others are only recorded. Exit code
+# 77 (skipped) means no packet arrived at all, i.e. no multicast on lo.
+#
+# `intervals` monitors the stream through a `--config` file with a CSV
+# sink and a 100 ms interval, and checks that no interval is missing
+# from the CSV.
+
+set -u
+
+GROUP=239.255.42.42
+HEADER="rate_mbps,sent_packets,received_packets,cc_errors,local_drops,stsmon_cpu_percent,clean"
+
+case "${1:-}" in
+init)
+    echo "$HEADER" > "$2"
+    ;;
+
+run)
+    results=$2 stsmon=$3 tsg=$4 rate=$5 seconds=$6 port=$7 required=$8
+    work=$(mktemp -d "${TMPDIR:-/tmp}/stsmon-loopback.XXXXXX") || exit 1
+    trap 'rm -rf "$work"' EXIT
+
+    # stsmon joins first and stops a second after test-tsg, the CPU time
+    # of stsmon is taken from /proc when it exits
+    "$stsmon" -m "$GROUP" -p "$port" -i 127.0.0.1 --interval 1000 > "$work/stsmon.log" 2>&1 &
+    monitor=$!
+    sleep 0.5
+    timeout -s INT "$seconds" "$tsg" -m "$GROUP" -p "$port" -i 127.0.0.1 --ttl 0 \
+        -b "${rate}M" --cc-errors 0 > "$work/tsg.log" 2>&1
+    sleep 1
+    ticks=$(awk '{ print $14 + $15 }' "/proc/$monitor/stat" 2>/dev/null || echo 0)
+    kill -INT "$monitor"
+    wait "$monitor"
+
+    sent=$(sed -n 's/^Sent [0-9]* datagrams (\([0-9]*\) TS packets.*/\1/p' "$work/tsg.log")
+    received=$(sed -n 's/^ *total packets: \([0-9]*\).*/\1/p' "$work/stsmon.log")
+    cc=$(sed -n 's/^ *cc errors: \([0-9]*\).*/\1/p' "$work/stsmon.log")
+    drops=$(sed -n 's/^ *local drops: \([0-9]*\).*/\1/p' "$work/stsmon.log")
+    cpu=$(awk -v t="$ticks" -v hz="$(getconf CLK_TCK)" -v s="$seconds" \
+        'BEGIN { printf "%.1f", t * 100 / hz / (s + 1.5) }')
+
+    if [ -z "$sent" ] || [ -z "$received" ] || [ -z "$cc" ] || [ -z "$drops" ]; then
+        echo "Could not parse the output"
+        cat "$work/tsg.log" "$work/stsmon.log"
+        exit 1
+    fi
+    clean=0
+    [ "$sent" = "$received" ] && [ "$cc" = 0 ] && [ "$drops" = 0 ] && clean=1
+    echo "$rate,$sent,$received,$cc,$drops,$cpu,$clean" >> "$results"
+    echo "$rate Mbit/s: sent $sent, received $received, cc errors $cc, local drops $drops, stsmon CPU $cpu%"
+
+    if [ "$received" = 0 ]; then
+        echo "Nothing received, is multicast routed on the loopback interface?"
+        exit 77
+    fi
+    if [ "$clean" = 0 ] && [ "$required" = 1 ]; then
+        exit 1
+    fi
+    ;;
+
+summary)
+    results=$2 gate=$3
+    column -t -s, "$results" 2>/dev/null || cat "$results"
+    best=$(awk -F, 'NR > 1 && $7 == 1 && $1 > best { best = $1 } END { print best + 0 }' "$results")
+    echo "Highest clean rate: $best Mbit/s (gate: $gate Mbit/s)"
+    [ "$best" -ge "$gate" ]
+    ;;
+
+intervals)
+    stsmon=$2 tsg=$3 seconds=$4 port=$5
+    work=$(mktemp -d "${TMPDIR:-/tmp}/stsmon-loopback.XXXXXX") || exit 1
+    trap 'rm -rf "$work"' EXIT
+
+    cat > "$work/streams.conf" <<EOF
+[loopback]
+group = $GROUP
+port = $port
+interface = 127.0.0.1
+csv = $work/loopback.csv
+console = no
+EOF
+    "$stsmon" --config "$work/streams.conf" --interval 100 > "$work/stsmon.log" 2>&1 &
+    monitor=$!
+    sleep 0.5
+    timeout -s INT "$seconds" "$tsg" -m "$GROUP" -p "$port" -i 127.0.0.1 --ttl 0 \
+        -b 20M --cc-errors 0 > "$work/tsg.log" 2>&1
+    sleep 1
+    kill -INT "$monitor"
+    wait "$monitor"
+
+    # Rows carry millisecond timestamps, so the number of 100 ms intervals
+    # between the first and last row is known; allow 10% for late ticks
+    set -- $(awk -F, 'NR == 2 { first = $1 } NR > 1 { last = $1; rows++; p += $7 }
+        END { printf "%d %d %d", rows - 1, (last - first) * 10 + 0.5, p }' "$work/loopback.csv")
+    intervals=$1 expected=$2 received=$3
+    echo "$intervals intervals between the CSV rows, $expected expected, $received packets"
+    if [ "$received" = 0 ]; then
+        echo "Nothing received, is multicast routed on the loopback interface?"
+        exit 77
+    fi
+    if [ "$((intervals * 10))" -lt "$((expected * 9))" ]; then
+        cat "$work/loopback.csv" "$work/stsmon.log"
+        exit 1
+    fi
+    ;;
+
+*)
+    echo "Usage: $0 init|run|summary|intervals ..." >&2
+    exit 2
+    ;;
+esac
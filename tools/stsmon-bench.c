@@ -0,0 +1,607 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ *
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * stsmon-bench - measure the packet processing core without a network
+ *
+ * Each scenario builds a TS buffer in memory and feeds it datagram by
+ * datagram into a libstsmon stream, as the capture loop of
+ * monitor_stream() does after every recv. The buffer holds 16 repetitions
+ * of a cycle of packets so continuity counters stay valid when it wraps,
+ * one untimed pass warms up the PSI tables before the timed passes.
+ *
+ * With --file a TS file (e.g. written by test-tsg -o) is mapped and fed
+ * once instead. Allocations are counted by wrapping malloc, calloc and
+ * realloc at link time, see CMakeLists.txt.
+ *
+ * With --console it measures console lines per second instead, see
+ * run_console().
+ */
+#define _GNU_SOURCE /* MAP_POPULATE */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/mpeg/psi.h>
+#include <bitstream/mpeg/psi/pat.h>
+#include <bitstream/mpeg/psi/pmt.h>
+#include <bitstream/dvb/si/sdt.h>
+#include <bitstream/dvb/si/desc_48.h>
+
+#include "stsmon.h"
+#include "output.h"
+
+/* Read by output.c, console lines are never suppressed here */
+int quiet_mode = 0;
+
+/* The stream under test, no callbacks: events cost only the check */
+static stsmon_stream_t *monitor = NULL;
+
+#define TS_PER_DATAGRAM 7
+/* Cycles per buffer, a multiple of 16 keeps every PID's CC continuous */
+#define CYCLES 16
+#define PID_PMT_FIRST 0x100
+#define SDT_SERVICES_PER_SECTION 32
+
+#ifdef BENCH_COUNT_ALLOCS
+static uint64_t allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    allocations++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    allocations++;
+    return __real_realloc(p, size);
+}
+#endif
+
+typedef struct scenario
+{
+    const char *name;
+    const char *description;
+    unsigned services;
+    unsigned es;
+    unsigned es_packets; /* ES packets per cycle */
+    unsigned cc_every;   /* break the CC of every n-th ES packet, 0: never */
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {"spts", "clean SPTS, 1 service, 3 PIDs", 1, 3, 2500, 0},
+    {"mpts", "MPTS, 200 services, 3 PIDs each", 200, 3, 25000, 0},
+    {"psi", "PSI-heavy, 50 services, about 40% PSI packets", 50, 8, 100, 0},
+    {"cc", "SPTS with every 10th ES packet out of sequence", 1, 3, 2500, 10},
+};
+
+/* Generated stream */
+static uint8_t *stream = NULL;
+static size_t stream_packets = 0;
+static size_t stream_alloc = 0;
+static uint8_t cc[8192];
+
+static uint8_t *next_packet(void)
+{
+    if (stream_packets == stream_alloc)
+    {
+        stream_alloc = stream_alloc ? stream_alloc * 2 : 4096;
+        stream = realloc(stream, stream_alloc * TS_SIZE);
+        if (!stream)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    return stream + TS_SIZE * stream_packets++;
+}
+
+static void add_section(uint16_t pid, uint8_t *section)
+{
+    uint16_t length = psi_get_length(section) + PSI_HEADER_SIZE;
+    uint16_t offset = 0;
+
+    while (offset < length)
+    {
+        uint8_t *ts = next_packet();
+        uint8_t ts_offset = 0;
+        memset(ts, 0xff, TS_SIZE);
+        psi_split_section(ts, &ts_offset, section, &offset);
+        ts_set_pid(ts, pid);
+        ts_set_cc(ts, cc[pid]);
+        cc[pid] = (cc[pid] + 1) & 0xf;
+        if (offset == length)
+            psi_split_end(ts, &ts_offset);
+    }
+    free(section);
+}
+
+static void add_es(uint16_t pid, bool broken)
+{
+    uint8_t *ts = next_packet();
+    ts_init(ts);
+    ts_set_pid(ts, pid);
+    ts_set_payload(ts);
+    ts_set_cc(ts, broken ? (cc[pid] + 8) & 0xf : cc[pid]);
+    cc[pid] = (cc[pid] + 1) & 0xf;
+    memset(ts + TS_HEADER_SIZE, 0, TS_SIZE - TS_HEADER_SIZE);
+}
+
+static uint16_t pmt_pid(const scenario_t *sc, unsigned n)
+{
+    return (uint16_t)(PID_PMT_FIRST + n * (sc->es + 1));
+}
+
+static void add_pat(const scenario_t *sc)
+{
+    uint8_t *pat = psi_allocate();
+    pat_init(pat);
+    psi_set_version(pat, 0);
+    psi_set_current(pat);
+    pat_set_tsid(pat, 1);
+    psi_set_section(pat, 0);
+    psi_set_lastsection(pat, 0);
+    for (unsigned n = 0; n < sc->services; n++)
+    {
+        uint8_t *pat_n = pat + PAT_HEADER_SIZE + n * PAT_PROGRAM_SIZE;
+        patn_init(pat_n);
+        patn_set_program(pat_n, n + 1);
+        patn_set_pid(pat_n, pmt_pid(sc, n));
+    }
+    pat_set_length(pat, sc->services * PAT_PROGRAM_SIZE);
+    psi_set_crc(pat);
+    add_section(PAT_PID, pat);
+}
+
+static void add_pmt(const scenario_t *sc, unsigned n)
+{
+    uint8_t *pmt = psi_allocate();
+    pmt_init(pmt);
+    psi_set_version(pmt, 0);
+    psi_set_current(pmt);
+    pmt_set_program(pmt, n + 1);
+    pmt_set_pcrpid(pmt, pmt_pid(sc, n) + 1);
+    pmt_set_desclength(pmt, 0);
+    pmt_set_length(pmt, PSI_MAX_SIZE);
+    for (unsigned es = 0; es < sc->es; es++)
+    {
+        uint8_t *pmt_n = pmt_get_es(pmt, es);
+        pmtn_init(pmt_n);
+        pmtn_set_streamtype(pmt_n, es == 0 ? 0x02 : es == 1 ? 0x04 : 0x06);
+        pmtn_set_pid(pmt_n, pmt_pid(sc, n) + 1 + es);
+        pmtn_set_desclength(pmt_n, 0);
+    }
+    pmt_set_length(pmt, sc->es * PMT_ES_SIZE);
+    psi_set_crc(pmt);
+    add_section(pmt_pid(sc, n), pmt);
+}
+
+static void add_sdt(const scenario_t *sc)
+{
+    unsigned last_section = (sc->services - 1) / SDT_SERVICES_PER_SECTION;
+    for (unsigned s = 0; s <= last_section; s++)
+    {
+        uint8_t *sdt = psi_allocate();
+        sdt_init(sdt, true);
+        psi_set_version(sdt, 0);
+        psi_set_current(sdt);
+        sdt_set_tsid(sdt, 1);
+        sdt_set_onid(sdt, 1);
+        psi_set_section(sdt, s);
+        psi_set_lastsection(sdt, last_section);
+
+        unsigned used = 0;
+        for (unsigned n = s * SDT_SERVICES_PER_SECTION;
+             n < sc->services && n < (s + 1) * SDT_SERVICES_PER_SECTION; n++)
+        {
+            uint8_t *sdt_n = sdt + SDT_HEADER_SIZE + used;
+            char name[32];
+            snprintf(name, sizeof(name), "Service %u", n + 1);
+
+            sdtn_init(sdt_n);
+            sdtn_set_sid(sdt_n, n + 1);
+            sdtn_set_running(sdt_n, 4);
+            uint8_t *descs = sdtn_get_descs(sdt_n);
+            descs_set_length(descs, DESCS_MAX_SIZE);
+            uint8_t *desc = descs_get_desc(descs, 0);
+            desc48_init(desc);
+            desc48_set_type(desc, 0x01);
+            desc48_set_provider(desc, (const uint8_t *)"Bench", 5);
+            desc48_set_service(desc, (const uint8_t *)name, strlen(name));
+            desc48_set_length(desc);
+            desc = descs_get_desc(descs, 1);
+            descs_set_length(descs, desc - descs - DESCS_HEADER_SIZE);
+            used += SDT_SERVICE_SIZE + descs_get_length(descs);
+        }
+        sdt_set_length(sdt, used);
+        psi_set_crc(sdt);
+        add_section(SDT_PID, sdt);
+    }
+}
+
+/* One cycle: all tables, then the ES packets spread over the services,
+ * half of them on the first (video) PID */
+static void add_cycle(const scenario_t *sc, unsigned *es_count)
+{
+    add_pat(sc);
+    for (unsigned n = 0; n < sc->services; n++)
+        add_pmt(sc, n);
+    add_sdt(sc);
+    for (unsigned i = 0; i < sc->es_packets; i++)
+    {
+        unsigned n = i % sc->services;
+        unsigned k = i / sc->services;
+        unsigned es = k % 2 ? 0 : 1 + (k / 2) % sc->es;
+        if (es >= sc->es)
+            es = 0;
+        (*es_count)++;
+        add_es((uint16_t)(pmt_pid(sc, n) + 1 + es), sc->cc_every && *es_count % sc->cc_every == 0);
+    }
+}
+
+static void build(const scenario_t *sc)
+{
+    unsigned es_count = 0;
+    stream_packets = 0;
+    memset(cc, 0, sizeof(cc));
+    for (unsigned c = 0; c < CYCLES; c++)
+        add_cycle(sc, &es_count);
+    /* Pad to whole datagrams with null packets */
+    while (stream_packets % TS_PER_DATAGRAM)
+        ts_pad(next_packet());
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void feed(uint8_t *data, size_t packets, uint64_t now)
+{
+    for (size_t i = 0; i < packets; i += TS_PER_DATAGRAM)
+    {
+        size_t n = packets - i < TS_PER_DATAGRAM ? packets - i : TS_PER_DATAGRAM;
+        stsmon_stream_feed(monitor, data + i * TS_SIZE, n * TS_SIZE, now);
+    }
+}
+
+static void report(const char *name, uint64_t packets, uint64_t cc_errors, uint64_t ns, uint64_t allocs)
+{
+    double per_packet = packets ? (double)ns / (double)packets : 0;
+    double rate = ns ? packets * 1e9 / (double)ns : 0;
+#ifdef BENCH_COUNT_ALLOCS
+    char alloc_str[32];
+    snprintf(alloc_str, sizeof(alloc_str), "%.4f", packets ? (double)allocs / (double)packets : 0);
+#else
+    const char *alloc_str = "n/a";
+    (void)allocs;
+#endif
+    printf("%-10s %12" PRIu64 " %10.2f %12.3f %9.2f %14s %10" PRIu64 " %6zu\n",
+           name, packets, per_packet, rate / 1e6, rate * TS_SIZE * 8 / 1e9, alloc_str,
+           cc_errors, stsmon_stream_service_count(monitor));
+}
+
+static uint64_t alloc_count(void)
+{
+#ifdef BENCH_COUNT_ALLOCS
+    return allocations;
+#else
+    return 0;
+#endif
+}
+
+static void run_scenario(const scenario_t *sc, uint64_t target_packets)
+{
+    build(sc);
+    uint64_t now = monotonic_ns() / 1000;
+
+    /* Warm up: the first pass creates the tables and services. The PID
+     * table keeps its state, the buffer continues where it ends. */
+    feed(stream, stream_packets, now);
+    stsmon_counters_t warm = *stsmon_stream_counters(monitor);
+
+    uint64_t passes = (target_packets + stream_packets - 1) / stream_packets;
+    uint64_t allocs = alloc_count();
+    uint64_t start = monotonic_ns();
+    for (uint64_t p = 0; p < passes; p++)
+        feed(stream, stream_packets, now);
+    uint64_t ns = monotonic_ns() - start;
+    const stsmon_counters_t *c = stsmon_stream_counters(monitor);
+    report(sc->name, c->packets - warm.packets, c->cc_errors - warm.cc_errors, ns, alloc_count() - allocs);
+    stsmon_stream_reset(monitor);
+}
+
+static int run_file(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    size_t packets = (size_t)st.st_size / TS_SIZE;
+    if (!packets)
+    {
+        fprintf(stderr, "%s: no TS packets\n", path);
+        close(fd);
+        return -1;
+    }
+    /* Private copy-on-write mapping, pre-faulted so page faults stay out of the timing */
+    uint8_t *data = mmap(NULL, packets * TS_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    uint64_t allocs = alloc_count();
+    uint64_t start = monotonic_ns();
+    feed(data, packets, start / 1000);
+    uint64_t ns = monotonic_ns() - start;
+    const stsmon_counters_t *c = stsmon_stream_counters(monitor);
+    report(name, c->packets, c->cc_errors, ns, alloc_count() - allocs);
+    stsmon_stream_reset(monitor);
+    munmap(data, packets * TS_SIZE);
+    return 0;
+}
+
+/*
+ * Console mode: lines per second of the output layer written to `path`,
+ * against the stdio path it replaced (time(), localtime() and strftime()
+ * for every timestamp, a printf per colour code, stdio buffering).
+ */
+static const char console_cc_fmt[] = " Discontinuity detected on PID %u: last CC %u, current CC %u";
+
+static void stdio_color(enum ConsoleColors color)
+{
+    printf("\033[%dm", color);
+}
+
+static void stdio_timestamp(void)
+{
+    char buf[64];
+    time_t t = time(NULL);
+    struct tm *tmp = localtime(&t);
+    if (!tmp || strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tmp) == 0)
+        return;
+    stdio_color(COLOR_WHITE);
+    fputs(buf, stdout);
+    stdio_color(COLOR_RESET);
+}
+
+static void line_stdio_cc(unsigned i)
+{
+    stdio_timestamp();
+    stdio_color(COLOR_YELLOW);
+    printf(console_cc_fmt, 256 + i % 8, i & 0xf, (i + 2) & 0xf);
+    printf("\n");
+    stdio_color(COLOR_RESET);
+}
+
+static void line_stdio_log(unsigned i)
+{
+    stdio_timestamp();
+    printf(" ");
+    stdio_color(COLOR_YELLOW);
+    fputs("Warning: ", stdout);
+    printf("Invalid section on PID %u", 256 + i % 8);
+    stdio_color(COLOR_RESET);
+    printf("\n");
+}
+
+static void line_out_cc(unsigned i)
+{
+    out_timestamp();
+    out_color(COLOR_YELLOW);
+    out_printf(console_cc_fmt, 256 + i % 8, i & 0xf, (i + 2) & 0xf);
+    out_reset();
+    out_newline();
+}
+
+static void line_out_log(unsigned i)
+{
+    out_log(LogLevel_Warning, "Invalid section on PID %u", 256 + i % 8);
+}
+
+static double lines_per_second(void (*line)(unsigned), unsigned lines)
+{
+    uint64_t start = monotonic_ns();
+    for (unsigned i = 0; i < lines; i++)
+        line(i);
+    fflush(stdout);
+    uint64_t ns = monotonic_ns() - start;
+    return ns ? lines * 1e9 / (double)ns : 0;
+}
+
+static int run_console(const char *path, unsigned lines)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    /* The lines go to `path` through stdout, as stsmon writes them */
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (saved < 0 || dup2(fd, STDOUT_FILENO) < 0)
+    {
+        perror("dup2");
+        close(fd);
+        if (saved >= 0)
+            close(saved);
+        return -1;
+    }
+    close(fd);
+    double rates[4] = {
+        lines_per_second(line_stdio_cc, lines),
+        lines_per_second(line_out_cc, lines),
+        lines_per_second(line_stdio_log, lines),
+        lines_per_second(line_out_log, lines),
+    };
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    printf("%-10s %10s %14s %14s %8s\n", "line", "lines", "stdio lines/s", "out lines/s", "speedup");
+    const char *names[] = {"cc-line", "out_log"};
+    for (int i = 0; i < 2; i++)
+        printf("%-10s %10u %14.0f %14.0f %7.2fx\n", names[i], lines, rates[2 * i], rates[2 * i + 1],
+               rates[2 * i] > 0 ? rates[2 * i + 1] / rates[2 * i] : 0);
+    return 0;
+}
+
+static void usage(void)
+{
+    printf("Usage: stsmon-bench [options] [scenario...]\n");
+    printf("Options:\n");
+    printf("  -n, --packets <n>   TS packets per scenario (default: 20000000)\n");
+    printf("  -f, --file <file>   Feed a TS file once instead of the scenarios, can be repeated\n");
+    printf("  -c, --console <file> Write console lines to <file> (e.g. /dev/null or a terminal) instead\n");
+    printf("  -l, --lines <n>     Console lines per measurement (default: 1000000)\n");
+    printf("  -h, --help          Show this help message\n");
+    printf("Scenarios (default: all):\n");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        printf("  %-8s %s\n", scenarios[i].name, scenarios[i].description);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"packets", required_argument, 0, 'n'},
+        {"file", required_argument, 0, 'f'},
+        {"console", required_argument, 0, 'c'},
+        {"lines", required_argument, 0, 'l'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+    uint64_t target_packets = 20000000;
+    const char **files = calloc((size_t)argc, sizeof(*files));
+    unsigned file_count = 0;
+    const char *console = NULL;
+    unsigned long lines = 1000000;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:f:c:l:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            target_packets = strtoull(optarg, NULL, 10);
+            if (!target_packets)
+            {
+                fprintf(stderr, "Invalid number of packets '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'f':
+            files[file_count++] = optarg;
+            break;
+        case 'c':
+            console = optarg;
+            break;
+        case 'l':
+            lines = strtoul(optarg, NULL, 10);
+            if (!lines || lines > UINT32_MAX)
+            {
+                fprintf(stderr, "Invalid number of lines '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            fprintf(stderr, "Unknown option. Use -h for help.\n");
+            return 1;
+        }
+    }
+
+    if (console)
+    {
+        free(files);
+        return run_console(console, (unsigned)lines) == 0 ? 0 : 1;
+    }
+
+    monitor = stsmon_stream_new(NULL, NULL);
+    if (!monitor)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    printf("%-10s %12s %10s %12s %9s %14s %10s %6s\n",
+           "scenario", "packets", "ns/packet", "Mpackets/s", "Gbit/s", "allocs/packet", "cc errors", "svcs");
+
+    int ret = 0;
+    for (unsigned i = 0; i < file_count; i++)
+        if (run_file(files[i]) != 0)
+            ret = 1;
+    if (file_count == 0)
+    {
+        for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        {
+            bool selected = optind == argc;
+            for (int a = optind; a < argc; a++)
+                selected |= strcmp(argv[a], scenarios[i].name) == 0;
+            if (selected)
+                run_scenario(&scenarios[i], target_packets);
+        }
+        for (int a = optind; a < argc; a++)
+        {
+            bool known = false;
+            for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+                known |= strcmp(argv[a], scenarios[i].name) == 0;
+            if (!known)
+            {
+                fprintf(stderr, "Unknown scenario '%s'.\n", argv[a]);
+                ret = 1;
+            }
+        }
+    }
+    stsmon_stream_free(monitor);
+    free(files);
+    free(stream);
+    return ret;
+}
@@ -0,0 +1,171 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * stsmon-ctl - talk to the control socket of `stsmon --control <path>`
+ *
+ *   stsmon-ctl -s /run/stsmon.sock stats
+ *   stsmon-ctl -s /run/stsmon.sock set cc_warning 50
+ *
+ * Without a command, commands are read from stdin one per line. The exit
+ * status is 1 if any command answered with an error.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static FILE *conn = NULL;
+
+static int connect_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "Cannot connect to %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    conn = fdopen(fd, "r+");
+    if (!conn)
+    {
+        perror("fdopen");
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* Send one command and copy the answer to stdout, 1 on "error:" */
+static int run_command(const char *command)
+{
+    fprintf(conn, "%s\n", command);
+    fflush(conn);
+
+    char line[1024];
+    while (fgets(line, sizeof(line), conn))
+    {
+        if (strcmp(line, "ok\n") == 0)
+            return 0;
+        if (strncmp(line, "error:", 6) == 0)
+        {
+            fputs(line, stderr);
+            return 1;
+        }
+        fputs(line, stdout);
+    }
+    fprintf(stderr, "Connection closed by stsmon\n");
+    return -1;
+}
+
+static void usage()
+{
+    printf("Usage: stsmon-ctl -s <socket> [command...]\n");
+    printf("Commands:\n");
+    printf("  stats                 Stream counters and bitrate rollups\n");
+    printf("  pids                  Per-PID counters\n");
+    printf("  services              Services from PAT, PMT and SDT\n");
+    printf("  psi [pid]             Current PSI sections as hex dumps\n");
+    printf("  get                   Show runtime settings\n");
+    printf("  set <name> <value>    Change a runtime setting\n");
+    printf("Without a command, commands are read from stdin.\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "+s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            path = optarg;
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (!path)
+    {
+        usage();
+        return 1;
+    }
+    if (connect_socket(path) != 0)
+        return 1;
+
+    int status = 0;
+    if (optind < argc)
+    {
+        char command[256] = "";
+        size_t used = 0;
+        for (int i = optind; i < argc; i++)
+        {
+            int n = snprintf(command + used, sizeof(command) - used, "%s%s", i > optind ? " " : "", argv[i]);
+            if (n < 0 || (size_t)n >= sizeof(command) - used)
+            {
+                fprintf(stderr, "Command too long\n");
+                fclose(conn);
+                return 1;
+            }
+            used += (size_t)n;
+        }
+        status = run_command(command) != 0;
+    }
+    else
+    {
+        char line[256];
+        while (fgets(line, sizeof(line), stdin))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+                continue;
+            int rc = run_command(line);
+            if (rc < 0)
+            {
+                status = 1;
+                break;
+            }
+            status |= rc;
+        }
+    }
+    fclose(conn);
+    return status;
+}
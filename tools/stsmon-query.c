@@ -0,0 +1,358 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * stsmon-query - extract statistics from a `stsmon --binlog` file
+ *
+ * The block index (<file>.idx) is binary searched for the first block
+ * overlapping the requested range, only blocks inside the range are read
+ * and decoded. Without an index the block headers are walked instead,
+ * which still skips over the payloads.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/types.h>
+#include "binlog_format.h"
+
+typedef struct bucket
+{
+    uint64_t start;
+    uint64_t samples;
+    double bitrate_sum;
+    double bitrate_min;
+    double bitrate_max;
+    double data_bitrate_sum;
+    uint64_t errors[3];
+    uint64_t packets;
+    uint64_t data_packets;
+} bucket_t;
+
+static binlog_index_entry_t *index_entries = NULL;
+static size_t index_count = 0;
+
+static int load_index(const char *path, FILE *data)
+{
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    FILE *f = fopen(index_path, "rb");
+    if (f)
+    {
+        fseeko(f, 0, SEEK_END);
+        index_count = (size_t)ftello(f) / sizeof(binlog_index_entry_t);
+        rewind(f);
+        index_entries = calloc(index_count ? index_count : 1, sizeof(binlog_index_entry_t));
+        if (!index_entries || fread(index_entries, sizeof(binlog_index_entry_t), index_count, f) != index_count)
+        {
+            fprintf(stderr, "Failed to read '%s'\n", index_path);
+            fclose(f);
+            return -1;
+        }
+        fclose(f);
+        return 0;
+    }
+
+    /* No index, walk the block headers */
+    fprintf(stderr, "'%s' not found, scanning block headers\n", index_path);
+    size_t capacity = 0;
+    uint64_t offset = sizeof(binlog_file_header_t);
+    binlog_block_header_t header;
+    while (fseeko(data, (off_t)offset, SEEK_SET) == 0 &&
+           fread(&header, sizeof(header), 1, data) == 1 &&
+           header.magic == BINLOG_BLOCK_MAGIC)
+    {
+        if (index_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            binlog_index_entry_t *grown = realloc(index_entries, capacity * sizeof(*grown));
+            if (!grown)
+                return -1;
+            index_entries = grown;
+        }
+        binlog_index_entry_t *entry = &index_entries[index_count++];
+        entry->t_first = header.t_first;
+        entry->t_last = header.t_last;
+        entry->offset = offset;
+        entry->rows = header.rows;
+        entry->size = (uint32_t)(sizeof(header) + header.payload_size);
+        offset += entry->size;
+    }
+    return 0;
+}
+
+/* First block whose last row is at or after `from` (milliseconds) */
+static size_t find_block(uint64_t from)
+{
+    size_t lo = 0, hi = index_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index_entries[mid].t_last < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Unix seconds or local "YYYY-MM-DD[ HH:MM[:SS]]" */
+static int parse_time(const char *s, uint64_t *out)
+{
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (*end == '\0')
+    {
+        *out = v;
+        return 0;
+    }
+
+    static const char *formats[] = {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"};
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        end = strptime(s, formats[i], &tm);
+        if (end && *end == '\0')
+        {
+            tm.tm_isdst = -1;
+            time_t t = mktime(&tm);
+            if (t < 0)
+                return -1;
+            *out = (uint64_t)t;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Increase of a cumulative counter, stsmon restarts reset it to 0 */
+static uint64_t counter_increase(uint64_t prev, uint64_t cur)
+{
+    return cur >= prev ? cur - prev : cur;
+}
+
+static void print_bucket(const bucket_t *b)
+{
+    if (b->samples == 0)
+        return;
+    printf("%" PRIu64 ",%" PRIu64 ",%.2f,%.2f,%.2f,%.2f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+           b->start / 1000, b->samples,
+           b->bitrate_sum / b->samples / 1000.0,
+           b->bitrate_min / 1000.0,
+           b->bitrate_max / 1000.0,
+           b->data_bitrate_sum / b->samples / 1000.0,
+           b->errors[0], b->errors[1], b->errors[2],
+           b->packets, b->data_packets);
+}
+
+int main(int argc, char **argv)
+{
+    /* All times below are unix milliseconds, as stored in the log */
+    uint64_t from = 0, to = UINT64_MAX;
+    uint64_t resolution = 0;
+    int show_info = 0;
+
+    static struct option long_options[] = {
+        {"from", required_argument, 0, 'f'},
+        {"to", required_argument, 0, 't'},
+        {"resolution", required_argument, 0, 'r'},
+        {"info", no_argument, 0, 'i'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:t:r:ih", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+        case 't':
+        {
+            uint64_t t;
+            if (parse_time(optarg, &t) != 0)
+            {
+                fprintf(stderr, "Invalid time '%s'\n", optarg);
+                return 1;
+            }
+            if (opt == 'f')
+                from = t * 1000;
+            else
+                to = t * 1000 + 999;
+            break;
+        }
+        case 'r':
+            if (strcmp(optarg, "raw") == 0)
+                resolution = 0;
+            else if (strcmp(optarg, "minute") == 0)
+                resolution = 60000;
+            else if (strcmp(optarg, "hour") == 0)
+                resolution = 3600000;
+            else
+            {
+                fprintf(stderr, "Resolution must be raw, minute or hour\n");
+                return 1;
+            }
+            break;
+        case 'i':
+            show_info = 1;
+            break;
+        case 'h':
+        default:
+            fprintf(stderr, "Usage: stsmon-query [options] <file>\n");
+            fprintf(stderr, "  -f, --from <time>        First timestamp (unix seconds or YYYY-MM-DD[ HH:MM[:SS]])\n");
+            fprintf(stderr, "  -t, --to <time>          Last timestamp, inclusive\n");
+            fprintf(stderr, "  -r, --resolution <res>   raw (default), minute or hour\n");
+            fprintf(stderr, "  -i, --info               Show block and compression summary\n");
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "Binary log file is required. Use -h for help.\n");
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    FILE *data = fopen(path, "rb");
+    if (!data)
+    {
+        fprintf(stderr, "fopen('%s') failed: %s\n", path, strerror(errno));
+        return 1;
+    }
+    binlog_file_header_t file_header;
+    if (fread(&file_header, sizeof(file_header), 1, data) != 1 ||
+        memcmp(file_header.magic, BINLOG_MAGIC, sizeof(file_header.magic)) != 0 ||
+        file_header.version != BINLOG_VERSION)
+    {
+        fprintf(stderr, "'%s' is not a stsmon binary log\n", path);
+        return 1;
+    }
+    if (load_index(path, data) != 0)
+        return 1;
+
+    if (show_info)
+    {
+        uint64_t rows = 0, bytes = sizeof(file_header);
+        for (size_t i = 0; i < index_count; i++)
+        {
+            rows += index_entries[i].rows;
+            bytes += index_entries[i].size;
+        }
+        printf("blocks: %zu\nrows: %" PRIu64 "\nbytes: %" PRIu64 "\n", index_count, rows, bytes);
+        if (index_count)
+            printf("first: %" PRIu64 "\nlast: %" PRIu64 "\n", index_entries[0].t_first / 1000, index_entries[index_count - 1].t_last / 1000);
+        if (rows)
+            printf("bytes per row: %.1f\n", (double)bytes / rows);
+        return 0;
+    }
+
+    if (resolution)
+        printf("Timestamp,Samples,Bitrate (kbps),Min Bitrate (kbps),Max Bitrate (kbps),Data Bitrate (kbps),CC Errors,Sync Errors,TEI Errors,Total Packets,Data Packets\n");
+    else
+        printf("Timestamp,Bitrate (kbps),Data Bitrate (kbps),CC Errors,Sync Errors,TEI Errors,Total Packets,Data Packets\n");
+
+    static binlog_block_t block;
+    static uint8_t payload[BINLOG_BLOCK_MAX_SIZE];
+    static const int error_columns[3] = {BINLOG_COL_CC_ERRORS, BINLOG_COL_SYNC_ERRORS, BINLOG_COL_TEI_ERRORS};
+    uint64_t prev_errors[3] = {0, 0, 0};
+    int have_prev = 0;
+    bucket_t bucket;
+    memset(&bucket, 0, sizeof(bucket));
+
+    for (size_t i = find_block(from); i < index_count && index_entries[i].t_first <= to; i++)
+    {
+        binlog_block_header_t header;
+        if (fseeko(data, (off_t)index_entries[i].offset, SEEK_SET) != 0 ||
+            fread(&header, sizeof(header), 1, data) != 1 ||
+            header.magic != BINLOG_BLOCK_MAGIC ||
+            header.payload_size > sizeof(payload) ||
+            fread(payload, 1, header.payload_size, data) != header.payload_size ||
+            binlog_decode_block(&header, payload, &block) != 0)
+        {
+            fprintf(stderr, "Corrupted block at offset %" PRIu64 ", skipping\n", index_entries[i].offset);
+            have_prev = 0;
+            continue;
+        }
+
+        for (int r = 0; r < block.rows; r++)
+        {
+            uint64_t ts = block.values[BINLOG_COL_TIMESTAMP][r];
+            uint64_t errors[3];
+            for (int e = 0; e < 3; e++)
+                errors[e] = block.values[error_columns[e]][r];
+
+            if (ts >= from && ts <= to)
+            {
+                double bitrate = binlog_bits_double(block.values[BINLOG_COL_BITRATE][r]);
+                double data_bitrate = binlog_bits_double(block.values[BINLOG_COL_DATA_BITRATE][r]);
+                uint64_t packets = block.values[BINLOG_COL_PACKETS][r];
+                uint64_t data_packets = block.values[BINLOG_COL_DATA_PACKETS][r];
+
+                if (!resolution)
+                {
+                    /* Same timestamp format as the CSV log */
+                    if (block.interval_ms < 1000)
+                        printf("%" PRIu64 ".%03u", ts / 1000, (unsigned)(ts % 1000));
+                    else
+                        printf("%" PRIu64, ts / 1000);
+                    printf(",%.2f,%.2f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                           bitrate / 1000.0, data_bitrate / 1000.0,
+                           errors[0], errors[1], errors[2], packets, data_packets);
+                }
+                else
+                {
+                    uint64_t start = ts - ts % resolution;
+                    if (bucket.samples && start != bucket.start)
+                    {
+                        print_bucket(&bucket);
+                        memset(&bucket, 0, sizeof(bucket));
+                    }
+                    if (bucket.samples == 0)
+                    {
+                        bucket.start = start;
+                        bucket.bitrate_min = bitrate;
+                        bucket.bitrate_max = bitrate;
+                    }
+                    bucket.samples++;
+                    bucket.bitrate_sum += bitrate;
+                    bucket.data_bitrate_sum += data_bitrate;
+                    if (bitrate < bucket.bitrate_min)
+                        bucket.bitrate_min = bitrate;
+                    if (bitrate > bucket.bitrate_max)
+                        bucket.bitrate_max = bitrate;
+                    for (int e = 0; e < 3; e++)
+                        if (have_prev)
+                            bucket.errors[e] += counter_increase(prev_errors[e], errors[e]);
+                    bucket.packets += packets;
+                    bucket.data_packets += data_packets;
+                }
+            }
+            memcpy(prev_errors, errors, sizeof(errors));
+            have_prev = 1;
+        }
+    }
+    print_bucket(&bucket);
+
+    free(index_entries);
+    fclose(data);
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * This file is part of stsmon - a simple DVB transport stream monitor
+ * Copyright (C) 2025 Michał Podsiadlik <michal@nglab.net>
+ * 
+ * stsmon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * stsmon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * stsmon-shmread - print statistics published by `stsmon --shm <name>`
+ *
+ * Example reader of the shared-memory layout described in
+ * src/stsmon_shm.h. Reading does not involve stsmon at all, the segment
+ * is mapped read-only and records are copied under their sequence locks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include "stsmon_shm.h"
+
+static const uint8_t *base = NULL;
+
+/* Copy a record guarded by a leading uint32_t sequence counter */
+static void read_record(void *dst, const void *src, size_t size)
+{
+    const uint32_t *seq = src;
+    while (1)
+    {
+        uint32_t begin = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if (begin & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        memcpy(dst, src, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(seq, __ATOMIC_RELAXED) == begin)
+            return;
+    }
+}
+
+static void print_stats(const stsmon_shm_header_t *header, int show_pids)
+{
+    stsmon_shm_stream_t st;
+    read_record(&st, &header->stream_stats, sizeof(st));
+
+    printf("%s: bitrate %.2f (data: %.2f) Mbps packets=%" PRIu64 " cc=%" PRIu64
+           " sync=%" PRIu64 " tei=%" PRIu64 " drops=%" PRIu64 "\n",
+           header->stream,
+           st.bitrate_bps / 1000000.0, st.data_bitrate_bps / 1000000.0,
+           st.packets_all, st.cc_errors, st.sync_errors, st.tei_errors,
+           st.socket_drops + st.csv_drops);
+
+    const stsmon_shm_service_t *services = (const void *)(base + header->service_offset);
+    for (uint32_t i = 0; i < st.service_count && i < header->max_services; i++)
+    {
+        stsmon_shm_service_t sv;
+        read_record(&sv, (const uint8_t *)services + i * header->service_record_size, sizeof(sv));
+        printf("  service %5u pmt %4u version %2u%s %s\n",
+               sv.service_id, sv.pmt_pid, sv.pmt_version, sv.scrambled ? " $" : "  ", sv.name);
+    }
+
+    if (!show_pids)
+        return;
+    printf("  %5s %7s %10s %14s %8s %8s\n", "PID", "service", "kbps", "packets", "cc", "tei");
+    for (uint32_t pid = 0; pid < header->max_pids; pid++)
+    {
+        stsmon_shm_pid_t rec;
+        read_record(&rec, base + header->pid_offset + pid * header->pid_record_size, sizeof(rec));
+        if (!(rec.flags & STSMON_SHM_PID_PRESENT))
+            continue;
+        printf("  %5u %7u %10.1f %14" PRIu64 " %8" PRIu64 " %8" PRIu64 "%s\n",
+               rec.pid, rec.service_id, rec.bitrate_bps / 1000.0, rec.packets,
+               rec.cc_errors, rec.tei_errors,
+               (rec.flags & STSMON_SHM_PID_PSI) ? " PSI" : "");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int interval = 0;
+    int show_pids = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:ph")) != -1)
+    {
+        switch (opt)
+        {
+        case 'w':
+            interval = atoi(optarg);
+            break;
+        case 'p':
+            show_pids = 1;
+            break;
+        case 'h':
+        default:
+            fprintf(stderr, "Usage: stsmon-shmread [-p] [-w seconds] <name>\n");
+            fprintf(stderr, "  -p          Show PID table\n");
+            fprintf(stderr, "  -w seconds  Repeat every given number of seconds\n");
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "Segment name is required. Use -h for help.\n");
+        return 1;
+    }
+
+    char name[256];
+    if (argv[optind][0] == '/')
+        snprintf(name, sizeof(name), "%s", argv[optind]);
+    else
+        snprintf(name, sizeof(name), "/%s", argv[optind]);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "shm_open('%s') failed: %s\n", name, strerror(errno));
+        return 1;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(stsmon_shm_header_t))
+    {
+        fprintf(stderr, "'%s' is not a stsmon statistics segment\n", name);
+        close(fd);
+        return 1;
+    }
+    base = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "mmap('%s') failed: %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    const stsmon_shm_header_t *header = (const void *)base;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != STSMON_SHM_MAGIC ||
+        header->version != STSMON_SHM_VERSION ||
+        (size_t)sb.st_size < header->service_offset + (size_t)header->max_services * header->service_record_size)
+    {
+        fprintf(stderr, "'%s' has unknown layout\n", name);
+        return 1;
+    }
+
+    while (1)
+    {
+        print_stats(header, show_pids);
+        if (!header->running)
+        {
+            printf("stsmon (pid %u) is no longer running\n", header->writer_pid);
+            break;
+        }
+        if (interval <= 0)
+            break;
+        fflush(stdout);
+        sleep((unsigned)interval);
+    }
+    return 0;
+}
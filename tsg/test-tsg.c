@@ -15,14 +15,34 @@
  * You should have received a copy of the GNU General Public License
  * along with stsmon. If not, see <http://www.gnu.org/licenses/>.
  * 
- * transport-stream-generator.c - Generate test MPEG-TS with intentional CC errors
+ * test-tsg.c - Generate test MPEG-TS with intentional CC errors
  *
  * This program generates a transport stream with:
- * - PAT, PMT, and SDT tables
- * - MPEG2 Video, MPEG2 Audio, and DVB Subtitles
- * - Intentional continuity counter errors on video PID every 15 seconds
- * - Output to UDP multicast 239.239.42.12:1234
+ * - PAT, PMT and SDT tables for one or more services (MPTS), split into
+ *   several sections when they do not fit in one
+ * - per service an MPEG2 Video PID carrying the PCR, an MPEG2 Audio PID
+ *   and DVB Subtitles / private data PIDs
+ * - intentional continuity counter errors on the first video PID every
+ *   15 seconds, or the impairments scheduled by a scenario (see
+ *   tsg/example.scenario) together with a ground truth log of every
+ *   impairment injected
+ * - output to UDP, by default multicast 239.239.42.12:1234
+ *
+ * Datagrams are paced against absolute deadlines on CLOCK_MONOTONIC and
+ * sent in batches with sendmmsg(), so the generator keeps its bitrate
+ * without drift and can drive stsmon at well over 1 Gbit/s on loopback.
+ *
+ * With --output the stream is written to a file or stdout as fast as
+ * possible, optionally with a pcap whose timestamps follow the bitrate.
+ * Output is deterministic for a given command line (and --seed), which
+ * makes reproducible benchmark corpora, e.g.:
+ *
+ *   test-tsg -o spts.ts --size 4G
+ *   test-tsg -o mpts.ts -s 200 -b 200M --duration 5m
+ *   test-tsg -o eit.ts -s 20 --eit 500 -b 40M --duration 5m
+ *   test-tsg -o errors.ts --impair "0 cc every=10ms" --impair "0 tei every=50ms" --size 2G
  */
+#define _GNU_SOURCE /* sendmmsg */
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -33,6 +53,8 @@
 #include <errno.h>
 #include <time.h>
 #include <inttypes.h>
+#include <getopt.h>
+#include <sys/time.h>
 #ifdef WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -53,49 +75,184 @@
 #include <bitstream/dvb/si/desc_48.h>
 #pragma GCC diagnostic pop
 
-/* Configuration */
+/* Defaults */
 #define MCAST_ADDR "239.239.42.12"
 #define MCAST_PORT 1234
 #define BITRATE 3800000 /* ~3.8 Mbps - typical SD bitrate */
 #define TS_PACKET_SIZE 188
-#define PACKETS_PER_SEC (BITRATE / 8 / TS_PACKET_SIZE)
+#define TS_PER_UDP_MAX 7
 
-/* PIDs */
+/* PIDs: service n uses PMT PID 0x100 + n * (es_per_service + 1) and the
+ * following PIDs for its elementary streams, the first one carries PCR */
 #define PID_PAT 0x0000
+#define PID_NIT 0x0010
 #define PID_SDT 0x0011
-#define PID_PMT 0x0100
-#define PID_VIDEO 0x0101
-#define PID_AUDIO 0x0102
-#define PID_SUBTITLES 0x0103
-#define PID_PCR PID_VIDEO
+#define PID_EIT 0x0012
+#define PID_PMT_FIRST 0x0100
+#define PID_MAX 0x1ffe
+#define ES_PER_SERVICE_MAX 15
 
 /* Program details */
 #define TSID 1
-#define SID 1
 #define ONID 1
-#define PMT_PID PID_PMT
-
-/* Continuity counters */
-static uint8_t cc_pat = 0;
-static uint8_t cc_pmt = 0;
-static uint8_t cc_sdt = 0;
-static uint8_t cc_video = 0;
-static uint8_t cc_audio = 0;
-static uint8_t cc_subtitles = 0;
-
-/* Timing */
-static time_t start_time;
-static time_t last_cc_error_time;
+
+/* PSI/SI tables are repeated this often, in stream time */
+#define PSI_INTERVAL_NS 1000000000ULL
+/* PCR is inserted on the video PID at least this often */
+#define PCR_INTERVAL_NS 40000000ULL
+/* Largest number of datagrams passed to one sendmmsg() */
+#define BATCH_MAX 64
+/* Without --batch, a batch covers at most this much stream time */
+#define BATCH_SPAN_NS 1000000ULL
+/* Falling further behind than this restarts the schedule instead of
+ * sending a catch-up burst */
+#define LATE_RESYNC_NS 100000000ULL
+/* The PAT and SDT loops are split into sections of at most this size */
+#define SECTION_PAYLOAD_MAX (PSI_MAX_SIZE - PSI_CRC_SIZE - (SDT_HEADER_SIZE - PSI_HEADER_SIZE))
+/* EIT events have a fixed size, a short event descriptor with this name
+ * and text length */
+#define EIT_HEADER_SIZE 14
+#define EIT_EVENT_SIZE 12
+#define EIT_NAME_SIZE 11
+#define EIT_TEXT_SIZE 40
+#define EIT_EVENT_MINUTES 30
+#define EIT_EVENT_TOTAL (EIT_EVENT_SIZE + 2 + 3 + 1 + EIT_NAME_SIZE + 1 + EIT_TEXT_SIZE)
+#define EIT_EVENTS_PER_SECTION ((PSI_MAX_SIZE - PSI_CRC_SIZE - (EIT_HEADER_SIZE - PSI_HEADER_SIZE)) / EIT_EVENT_TOTAL)
+#define EIT_EVENTS_MAX (EIT_EVENTS_PER_SECTION * 256)
+/* Synthetic pcap timestamps start at 2025-01-01T00:00:00Z */
+#define PCAP_EPOCH 1735689600ULL
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_IP_UDP_SIZE 28
+
+/* Configuration, set from the command line */
+static const char *dest_host = MCAST_ADDR;
+static uint16_t dest_port = MCAST_PORT;
+static const char *local_interface = NULL;
+static int ttl = -1;
+static uint64_t bitrate = BITRATE;
+static unsigned services = 1;
+static unsigned es_per_service = 3;
+static unsigned ts_per_udp = TS_PER_UDP_MAX;
+static unsigned batch_size = 0;
+static int cc_error_period = -1; /* -1: 15 s unless a scenario is given */
+static const char *truth_file = NULL;
+static unsigned eit_events = 0;
+static const char *output_file = NULL;
+static const char *pcap_file = NULL;
+static bool fast = false;
+static uint64_t duration_ns = 0;
+static uint64_t size_limit = 0;
+
+/* Progress and messages, stderr when the stream goes to stdout */
+static FILE *info = NULL;
+/* TS output instead of the socket, and the optional pcap */
+static FILE *output = NULL;
+static FILE *pcap = NULL;
+
+/* Continuity counters, per PID */
+static uint8_t cc[8192];
+
+typedef enum {
+    TABLE_NONE,
+    TABLE_PAT,
+    TABLE_PMT,
+    TABLE_SDT,
+} table_t;
+
+/* PSI/SI tables split into TS packets, continuity counters are set when
+ * the packets are sent */
+typedef struct psi_packet
+{
+    uint16_t pid;
+    uint8_t table;
+    uint8_t crc_offset; /* last CRC byte in ts, 0 when no section ends here */
+    unsigned service;
+    uint8_t ts[TS_SIZE];
+} psi_packet_t;
+static psi_packet_t *psi_packets = NULL;
+static size_t psi_count = 0;
+static size_t psi_alloc = 0;
+static size_t psi_pos = 0;
+static uint64_t next_psi_ns = 0;
+
+static uint8_t pat_version = 0;
+static uint8_t sdt_version = 0;
+
+/* Per service state */
+typedef struct service_state
+{
+    uint64_t next_pcr_ns;
+    uint8_t pmt_version;
+    uint64_t pcr_jitter_until;
+    uint64_t pcr_jitter_max;
+} service_state_t;
+static service_state_t *service_state = NULL;
+
+/* Stream time */
+static double packet_ns;
 static uint64_t packet_count = 0;
+static uint64_t es_slot = 0;
 
 /* Socket */
 static int sockfd = -1;
 static struct sockaddr_in dest_addr;
 
-/* Batch buffer: send 7 TS packets per UDP datagram */
-#define TS_PER_UDP 7
-static uint8_t udp_buf[TS_PER_UDP * TS_PACKET_SIZE];
-static int udp_buf_count = 0;
+/* Batch buffer: up to BATCH_MAX datagrams of ts_per_udp TS packets, plus
+ * one for a datagram held back by reordering */
+static uint8_t udp_buf[BATCH_MAX + 1][TS_PER_UDP_MAX * TS_PACKET_SIZE];
+#ifndef WIN32
+static struct mmsghdr msgs[BATCH_MAX + 1];
+static struct iovec iovs[BATCH_MAX + 1];
+#endif
+static uint64_t datagram_count = 0;
+
+static volatile sig_atomic_t running = 1;
+
+static uint16_t service_pmt_pid(unsigned n)
+{
+    return PID_PMT_FIRST + n * (es_per_service + 1);
+}
+
+static uint16_t service_es_pid(unsigned n, unsigned es)
+{
+    return service_pmt_pid(n) + 1 + es;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Parse a bitrate or size with an optional k, M or G suffix (powers of 1000) */
+static int parse_scaled(const char *arg, uint64_t *out)
+{
+    char *end;
+    double value = strtod(arg, &end);
+    if (end == arg || value <= 0)
+        return -1;
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        value *= 1e3;
+        end++;
+        break;
+    case 'M':
+        value *= 1e6;
+        end++;
+        break;
+    case 'G':
+        value *= 1e9;
+        end++;
+        break;
+    }
+    if (*end != '\0')
+        return -1;
+    *out = (uint64_t)value;
+    return 0;
+}
 
 /* Initialize UDP socket */
 static int init_socket(void)
@@ -115,203 +272,299 @@ static int init_socket(void)
         return -1;
     }
 
-    memset(&dest_addr, 0, sizeof(dest_addr));
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(MCAST_PORT);
-    dest_addr.sin_addr.s_addr = inet_addr(MCAST_ADDR);
+    /* Room for a few milliseconds of a Gbit/s stream */
+    int sndbuf = 4 * 1024 * 1024;
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, (const char *)&sndbuf, sizeof(sndbuf));
 
-    if (dest_addr.sin_addr.s_addr == INADDR_NONE)
+    if (local_interface)
     {
-        perror("inet_addr");
+        struct in_addr iface;
+        iface.s_addr = inet_addr(local_interface);
+        if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, (const char *)&iface, sizeof(iface)) < 0)
+        {
+            perror("IP_MULTICAST_IF");
+            close(sockfd);
+            return -1;
+        }
+    }
+    if (ttl >= 0 && setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&ttl, sizeof(ttl)) < 0)
+    {
+        perror("IP_MULTICAST_TTL");
         close(sockfd);
         return -1;
     }
 
-    printf("Sending to %s:%d\n", MCAST_ADDR, MCAST_PORT);
+#ifndef WIN32
+    for (int i = 0; i <= BATCH_MAX; i++)
+    {
+        iovs[i].iov_base = udp_buf[i];
+        iovs[i].iov_len = ts_per_udp * TS_PACKET_SIZE;
+        msgs[i].msg_hdr.msg_name = &dest_addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(dest_addr);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+
+    fprintf(info, "Sending to %s:%u\n", dest_host, dest_port);
     return 0;
 }
 
-/* Flush UDP buffer (send accumulated TS packets as one UDP datagram) */
-static int flush_udp_buf(void)
+/* IPv4 header checksum */
+static uint16_t ip_checksum(const uint8_t *p, size_t len)
 {
-    if (udp_buf_count == 0)
-        return 0;
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2)
+        sum += (uint32_t)(p[i] << 8 | p[i + 1]);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/* Classic pcap with nanosecond timestamps and raw IPv4 packets */
+static int pcap_open(const char *path)
+{
+    pcap = fopen(path, "wb");
+    if (!pcap)
+    {
+        perror(path);
+        return -1;
+    }
+    setvbuf(pcap, NULL, _IOFBF, 4 * 1024 * 1024);
+    uint32_t header[6] = {0xa1b23c4d, 2 | (4 << 16), 0, 0, 65535, PCAP_LINKTYPE_RAW};
+    if (fwrite(header, sizeof(header), 1, pcap) != 1)
+    {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
 
-    ssize_t to_send = udp_buf_count * TS_PACKET_SIZE;
-    ssize_t sent = sendto(sockfd, (const char *)udp_buf, to_send, 0,
-                          (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    if (sent < 0)
+/* Write one datagram with synthetic IPv4/UDP headers, stream time `ns` */
+static int pcap_write(const uint8_t *data, size_t len, uint64_t ns)
+{
+    static uint16_t ip_id = 0;
+    uint8_t packet[PCAP_IP_UDP_SIZE];
+    uint32_t record[4] = {
+        (uint32_t)(PCAP_EPOCH + ns / 1000000000ULL),
+        (uint32_t)(ns % 1000000000ULL),
+        (uint32_t)(PCAP_IP_UDP_SIZE + len),
+        (uint32_t)(PCAP_IP_UDP_SIZE + len),
+    };
+    uint32_t src = local_interface ? inet_addr(local_interface) : inet_addr("192.0.2.1");
+    uint16_t total = htons((uint16_t)(PCAP_IP_UDP_SIZE + len));
+    uint16_t id = htons(ip_id++);
+    uint16_t udp_len = htons((uint16_t)(8 + len));
+
+    memset(packet, 0, sizeof(packet));
+    packet[0] = 0x45;
+    memcpy(packet + 2, &total, 2);
+    memcpy(packet + 4, &id, 2);
+    packet[8] = ttl >= 0 ? (uint8_t)ttl : 1;
+    packet[9] = 17; /* UDP */
+    memcpy(packet + 12, &src, 4);
+    memcpy(packet + 16, &dest_addr.sin_addr.s_addr, 4);
+    uint16_t checksum = htons(ip_checksum(packet, 20));
+    memcpy(packet + 10, &checksum, 2);
+    memcpy(packet + 20, &dest_addr.sin_port, 2);
+    memcpy(packet + 22, &dest_addr.sin_port, 2);
+    memcpy(packet + 24, &udp_len, 2);
+
+    if (fwrite(record, sizeof(record), 1, pcap) != 1 ||
+        fwrite(packet, sizeof(packet), 1, pcap) != 1 ||
+        fwrite(data, len, 1, pcap) != 1)
     {
-        perror("sendto");
+        perror("pcap");
         return -1;
     }
-    packet_count += udp_buf_count;
-    udp_buf_count = 0;
     return 0;
 }
 
-static void handle_sigint(int signo)
+/* Write the first `count` datagrams of the batch buffer to the output file
+ * and the pcap, `slot_ns` are their stream times */
+static int write_batch(unsigned count, const uint64_t *slot_ns)
 {
-    (void)signo;
-    printf("\nCaught signal, flushing buffer and exiting...\n");
-    flush_udp_buf();
-    if (sockfd >= 0)
-        close(sockfd);
-    exit(0);
+    size_t len = ts_per_udp * TS_PACKET_SIZE;
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (output && fwrite(udp_buf[i], len, 1, output) != 1)
+        {
+            perror(output_file);
+            return -1;
+        }
+        if (pcap && pcap_write(udp_buf[i], len, slot_ns[i]) != 0)
+            return -1;
+    }
+    if (output)
+        datagram_count += count;
+    return 0;
 }
 
-/* Enqueue a TS packet to UDP buffer; flush when full */
-static int send_ts_packet(const uint8_t *packet)
+/* Send the first `count` datagrams of the batch buffer */
+static int send_batch(unsigned count)
 {
-    /* copy packet into buffer */
-    memcpy(udp_buf + udp_buf_count * TS_PACKET_SIZE, packet, TS_PACKET_SIZE);
-    udp_buf_count++;
-    if (udp_buf_count >= TS_PER_UDP)
+#ifdef WIN32
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (sendto(sockfd, (const char *)udp_buf[i], ts_per_udp * TS_PACKET_SIZE, 0,
+                   (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0)
+        {
+            perror("sendto");
+            return -1;
+        }
+    }
+#else
+    unsigned sent = 0;
+    while (sent < count)
     {
-        return flush_udp_buf();
+        int ret = sendmmsg(sockfd, msgs + sent, count - sent, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("sendmmsg");
+            return -1;
+        }
+        sent += (unsigned)ret;
     }
+#endif
+    datagram_count += count;
     return 0;
 }
 
-/* Generate PAT (Program Association Table) */
-static void generate_pat(void)
+static void handle_sigint(int signo)
 {
-    uint8_t *pat = psi_allocate();
-    uint8_t *pat_n;
-
-    pat_init(pat);
-    psi_set_version(pat, 0);
-    psi_set_current(pat);
-    pat_set_tsid(pat, TSID);
-    psi_set_section(pat, 0);
-    psi_set_lastsection(pat, 0);
-    pat_set_length(pat, PSI_MAX_SIZE);
-
-    /* NIT PID */
-    pat_n = pat_get_program(pat, 0);
-    patn_init(pat_n);
-    patn_set_program(pat_n, 0);
-    patn_set_pid(pat_n, 0x10); /* NIT PID */
-
-    /* PMT for our service */
-    pat_n = pat_get_program(pat, 1);
-    patn_init(pat_n);
-    patn_set_program(pat_n, SID);
-    patn_set_pid(pat_n, PMT_PID);
-
-    /* Calculate actual length */
-    pat_n = pat_get_program(pat, 2);
-    pat_set_length(pat, pat_n - pat - PAT_HEADER_SIZE);
-    psi_set_crc(pat);
-
-    /* Output PAT in TS packets */
-    uint16_t section_length = psi_get_length(pat) + PSI_HEADER_SIZE;
+    (void)signo;
+    running = 0;
+}
+
+/* Split a section into TS packets and append them to the PSI packets */
+static void psi_add_section(uint16_t pid, uint8_t *section, table_t table, unsigned service)
+{
+    uint16_t section_length = psi_get_length(section) + PSI_HEADER_SIZE;
     uint16_t section_offset = 0;
 
     do
     {
-        uint8_t ts[TS_SIZE];
+        if (psi_count == psi_alloc)
+        {
+            psi_alloc = psi_alloc ? psi_alloc * 2 : 64;
+            psi_packets = realloc(psi_packets, psi_alloc * sizeof(*psi_packets));
+            if (!psi_packets)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        uint8_t *ts = psi_packets[psi_count].ts;
         uint8_t ts_offset = 0;
         memset(ts, 0xff, TS_SIZE);
 
-        psi_split_section(ts, &ts_offset, pat, &section_offset);
-        ts_set_pid(ts, PID_PAT);
-        ts_set_cc(ts, cc_pat);
-        cc_pat = (cc_pat + 1) & 0xf;
+        psi_split_section(ts, &ts_offset, section, &section_offset);
+        ts_set_pid(ts, pid);
 
+        psi_packets[psi_count].crc_offset = 0;
         if (section_offset == section_length)
+        {
+            psi_packets[psi_count].crc_offset = ts_offset - 1;
             psi_split_end(ts, &ts_offset);
+        }
 
-        send_ts_packet(ts);
+        psi_packets[psi_count].pid = pid;
+        psi_packets[psi_count].table = table;
+        psi_packets[psi_count].service = service;
+        psi_count++;
     } while (section_offset < section_length);
+}
+
+/* Generate PAT (Program Association Table), one section per 250 programs */
+static void generate_pat(void)
+{
+    unsigned programs = services + 1; /* NIT + services */
+    unsigned per_section = SECTION_PAYLOAD_MAX / PAT_PROGRAM_SIZE;
+    if (per_section > 250)
+        per_section = 250;
+    unsigned last_section = (programs - 1) / per_section;
+
+    for (unsigned s = 0; s <= last_section; s++)
+    {
+        uint8_t *pat = psi_allocate();
+        unsigned first = s * per_section;
+        unsigned count = programs - first < per_section ? programs - first : per_section;
+
+        pat_init(pat);
+        psi_set_version(pat, pat_version);
+        psi_set_current(pat);
+        pat_set_tsid(pat, TSID);
+        psi_set_section(pat, s);
+        psi_set_lastsection(pat, last_section);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            uint8_t *pat_n = pat + PAT_HEADER_SIZE + i * PAT_PROGRAM_SIZE;
+            patn_init(pat_n);
+            if (first + i == 0)
+            {
+                patn_set_program(pat_n, 0);
+                patn_set_pid(pat_n, PID_NIT);
+            }
+            else
+            {
+                patn_set_program(pat_n, first + i); /* service IDs start at 1 */
+                patn_set_pid(pat_n, service_pmt_pid(first + i - 1));
+            }
+        }
+        pat_set_length(pat, count * PAT_PROGRAM_SIZE);
+        psi_set_crc(pat);
 
-    free(pat);
+        psi_add_section(PID_PAT, pat, TABLE_PAT, 0);
+        free(pat);
+    }
 }
 
-/* Generate PMT (Program Map Table) */
-static void generate_pmt(void)
+/* Generate PMT (Program Map Table) of service n */
+static void generate_pmt(unsigned n)
 {
     uint8_t *pmt = psi_allocate();
     uint8_t *pmt_n;
 
     pmt_init(pmt);
-    psi_set_version(pmt, 0);
+    psi_set_version(pmt, service_state[n].pmt_version);
     psi_set_current(pmt);
-    pmt_set_program(pmt, SID);
-    pmt_set_pcrpid(pmt, PID_PCR);
+    pmt_set_program(pmt, n + 1);
+    pmt_set_pcrpid(pmt, service_es_pid(n, 0));
     pmt_set_desclength(pmt, 0);
     pmt_set_length(pmt, PSI_MAX_SIZE);
 
-    /* MPEG2 Video */
-    pmt_n = pmt_get_es(pmt, 0);
-    pmtn_init(pmt_n);
-    pmtn_set_streamtype(pmt_n, 0x02); /* MPEG2 Video */
-    pmtn_set_pid(pmt_n, PID_VIDEO);
-    pmtn_set_desclength(pmt_n, 0);
-
-    /* MPEG2 Audio */
-    pmt_n = pmt_get_es(pmt, 1);
-    pmtn_init(pmt_n);
-    pmtn_set_streamtype(pmt_n, 0x04); /* MPEG2 Audio */
-    pmtn_set_pid(pmt_n, PID_AUDIO);
-    pmtn_set_desclength(pmt_n, 0);
-
-    /* DVB Subtitles */
-    pmt_n = pmt_get_es(pmt, 2);
-    pmtn_init(pmt_n);
-    pmtn_set_streamtype(pmt_n, 0x06); /* Private PES (for subtitles) */
-    pmtn_set_pid(pmt_n, PID_SUBTITLES);
-    pmtn_set_desclength(pmt_n, 0);
-
-    /* Calculate actual length */
-    pmt_n = pmt_get_es(pmt, 3);
-    pmt_set_length(pmt, pmt_n - pmt - PMT_HEADER_SIZE);
-    psi_set_crc(pmt);
-
-    /* Output PMT in TS packets */
-    uint16_t section_length = psi_get_length(pmt) + PSI_HEADER_SIZE;
-    uint16_t section_offset = 0;
-
-    do
+    for (unsigned es = 0; es < es_per_service; es++)
     {
-        uint8_t ts[TS_SIZE];
-        uint8_t ts_offset = 0;
-        memset(ts, 0xff, TS_SIZE);
-
-        psi_split_section(ts, &ts_offset, pmt, &section_offset);
-        ts_set_pid(ts, PMT_PID);
-        ts_set_cc(ts, cc_pmt);
-        cc_pmt = (cc_pmt + 1) & 0xf;
-
-        if (section_offset == section_length)
-            psi_split_end(ts, &ts_offset);
+        pmt_n = pmt_get_es(pmt, es);
+        pmtn_init(pmt_n);
+        if (es == 0)
+            pmtn_set_streamtype(pmt_n, 0x02); /* MPEG2 Video */
+        else if (es == 1)
+            pmtn_set_streamtype(pmt_n, 0x04); /* MPEG2 Audio */
+        else
+            pmtn_set_streamtype(pmt_n, 0x06); /* Private PES (subtitles) */
+        pmtn_set_pid(pmt_n, service_es_pid(n, es));
+        pmtn_set_desclength(pmt_n, 0);
+    }
 
-        send_ts_packet(ts);
-    } while (section_offset < section_length);
+    pmt_set_length(pmt, es_per_service * PMT_ES_SIZE);
+    psi_set_crc(pmt);
 
+    psi_add_section(service_pmt_pid(n), pmt, TABLE_PMT, n);
     free(pmt);
 }
 
-/* Generate SDT (Service Description Table) */
-static void generate_sdt(void)
+/* Write the SDT entry of service n at sdt_n, returns its size */
+static unsigned sdt_service(uint8_t *sdt_n, unsigned n)
 {
-    uint8_t *sdt = psi_allocate();
-    uint8_t *sdt_n;
     uint8_t *desc_loop, *desc;
+    char service_name[32];
 
-    sdt_init(sdt, true); /* actual SDT */
-    psi_set_version(sdt, 0);
-    psi_set_current(sdt);
-    sdt_set_tsid(sdt, TSID);
-    sdt_set_onid(sdt, ONID);
-    psi_set_section(sdt, 0);
-    psi_set_lastsection(sdt, 0);
-    sdt_set_length(sdt, PSI_MAX_SIZE);
-
-    /* Service description */
-    sdt_n = sdt_get_service(sdt, 0);
     sdtn_init(sdt_n);
-    sdtn_set_sid(sdt_n, SID);
+    sdtn_set_sid(sdt_n, n + 1);
     sdtn_set_eitschedule(sdt_n);
     sdtn_set_eitpresent(sdt_n);
     sdtn_set_running(sdt_n, 4); /* running */
@@ -324,162 +577,1093 @@ static void generate_sdt(void)
     desc = descs_get_desc(desc_loop, 0);
     desc48_init(desc);
     desc48_set_type(desc, 0x01); /* digital television service */
-    const char* provider_name = "Test";    
+    const char *provider_name = "Test";
     desc48_set_provider(desc, (uint8_t *)provider_name, strlen(provider_name));
-    const char* service_name = "\x15Żółty🟡";
+    if (n == 0)
+        strcpy(service_name, "\x15Żółty🟡");
+    else
+        snprintf(service_name, sizeof(service_name), "Service %u", n + 1);
     desc48_set_service(desc, (uint8_t *)service_name, strlen(service_name));
-    
     desc48_set_length(desc);
 
     /* Finalize descriptors */
     desc = descs_get_desc(desc_loop, 1);
     descs_set_length(desc_loop, desc - desc_loop - DESCS_HEADER_SIZE);
 
-    /* Calculate actual length */
-    sdt_n = sdt_get_service(sdt, 1);
-    sdt_set_length(sdt, sdt_n - sdt - SDT_HEADER_SIZE);
-    psi_set_crc(sdt);
+    return SDT_SERVICE_SIZE + descs_get_length(desc_loop);
+}
 
-    /* Output SDT in TS packets */
-    uint16_t section_length = psi_get_length(sdt) + PSI_HEADER_SIZE;
-    uint16_t section_offset = 0;
+/* Size of the SDT entry of service n */
+static unsigned sdt_service_size(unsigned n)
+{
+    uint8_t entry[SDT_SERVICE_SIZE + DESCS_MAX_SIZE];
+    return sdt_service(entry, n);
+}
 
-    do
+/* Generate SDT (Service Description Table), as many sections as needed */
+static void generate_sdt(void)
+{
+    unsigned last_section = 0;
+    unsigned used = 0;
+
+    /* Count the sections first, every section carries last_section_number */
+    for (unsigned n = 0; n < services; n++)
     {
-        uint8_t ts[TS_SIZE];
-        uint8_t ts_offset = 0;
-        memset(ts, 0xff, TS_SIZE);
+        unsigned size = sdt_service_size(n);
+        if (used + size > SECTION_PAYLOAD_MAX)
+        {
+            last_section++;
+            used = 0;
+        }
+        used += size;
+    }
 
-        psi_split_section(ts, &ts_offset, sdt, &section_offset);
-        ts_set_pid(ts, PID_SDT);
-        ts_set_cc(ts, cc_sdt);
-        cc_sdt = (cc_sdt + 1) & 0xf;
+    unsigned n = 0;
+    for (unsigned s = 0; s <= last_section; s++)
+    {
+        uint8_t *sdt = psi_allocate();
+
+        sdt_init(sdt, true); /* actual SDT */
+        psi_set_version(sdt, sdt_version);
+        psi_set_current(sdt);
+        sdt_set_tsid(sdt, TSID);
+        sdt_set_onid(sdt, ONID);
+        psi_set_section(sdt, s);
+        psi_set_lastsection(sdt, last_section);
+
+        used = 0;
+        while (n < services && used + sdt_service_size(n) <= SECTION_PAYLOAD_MAX)
+        {
+            used += sdt_service(sdt + SDT_HEADER_SIZE + used, n);
+            n++;
+        }
+        sdt_set_length(sdt, used);
+        psi_set_crc(sdt);
 
-        if (section_offset == section_length)
-            psi_split_end(ts, &ts_offset);
+        psi_add_section(PID_SDT, sdt, TABLE_SDT, 0);
+        free(sdt);
+    }
+}
 
-        send_ts_packet(ts);
-    } while (section_offset < section_length);
+static uint8_t bcd(unsigned v)
+{
+    return (uint8_t)((v / 10) << 4 | v % 10);
+}
 
-    free(sdt);
+/* Write EIT event `event` of a service at eit_n: EIT_EVENT_MINUTES long
+ * events back to back from PCAP_EPOCH, each with a short event descriptor */
+static void eit_event(uint8_t *eit_n, unsigned event)
+{
+    uint64_t start = PCAP_EPOCH + (uint64_t)event * EIT_EVENT_MINUTES * 60;
+    unsigned mjd = (unsigned)(40587 + start / 86400); /* 1970-01-01 is MJD 40587 */
+    unsigned secs = (unsigned)(start % 86400);
+    unsigned desc_length = 2 + 3 + 1 + EIT_NAME_SIZE + 1 + EIT_TEXT_SIZE;
+    char name[EIT_NAME_SIZE + 6]; /* room for any unsigned, only EIT_NAME_SIZE bytes are used */
+
+    eit_n[0] = (uint8_t)(event >> 8);
+    eit_n[1] = (uint8_t)event;
+    eit_n[2] = (uint8_t)(mjd >> 8);
+    eit_n[3] = (uint8_t)mjd;
+    eit_n[4] = bcd(secs / 3600);
+    eit_n[5] = bcd(secs / 60 % 60);
+    eit_n[6] = bcd(secs % 60);
+    eit_n[7] = bcd(EIT_EVENT_MINUTES / 60);
+    eit_n[8] = bcd(EIT_EVENT_MINUTES % 60);
+    eit_n[9] = 0;
+    eit_n[10] = (uint8_t)((event == 0 ? 4 : 1) << 5 | desc_length >> 8); /* running / not yet running */
+    eit_n[11] = (uint8_t)desc_length;
+
+    /* Short event descriptor (0x4d) */
+    uint8_t *desc = eit_n + EIT_EVENT_SIZE;
+    desc[0] = 0x4d;
+    desc[1] = (uint8_t)(desc_length - 2);
+    memcpy(desc + 2, "eng", 3);
+    desc[5] = EIT_NAME_SIZE;
+    snprintf(name, sizeof(name), "Event %05u", event);
+    memcpy(desc + 6, name, EIT_NAME_SIZE);
+    desc[6 + EIT_NAME_SIZE] = EIT_TEXT_SIZE;
+    memcpy(desc + 7 + EIT_NAME_SIZE, "Synthetic programme guide entry for test", EIT_TEXT_SIZE);
 }
 
-/* Generate a null/stuffing TS packet for a given PID */
-static void generate_es_packet(uint16_t pid, uint8_t *cc, bool inject_cc_error)
+/* Add one EIT section with `count` events from `first` */
+static void eit_section(unsigned n, uint8_t table_id, unsigned section, unsigned last_section,
+                        unsigned first, unsigned count)
 {
-    uint8_t ts[TS_SIZE];
+    uint8_t *eit = psi_allocate();
+
+    psi_init(eit, true);
+    psi_set_tableid(eit, table_id);
+    psi_set_tableidext(eit, n + 1);
+    psi_set_version(eit, 0);
+    psi_set_current(eit);
+    psi_set_section(eit, section);
+    psi_set_lastsection(eit, last_section);
+    eit[8] = TSID >> 8;
+    eit[9] = TSID & 0xff;
+    eit[10] = ONID >> 8;
+    eit[11] = ONID & 0xff;
+    eit[12] = (uint8_t)((section | 7) < last_section ? (section | 7) : last_section);
+    eit[13] = table_id == 0x4e ? 0x4e : 0x50;
+
+    for (unsigned i = 0; i < count; i++)
+        eit_event(eit + EIT_HEADER_SIZE + i * EIT_EVENT_TOTAL, first + i);
+    psi_set_length(eit, EIT_HEADER_SIZE - PSI_HEADER_SIZE + count * EIT_EVENT_TOTAL + PSI_CRC_SIZE);
+    psi_set_crc(eit);
+
+    psi_add_section(PID_EIT, eit, TABLE_NONE, n);
+    free(eit);
+}
+
+/* Generate EIT actual of service n: present/following and a schedule of
+ * eit_events events */
+static void generate_eit(unsigned n)
+{
+    eit_section(n, 0x4e, 0, 1, 0, 1);
+    eit_section(n, 0x4e, 1, 1, 1, 1);
+
+    unsigned last_section = (eit_events - 1) / EIT_EVENTS_PER_SECTION;
+    for (unsigned s = 0; s <= last_section; s++)
+    {
+        unsigned first = s * EIT_EVENTS_PER_SECTION;
+        unsigned count = eit_events - first < EIT_EVENTS_PER_SECTION ? eit_events - first : EIT_EVENTS_PER_SECTION;
+        eit_section(n, 0x50, s, last_section, first, count);
+    }
+}
+
+/* Build the TS packets of all PSI/SI tables */
+static void generate_psi(void)
+{
+    psi_count = 0;
+    generate_pat();
+    for (unsigned n = 0; n < services; n++)
+        generate_pmt(n);
+    generate_sdt();
+    if (eit_events)
+        for (unsigned n = 0; n < services; n++)
+            generate_eit(n);
+}
+
+/* Stream time of the next TS packet */
+static uint64_t stream_time_ns(void)
+{
+    return (uint64_t)((double)packet_count * packet_ns);
+}
 
+/* Whether --duration or --size has been reached after `bytes` of output */
+static bool limit_reached(uint64_t bytes)
+{
+    return (duration_ns && stream_time_ns() >= duration_ns) ||
+           (size_limit && bytes >= size_limit);
+}
+
+/* Uniformly distributed in [0, n) */
+static uint64_t random_below(uint64_t n)
+{
+    return n ? (((uint64_t)rand() << 31) ^ (uint64_t)rand()) % n : 0;
+}
+
+/* Parse a duration with an optional ms, s or m suffix, seconds by default */
+static int parse_duration_ns(const char *arg, uint64_t *out)
+{
+    char *end;
+    double value = strtod(arg, &end);
+    if (end == arg || value < 0)
+        return -1;
+    if (strcmp(end, "ms") == 0)
+        value /= 1e3;
+    else if (strcmp(end, "m") == 0)
+        value *= 60;
+    else if (*end != '\0' && strcmp(end, "s") != 0)
+        return -1;
+    *out = (uint64_t)(value * 1e9);
+    return 0;
+}
+
+/*
+ * Impairments. Each scenario line schedules one impairment at a point in
+ * stream time, optionally repeating:
+ *
+ *   <at> <type> [pid=<pid>] [service=<n>] [table=pat|pmt|sdt]
+ *        [count=<n>|random] [for=<duration>] [max=<duration>] [every=<duration>]
+ *
+ * Packet level impairments act on the next `count` packets of the PID,
+ * datagram level ones on the next `count` datagrams. Every impairment
+ * injected is written to the ground truth log in the format of stsmon's
+ * --events, so the two can be compared directly.
+ */
+typedef enum {
+    IMPAIR_CC,          /* skip the continuity counter */
+    IMPAIR_DUPLICATE,   /* send a packet twice */
+    IMPAIR_TEI,         /* set transport_error_indicator */
+    IMPAIR_SYNC,        /* break the sync byte */
+    IMPAIR_DROP,        /* drop datagrams */
+    IMPAIR_REORDER,     /* send a datagram after the next one */
+    IMPAIR_JITTER,      /* delay sends by up to max for a while */
+    IMPAIR_PSI_VERSION, /* increment a table version */
+    IMPAIR_CRC,         /* corrupt section CRCs */
+    IMPAIR_PCR_JITTER,  /* offset PCR values by up to +-max for a while */
+    IMPAIR_PID_OFF,     /* stop sending a PID for a while */
+    IMPAIR_PAUSE,       /* stop sending for a while */
+    IMPAIR_TYPES,
+} impair_type_t;
+
+static const char *impair_names[IMPAIR_TYPES] = {
+    "cc", "duplicate", "tei", "sync", "drop", "reorder", "jitter",
+    "psi-version", "crc", "pcr-jitter", "pid-off", "pause",
+};
+
+static const char *table_names[] = {"", "pat", "pmt", "sdt"};
+
+typedef struct impairment
+{
+    impair_type_t type;
+    uint64_t at_ns;
+    uint64_t every_ns;
+    int pid;          /* -1: any PID */
+    unsigned service; /* 0 is the first service */
+    table_t table;
+    unsigned count;   /* 0: random 1-9 */
+    uint64_t for_ns;
+    uint64_t max_ns;
+} impairment_t;
+
+static impairment_t *impairments = NULL;
+static size_t impairment_count = 0;
+static uint64_t next_impairment_ns = UINT64_MAX;
+static FILE *truth = NULL;
+
+/* Pending packet level impairments, for one PID or any */
+typedef struct packet_impairment
+{
+    unsigned any;
+    unsigned pid[8192];
+} packet_impairment_t;
+static packet_impairment_t pending_cc;
+static packet_impairment_t pending_duplicate;
+static packet_impairment_t pending_tei;
+static packet_impairment_t pending_sync;
+static uint64_t pid_off_until[8192];
+static unsigned pending_crc[4]; /* PAT and SDT, PMTs are per service */
+static unsigned *pending_crc_pmt = NULL;
+static uint8_t repeat_ts[TS_SIZE];
+static bool repeat_pending = false;
+
+/* Pending datagram level impairments */
+static unsigned pending_drop = 0;
+static unsigned pending_reorder = 0;
+static uint64_t pending_pause_ns = 0;
+static uint64_t jitter_until = 0;
+static uint64_t jitter_max = 0;
+
+/* Parse one scenario line, `where` names it in error messages */
+static int impair_parse(const char *line, const char *where)
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", line);
+    char *comment = strchr(buf, '#');
+    if (comment)
+        *comment = '\0';
+
+    char *save = NULL;
+    char *at = strtok_r(buf, " \t\r\n", &save);
+    if (!at)
+        return 0; /* empty line */
+    char *type = strtok_r(NULL, " \t\r\n", &save);
+
+    impairment_t imp = {
+        .pid = -1,
+        .count = 1,
+        .for_ns = 1000000000ULL,
+        .max_ns = 0,
+    };
+    if (parse_duration_ns(at, &imp.at_ns) != 0)
+    {
+        fprintf(stderr, "%s: invalid time '%s'\n", where, at);
+        return -1;
+    }
+    for (imp.type = 0; imp.type < IMPAIR_TYPES; imp.type++)
+        if (type && strcmp(type, impair_names[imp.type]) == 0)
+            break;
+    if (imp.type == IMPAIR_TYPES)
+    {
+        fprintf(stderr, "%s: unknown impairment '%s'\n", where, type ? type : "");
+        return -1;
+    }
+    imp.max_ns = imp.type == IMPAIR_PCR_JITTER ? 1000000ULL : 10000000ULL;
+    imp.table = imp.type == IMPAIR_PSI_VERSION || imp.type == IMPAIR_CRC ? TABLE_PMT : TABLE_NONE;
+
+    char *arg;
+    while ((arg = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+    {
+        char *value = strchr(arg, '=');
+        int ret = 0;
+        if (!value)
+            ret = -1;
+        else
+        {
+            *value++ = '\0';
+            char *end;
+            if (strcmp(arg, "pid") == 0)
+            {
+                unsigned long pid = strtoul(value, &end, 0);
+                ret = *end || pid > PID_MAX ? -1 : 0;
+                imp.pid = (int)pid;
+            }
+            else if (strcmp(arg, "service") == 0)
+            {
+                unsigned long service = strtoul(value, &end, 0);
+                ret = *end || service < 1 || service > services ? -1 : 0;
+                imp.service = (unsigned)service - 1;
+            }
+            else if (strcmp(arg, "table") == 0)
+            {
+                ret = -1;
+                for (table_t t = TABLE_PAT; t <= TABLE_SDT; t++)
+                    if (strcmp(value, table_names[t]) == 0)
+                    {
+                        imp.table = t;
+                        ret = 0;
+                    }
+            }
+            else if (strcmp(arg, "count") == 0)
+            {
+                imp.count = strcmp(value, "random") == 0 ? 0 : (unsigned)strtoul(value, &end, 0);
+                ret = imp.count || strcmp(value, "random") == 0 ? 0 : -1;
+            }
+            else if (strcmp(arg, "for") == 0)
+                ret = parse_duration_ns(value, &imp.for_ns);
+            else if (strcmp(arg, "max") == 0)
+                ret = parse_duration_ns(value, &imp.max_ns);
+            else if (strcmp(arg, "every") == 0)
+                ret = parse_duration_ns(value, &imp.every_ns);
+            else
+                ret = -1;
+        }
+        if (ret != 0)
+        {
+            fprintf(stderr, "%s: invalid argument '%s'\n", where, arg);
+            return -1;
+        }
+    }
+
+    /* CC errors, duplicates and outages default to the service's video PID,
+     * TEI and sync errors hit any PID */
+    if (imp.pid < 0 && (imp.type == IMPAIR_CC || imp.type == IMPAIR_DUPLICATE || imp.type == IMPAIR_PID_OFF))
+        imp.pid = service_es_pid(imp.service, 0);
+
+    impairment_t *grown = realloc(impairments, (impairment_count + 1) * sizeof(*impairments));
+    if (!grown)
+    {
+        perror("realloc");
+        return -1;
+    }
+    impairments = grown;
+    impairments[impairment_count++] = imp;
+    if (imp.at_ns < next_impairment_ns)
+        next_impairment_ns = imp.at_ns;
+    return 0;
+}
+
+static int impair_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return -1;
+    }
+    char line[512];
+    char where[256];
+    unsigned lineno = 0;
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), f))
+    {
+        snprintf(where, sizeof(where), "%s:%u", path, ++lineno);
+        ret = impair_parse(line, where);
+    }
+    fclose(f);
+    return ret;
+}
+
+/* Ground truth record, same layout as stsmon's --events */
+static void truth_write(const impairment_t *imp, unsigned count, uint64_t now_ns)
+{
+    struct timeval tv;
+    struct tm tm;
+    char ts[32];
+    if (fast)
+    {
+        /* Same clock as the pcap, so the log stays reproducible */
+        tv.tv_sec = (time_t)(PCAP_EPOCH + now_ns / 1000000000ULL);
+        tv.tv_usec = (long)(now_ns % 1000000000ULL / 1000);
+    }
+    else
+        gettimeofday(&tv, NULL);
+    time_t sec = tv.tv_sec;
+#ifdef WIN32
+    gmtime_s(&tm, &sec);
+#else
+    gmtime_r(&sec, &tm);
+#endif
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    fprintf(truth, "{\"ts\":\"%s.%06ldZ\",\"stream\":\"%s:%u\",\"type\":\"%s\"",
+            ts, (long)tv.tv_usec, dest_host, dest_port, impair_names[imp->type]);
+    if (imp->pid >= 0)
+        fprintf(truth, ",\"pid\":%d", imp->pid);
+    if (imp->type == IMPAIR_PCR_JITTER || imp->table == TABLE_PMT)
+        fprintf(truth, ",\"service\":%u", imp->service + 1);
+    fprintf(truth, ",\"values\":{\"stream_time\":%.6f", now_ns / 1e9);
+    switch (imp->type)
+    {
+    case IMPAIR_JITTER:
+    case IMPAIR_PCR_JITTER:
+        fprintf(truth, ",\"duration_ms\":%" PRIu64 ",\"max_us\":%" PRIu64, imp->for_ns / 1000000, imp->max_ns / 1000);
+        break;
+    case IMPAIR_PID_OFF:
+    case IMPAIR_PAUSE:
+        fprintf(truth, ",\"duration_ms\":%" PRIu64, imp->for_ns / 1000000);
+        break;
+    case IMPAIR_PSI_VERSION:
+        fprintf(truth, ",\"table\":\"%s\",\"version\":%u", table_names[imp->table],
+                imp->table == TABLE_PAT ? pat_version :
+                imp->table == TABLE_SDT ? sdt_version : service_state[imp->service].pmt_version);
+        break;
+    case IMPAIR_CRC:
+        fprintf(truth, ",\"table\":\"%s\",\"count\":%u", table_names[imp->table], count);
+        break;
+    default:
+        fprintf(truth, ",\"count\":%u", count);
+        break;
+    }
+    fprintf(truth, "}}\n");
+    fflush(truth);
+}
+
+static void pending_add(packet_impairment_t *p, int pid, unsigned count)
+{
+    if (pid < 0)
+        p->any += count;
+    else
+        p->pid[pid] += count;
+}
+
+static bool pending_take(packet_impairment_t *p, uint16_t pid)
+{
+    if (p->pid[pid])
+    {
+        p->pid[pid]--;
+        return true;
+    }
+    if (p->any)
+    {
+        p->any--;
+        return true;
+    }
+    return false;
+}
+
+/* Start the impairments due at `now_ns` */
+static void impair_fire(uint64_t now_ns)
+{
+    next_impairment_ns = UINT64_MAX;
+    for (size_t i = 0; i < impairment_count; i++)
+    {
+        impairment_t *imp = &impairments[i];
+        if (imp->at_ns <= now_ns)
+        {
+            unsigned count = imp->count ? imp->count : (unsigned)(1 + rand() % 9);
+            service_state_t *svc = &service_state[imp->service];
+            switch (imp->type)
+            {
+            case IMPAIR_CC:
+                pending_add(&pending_cc, imp->pid, count);
+                break;
+            case IMPAIR_DUPLICATE:
+                pending_add(&pending_duplicate, imp->pid, count);
+                break;
+            case IMPAIR_TEI:
+                pending_add(&pending_tei, imp->pid, count);
+                break;
+            case IMPAIR_SYNC:
+                pending_add(&pending_sync, imp->pid, count);
+                break;
+            case IMPAIR_DROP:
+                pending_drop += count;
+                break;
+            case IMPAIR_REORDER:
+                pending_reorder += count;
+                break;
+            case IMPAIR_JITTER:
+                jitter_until = now_ns + imp->for_ns;
+                jitter_max = imp->max_ns;
+                break;
+            case IMPAIR_PSI_VERSION:
+                if (imp->table == TABLE_PAT)
+                    pat_version = (pat_version + 1) & 0x1f;
+                else if (imp->table == TABLE_SDT)
+                    sdt_version = (sdt_version + 1) & 0x1f;
+                else
+                    svc->pmt_version = (svc->pmt_version + 1) & 0x1f;
+                /* Send the new tables right away */
+                generate_psi();
+                psi_pos = psi_count;
+                next_psi_ns = now_ns;
+                break;
+            case IMPAIR_CRC:
+                if (imp->table == TABLE_PMT)
+                    pending_crc_pmt[imp->service] += count;
+                else
+                    pending_crc[imp->table] += count;
+                break;
+            case IMPAIR_PCR_JITTER:
+                svc->pcr_jitter_until = now_ns + imp->for_ns;
+                svc->pcr_jitter_max = imp->max_ns;
+                break;
+            case IMPAIR_PID_OFF:
+                pid_off_until[imp->pid] = now_ns + imp->for_ns;
+                break;
+            case IMPAIR_PAUSE:
+                pending_pause_ns += imp->for_ns;
+                break;
+            default:
+                break;
+            }
+
+            fprintf(info, "Injecting %s", impair_names[imp->type]);
+            if (imp->pid >= 0)
+                fprintf(info, " on PID 0x%04x", imp->pid);
+            fprintf(info, " (count: %u, time: %.1fs)\n", count, now_ns / 1e9);
+            if (truth)
+                truth_write(imp, count, now_ns);
+
+            imp->at_ns = imp->every_ns ? imp->at_ns + imp->every_ns : UINT64_MAX;
+        }
+        if (imp->at_ns < next_impairment_ns)
+            next_impairment_ns = imp->at_ns;
+    }
+}
+
+/* Apply pending packet level impairments to a generated packet. Returns
+ * false when the packet's PID is switched off and it must not be sent. */
+static bool impair_packet(uint8_t *ts, uint64_t now_ns)
+{
+    uint16_t pid = ts_get_pid(ts);
+
+    if (pid_off_until[pid] > now_ns)
+    {
+        /* As if never generated, the PID resumes without a CC error */
+        cc[pid] = ts_get_cc(ts);
+        return false;
+    }
+    if (pending_take(&pending_cc, pid))
+    {
+        /* Skip CC to create error */
+        ts_set_cc(ts, (ts_get_cc(ts) + 1) & 0xf);
+        cc[pid] = (cc[pid] + 1) & 0xf;
+    }
+    if (pending_take(&pending_tei, pid))
+        ts_set_transporterror(ts);
+    if (pending_take(&pending_duplicate, pid))
+    {
+        memcpy(repeat_ts, ts, TS_SIZE);
+        repeat_pending = true;
+    }
+    if (pending_take(&pending_sync, pid))
+        ts[0] = 0x46;
+    return true;
+}
+
+/* Generate an ES packet with zero payload, PCR in the adaptation field */
+static void generate_es_packet(uint8_t *ts, uint16_t pid, bool pcr, uint64_t pcr_ns)
+{
     ts_init(ts);
     ts_set_pid(ts, pid);
     ts_set_payload(ts);
 
-    if (inject_cc_error)
+    uint8_t header = TS_HEADER_SIZE;
+    if (pcr)
     {
-        /* Skip CC to create error */
-        *cc = (*cc + 2) & 0xf;
-        printf("Injecting CC error on PID 0x%04x at packet %" PRIu64 " (time: %" PRId64 "s)\n",
-               pid, packet_count, (int64_t)(time(NULL) - start_time));
+        /* 27 MHz clock, 33 bit base in units of 300 and 9 bit extension */
+        uint64_t pcr_27mhz = pcr_ns * 27 / 1000;
+        ts_set_adaptation(ts, 7);
+        tsaf_set_pcr(ts, (pcr_27mhz / 300) & 0x1ffffffffULL);
+        tsaf_set_pcrext(ts, pcr_27mhz % 300);
+        header += 8;
     }
 
-    ts_set_cc(ts, *cc);
-    *cc = (*cc + 1) & 0xf;
+    ts_set_cc(ts, cc[pid]);
+    cc[pid] = (cc[pid] + 1) & 0xf;
 
     /* Fill payload with zeros */
-    memset(ts + TS_HEADER_SIZE, 0, TS_SIZE - TS_HEADER_SIZE);
+    memset(ts + header, 0, TS_SIZE - header);
+}
 
-    send_ts_packet(ts);
+/*
+ * Generate the next TS packet of the stream. PSI/SI tables are sent as a
+ * block every PSI_INTERVAL_NS, the rest is shared by the services in turn
+ * and within a service split 80% video and 10% per other ES (the video
+ * PID takes what others do not use). Returns false when the packet was
+ * suppressed by pid-off.
+ */
+static bool generate_next(uint8_t *ts, uint64_t now_ns)
+{
+    if (now_ns >= next_psi_ns)
+    {
+        psi_pos = 0;
+        next_psi_ns += PSI_INTERVAL_NS;
+    }
+    if (psi_pos < psi_count)
+    {
+        psi_packet_t *p = &psi_packets[psi_pos++];
+        memcpy(ts, p->ts, TS_SIZE);
+        ts_set_cc(ts, cc[p->pid]);
+        cc[p->pid] = (cc[p->pid] + 1) & 0xf;
+        unsigned *crc = p->table == TABLE_PMT ? &pending_crc_pmt[p->service] : &pending_crc[p->table];
+        if (p->crc_offset && *crc)
+        {
+            ts[p->crc_offset] ^= 0xff;
+            (*crc)--;
+        }
+        return impair_packet(ts, now_ns);
+    }
+
+    unsigned n = es_slot % services;
+    unsigned slot = (es_slot / services) % 10;
+    unsigned es = slot < es_per_service && slot > 0 ? slot : 0;
+    uint16_t pid = service_es_pid(n, es);
+    es_slot++;
+
+    service_state_t *svc = &service_state[n];
+    bool pcr = false;
+    uint64_t pcr_ns = now_ns;
+    if (es == 0 && now_ns >= svc->next_pcr_ns)
+    {
+        pcr = true;
+        svc->next_pcr_ns = now_ns + PCR_INTERVAL_NS;
+        if (svc->pcr_jitter_until > now_ns && now_ns >= svc->pcr_jitter_max)
+            pcr_ns = now_ns + random_below(2 * svc->pcr_jitter_max + 1) - svc->pcr_jitter_max;
+    }
+    generate_es_packet(ts, pid, pcr, pcr_ns);
+    return impair_packet(ts, now_ns);
 }
 
-int main(int argc, char **argv)
+static void generate_packet(uint8_t *ts)
 {
-    (void)argc;
-    (void)argv;
-    printf("MPEG-TS Generator\n");
-    printf("=================\n");
-    printf("Bitrate: %.2f Mbps\n", BITRATE / 1000000.0);
-    printf("Packets/sec: %d\n", PACKETS_PER_SEC);
-    printf("\n");
+    uint64_t now_ns = stream_time_ns();
+    packet_count++;
 
-    /* Initialize socket */
-    if (init_socket() < 0)
-        return 1;
+    if (now_ns >= next_impairment_ns)
+        impair_fire(now_ns);
+    if (repeat_pending)
+    {
+        memcpy(ts, repeat_ts, TS_SIZE);
+        repeat_pending = false;
+        return;
+    }
 
-    /* Install signal handler to flush buffer on exit */
-    signal(SIGINT, handle_sigint);
-    signal(SIGTERM, handle_sigint);
+    /* Packets of switched off PIDs give their place to the next ones, a
+     * null packet only fills in when (nearly) everything is off */
+    for (int tries = 0; tries < 64; tries++)
+        if (generate_next(ts, now_ns))
+            return;
+    ts_pad(ts);
+}
 
-    /* Initialize timing */
-    start_time = time(NULL);
-    last_cc_error_time = start_time;
+/* Generate the next datagram of ts_per_udp packets */
+static void generate_datagram(uint8_t *buf)
+{
+    for (unsigned k = 0; k < ts_per_udp; k++)
+        generate_packet(buf + k * TS_PACKET_SIZE);
+}
 
-    /* Send initial PSI/SI tables */
-    printf("Sending initial tables...\n");
-    generate_pat();
-    generate_pmt();
-    generate_sdt();
+static void usage(void)
+{
+    printf("Usage: test-tsg [options]\n");
+    printf("Options:\n");
+    printf("  -m, --multicast <address>   Destination address (default: " MCAST_ADDR ")\n");
+    printf("  -p, --port <port>           Destination port (default: %d)\n", MCAST_PORT);
+    printf("  -i, --interface <address>   Local interface for multicast\n");
+    printf("      --ttl <n>               Multicast TTL\n");
+    printf("  -b, --bitrate <n>[k|M|G]    Bitrate in bit/s (default: 3.8M)\n");
+    printf("  -s, --services <n>          Number of services (default: 1)\n");
+    printf("  -e, --es <n>                Elementary stream PIDs per service (default: 3, maximum: %d)\n", ES_PER_SERVICE_MAX);
+    printf("  -n, --packets <n>           TS packets per datagram (default: 7)\n");
+    printf("      --batch <n>             Datagrams per send call (default: up to 1 ms of stream, maximum: %d)\n", BATCH_MAX);
+    printf("      --cc-errors <seconds>   Inject CC errors this often (default: 15 without a scenario, 0: never)\n");
+    printf("      --scenario <file>       Inject the impairments scheduled in <file>, see tsg/example.scenario\n");
+    printf("      --impair <line>         Inject an impairment given as a scenario line, can be repeated\n");
+    printf("      --truth <file>          Write every impairment injected to <file> as NDJSON\n");
+    printf("      --seed <n>              Seed of the random impairment counts and jitter (default: 1)\n");
+    printf("      --eit <n>               Add EIT present/following and a schedule of <n> events per service\n");
+    printf("  -o, --output <file>         Write the stream to <file> (- for stdout) instead of UDP, implies --fast\n");
+    printf("      --fast                  Generate as fast as possible instead of at the bitrate\n");
+    printf("      --duration <time>       Stop after <time> of stream time (ms, s or m, e.g. 5m)\n");
+    printf("      --size <n>[k|M|G]       Stop after <n> bytes of stream\n");
+    printf("      --pcap <file>           Also write the datagrams to a pcap with timestamps following the bitrate\n");
+    printf("  -h, --help                  Show this help message\n");
+}
 
-    printf("\nStreaming started. Press Ctrl+C to stop.\n\n");
+/* Options without a short equivalent */
+enum {
+    OPT_TTL = 256,
+    OPT_BATCH,
+    OPT_CC_ERRORS,
+    OPT_SCENARIO,
+    OPT_IMPAIR,
+    OPT_TRUTH,
+    OPT_SEED,
+    OPT_EIT,
+    OPT_FAST,
+    OPT_DURATION,
+    OPT_SIZE,
+    OPT_PCAP,
+};
 
-    /* Main streaming loop */
-    time_t last_psi_time = start_time;
-    time_t next_errors_inject_time = start_time + 15;
+int main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"multicast", required_argument, 0, 'm'},
+        {"port", required_argument, 0, 'p'},
+        {"interface", required_argument, 0, 'i'},
+        {"ttl", required_argument, 0, OPT_TTL},
+        {"bitrate", required_argument, 0, 'b'},
+        {"services", required_argument, 0, 's'},
+        {"es", required_argument, 0, 'e'},
+        {"packets", required_argument, 0, 'n'},
+        {"batch", required_argument, 0, OPT_BATCH},
+        {"cc-errors", required_argument, 0, OPT_CC_ERRORS},
+        {"scenario", required_argument, 0, OPT_SCENARIO},
+        {"impair", required_argument, 0, OPT_IMPAIR},
+        {"truth", required_argument, 0, OPT_TRUTH},
+        {"seed", required_argument, 0, OPT_SEED},
+        {"eit", required_argument, 0, OPT_EIT},
+        {"output", required_argument, 0, 'o'},
+        {"fast", no_argument, 0, OPT_FAST},
+        {"duration", required_argument, 0, OPT_DURATION},
+        {"size", required_argument, 0, OPT_SIZE},
+        {"pcap", required_argument, 0, OPT_PCAP},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+
+    /* Scenario lines refer to services, they are parsed after all options */
+    const char *scenario_file = NULL;
+    const char **impair_lines = calloc((size_t)argc, sizeof(*impair_lines));
+    unsigned impair_line_count = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "m:p:i:b:s:e:n:o:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            dest_host = optarg;
+            break;
+        case 'p':
+            dest_port = (uint16_t)atoi(optarg);
+            break;
+        case 'i':
+            local_interface = optarg;
+            break;
+        case OPT_TTL:
+            ttl = atoi(optarg);
+            break;
+        case 'b':
+            if (parse_scaled(optarg, &bitrate) != 0 || bitrate < 10000)
+            {
+                fprintf(stderr, "Invalid bitrate '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            services = (unsigned)atoi(optarg);
+            break;
+        case 'e':
+            es_per_service = (unsigned)atoi(optarg);
+            if (es_per_service < 1 || es_per_service > ES_PER_SERVICE_MAX)
+            {
+                fprintf(stderr, "Invalid number of PIDs per service '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            ts_per_udp = (unsigned)atoi(optarg);
+            if (ts_per_udp < 1 || ts_per_udp > TS_PER_UDP_MAX)
+            {
+                fprintf(stderr, "Invalid number of packets per datagram '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_BATCH:
+            batch_size = (unsigned)atoi(optarg);
+            if (batch_size < 1 || batch_size > BATCH_MAX)
+            {
+                fprintf(stderr, "Invalid batch size '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_CC_ERRORS:
+            cc_error_period = atoi(optarg);
+            break;
+        case OPT_SCENARIO:
+            scenario_file = optarg;
+            break;
+        case OPT_IMPAIR:
+            impair_lines[impair_line_count++] = optarg;
+            break;
+        case OPT_TRUTH:
+            truth_file = optarg;
+            break;
+        case OPT_SEED:
+            srand((unsigned)strtoul(optarg, NULL, 10));
+            break;
+        case OPT_EIT:
+            eit_events = (unsigned)atoi(optarg);
+            if (eit_events > EIT_EVENTS_MAX)
+            {
+                fprintf(stderr, "Invalid number of EIT events '%s', at most %d.\n", optarg, EIT_EVENTS_MAX);
+                return 1;
+            }
+            break;
+        case 'o':
+            output_file = optarg;
+            fast = true;
+            break;
+        case OPT_FAST:
+            fast = true;
+            break;
+        case OPT_DURATION:
+            if (parse_duration_ns(optarg, &duration_ns) != 0)
+            {
+                fprintf(stderr, "Invalid duration '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_SIZE:
+            if (parse_scaled(optarg, &size_limit) != 0)
+            {
+                fprintf(stderr, "Invalid size '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_PCAP:
+            pcap_file = optarg;
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            fprintf(stderr, "Unknown option. Use -h for help.\n");
+            return 1;
+        }
+    }
+    if (services < 1 || service_es_pid(services - 1, es_per_service - 1) > PID_MAX)
+    {
+        fprintf(stderr, "Invalid number of services, at most %u with %u PIDs each.\n",
+                (PID_MAX + 1 - PID_PMT_FIRST) / (es_per_service + 1), es_per_service);
+        return 1;
+    }
 
-    while (1)
+    packet_ns = TS_PACKET_SIZE * 8 * 1e9 / (double)bitrate;
+    double datagram_ns = packet_ns * ts_per_udp;
+    if (!batch_size)
     {
-        time_t now = time(NULL);
+        batch_size = (unsigned)(BATCH_SPAN_NS / datagram_ns);
+        if (batch_size < 1)
+            batch_size = 1;
+        if (batch_size > BATCH_MAX)
+            batch_size = BATCH_MAX;
+    }
 
-        /* Send PSI/SI tables every second */
-        if (now > last_psi_time)
+    service_state = calloc(services, sizeof(*service_state));
+    pending_crc_pmt = calloc(services, sizeof(*pending_crc_pmt));
+    if (!service_state || !pending_crc_pmt)
+    {
+        perror("calloc");
+        return 1;
+    }
+    generate_psi();
+
+    if (scenario_file && impair_load(scenario_file) != 0)
+        return 1;
+    for (unsigned i = 0; i < impair_line_count; i++)
+        if (impair_parse(impair_lines[i], "--impair") != 0)
+            return 1;
+    free(impair_lines);
+    if (cc_error_period < 0)
+        cc_error_period = impairment_count ? 0 : 15;
+    if (cc_error_period > 0)
+    {
+        /* Random bursts of CC errors on the first video PID */
+        char line[64];
+        snprintf(line, sizeof(line), "%d cc count=random every=%d", cc_error_period, cc_error_period);
+        impair_parse(line, "--cc-errors");
+    }
+    if (truth_file)
+    {
+        truth = fopen(truth_file, "w");
+        if (!truth)
         {
-            generate_pat();
-            generate_pmt();
-            generate_sdt();
-            last_psi_time = now;
+            perror(truth_file);
+            return 1;
         }
+    }
 
-        if(now >= next_errors_inject_time)
-        {
-            for(int i = 0; i < rand()%10; i++)
-                generate_es_packet(PID_VIDEO, &cc_video, true);
+    info = output_file && strcmp(output_file, "-") == 0 ? stderr : stdout;
+    fprintf(info, "MPEG-TS Generator\n");
+    fprintf(info, "=================\n");
+    fprintf(info, "Bitrate: %.2f Mbps\n", bitrate / 1000000.0);
+    fprintf(info, "Packets/sec: %.0f\n", 1e9 / packet_ns);
+    fprintf(info, "Services: %u, %u PIDs each, %zu PSI/SI packets per second\n", services, es_per_service, psi_count);
+    fprintf(info, "Datagrams: %u TS packets, %u per %s\n", ts_per_udp, fast ? BATCH_MAX : batch_size,
+            output_file ? "write" : "send");
+    fprintf(info, "\n");
+
+    memset(&dest_addr, 0, sizeof(dest_addr));
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port = htons(dest_port);
+    dest_addr.sin_addr.s_addr = inet_addr(dest_host);
+    if (dest_addr.sin_addr.s_addr == INADDR_NONE)
+    {
+        fprintf(stderr, "Invalid destination address '%s'\n", dest_host);
+        return 1;
+    }
 
-            next_errors_inject_time += 15;
+    if (output_file)
+    {
+        if (strcmp(output_file, "-") == 0)
+            output = stdout;
+        else
+            output = fopen(output_file, "wb");
+        if (!output)
+        {
+            perror(output_file);
+            return 1;
         }
+        setvbuf(output, NULL, _IOFBF, 4 * 1024 * 1024);
+        fprintf(info, "Writing to %s\n", strcmp(output_file, "-") == 0 ? "stdout" : output_file);
+    }
+    else if (init_socket() < 0)
+        return 1;
+    if (pcap_file && pcap_open(pcap_file) != 0)
+        return 1;
 
-        /* Generate ES packets with distribution:
-         * Video: ~90% (higher bitrate)
-         * Audio: ~8%
-         * Subtitles: ~2%
-         */
-        int video_packets = 90;
-        int audio_packets = 8;
-        int subtitle_packets = 2;
-        for (int i = 0; i < 100; i++)
+    /* Install signal handler to stop after the current batch */
+    signal(SIGINT, handle_sigint);
+    signal(SIGTERM, handle_sigint);
+
+    if (fast)
+    {
+        batch_size = BATCH_MAX;
+        fprintf(info, "\nGenerating as fast as possible. Press Ctrl+C to stop.\n\n");
+    }
+    else
+        fprintf(info, "\nStreaming started. Press Ctrl+C to stop.\n\n");
+
+    /* Datagram k is due at start_ns + k * datagram_ns. Deadlines are
+     * absolute, so time spent generating and sending does not add up.
+     * The pcap uses the same schedule as stream time from 0, with
+     * shift_ns collecting the pauses. */
+    uint64_t start_ns = monotonic_ns();
+    uint64_t first_ns = start_ns;
+    uint64_t shift_ns = 0;
+    uint64_t datagram_index = 0;
+    uint64_t datagram_bytes = ts_per_udp * TS_PACKET_SIZE;
+    uint64_t slot_ns[BATCH_MAX + 1];
+    static uint8_t held[TS_PER_UDP_MAX * TS_PACKET_SIZE];
+    bool have_held = false;
+    unsigned late = 0;
+
+    while (running && !limit_reached(datagram_count * datagram_bytes))
+    {
+        uint64_t batch_first = datagram_index;
+        unsigned count = 0;
+        while (count < batch_size)
         {
-            int type = i % 3;
-            if (type == 0 && video_packets > 0)
+            uint64_t index = datagram_index++;
+            generate_datagram(udp_buf[count]);
+            if (pending_pause_ns)
+            {
+                shift_ns += pending_pause_ns;
+                if (!fast)
+                    start_ns += pending_pause_ns;
+                pending_pause_ns = 0;
+            }
+            if (pending_drop)
             {
-                /* Video packets */
-                generate_es_packet(PID_VIDEO, &cc_video, 0);
+                pending_drop--;
+                continue;
             }
-            else if (type == 1 && audio_packets > 0)
+            if (pending_reorder && !have_held)
             {
-                /* Audio packets */
-                generate_es_packet(PID_AUDIO, &cc_audio, false);
+                /* Sent after the next datagram, the spare slot keeps room for it */
+                memcpy(held, udp_buf[count], sizeof(held));
+                have_held = true;
+                pending_reorder--;
+                continue;
             }
-            else if (type == 2 && subtitle_packets > 0)
+            slot_ns[count] = (uint64_t)((double)index * datagram_ns) + shift_ns;
+            if (jitter_until > stream_time_ns())
+                slot_ns[count] += random_below(jitter_max + 1);
+            count++;
+            if (have_held)
             {
-                /* Subtitle packet */
-                generate_es_packet(PID_SUBTITLES, &cc_subtitles, false);
+                slot_ns[count] = slot_ns[count - 1];
+                memcpy(udp_buf[count++], held, sizeof(held));
+                have_held = false;
             }
+            if (limit_reached((datagram_count + count) * datagram_bytes))
+                break;
+        }
 
-            if (i % 7 == 0)
+        if (!fast)
+        {
+            uint64_t due = start_ns + (uint64_t)((double)batch_first * datagram_ns);
+            if (jitter_until > stream_time_ns())
+                due += random_below(jitter_max + 1);
+            uint64_t now = monotonic_ns();
+            if (now > due + LATE_RESYNC_NS)
             {
-                // 2500 us sleep to pace the stream
-                usleep(2500);
+                late++;
+                start_ns += now - due;
+            }
+            else if (due > now)
+            {
+                struct timespec deadline = {
+                    .tv_sec = (time_t)(due / 1000000000ULL),
+                    .tv_nsec = (long)(due % 1000000000ULL),
+                };
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && running)
+                    ;
             }
         }
+
+        if (!output && send_batch(count) < 0)
+            break;
+        if (write_batch(count, slot_ns) < 0)
+            break;
     }
 
-    close(sockfd);
+    double elapsed = (monotonic_ns() - first_ns) / 1e9;
+    fprintf(info, "\n%s %" PRIu64 " datagrams (%" PRIu64 " TS packets, %.1fs of stream) in %.1fs, %.2f Mbps",
+            output_file ? "Wrote" : "Sent", datagram_count, datagram_count * ts_per_udp,
+            stream_time_ns() / 1e9, elapsed,
+            elapsed > 0 ? datagram_count * ts_per_udp * TS_PACKET_SIZE * 8 / elapsed / 1e6 : 0.0);
+    if (late)
+        fprintf(info, ", fell behind %u times", late);
+    fprintf(info, "\n");
+
+    if (output && fclose(output) != 0)
+        perror(output_file);
+    if (pcap && fclose(pcap) != 0)
+        perror(pcap_file);
+    if (sockfd >= 0)
+        close(sockfd);
+    if (truth)
+        fclose(truth);
+    free(psi_packets);
+    free(service_state);
+    free(pending_crc_pmt);
+    free(impairments);
     return 0;
 }